@@ -0,0 +1,23 @@
+#include "pf_actiondetectfaces.h"
+
+#include "pf_entitycontainer.h"
+#include "pf_graphicview.h"
+
+
+PF_ActionDetectFaces::PF_ActionDetectFaces(PF_EntityContainer* container,
+                                           PF_GraphicView* graphicView)
+        :PF_ActionInterface("Detect Faces", container, graphicView)
+{
+    actionType = PF::ActionDetectFaces;
+}
+
+void PF_ActionDetectFaces::init(int status) {
+    PF_ActionInterface::init(status);
+    trigger();
+    finish();
+}
+
+void PF_ActionDetectFaces::trigger() {
+    container->createFaces();
+    view->replot();
+}
@@ -0,0 +1,19 @@
+#ifndef PF_ACTIONDETECTFACES_H
+#define PF_ACTIONDETECTFACES_H
+
+
+#include "pf_actioninterface.h"
+
+
+/** 为直线围成的每个区域生成面 **/
+class PF_ActionDetectFaces : public PF_ActionInterface {
+    Q_OBJECT
+public:
+    PF_ActionDetectFaces(PF_EntityContainer* container,
+                         PF_GraphicView* graphicView);
+
+    void init(int status) override;
+    void trigger() override;
+};
+
+#endif // PF_ACTIONDETECTFACES_H
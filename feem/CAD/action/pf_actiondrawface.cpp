@@ -118,6 +118,13 @@ void PF_ActionDrawFace::mouseReleaseEvent(QMouseEvent *e)
         PF_Entity* entity = catchEntity(mouse,PF::EntityLine);
         if(!entity)
             return;
+        /** 离直线较远时点在区域内部，直接生成这个区域的面 **/
+        if(getStatus() == SetFirstLoop && data->faceData.isEmpty() &&
+                entity->getDistanceToPoint(mouse) > view->toGraphDX(snapRange) &&
+                container->createFaceAt(mouse)){
+            view->replot();
+            return;
+        }
         /** 标记为选中 **/
         entity->setSelected(true);
         view->replot();
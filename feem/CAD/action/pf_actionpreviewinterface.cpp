@@ -55,7 +55,7 @@ void PF_ActionPreviewInterface::drawPreview()
     ctainer->setOwner(false); // Little hack for now so we don't delete the preview twice
     ctainer->addEntity(preview);
     //view->redraw(PF::RedrawOverlay);
-    view->replot();
+    view->replotOverlay();
     hasPreview=true;
 }
 
@@ -0,0 +1,23 @@
+#include "pf_actionsplitintersections.h"
+
+#include "pf_entitycontainer.h"
+#include "pf_graphicview.h"
+
+
+PF_ActionSplitIntersections::PF_ActionSplitIntersections(PF_EntityContainer* container,
+                                                         PF_GraphicView* graphicView)
+        :PF_ActionInterface("Split At Intersections", container, graphicView)
+{
+    actionType = PF::ActionSplitIntersections;
+}
+
+void PF_ActionSplitIntersections::init(int status) {
+    PF_ActionInterface::init(status);
+    trigger();
+    finish();
+}
+
+void PF_ActionSplitIntersections::trigger() {
+    container->splitAtIntersections();
+    view->replot();
+}
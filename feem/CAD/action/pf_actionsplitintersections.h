@@ -0,0 +1,19 @@
+#ifndef PF_ACTIONSPLITINTERSECTIONS_H
+#define PF_ACTIONSPLITINTERSECTIONS_H
+
+
+#include "pf_actioninterface.h"
+
+
+/** 在所有交点处打断直线 **/
+class PF_ActionSplitIntersections : public PF_ActionInterface {
+    Q_OBJECT
+public:
+    PF_ActionSplitIntersections(PF_EntityContainer* container,
+                                PF_GraphicView* graphicView);
+
+    void init(int status) override;
+    void trigger() override;
+};
+
+#endif // PF_ACTIONSPLITINTERSECTIONS_H
@@ -41,6 +41,7 @@ void PF_Snapper::init()
     pImpData->snapSpot = PF_Vector{false};
     pImpData->snapCoord = PF_Vector{false};
     m_SnapDistance = 1.0;
+    middlePoints = 1;
 
     //    RS_SETTINGS->beginGroup("/Appearance");
     snap_indicator->lines_state = 1;//RS_SETTINGS->readNumEntry("/indicator_lines_state", 1);
@@ -106,68 +107,30 @@ PF_Vector PF_Snapper::snapPoint(QMouseEvent *e)
     PF_Vector mouseCoord = view->toGraph(e->x(), e->y());
     double ds2Min = PF_MAXDOUBLE*PF_MAXDOUBLE;
 
-    if(snapMode.snapEndpoint){
-        t = snapEndpoint(mouseCoord);
-        if(t.valid){
-            double ds2 = mouseCoord.squaredTo(t);
-
+    /** 所有模式在一次查询中完成，只查找捕捉范围以内的实体 **/
+    PF_SnapCandidates candidates = container->getSnapCandidates(mouseCoord, snapMode,
+                                                                view->toGraphDX(snapRange),
+                                                                middlePoints, m_SnapDistance);
+    /** 按照端点、中心、中点、距离、交点的顺序，距离相同时先找到的优先 **/
+    for(const PF_Vector& c : {candidates.endpoint, candidates.center, candidates.middle,
+                              candidates.distance, candidates.intersection}){
+        if(c.valid){
+            double ds2 = mouseCoord.squaredTo(c);
             if (ds2 < ds2Min){
                 ds2Min = ds2;
-                pImpData->snapSpot = t;
-//                qDebug()<<"snapEndpoint"<<ds2<<t.x<<t.y;
+                pImpData->snapSpot = c;
             }
         }
     }
-    if(snapMode.snapCenter){
-        t = snapCenter(mouseCoord);
-        double ds2 = mouseCoord.squaredTo(t);
-        if (ds2 < ds2Min){
-            ds2Min = ds2;
-            pImpData->snapSpot = t;
-//            qDebug()<<"snapCenter"<<ds2;
-        }
-    }
-    if(snapMode.snapMiddle){
-        //this is still brutal force
-        //todo: accept value from widget QG_SnapMiddleOptions
-        //RS_DIALOGFACTORY->requestSnapMiddleOptions(middlePoints, snapMode.snapMiddle);
-        t = snapMiddle(mouseCoord);
-        double ds2 = mouseCoord.squaredTo(t);
-        if (ds2 < ds2Min){
-            ds2Min = ds2;
-            pImpData->snapSpot = t;
-//            qDebug()<<"snapMiddle"<<ds2;
-        }
-    }
-    if(snapMode.snapDistance){
-        //this is still brutal force
-        //todo: accept value from widget QG_SnapDistOptions
-        //RS_DIALOGFACTORY->requestSnapDistOptions(m_SnapDistance, snapMode.snapDistance);
-        t = snapDist(mouseCoord);
-        double ds2 = mouseCoord.squaredTo(t);
-        if (ds2 < ds2Min){
-            ds2Min = ds2;
-            pImpData->snapSpot = t;
-//            qDebug()<<"snapDistance"<<ds2;
-        }
-    }
-    if(snapMode.snapIntersection){
-        t = snapIntersection(mouseCoord);
-        double ds2 = mouseCoord.squaredTo(t);
-        if (ds2 < ds2Min){
-            ds2Min = ds2;
-            pImpData->snapSpot = t;
-//            qDebug()<<"snapIntersection"<<ds2;
-        }
-    }
     if (snapMode.snapOnEntity &&
         pImpData->snapSpot.distanceTo(mouseCoord) > snapMode.distance) {
-        t = snapOnEntity(mouseCoord);
+        t = candidates.onEntity;
         if(t.valid){
             double ds2 = mouseCoord.squaredTo(t);
             if (ds2 < ds2Min){
                 ds2Min = ds2;
                 pImpData->snapSpot = t;
+                keyEntity = candidates.entity;
 //                qDebug()<<"snapOnEntity";
             }
         }
@@ -181,7 +144,8 @@ PF_Vector PF_Snapper::snapPoint(QMouseEvent *e)
 //            qDebug()<<"snapGrid"<<ds2<<t.x<<t.y;
         }
     }
-    if( snapMode.snapFree/*!pImpData->snapSpot.valid*/ ) {
+    /** 捕捉范围内什么也没有找到时退回到自由捕捉 **/
+    if( snapMode.snapFree || !pImpData->snapSpot.valid ) {
         pImpData->snapSpot = mouseCoord; //default to snapFree
 //        qDebug()<<"snapFree";
     } //else {
@@ -5,6 +5,39 @@
 #include <qDebug>
 #include "pf_graphicview.h"
 
+#include <cmath>
+
+/** 圆离散成2的幂条边，最少minSegments条，最多maxSegments条 **/
+static const int minSegments = 8;
+static const int maxSegments = 1024;
+/** 离散化的弦高不超过这么多像素 **/
+static const double maxSagitta = 0.25;
+
+/*!
+ \brief n等分的单位圆上的点，各种n只在第一次使用时计算一次，之后
+ 所有的圆在任何缩放比例下共用。
+
+ \param n 2的幂
+ \return const QVector<QPointF>
+*/
+static const QVector<QPointF>& unitCircle(int n)
+{
+    static const QVector<QVector<QPointF> > tables = [](){
+        QVector<QVector<QPointF> > t;
+        for(int k = minSegments; k <= maxSegments; k *= 2){
+            QVector<QPointF> points(k);
+            for(int i = 0; i < k; ++i)
+                points[i] = QPointF(std::cos(2*M_PI*i/k), std::sin(2*M_PI*i/k));
+            t.append(points);
+        }
+        return t;
+    }();
+    int level = 0;
+    while((minSegments << level) < n)
+        ++level;
+    return tables.at(level);
+}
+
 
 PF_Circle::PF_Circle(PF_EntityContainer *parent, PF_GraphicView *view, const PF_CircleData &d)
     :PF_AtomicEntity(parent,view)
@@ -20,6 +53,7 @@ PF_Vector PF_Circle::getCenter() const
 
 void PF_Circle::setCenter(const PF_Vector &c)
 {
+    setDirty(true);
     data.center = c;
 }
 
@@ -30,6 +64,7 @@ double PF_Circle::getRadius() const
 
 void PF_Circle::setRadius(double r)
 {
+    setDirty(true);
     data.radius = r;
 }
 
@@ -203,23 +238,27 @@ bool PF_Circle::offset(const PF_Vector &coord, const double &distance)
 */
 void PF_Circle::move(const PF_Vector &offset)
 {
+    setDirty(true);
     data.center.move(offset);
 }
 
 void PF_Circle::rotate(const PF_Vector &center, const double &angle)
 {
+    setDirty(true);
     data.center.rotate(center, angle);
     calculateBorders();
 }
 
 void PF_Circle::rotate(const PF_Vector &center, const PF_Vector &angleVector)
 {
+    setDirty(true);
     data.center.rotate(center, angleVector);
     calculateBorders();
 }
 
 void PF_Circle::scale(const PF_Vector &center, const PF_Vector &factor)
 {
+    setDirty(true);
     data.center.scale(center, factor);
     //radius always is positive
     data.radius *= fabs(factor.x);
@@ -228,12 +267,14 @@ void PF_Circle::scale(const PF_Vector &center, const PF_Vector &factor)
 
 void PF_Circle::mirror(const PF_Vector &axisPoint1, const PF_Vector &axisPoint2)
 {
+    setDirty(true);
     data.center.mirror(axisPoint1, axisPoint2);
     calculateBorders();
 }
 
 void PF_Circle::moveRef(const PF_Vector &ref, const PF_Vector &offset)
 {
+    setDirty(true);
     if(ref.distanceTo(data.center)<1.0e-4){
         data.center += offset;
         return;
@@ -270,26 +311,43 @@ void PF_Circle::draw(QCPPainter *painter)
     //qDebug()<<"PF_Circle::draw: OK.";
     /** 绘制控制点 **/
     if (isSelected() || isHighlighted()) {
-//		if (!e->isParentSelected()) {
-            PF_VectorSolutions const& s = this->getRefPoints();
-            double x,y;
-            int size = 4;
-            for (size_t i=0; i<s.getNumber(); ++i) {
-                x = mParentPlot->toGuiX(s.get(i).x);
-                y = mParentPlot->toGuiY(s.get(i).y);
-
-                painter->drawLine(QPointF(x-size,y-size),QPointF(x+size,y-size));
-                painter->drawLine(QPointF(x+size,y-size),QPointF(x+size,y+size));
-                painter->drawLine(QPointF(x+size,y+size),QPointF(x-size,y+size));
-                painter->drawLine(QPointF(x-size,y+size),QPointF(x-size,y-size));
-            }
-//		}
+        drawRefPoints(painter);
     }
 //    painter->setPen(oldpen);
 //    painter->setBrush(oldbursh);
     painter->restore();
 }
 
+/*!
+ \brief 按照屏幕上的半径选取边数，弦高r(1-cos(π/n))不超过maxSagitta
+ 个像素。很大的圆边数不够时仍然由draw用drawEllipse绘制。
+
+ \param lines
+ \return bool
+*/
+bool PF_Circle::batchLines(QVector<QLineF> &lines) const
+{
+    if(!mParentPlot || isSelected() || isHighlighted()){
+        return false;
+    }
+    double r = std::fabs(mParentPlot->toGuiDY(getRadius()));
+    int n = minSegments;
+    while(n < maxSegments && r*(1 - std::cos(M_PI/n)) > maxSagitta)
+        n *= 2;
+    if(r*(1 - std::cos(M_PI/n)) > maxSagitta)
+        return false;
+    double cx = mParentPlot->toGuiX(getCenter().x);
+    double cy = mParentPlot->toGuiY(getCenter().y);
+    const QVector<QPointF>& unit = unitCircle(n);
+    QPointF last(cx + r*unit.last().x(), cy + r*unit.last().y());
+    for(const QPointF& u : unit){
+        QPointF p(cx + r*u.x(), cy + r*u.y());
+        lines.append(QLineF(last, p));
+        last = p;
+    }
+    return true;
+}
+
 void PF_Circle::calculateBorders()
 {
     PF_Vector r(data.radius,data.radius);
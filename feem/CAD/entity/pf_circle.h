@@ -2,6 +2,7 @@
 #define PF_CIRCLE_H
 
 #include "pf_atomicentity.h"
+#include "pf_entitypool.h"
 //2018-02-11
 //by Poofee
 /**圆**/
@@ -15,7 +16,7 @@ struct PF_CircleData
     double radius;
 };
 
-class PF_Circle: public PF_AtomicEntity
+class PF_Circle : public PF_AtomicEntity, public PF_PoolAllocated<PF_Circle>
 {
 public:
     PF_Circle()=default;
@@ -68,6 +69,7 @@ public:
     void moveRef(const PF_Vector& ref, const PF_Vector& offset) override;
 
     void draw(QCPPainter* painter) override;
+    bool batchLines(QVector<QLineF>& lines) const override;
 
     void calculateBorders() override;
 
@@ -1,4 +1,5 @@
 #include "pf_entity.h"
+#include "pf_entitycontainer.h"
 #include "pf_graphicview.h"
 
 
@@ -156,6 +157,22 @@ void PF_Entity::setVisible(bool v)
         delFlag(PF::FlagVisible);
 }
 
+void PF_Entity::setDirty(bool dirty)
+{
+    if(dirty){
+        setFlag(PF::FlagDirty);
+        /** 通知所在的容器更新空间索引 **/
+        if(parent)
+            parent->entityChanged(this);
+    }else
+        delFlag(PF::FlagDirty);
+}
+
+bool PF_Entity::isDirty() const
+{
+    return getFlag(PF::FlagDirty);
+}
+
 PF_Vector PF_Entity::getSize() const
 {
     return maxV-minV;
@@ -189,6 +206,32 @@ PF_VectorSolutions PF_Entity::getRefPoints() const
     return PF_VectorSolutions();
 }
 
+bool PF_Entity::batchLines(QVector<QLineF> &lines) const
+{
+    Q_UNUSED(lines)
+    return false;
+}
+
+/*!
+ \brief 在每个参考点上画出控制点的方框，所有的边一次画出。
+
+ \param painter
+*/
+void PF_Entity::drawRefPoints(QCPPainter *painter) const
+{
+    PF_VectorSolutions const& s = this->getRefPoints();
+    int size = 4;
+    QVector<QLineF> lines;
+    lines.reserve(4*int(s.getNumber()));
+    for (size_t i=0; i<s.getNumber(); ++i) {
+        int x = qRound(mParentPlot->toGuiX(s.get(i).x));
+        int y = qRound(mParentPlot->toGuiY(s.get(i).y));
+        QPointF a(x-size,y-size), b(x+size,y-size), c(x+size,y+size), d(x-size,y+size);
+        lines<<QLineF(a,b)<<QLineF(b,c)<<QLineF(c,d)<<QLineF(d,a);
+    }
+    painter->drawLines(lines);
+}
+
 PF_Vector PF_Entity::getNearestRef(const PF_Vector& coord,
                                    double* dist) const{
     /** 右值引用，由于函数的返回值的存储是不稳定的，立马被释放掉的
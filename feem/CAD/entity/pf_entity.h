@@ -78,6 +78,10 @@ public:
     virtual bool isVisible() const;
     virtual void setVisible(bool v);
 
+    /** 几何形状在上一次分网之后是否改变 **/
+    void setDirty(bool dirty);
+    bool isDirty() const;
+
     /**
      * This method must be overwritten in subclasses and return the
      * number of <b>atomic</b> entities in this entity.
@@ -118,6 +122,9 @@ public:
     /**继承的虚函数**/
     virtual void applyDefaultAntialiasingHint(QCPPainter *painter) const Q_DECL_OVERRIDE;
     virtual void draw(QCPPainter *painter) Q_DECL_OVERRIDE = 0;
+    /** 把实体表示成直线段（gui坐标）加入lines，与其他实体的线段一起
+        用当前画笔一次画出。需要单独设置画笔时返回false，由draw绘制 **/
+    virtual bool batchLines(QVector<QLineF>& lines) const;
 
     //virtual void draw(QPainter* painter, PF_GraphicView* view)=0;
 
@@ -332,6 +339,8 @@ public:
     virtual QString toGeoString() = 0;
     virtual int index() const = 0;
 protected:
+    void drawRefPoints(QCPPainter* painter) const;
+
     PF_EntityContainer* parent = nullptr;
     QPen pen;
     QBrush brush;
@@ -1,10 +1,19 @@
 #include "pf_entitycontainer.h"
 #include "pf_graphicview.h"
 #include "pf_line.h"
+#include "pf_face.h"
+#include "pf_mesh.h"
+#include "pf_mesher.h"
+#include "pf_snapper.h"
 #include "gmsh.h"
 #include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
 
 #include <QDebug>
+#include <QHash>
 
 int next_int(char **start)
 {
@@ -142,12 +151,18 @@ CMesh* PF_EntityContainer::loadGmsh22(const char fn[]){
 }
 PF_EntityContainer::PF_EntityContainer(PF_EntityContainer *parent, PF_GraphicView *view, bool owner)
     :PF_Entity(parent,view)
+    ,spatialIndex(entities)
+    ,intersections(entities, spatialIndex)
+    ,faceDetector(entities)
 {
     autoDelete = owner;
 }
 
 PF_EntityContainer::~PF_EntityContainer()
 {
+    spatialIndex.clear();
+    intersections.clear();
+    faceDetector.clear();
     if(autoDelete){
         while(!entities.isEmpty()){
             delete entities.takeFirst();
@@ -160,6 +175,9 @@ PF_EntityContainer::~PF_EntityContainer()
 void PF_EntityContainer::clear()
 {
     //qDebug()<<"PF_EntityContainer::clear";
+    spatialIndex.clear();
+    intersections.clear();
+    faceDetector.clear();
     if(autoDelete){
         while(!entities.isEmpty()){
             delete entities.takeFirst();
@@ -204,6 +222,9 @@ void PF_EntityContainer::addEntity(PF_Entity *entity)
     }
 
     entities.append(entity);
+    spatialIndex.insert(entity);
+    intersections.insert(entity);
+    faceDetector.insert(entity);
     //qDebug()<<"PF_EntityContainer::addEntity:size:"<<entities.size();
 }
 
@@ -218,6 +239,9 @@ void PF_EntityContainer::appendEntity(PF_Entity *entity)
     if (!entity)
             return;
     entities.append(entity);
+    spatialIndex.insert(entity);
+    intersections.insert(entity);
+    faceDetector.insert(entity);
 }
 
 /**
@@ -229,6 +253,9 @@ void PF_EntityContainer::prependEntity(PF_Entity *entity)
 {
     if (!entity) return;
     entities.prepend(entity);
+    spatialIndex.invalidate();
+    intersections.insert(entity);
+    faceDetector.insert(entity);
 }
 
 void PF_EntityContainer::moveEntity(int index, QList<PF_Entity *> &entList)
@@ -261,6 +288,8 @@ void PF_EntityContainer::moveEntity(int index, QList<PF_Entity *> &entList)
     for(auto e: entList){
             entities.insert(ci++, e);
     }
+    /** 顺序改变，距离相同时的优先次序也随之改变 **/
+    spatialIndex.invalidate();
 }
 
 
@@ -275,6 +304,9 @@ void PF_EntityContainer::insertEntity(int index, PF_Entity *entity)
     if (!entity) return;
 
     entities.insert(index, entity);
+    spatialIndex.invalidate();
+    intersections.insert(entity);
+    faceDetector.insert(entity);
 }
 
 
@@ -288,6 +320,11 @@ bool PF_EntityContainer::removeEntity(PF_Entity *entity)
 {
     bool ret;
     ret = entities.removeOne(entity);
+    if (ret) {
+        spatialIndex.remove(entity);
+        intersections.remove(entity);
+        faceDetector.remove(entity);
+    }
 
     if (autoDelete && ret) {
         delete entity;
@@ -295,6 +332,25 @@ bool PF_EntityContainer::removeEntity(PF_Entity *entity)
     return ret;
 }
 
+/*!
+ \brief 点移动时引用它的线也随之改变，所以整体重建索引、交点和区域，
+ 其他实体只需要更新自己。
+
+ \param entity
+*/
+void PF_EntityContainer::entityChanged(PF_Entity *entity)
+{
+    if(entity->rtti() == PF::EntityPoint){
+        spatialIndex.invalidate();
+        intersections.invalidate();
+        faceDetector.invalidate();
+    }else{
+        spatialIndex.update(entity);
+        intersections.update(entity);
+        faceDetector.update(entity);
+    }
+}
+
 
 
 
@@ -305,16 +361,36 @@ void PF_EntityContainer::draw(QCPPainter *painter)
         return;
     }
 
-    /** 有些东西适合绘制在顶层，有些适合绘制在底层，先画面，
-        再画线，最后画点**/
-    for(int i=0;i < entities.size();++i){
+    /** 只画包围盒与可见区域相交的实体，留出点的标记所占的几个像素 **/
+    QCPRange xr = mParentPlot->xAxis->range();
+    QCPRange yr = mParentPlot->yAxis->range();
+    double dx = fabs(mParentPlot->toGraphDX(4));
+    double dy = fabs(mParentPlot->toGraphDY(4));
+    double x0 = xr.lower - dx, x1 = xr.upper + dx;
+    double y0 = yr.lower - dy, y1 = yr.upper + dy;
 
-            mParentPlot->drawEntity(painter,entities.at(i));
-    }
-    for(int i=0;i < entities.size();++i){
-        if(entities.at(i)->rtti() != PF::EntityFace)
-            mParentPlot->drawEntity(painter,entities.at(i));
+    /** 有些东西适合绘制在顶层，有些适合绘制在底层，先画面，
+        再画线，最后画点，同一层按照加入的次序**/
+    QVector<QPair<unsigned,PF_Entity*> > layers[3];
+    spatialIndex.queryBox(x0, y0, x1, y1, [&](PF_Entity* e, unsigned serial){
+        PF_Vector vmin = e->getMin(), vmax = e->getMax();
+        if(vmin.valid && vmax.valid &&
+                (vmin.x > x1 || vmax.x < x0 || vmin.y > y1 || vmax.y < y0))
+            return;
+        int layer = 1;
+        if(e->rtti() == PF::EntityFace)
+            layer = 0;
+        else if(e->rtti() == PF::EntityPoint)
+            layer = 2;
+        layers[layer].append(qMakePair(serial, e));
+    });
+    QVector<PF_Entity*> visible;
+    for(auto& list : layers){
+        std::sort(list.begin(), list.end());
+        for(auto& p : list)
+            visible.append(p.second);
     }
+    mParentPlot->drawEntities(painter,visible);
 }
 
 void PF_EntityContainer::adjustBorders(PF_Entity *entity)
@@ -342,12 +418,24 @@ void PF_EntityContainer::adjustBorders(PF_Entity *entity)
 void PF_EntityContainer::calculateBorders() {
 
     resetBorders();
+    /** 点的包围盒总是最新的，点的范围在坐标数组上一次求出 **/
+    QVector<int> slots;
     for (PF_Entity* e: entities){
         if (e->isVisible() /*&& !(layer && layer->isFrozen())*/) {
+            if (e->rtti() == PF::EntityPoint) {
+                slots.append(static_cast<PF_Point*>(e)->getSlot());
+                continue;
+            }
             e->calculateBorders();
             adjustBorders(e);
         }
     }
+    PF_PointStore& store = PF_PointStore::instance();
+    PF_Vector vmin, vmax;
+    if (store.bounds(slots, slots.size() == store.count(), vmin, vmax)) {
+        minV = PF_Vector::minimum(vmin,minV);
+        maxV = PF_Vector::maximum(vmax,maxV);
+    }
 
     if (minV.x>maxV.x || minV.x>PF_MAXDOUBLE || maxV.x>PF_MAXDOUBLE
             || minV.x<PF_MINDOUBLE || maxV.x<PF_MINDOUBLE) {
@@ -376,22 +464,25 @@ PF_Vector PF_EntityContainer::getNearestEndpoint(const PF_Vector& coord,
     double curDist;                 // currently measured distance
     PF_Vector closestPoint(false);  // closest found endpoint
     PF_Vector point;                // endpoint found
+    unsigned closestSerial = ~0u;   // 距离相同时取列表中靠前的
 
-    for (PF_Entity* en: entities){
-
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned serial){
         if (en->isVisible()
                 //&& !en->getParent()->ignoredOnModification()
                 ){//no end point for Insert, text, Dim
             point = en->getNearestEndpoint(coord, &curDist);
-            if (point.valid && curDist<minDist) {
+            if (point.valid && (curDist<minDist
+                                || (curDist==minDist && serial<closestSerial))) {
                 closestPoint = point;
                 minDist = curDist;
+                closestSerial = serial;
                 if (dist) {
                     *dist = minDist;
                 }
             }
         }
-    }
+        return minDist;
+    });
 
     return closestPoint;
 }
@@ -410,19 +501,16 @@ PF_Vector PF_EntityContainer::getNearestEndpoint(const PF_Vector& coord,
     PF_Vector closestPoint(false);  // closest found endpoint
     PF_Vector point;                // endpoint found
 
-    //QListIterator<PF_Entity> it = createIterator();
-    //PF_Entity* en;
-    //while ( (en = it.current())  ) {
-    //    ++it;
+    unsigned closestSerial = ~0u;   // 距离相同时取列表中靠前的
 
-    unsigned i0=0;
-    for(auto en: entities){
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned serial){
         //if (!en->getParent()->ignoredOnModification() ){//no end point for Insert, text, Dim
-//            std::cout<<"find nearest for entity "<<i0<<std::endl;
             point = en->getNearestEndpoint(coord, &curDist);
-            if (point.valid && curDist<minDist) {
+            if (point.valid && (curDist<minDist
+                                || (curDist==minDist && serial<closestSerial))) {
                 closestPoint = point;
                 minDist = curDist;
+                closestSerial = serial;
                 if (dist) {
                     *dist = minDist;
                 }
@@ -431,8 +519,8 @@ PF_Vector PF_EntityContainer::getNearestEndpoint(const PF_Vector& coord,
                 }
             }
         //}
-        i0++;
-    }
+        return minDist;
+    });
 
 //    std::cout<<__FILE__<<" : "<<__func__<<" : line "<<__LINE__<<std::endl;
 //    std::cout<<"count()="<<const_cast<PF_EntityContainer*>(this)->count()<<"\tminDist= "<<minDist<<"\tclosestPoint="<<closestPoint;
@@ -467,19 +555,22 @@ PF_Vector PF_EntityContainer::getNearestCenter(const PF_Vector& coord,
     double curDist = PF_MAXDOUBLE;  // currently measured distance
     PF_Vector closestPoint(false);  // closest found endpoint
     PF_Vector point;                // endpoint found
+    unsigned closestSerial = ~0u;   // 距离相同时取列表中靠前的
 
-    for(auto en: entities){
-
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned serial){
         if (en->isVisible()
                 //&& !en->getParent()->ignoredSnap()
                 ){//no center point for spline, text, Dim
             point = en->getNearestCenter(coord, &curDist);
-            if (point.valid && curDist<minDist) {
+            if (point.valid && (curDist<minDist
+                                || (curDist==minDist && serial<closestSerial))) {
                 closestPoint = point;
                 minDist = curDist;
+                closestSerial = serial;
             }
         }
-    }
+        return minDist;
+    });
     if (dist) {
         *dist = minDist;
     }
@@ -497,19 +588,22 @@ PF_Vector PF_EntityContainer::getNearestMiddle(const PF_Vector& coord,
     double curDist = PF_MAXDOUBLE;  // currently measured distance
     PF_Vector closestPoint(false);  // closest found endpoint
     PF_Vector point;                // endpoint found
+    unsigned closestSerial = ~0u;   // 距离相同时取列表中靠前的
 
-    for(auto en: entities){
-
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned serial){
         if (en->isVisible()
                 //&& !en->getParent()->ignoredSnap()
                 ){//no midle point for spline, text, Dim
             point = en->getNearestMiddle(coord, &curDist, middlePoints);
-            if (point.valid && curDist<minDist) {
+            if (point.valid && (curDist<minDist
+                                || (curDist==minDist && serial<closestSerial))) {
                 closestPoint = point;
                 minDist = curDist;
+                closestSerial = serial;
             }
         }
-    }
+        return minDist;
+    });
     if (dist) {
         *dist = minDist;
     }
@@ -535,9 +629,244 @@ PF_Vector PF_EntityContainer::getNearestDist(double distance,
     return point;
 }
 
-PF_Vector PF_EntityContainer::getNearestIntersection(const PF_Vector &coord, double *dist)
+/*!
+ \brief 查找最近的直线和圆的交点。交点在实体上，所以按照实体由近
+ 及远查找缓存的交点，比已找到的交点远的实体不再访问。
+
+ \param coord
+ \param dist
+ \return PF_Vector
+*/
+PF_Vector PF_EntityContainer::getNearestIntersection(const PF_Vector &coord, double *dist) const
 {
-    return PF_Vector{};
+    double minDist = PF_MAXDOUBLE;
+    PF_Vector closestPoint(false);
+
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned){
+        if (!en->isVisible() || !PF_Intersection::isCurve(en))
+            return minDist;
+        for (auto& c : intersections.crossings(en)) {
+            if (!c.other->isVisible())
+                continue;
+            double curDist = c.pos.distanceTo(coord);
+            if (curDist<minDist) {
+                closestPoint = c.pos;
+                minDist = curDist;
+            }
+        }
+        return minDist;
+    });
+    if (dist) {
+        *dist = minDist;
+    }
+
+    return closestPoint;
+}
+
+/*!
+ \brief 在直线与其他直线和圆的交点处打断直线，分网之前的几何才是
+ 平面图。交点在某条直线的端点上时使用已有的点，位置相同的交点共用
+ 一个点。面的边界中打断的直线换成打断后的各段。没有圆弧实体，所以
+ 圆不打断。
+
+ \return int 打断的直线数目
+*/
+int PF_EntityContainer::splitAtIntersections()
+{
+    calculateBorders();
+    const double tol = std::max(1.0, (maxV - minV).magnitude())*1e-9;
+    /** 按照容差取整后的坐标查找已有的点 **/
+    QHash<QPair<qint64,qint64>,PF_Point*> points;
+    auto keyOf = [&](const PF_Vector& v){
+        return qMakePair(qint64(std::floor(v.x/tol)), qint64(std::floor(v.y/tol)));
+    };
+    auto findPoint = [&](const PF_Vector& v)->PF_Point*{
+        QPair<qint64,qint64> k = keyOf(v);
+        for(qint64 dx = -1; dx <= 1; ++dx)
+            for(qint64 dy = -1; dy <= 1; ++dy){
+                PF_Point* p = points.value(qMakePair(k.first+dx, k.second+dy), nullptr);
+                if(p && p->getCenter().distanceTo(v) <= tol)
+                    return p;
+            }
+        return nullptr;
+    };
+
+    QList<PF_Line*> lines;
+    QList<PF_Face*> faces;
+    for(auto e : entities){
+        if(e->rtti() == PF::EntityLine)
+            lines.append(static_cast<PF_Line*>(e));
+        else if(e->rtti() == PF::EntityFace)
+            faces.append(static_cast<PF_Face*>(e));
+    }
+    for(auto l : lines){
+        for(PF_Point* p : {l->data.startpoint, l->data.endpoint})
+            if(!findPoint(p->getCenter()))
+                points.insert(keyOf(p->getCenter()), p);
+    }
+
+    /** 每条直线内部的打断位置 **/
+    QList<PF_Point*> newPoints;
+    QList<QPair<PF_Line*,QList<QPair<double,PF_Point*> > > > cuts;
+    for(auto l : lines){
+        PF_Vector p0 = l->getStartpoint(), d = l->getEndpoint() - p0;
+        double len = d.magnitude();
+        if(len <= tol)
+            continue;
+        QList<QPair<double,PF_Point*> > list;
+        for(auto& c : intersections.crossings(l)){
+            double t = (c.pos - p0).dotP(d)/(len*len);
+            if(t*len <= tol || (1 - t)*len <= tol)
+                continue;
+            PF_Point* p = findPoint(c.pos);
+            if(!p){
+                p = new PF_Point(this, mParentPlot, PF_PointData(c.pos));
+                PF_Point::point_index++;
+                newPoints.append(p);
+                points.insert(keyOf(c.pos), p);
+            }
+            if(p != l->data.startpoint && p != l->data.endpoint)
+                list.append(qMakePair(t, p));
+        }
+        if(!list.isEmpty())
+            cuts.append(qMakePair(l, list));
+    }
+    for(auto p : newPoints)
+        addEntity(p);
+
+    for(auto& cut : cuts){
+        PF_Line* line = cut.first;
+        QList<QPair<double,PF_Point*> >& list = cut.second;
+        std::sort(list.begin(), list.end(), [](const QPair<double,PF_Point*>& a, const QPair<double,PF_Point*>& b){
+            return a.first < b.first;
+        });
+        QList<PF_Line*> parts;
+        PF_Point* last = line->data.startpoint;
+        for(auto& c : list){
+            if(c.second == last)
+                continue;
+            parts.append(new PF_Line(this, mParentPlot, last, c.second));
+            PF_Line::line_index++;
+            last = c.second;
+        }
+        parts.append(new PF_Line(this, mParentPlot, last, line->data.endpoint));
+        PF_Line::line_index++;
+        for(auto part : parts)
+            addEntity(part);
+        for(auto face : faces)
+            face->replaceLine(line, parts);
+        removeEntity(line);
+    }
+
+    return cuts.size();
+}
+
+/*!
+ \brief 与其他直线或圆相交于内部的直线数目，判断的方法与
+ splitAtIntersections()相同，但是不改变几何。
+
+ \return int 需要打断的直线数目
+*/
+int PF_EntityContainer::crossingLines()
+{
+    calculateBorders();
+    const double tol = std::max(1.0, (maxV - minV).magnitude())*1e-9;
+    int count = 0;
+    for(auto e : entities){
+        if(e->rtti() != PF::EntityLine)
+            continue;
+        PF_Line* l = static_cast<PF_Line*>(e);
+        PF_Vector p0 = l->getStartpoint(), d = l->getEndpoint() - p0;
+        double len = d.magnitude();
+        if(len <= tol)
+            continue;
+        for(auto& c : intersections.crossings(l)){
+            double t = (c.pos - p0).dotP(d)/(len*len);
+            if(t*len > tol && (1 - t)*len > tol){
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+/*!
+ \brief 直线围成的所有有界区域，按照外边界的面积从小到大排列。
+ 直线要先在交点处打断。
+
+ \return const QList<PF_FaceDetector::Region>
+*/
+const QList<PF_FaceDetector::Region> &PF_EntityContainer::getRegions() const
+{
+    return faceDetector.regions();
+}
+
+static PF_Face* newFace(PF_EntityContainer* container, PF_GraphicView* view,
+                        const PF_FaceDetector::Region& region)
+{
+    PF_FaceData data;
+    for(auto& lines : region.loops){
+        PF_LineLoop* loop = new PF_LineLoop();
+        loop->lines = lines;
+        data.faceData.append(loop);
+        PF_LineLoop::lineloop_index++;
+    }
+    PF_Face* face = new PF_Face(container, view, data);
+    PF_Face::face_index++;
+    qDeleteAll(data.faceData);
+    return face;
+}
+
+/*!
+ \brief 用包含coord的最小区域生成一个面，区域的孔作为面的内边界。
+
+ \param coord
+ \return PF_Face 不在任何区域中时返回nullptr
+*/
+PF_Face *PF_EntityContainer::createFaceAt(const PF_Vector &coord)
+{
+    splitAtIntersections();
+    int i = faceDetector.regionAt(coord);
+    if(i < 0)
+        return nullptr;
+    PF_Face* face = newFace(this, mParentPlot, faceDetector.regions().at(i));
+    addEntity(face);
+    return face;
+}
+
+/*!
+ \brief 为每个还没有面的区域生成一个面。外边界的直线与已有的面相同的
+ 区域看作已经有面。
+
+ \return int 生成的面的数目
+*/
+int PF_EntityContainer::createFaces()
+{
+    splitAtIntersections();
+    std::set<std::vector<PF_Line*> > existing;
+    for(auto e : entities){
+        if(e->rtti() != PF::EntityFace)
+            continue;
+        const PF_FaceData& data = static_cast<PF_Face*>(e)->getData();
+        if(data.faceData.isEmpty())
+            continue;
+        const QList<PF_Line*>& lines = data.faceData.first()->lines;
+        std::vector<PF_Line*> key(lines.begin(), lines.end());
+        std::sort(key.begin(), key.end());
+        existing.insert(key);
+    }
+    int count = 0;
+    for(auto& region : faceDetector.regions()){
+        const QList<PF_Line*>& lines = region.loops.first();
+        std::vector<PF_Line*> key(lines.begin(), lines.end());
+        std::sort(key.begin(), key.end());
+        if(existing.count(key) == 0){
+            addEntity(newFace(this, mParentPlot, region));
+            ++count;
+        }
+    }
+    return count;
 }
 
 PF_Vector PF_EntityContainer::getNearestRef(const PF_Vector& coord,
@@ -547,20 +876,23 @@ PF_Vector PF_EntityContainer::getNearestRef(const PF_Vector& coord,
     double curDist;                 // currently measured distance
     PF_Vector closestPoint(false);  // closest found endpoint
     PF_Vector point;                // endpoint found
+    unsigned closestSerial = ~0u;   // 距离相同时取列表中靠前的
 
-    for(auto en: entities){
-
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned serial){
         if (en->isVisible()) {
             point = en->getNearestRef(coord, &curDist);
-            if (point.valid && curDist<minDist) {
+            if (point.valid && (curDist<minDist
+                                || (curDist==minDist && serial<closestSerial))) {
                 closestPoint = point;
                 minDist = curDist;
+                closestSerial = serial;
                 if (dist) {
                     *dist = minDist;
                 }
             }
         }
-    }
+        return minDist;
+    });
 
     return closestPoint;
 }
@@ -573,25 +905,123 @@ PF_Vector PF_EntityContainer::getNearestSelectedRef(const PF_Vector& coord,
     double curDist;                 // currently measured distance
     PF_Vector closestPoint(false);  // closest found endpoint
     PF_Vector point;                // endpoint found
+    unsigned closestSerial = ~0u;   // 距离相同时取列表中靠前的
 
-    for(auto en: entities){
-
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned serial){
         if (en->isVisible() && en->isSelected() && !en->isParentSelected()) {
             point = en->getNearestSelectedRef(coord, &curDist);
-            if (point.valid && curDist<minDist) {
+            if (point.valid && (curDist<minDist
+                                || (curDist==minDist && serial<closestSerial))) {
                 closestPoint = point;
                 minDist = curDist;
+                closestSerial = serial;
                 if (dist) {
                     *dist = minDist;
                 }
             }
         }
-    }
+        return minDist;
+    });
 
     return closestPoint;
 }
 
 
+/*!
+ \brief 一次遍历找到所有打开的捕捉模式的候选点。只访问距离coord在
+ range以内的实体，代价只与光标附近的实体数目有关。
+
+ \param coord 光标位置
+ \param mode 捕捉模式
+ \param range 捕捉范围，实际坐标
+ \param middlePoints 等分点的数目
+ \param distance 到端点的距离
+ \return PF_SnapCandidates
+*/
+PF_SnapCandidates PF_EntityContainer::getSnapCandidates(const PF_Vector& coord,
+                                                        const PF_SnapMode& mode,
+                                                        double range,
+                                                        int middlePoints,
+                                                        double distance) const{
+    PF_SnapCandidates result;
+    if(!(mode.snapEndpoint || mode.snapCenter || mode.snapMiddle || mode.snapDistance
+         || mode.snapIntersection || mode.snapOnEntity))
+        return result;
+
+    /** 各模式目前找到的最小距离，初始为捕捉范围 **/
+    double dEnd = range, dCenter = range, dMiddle = range, dDist = range, dOn = range;
+    double dInt = range;
+    double curDist;
+    PF_Vector point;
+
+    /** 剩下的实体比所有打开的模式的当前距离都远时停止 **/
+    auto bound = [&](){
+        double d = 0;
+        if(mode.snapEndpoint) d = std::max(d, dEnd);
+        if(mode.snapCenter) d = std::max(d, dCenter);
+        if(mode.snapMiddle) d = std::max(d, dMiddle);
+        if(mode.snapDistance) d = std::max(d, dDist);
+        if(mode.snapOnEntity) d = std::max(d, dOn);
+        if(mode.snapIntersection) d = std::max(d, dInt);
+        return d;
+    };
+
+    spatialIndex.query(coord, [&](PF_Entity* en, unsigned){
+        if (!en->isVisible())
+            return bound();
+        if (mode.snapEndpoint) {
+            point = en->getNearestEndpoint(coord, &curDist);
+            if (point.valid && curDist<dEnd) {
+                result.endpoint = point;
+                dEnd = curDist;
+            }
+        }
+        if (mode.snapCenter) {
+            point = en->getNearestCenter(coord, &curDist);
+            if (point.valid && curDist<dCenter) {
+                result.center = point;
+                dCenter = curDist;
+            }
+        }
+        if (mode.snapMiddle) {
+            point = en->getNearestMiddle(coord, &curDist, middlePoints);
+            if (point.valid && curDist<dMiddle) {
+                result.middle = point;
+                dMiddle = curDist;
+            }
+        }
+        if (mode.snapDistance) {
+            point = en->getNearestDist(distance, coord, &curDist);
+            if (point.valid && curDist<dDist) {
+                result.distance = point;
+                dDist = curDist;
+            }
+        }
+        if (mode.snapOnEntity) {
+            PF_Entity* subEntity = nullptr;
+            curDist = PF_MAXDOUBLE;
+            point = en->getNearestPointOnEntity(coord, true, &curDist, &subEntity);
+            if (point.valid && curDist<dOn) {
+                result.onEntity = point;
+                result.entity = subEntity ? subEntity : en;
+                dOn = curDist;
+            }
+        }
+        if (mode.snapIntersection && PF_Intersection::isCurve(en)) {
+            for (auto& c : intersections.crossings(en)) {
+                curDist = c.pos.distanceTo(coord);
+                if (c.other->isVisible() && curDist<dInt) {
+                    result.intersection = c.pos;
+                    dInt = curDist;
+                }
+            }
+        }
+        return bound();
+    });
+
+    return result;
+}
+
 /*!
  \brief 计算距离输入点最近的entity以及对应的距离
 
@@ -613,28 +1043,37 @@ double PF_EntityContainer::getDistanceToPoint(const PF_Vector& coord,
     double curDist;                     // currently measured distance
     PF_Entity* closestEntity = nullptr;    // closest entity found
     PF_Entity* subEntity = nullptr;
+    unsigned closestSerial = 0;
+    bool found = false;
 
-    for(auto e: entities){
+    // bug#426, need to ignore Images to find nearest intersections
+    if(level==PF::ResolveAllButTextImage /*&& e->rtti()==PF::EntityImage*/) {
+        if (entity) {
+            *entity = nullptr;
+        }
+        return minDist;
+    }
 
+    spatialIndex.query(coord, [&](PF_Entity* e, unsigned serial){
         if (e->isVisible()) {
             // RS_DEBUG->print("entity: getDistanceToPoint");
             // RS_DEBUG->print("entity: %d", e->rtti());
-            // bug#426, need to ignore Images to find nearest intersections
-            if(level==PF::ResolveAllButTextImage /*&& e->rtti()==PF::EntityImage*/) continue;
             curDist = e->getDistanceToPoint(coord, &subEntity, level, solidDist);
 
             // RS_DEBUG->print("entity: getDistanceToPoint: OK");
 
             /*
-             * By using '<=', we will prefer the *last* item in the container if there are multiple
+             * By taking equal distances too, we will prefer the *last* item in the container if there are multiple
              * entities that are *exactly* the same distance away, which should tend to be the one
              * drawn most recently, and the one most likely to be visible (as it is also the order
              * that the software draws the entities). This makes a difference when one entity is
              * drawn directly over top of another, and it's reasonable to assume that humans will
              * tend to want to reference entities that they see or have recently drawn as opposed
              * to deeper more forgotten and invisible ones...
+             * The index visits the entities out of order, so the position in the list
+             * (serial) decides between equal distances.
              */
-            if (curDist<=minDist)
+            if (curDist<minDist || (curDist==minDist && (!found || serial>closestSerial)))
             {
                 switch(level){
                 case PF::ResolveAll:
@@ -645,9 +1084,12 @@ double PF_EntityContainer::getDistanceToPoint(const PF_Vector& coord,
                     closestEntity = e;
                 }
                 minDist = curDist;
+                closestSerial = serial;
+                found = true;
             }
         }
-    }
+        return minDist;
+    });
 
     if (entity) {
         *entity = closestEntity;
@@ -690,9 +1132,41 @@ PF_Entity* PF_EntityContainer::getNearestEntity(const PF_Vector& coord,
 
 
 
-void PF_EntityContainer::move(const PF_Vector& offset) {
+/*!
+ \brief 容器中的点在PF_PointStore中一次变换，容器包含了所有的点时
+ 对整个坐标数组做变换。点移动后整体重建索引、交点和区域，所以不再
+ 逐个通知，只标记为已修改。其他实体随后各自变换。
+
+ \param t
+*/
+void PF_EntityContainer::transformPoints(const PF_PointStore::Affine &t)
+{
+    QVector<PF_Point*> points;
+    QVector<int> slots;
     for(auto e: entities){
+        if(e->rtti() == PF::EntityPoint){
+            points.append(static_cast<PF_Point*>(e));
+            slots.append(points.last()->getSlot());
+        }
+    }
+    if(points.isEmpty())
+        return;
+    PF_PointStore& store = PF_PointStore::instance();
+    store.transform(slots, slots.size() == store.count(), t);
+    for(auto p: points){
+        p->setFlag(PF::FlagDirty);
+        p->PF_Point::calculateBorders();
+    }
+    spatialIndex.invalidate();
+    intersections.invalidate();
+    faceDetector.invalidate();
+}
 
+void PF_EntityContainer::move(const PF_Vector& offset) {
+    transformPoints(PF_PointStore::Affine::translation(offset));
+    for(auto e: entities){
+        if(e->rtti() == PF::EntityPoint)
+            continue;
         e->move(offset);
 //        if (autoUpdateBorders) {
 //            e->moveBorders(offset);
@@ -708,9 +1182,7 @@ void PF_EntityContainer::move(const PF_Vector& offset) {
 void PF_EntityContainer::rotate(const PF_Vector& center, const double& angle) {
     PF_Vector angleVector(angle);
 
-    for(auto e: entities){
-        e->rotate(center, angleVector);
-    }
+    rotate(center, angleVector);
 //    if (autoUpdateBorders) {
 //        calculateBorders();
 //    }
@@ -719,7 +1191,10 @@ void PF_EntityContainer::rotate(const PF_Vector& center, const double& angle) {
 
 void PF_EntityContainer::rotate(const PF_Vector& center, const PF_Vector& angleVector) {
 
+    transformPoints(PF_PointStore::Affine::rotation(center, angleVector));
     for(auto e: entities){
+        if(e->rtti() == PF::EntityPoint)
+            continue;
         e->rotate(center, angleVector);
     }
 //    if (autoUpdateBorders) {
@@ -731,7 +1206,10 @@ void PF_EntityContainer::rotate(const PF_Vector& center, const PF_Vector& angleV
 void PF_EntityContainer::scale(const PF_Vector& center, const PF_Vector& factor) {
     if (fabs(factor.x)>PF_TOLERANCE && fabs(factor.y)>PF_TOLERANCE) {
 
+        transformPoints(PF_PointStore::Affine::scaling(center, factor));
         for(auto e: entities){
+            if(e->rtti() == PF::EntityPoint)
+                continue;
             e->scale(center, factor);
         }
     }
@@ -745,7 +1223,10 @@ void PF_EntityContainer::scale(const PF_Vector& center, const PF_Vector& factor)
 void PF_EntityContainer::mirror(const PF_Vector& axisPoint1, const PF_Vector& axisPoint2) {
     if (axisPoint1.distanceTo(axisPoint2)>PF_TOLERANCE) {
 
+        transformPoints(PF_PointStore::Affine::reflection(axisPoint1, axisPoint2));
         for(auto e: entities){
+            if(e->rtti() == PF::EntityPoint)
+                continue;
             e->mirror(axisPoint1, axisPoint2);
         }
     }
@@ -876,8 +1357,288 @@ bool PF_EntityContainer::exportGeofile()
     return true;
 }
 
+/*!
+ \brief 调用内部的分网程序进行分网，不需要经过gmsh的文件，用于交互时
+ 的重新分网。只有改变过的面被重新分网，这些面与未改变的面相接的边界
+ 使用已有网格的节点并保持不变，分好之后与其他面的网格拼接起来。有圆
+ 或者相接的边界不能保持时整体分网。
+ 直线相交时不分网，需要先用PF_ActionSplitIntersections在交点处打断，
+ 分网不修改几何。
+
+*/
 void PF_EntityContainer::doMesh()
 {
+    int crossing = crossingLines();
+    if(crossing > 0){
+        qWarning() << Q_FUNC_INFO << crossing << "lines cross other lines or circles, split them at the intersections before meshing";
+        return;
+    }
+    QList<PF_Face*> faces, dirty;
+    bool full = false;
+    for(auto e:entities){
+        if(!e->isVisible())
+            continue;
+        if(e->rtti() == PF::EntityFace){
+            PF_Face* face = static_cast<PF_Face*>(e);
+            faces.append(face);
+            if(face->isMeshDirty())
+                dirty.append(face);
+        }else if(e->rtti() == PF::EntityCircle){
+            /** 圆与面的网格相互覆盖，不能单独更新 **/
+            full = true;
+        }
+    }
+    if(full || dirty.size() == faces.size()){
+        doMeshAll(faces);
+        return;
+    }
+    if(dirty.isEmpty() && !meshEntities.isEmpty())
+        return;
+    if(!dirty.isEmpty() && !doMeshFaces(dirty,faces)){
+        doMeshAll(faces);
+        return;
+    }
+    showMesh(assembleMesh(faces));
+}
+
+/*!
+ \brief 对所有的面和圆整体分网。面的网格分别保存在面中，圆的编号
+ 接在面之后。
+
+*/
+void PF_EntityContainer::doMeshAll(const QList<PF_Face *> &faces)
+{
+    PF_Mesher mesher;
+    mesher.setDefaultSize(defaultMeshSize(faces));
+    QList<int> regions;
+    int tag = 0;
+    for(auto face:faces){
+        regions.append(mesher.addRegion(face->getLoops(),face->getMeshSize(),face->index()));
+        tag = qMax(tag,face->index());
+    }
+    QList<PF_Entity*> circles;
+    for(auto e:entities){
+        if(e->rtti() == PF::EntityCircle && e->isVisible()){
+            PF_Vector center = e->getCenter();
+            mesher.addCircle(QPointF(center.x,center.y),e->getRadius(),0,++tag);
+            circles.append(e);
+        }
+    }
+    if(!mesher.generate()){
+        showMesh(nullptr);
+        return;
+    }
+    for(int i = 0;i < faces.size();++i){
+        faces.at(i)->setMesh(regions.at(i) < 0 ? nullptr : mesher.createMesh(regions.at(i)));
+        faces.at(i)->clearMeshDirty();
+    }
+    for(auto c:circles){
+        c->setDirty(false);
+    }
+    showMesh(mesher.createMesh());
+}
+
+/*!
+ \brief 只对改变过的面分网。未改变的面的网格在边界上的边，如果落在
+ 改变过的面的边界上，就作为固定的边加入分网，保证网格在交界处协调。
+
+ \param dirty 改变过的面
+ \param faces 所有的面
+ \return bool 固定的边被分割时返回false，需要整体分网
+*/
+bool PF_EntityContainer::doMeshFaces(const QList<PF_Face *> &dirty, const QList<PF_Face *> &faces)
+{
+    typedef std::pair<double,double> Point;
+    typedef std::pair<Point,Point> Edge;
+    /** 改变过的面的边界，每条边上需要插入的节点，按照在边上的位置排序 **/
+    std::map<Edge,std::map<double,QPointF> > edgePoints;
+    QList<QList<QPolygonF> > loops;
+    QVector<QPointF> vertices;
+    for(auto face:dirty){
+        loops.append(face->getLoops());
+        for(auto& l:loops.last()){
+            for(int k = 0;k < l.size();++k){
+                vertices.append(l.at(k));
+                Point a(l.at(k).x(),l.at(k).y());
+                Point b(l.at((k+1)%l.size()).x(),l.at((k+1)%l.size()).y());
+                edgePoints[a < b ? Edge(a,b) : Edge(b,a)];
+            }
+        }
+    }
+
+    PF_Mesher mesher;
+    /** 未设置尺寸的面按照整个模型选取尺寸，与整体分网一致 **/
+    mesher.setDefaultSize(defaultMeshSize(faces));
+    for(auto face:faces){
+        if(dirty.contains(face) || !face->getMesh())
+            continue;
+        /** 只被一个单元使用的边是网格的边界 **/
+        CMesh* mesh = face->getMesh();
+        QHash<QPair<int,int>,int> count;
+        for(int i = 0;i < mesh->numEle;++i){
+            for(int j = 0;j < 3;++j){
+                int n0 = mesh->eles[i].n[j];
+                int n1 = mesh->eles[i].n[(j+1)%3];
+                count[qMakePair(qMin(n0,n1),qMax(n0,n1))]++;
+            }
+        }
+        for(auto it = count.constBegin();it != count.constEnd();++it){
+            if(it.value() != 1)
+                continue;
+            const CNode& u = mesh->nodes[it.key().first];
+            const CNode& v = mesh->nodes[it.key().second];
+            /** 改变过的面的顶点落在这条边的中间时，网格不能协调 **/
+            double ux = v.x - u.x, uy = v.y - u.y;
+            double ulen2 = ux*ux + uy*uy;
+            for(auto& w:vertices){
+                double c = ux*(w.y()-u.y) - uy*(w.x()-u.x);
+                double t = (ux*(w.x()-u.x) + uy*(w.y()-u.y))/ulen2;
+                if(qAbs(c) <= 1e-9*ulen2 && t > 1e-9 && t < 1-1e-9)
+                    return false;
+            }
+            for(auto& e:edgePoints){
+                double ex = e.first.second.first - e.first.first.first;
+                double ey = e.first.second.second - e.first.first.second;
+                double len2 = ex*ex + ey*ey;
+                double eps = 1e-9*len2;
+                double cu = ex*(u.y-e.first.first.second) - ey*(u.x-e.first.first.first);
+                double cv = ex*(v.y-e.first.first.second) - ey*(v.x-e.first.first.first);
+                if(qAbs(cu) > eps || qAbs(cv) > eps)
+                    continue;
+                double tu = (ex*(u.x-e.first.first.first) + ey*(u.y-e.first.first.second))/len2;
+                double tv = (ex*(v.x-e.first.first.first) + ey*(v.y-e.first.first.second))/len2;
+                if(qMin(tu,tv) < -1e-9 || qMax(tu,tv) > 1+1e-9)
+                    continue;
+                e.second[tu] = QPointF(u.x,u.y);
+                e.second[tv] = QPointF(v.x,v.y);
+                mesher.addFixedEdge(QPointF(u.x,u.y),QPointF(v.x,v.y));
+                break;
+            }
+        }
+    }
+
+    /** 在边界上插入已有网格的节点 **/
+    QList<int> regions;
+    for(int i = 0;i < dirty.size();++i){
+        QList<QPolygonF> faceLoops;
+        for(auto& l:loops.at(i)){
+            QPolygonF loop;
+            for(int k = 0;k < l.size();++k){
+                Point a(l.at(k).x(),l.at(k).y());
+                Point b(l.at((k+1)%l.size()).x(),l.at((k+1)%l.size()).y());
+                loop.append(l.at(k));
+                const std::map<double,QPointF>& pts = edgePoints[a < b ? Edge(a,b) : Edge(b,a)];
+                if(a < b){
+                    for(auto it = pts.begin();it != pts.end();++it)
+                        if(it->first > 1e-9 && it->first < 1-1e-9)
+                            loop.append(it->second);
+                }else{
+                    for(auto it = pts.rbegin();it != pts.rend();++it)
+                        if(it->first > 1e-9 && it->first < 1-1e-9)
+                            loop.append(it->second);
+                }
+            }
+            faceLoops.append(loop);
+        }
+        regions.append(mesher.addRegion(faceLoops,dirty.at(i)->getMeshSize(),dirty.at(i)->index()));
+    }
+    if(!mesher.generate() || mesher.fixedEdgesSplit())
+        return false;
+    for(int i = 0;i < dirty.size();++i){
+        dirty.at(i)->setMesh(regions.at(i) < 0 ? nullptr : mesher.createMesh(regions.at(i)));
+        dirty.at(i)->clearMeshDirty();
+    }
+    return true;
+}
+
+/*!
+ \brief 面未设置分网尺寸时使用的尺寸，取所有的面和圆的范围的对角线
+ 的1/20。局部分网时只有改变过的面交给分网程序，需要由此保证尺寸与
+ 整体分网相同。
+
+ \param faces 所有的面
+ \return double 单元尺寸
+*/
+double PF_EntityContainer::defaultMeshSize(const QList<PF_Face *> &faces) const
+{
+    double xmin = 1e300, xmax = -1e300, ymin = 1e300, ymax = -1e300;
+    for(auto face:faces){
+        for(auto& l:face->getLoops()){
+            for(auto& p:l){
+                xmin = qMin(xmin,p.x());
+                xmax = qMax(xmax,p.x());
+                ymin = qMin(ymin,p.y());
+                ymax = qMax(ymax,p.y());
+            }
+        }
+    }
+    for(auto e:entities){
+        if(e->rtti() == PF::EntityCircle && e->isVisible()){
+            PF_Vector center = e->getCenter();
+            double r = e->getRadius();
+            xmin = qMin(xmin,center.x-r);
+            xmax = qMax(xmax,center.x+r);
+            ymin = qMin(ymin,center.y-r);
+            ymax = qMax(ymax,center.y+r);
+        }
+    }
+    if(xmin > xmax || ymin > ymax)
+        return 0;
+    return std::sqrt((xmax-xmin)*(xmax-xmin) + (ymax-ymin)*(ymax-ymin))/20;
+}
+
+/*!
+ \brief 把各个面的网格拼接成整体的网格，交界处坐标相同的节点合并
+
+*/
+CMesh *PF_EntityContainer::assembleMesh(const QList<PF_Face *> &faces)
+{
+    QHash<QPair<double,double>,int> nodeIndex;
+    QVector<CNode> nodes;
+    QVector<CElement> eles;
+    for(auto face:faces){
+        CMesh* mesh = face->getMesh();
+        if(!mesh)
+            continue;
+        QVector<int> perm(mesh->numNode);
+        for(int i = 0;i < mesh->numNode;++i){
+            QPair<double,double> key(mesh->nodes[i].x,mesh->nodes[i].y);
+            auto it = nodeIndex.find(key);
+            if(it == nodeIndex.end()){
+                it = nodeIndex.insert(key,nodes.size());
+                nodes.append(mesh->nodes[i]);
+            }
+            perm[i] = it.value();
+        }
+        for(int i = 0;i < mesh->numEle;++i){
+            CElement e = mesh->eles[i];
+            for(int j = 0;j < 3;++j)
+                e.n[j] = perm[e.n[j]];
+            eles.append(e);
+        }
+    }
+    CMesh* mesh = new CMesh;
+    mesh->numNode = nodes.size();
+    mesh->numEle = eles.size();
+    mesh->nodes = (CNode*)malloc(nodes.size() * sizeof (CNode));
+    mesh->eles = (CElement*)malloc(eles.size() * sizeof (CElement));
+    std::copy(nodes.begin(),nodes.end(),mesh->nodes);
+    std::copy(eles.begin(),eles.end(),mesh->eles);
+    return mesh;
+}
+
+/*!
+ \brief 导出geo文件后调用gmsh分网
+ 直线相交时不分网，与doMesh()相同。
+
+*/
+void PF_EntityContainer::doMeshGmsh()
+{
+    int crossing = crossingLines();
+    if(crossing > 0){
+        qWarning() << Q_FUNC_INFO << crossing << "lines cross other lines or circles, split them at the intersections before meshing";
+        return;
+    }
     exportGeofile();
     int myargn = 3;
     char *myargv[] = {(char*)"gmsh",(char*)"-format",(char*)"msh2"};
@@ -886,27 +1647,33 @@ void PF_EntityContainer::doMesh()
     gmsh::open("D:/model.geo");
     gmsh::model::mesh::generate(2);
     gmsh::write("D:/model.msh");
-    CMesh* mesh = loadGmsh22("D:/model.msh");
-    PF_Point** points = (PF_Point**)malloc(mesh->numNode * sizeof (PF_Point*));
-    for(int i = 0;i < mesh->numNode;++i){
-        double x = mesh->nodes[i].x;
-        double y = mesh->nodes[i].y;
-        points[i] = new PF_Point(this,this->mParentPlot,PF_PointData(PF_Vector(x,y)));
-        this->addEntity(points[i]);
-    }
-    for(int i = 0;i < mesh->numEle;++i){
-        if(mesh->eles[i].ele_type == TRIANGLE_NODE3){
-            int n0 = mesh->eles[i].n[0];
-            int n1 = mesh->eles[i].n[1];
-            int n2 = mesh->eles[i].n[2];
-            this->addEntity(new PF_Line(this,this->mParentPlot,points[n0],points[n1]));
-            this->addEntity(new PF_Line(this,this->mParentPlot,points[n1],points[n2]));
-            this->addEntity(new PF_Line(this,this->mParentPlot,points[n2],points[n0]));
+    showMesh(loadGmsh22("D:/model.msh"));
+    gmsh::finalize();
+}
 
-        }
+/*!
+ \brief 把网格作为一个实体显示出来，之前显示的网格被删除，网格交给
+ 实体管理。质量最差的单元在视图中高亮显示。
+
+ \param mesh
+*/
+void PF_EntityContainer::showMesh(CMesh *mesh)
+{
+    for(auto e:meshEntities){
+        removeEntity(e);
     }
+    meshEntities.clear();
+    if(!mesh){
+        this->mParentPlot->clearHighlightedElements();
+        this->mParentPlot->replot();
+        return;
+    }
+
+    PF_Mesh* entity = new PF_Mesh(this,this->mParentPlot,mesh);
+    this->addEntity(entity);
+    meshEntities.append(entity);
+    this->mParentPlot->setHighlightedElements(entity->worstElements());
     this->mParentPlot->replot();
-    gmsh::finalize();
 }
 
 int PF_EntityContainer::index() const
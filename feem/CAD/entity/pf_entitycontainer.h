@@ -2,8 +2,15 @@
 #define PF_ENTITYCONTAINER_H
 
 #include "pf_entity.h"
+#include "pf_spatialindex.h"
+#include "pf_intersection.h"
+#include "pf_facedetector.h"
+#include "pf_entitypool.h"
 #include <QList>
 
+class PF_Face;
+struct PF_SnapMode;
+
 //2018-02-15
 //by Poofee
 /**该类实现entity的组合功能，也就是一个数组列表**/
@@ -31,6 +38,17 @@ typedef struct _CMesh{
     CElement* eles;
 }CMesh;
 
+/** 一次捕捉查询中各个模式找到的点，捕捉范围内没有时无效 **/
+struct PF_SnapCandidates{
+    PF_Vector endpoint{false};
+    PF_Vector center{false};
+    PF_Vector middle{false};
+    PF_Vector distance{false};
+    PF_Vector intersection{false};
+    PF_Vector onEntity{false};
+    PF_Entity* entity = nullptr;/** onEntity所在的实体 **/
+};
+
 class PF_EntityContainer: public PF_Entity
 {
 public:
@@ -64,6 +82,8 @@ public:
     virtual void moveEntity(int index, QList<PF_Entity *>& entList);
     virtual void insertEntity(int index, PF_Entity* entity);
     virtual bool removeEntity(PF_Entity* entity);
+    /** 实体的形状改变之后更新空间索引 **/
+    void entityChanged(PF_Entity* entity);
 
 
     /**一系列对Entity的操作**/
@@ -91,11 +111,16 @@ public:
                                      const PF_Vector& coord,
                                      double* dist = nullptr) const override;
     PF_Vector getNearestIntersection(const PF_Vector& coord,
-            double* dist = nullptr);
+            double* dist = nullptr) const;
     PF_Vector getNearestRef(const PF_Vector& coord,
                                      double* dist = nullptr) const override;
     PF_Vector getNearestSelectedRef(const PF_Vector& coord,
                                      double* dist = nullptr) const override;
+    PF_SnapCandidates getSnapCandidates(const PF_Vector& coord,
+                                        const PF_SnapMode& mode,
+                                        double range,
+                                        int middlePoints = 1,
+                                        double distance = 1.0) const;
 
     double getDistanceToPoint(const PF_Vector& coord,
                                       PF_Entity** entity,
@@ -138,10 +163,27 @@ public:
     QString toGeoString() override;
     bool exportGeofile();
     void doMesh();
+    void doMeshGmsh();
+    void showMesh(CMesh* mesh);
+    CMesh* assembleMesh(const QList<PF_Face*>& faces);
     CMesh *loadGmsh22(const char fn[]);
+    int splitAtIntersections();
+    int crossingLines();
+    const QList<PF_FaceDetector::Region>& getRegions() const;
+    PF_Face* createFaceAt(const PF_Vector& coord);
+    int createFaces();
     int index() const override;
 protected:
+    void doMeshAll(const QList<PF_Face*>& faces);
+    bool doMeshFaces(const QList<PF_Face*>& dirty, const QList<PF_Face*>& faces);
+    double defaultMeshSize(const QList<PF_Face*>& faces) const;
+    void transformPoints(const PF_PointStore::Affine& t);
+
     QList<PF_Entity*> entities;/**保存所有实体**/
+    QList<PF_Entity*> meshEntities;/**显示网格的实体**/
+    PF_SpatialIndex spatialIndex;/**用于查找最近的实体**/
+    PF_Intersection intersections;/**直线和圆之间的交点**/
+    PF_FaceDetector faceDetector;/**直线围成的区域**/
 private:
     bool autoDelete;
 };
@@ -0,0 +1,177 @@
+#include "pf_entitypool.h"
+
+#include <algorithm>
+#include <new>
+
+PF_EntityPool::PF_EntityPool(size_t size, int blockSize)
+    :objectSize(size)
+    ,blockSize(blockSize)
+    ,freeList(nullptr)
+    ,used(0)
+{
+    /** 每个对象按照最大的基本类型对齐 **/
+    const size_t align = alignof(std::max_align_t);
+    stride = (std::max(size, sizeof(Node)) + align - 1)/align*align;
+}
+
+void *PF_EntityPool::allocate(size_t size)
+{
+    if(size != objectSize)
+        return ::operator new(size);
+    if(!freeList){
+        char* block = static_cast<char*>(::operator new(stride*blockSize));
+        blocks.append(block);
+        for(int i = blockSize-1; i >= 0; --i){
+            Node* node = reinterpret_cast<Node*>(block + i*stride);
+            node->next = freeList;
+            freeList = node;
+        }
+    }
+    Node* node = freeList;
+    freeList = node->next;
+    ++used;
+    return node;
+}
+
+void PF_EntityPool::deallocate(void *p, size_t size)
+{
+    if(!p)
+        return;
+    if(size != objectSize){
+        ::operator delete(p);
+        return;
+    }
+    Node* node = static_cast<Node*>(p);
+    node->next = freeList;
+    freeList = node;
+    --used;
+}
+
+PF_PointStore::Affine PF_PointStore::Affine::translation(const PF_Vector &offset)
+{
+    return {1, 0, offset.x,
+            0, 1, offset.y};
+}
+
+PF_PointStore::Affine PF_PointStore::Affine::rotation(const PF_Vector &center, const PF_Vector &angleVector)
+{
+    double c = angleVector.x, s = angleVector.y;
+    return {c, -s, center.x - c*center.x + s*center.y,
+            s, c, center.y - s*center.x - c*center.y};
+}
+
+PF_PointStore::Affine PF_PointStore::Affine::scaling(const PF_Vector &center, const PF_Vector &factor)
+{
+    return {factor.x, 0, center.x - factor.x*center.x,
+            0, factor.y, center.y - factor.y*center.y};
+}
+
+/*!
+ \brief 关于经过两点的直线的镜像：p' = a + R(p-a)，R = 2dd^T/|d|^2 - I。
+ 两点重合时返回恒等变换。
+
+*/
+PF_PointStore::Affine PF_PointStore::Affine::reflection(const PF_Vector &axisPoint1, const PF_Vector &axisPoint2)
+{
+    PF_Vector d = axisPoint2 - axisPoint1;
+    double a = d.squared();
+    if(a < PF_TOLERANCE2)
+        return translation(PF_Vector(0., 0.));
+    double xx = 2*d.x*d.x/a - 1, xy = 2*d.x*d.y/a, yy = 2*d.y*d.y/a - 1;
+    const PF_Vector& p = axisPoint1;
+    return {xx, xy, p.x - xx*p.x - xy*p.y,
+            xy, yy, p.y - xy*p.x - yy*p.y};
+}
+
+PF_PointStore &PF_PointStore::instance()
+{
+    /** 不析构，静态对象析构之后删除的点也能够释放位置 **/
+    static PF_PointStore* store = new PF_PointStore();
+    return *store;
+}
+
+int PF_PointStore::allocate(const PF_Vector &pos)
+{
+    int slot;
+    if(!freeSlots.isEmpty()){
+        slot = freeSlots.takeLast();
+        live[slot] = 1;
+    }else{
+        slot = xs.size();
+        xs.append(0);
+        ys.append(0);
+        live.append(1);
+    }
+    set(slot, pos);
+    return slot;
+}
+
+void PF_PointStore::release(int slot)
+{
+    if(slot < 0 || slot >= live.size() || !live.at(slot))
+        return;
+    live[slot] = 0;
+    freeSlots.append(slot);
+    /** 全部释放时收回数组 **/
+    if(freeSlots.size() == xs.size()){
+        xs.clear();
+        ys.clear();
+        live.clear();
+        freeSlots.clear();
+    }
+}
+
+void PF_PointStore::transform(const QVector<int> &slots, bool all, const Affine &t)
+{
+    if(all){
+        double* x = xs.data();
+        double* y = ys.data();
+        const int n = xs.size();
+        for(int i = 0; i < n; ++i){
+            double px = x[i], py = y[i];
+            x[i] = t.xx*px + t.xy*py + t.x0;
+            y[i] = t.yx*px + t.yy*py + t.y0;
+        }
+        return;
+    }
+    for(int i : slots){
+        double px = xs.at(i), py = ys.at(i);
+        xs[i] = t.xx*px + t.xy*py + t.x0;
+        ys[i] = t.yx*px + t.yy*py + t.y0;
+    }
+}
+
+bool PF_PointStore::bounds(const QVector<int> &slots, bool all, PF_Vector &vmin, PF_Vector &vmax) const
+{
+    double minx = PF_MAXDOUBLE, miny = PF_MAXDOUBLE;
+    double maxx = -PF_MAXDOUBLE, maxy = -PF_MAXDOUBLE;
+    bool found = false;
+    if(all){
+        const double* x = xs.constData();
+        const double* y = ys.constData();
+        const char* l = live.constData();
+        const int n = xs.size();
+        for(int i = 0; i < n; ++i){
+            /** 空闲的位置换成不影响结果的值，循环中没有分支 **/
+            double px = x[i], py = y[i];
+            minx = std::min(minx, l[i] ? px : PF_MAXDOUBLE);
+            miny = std::min(miny, l[i] ? py : PF_MAXDOUBLE);
+            maxx = std::max(maxx, l[i] ? px : -PF_MAXDOUBLE);
+            maxy = std::max(maxy, l[i] ? py : -PF_MAXDOUBLE);
+        }
+        found = count() > 0;
+    }else{
+        for(int i : slots){
+            minx = std::min(minx, xs.at(i));
+            miny = std::min(miny, ys.at(i));
+            maxx = std::max(maxx, xs.at(i));
+            maxy = std::max(maxy, ys.at(i));
+        }
+        found = !slots.isEmpty();
+    }
+    if(found){
+        vmin = PF_Vector(minx, miny);
+        vmax = PF_Vector(maxx, maxy);
+    }
+    return found;
+}
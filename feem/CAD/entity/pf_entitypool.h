@@ -0,0 +1,117 @@
+#ifndef PF_ENTITYPOOL_H
+#define PF_ENTITYPOOL_H
+
+#include "pf_vector.h"
+
+#include <QVector>
+#include <cstddef>
+
+/*!
+ \brief 同一种实体的内存池。实体按块分配，每块放blockSize个，删除的
+ 实体放入空闲链表重复使用，同类实体在内存中连续存放，也没有每个对象
+ 单独分配的开销。点、线、圆的operator new/delete从这里分配，大小不同
+ 的派生类仍然使用全局的operator new。实体只在GUI线程中创建和删除，
+ 内存池不加锁，并且不会释放，程序退出时仍在容器中的实体也可以安全删除。
+
+*/
+class PF_EntityPool
+{
+public:
+    PF_EntityPool(size_t size, int blockSize = 1024);
+
+    void* allocate(size_t size);
+    void deallocate(void* p, size_t size);
+
+    /** 正在使用的对象数目 **/
+    int count() const {return used;}
+
+    /** T的内存池，不析构，见上 **/
+    template<class T>
+    static PF_EntityPool& of(){
+        static PF_EntityPool* p = new PF_EntityPool(sizeof(T));
+        return *p;
+    }
+
+private:
+    struct Node{
+        Node* next;
+    };
+
+    size_t objectSize;
+    size_t stride;/** 对齐之后每个对象所占的字节数 **/
+    int blockSize;
+    QVector<char*> blocks;
+    Node* freeList;
+    int used;
+};
+
+/*!
+ \brief 作为实体的第二个基类，使T的operator new/delete从
+ PF_EntityPool::of<T>()分配，如class PF_Point : public PF_AtomicEntity,
+ public PF_PoolAllocated<PF_Point>。
+
+*/
+template<class T>
+class PF_PoolAllocated
+{
+public:
+    static void* operator new(size_t size){
+        return PF_EntityPool::of<T>().allocate(size);
+    }
+    static void operator delete(void* p, size_t size){
+        PF_EntityPool::of<T>().deallocate(p, size);
+    }
+};
+
+/*!
+ \brief 所有点的坐标，按照结构数组保存，x和y各自连续存放，每个点
+ 保存自己在数组中的位置。删除的点留下的位置由下一个点使用。容器整体
+ 平移、旋转、缩放和镜像时，这些都是仿射变换，对坐标数组做一遍循环，
+ 编译器可以向量化；求包围盒也一样。
+
+*/
+class PF_PointStore
+{
+public:
+    /** x' = xx*x + xy*y + x0, y' = yx*x + yy*y + y0 **/
+    struct Affine{
+        double xx, xy, x0;
+        double yx, yy, y0;
+
+        static Affine translation(const PF_Vector& offset);
+        static Affine rotation(const PF_Vector& center, const PF_Vector& angleVector);
+        static Affine scaling(const PF_Vector& center, const PF_Vector& factor);
+        static Affine reflection(const PF_Vector& axisPoint1, const PF_Vector& axisPoint2);
+    };
+
+    static PF_PointStore& instance();
+
+    int allocate(const PF_Vector& pos);
+    void release(int slot);
+
+    PF_Vector get(int slot) const{
+        return PF_Vector(xs.at(slot), ys.at(slot));
+    }
+    void set(int slot, const PF_Vector& pos){
+        xs[slot] = pos.x;
+        ys[slot] = pos.y;
+    }
+
+    /** 正在使用的位置数目 **/
+    int count() const {return xs.size() - freeSlots.size();}
+
+    /** 变换slots中的点，all为true时变换整个数组，包括空闲的位置 **/
+    void transform(const QVector<int>& slots, bool all, const Affine& t);
+    /** slots中的点的包围盒，没有点时返回false **/
+    bool bounds(const QVector<int>& slots, bool all, PF_Vector& vmin, PF_Vector& vmax) const;
+
+private:
+    PF_PointStore()=default;
+
+    QVector<double> xs;
+    QVector<double> ys;
+    QVector<char> live;
+    QVector<int> freeSlots;
+};
+
+#endif // PF_ENTITYPOOL_H
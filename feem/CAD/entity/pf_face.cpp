@@ -1,6 +1,7 @@
 #include "pf_line.h"
 #include "pf_face.h"
 #include "pf_graphicview.h"
+#include "pf_entitycontainer.h"
 #include <QPainter>
 
 int PF_Face::face_index = 1;
@@ -22,6 +23,11 @@ PF_Face::PF_Face(PF_EntityContainer *parent, PF_GraphicView *view, const PF_Face
     m_index = face_index;
 }
 
+PF_Face::~PF_Face()
+{
+    setMesh(nullptr);
+}
+
 PF_VectorSolutions PF_Face::getRefPoints() const
 {
     return {};
@@ -111,51 +117,17 @@ void PF_Face::draw(QCPPainter *painter)
     }
     painter->save();
 
-    /** 绘制面 **/
+    /** 绘制面，转换成gui坐标。不修改lineloop，分块绘制时可能在
+        几个线程中同时绘制同一个面 **/
     QPainterPath path;
-    PF_Line* line1,*line2;
-    PF_Vector pos;
-    int indexLast = -1;
-    for(auto e : data.faceData){
-        /** 生成lineloop，实际的gui坐标 **/
-        e->loop.clear();
-        /** 保存上一次的终点 **/
-        if(e->lines.size() < 2)
-            break;
-        /** 找到前两条线段的公共点，然后算出起始点 **/
-        line1 = e->lines.at(0);
-        line2 = e->lines.at(1);
-        if(line1->data.startpoint->index() == line2->data.startpoint->index() ||
-                line1->data.startpoint->index() == line2->data.endpoint->index()){
-            indexLast = line1->data.endpoint->index();
-        }else if(line1->data.endpoint->index() == line2->data.startpoint->index() ||
-                line1->data.endpoint->index() == line2->data.endpoint->index()){
-            indexLast = line1->data.startpoint->index();
-        }else{
-            break;/** 第一条和第二条并没有相连 **/
-        }
-
-        for(auto p : e->lines){
-            /** 要注意线的方向 **/
-            if(indexLast == p->data.startpoint->index()){
-                pos = p->data.startpoint->getCenter();
-                e->loop.append(QPointF(mParentPlot->toGuiX(pos.x),mParentPlot->toGuiY(pos.y)));
-                pos = p->data.endpoint->getCenter();
-                e->loop.append(QPointF(mParentPlot->toGuiX(pos.x),mParentPlot->toGuiY(pos.y)));
-                indexLast = p->data.endpoint->index();
-                continue;
-            }else if(indexLast == p->data.endpoint->index()){
-                pos = p->data.endpoint->getCenter();
-                e->loop.append(QPointF(mParentPlot->toGuiX(pos.x),mParentPlot->toGuiY(pos.y)));
-                pos = p->data.startpoint->getCenter();
-                e->loop.append(QPointF(mParentPlot->toGuiX(pos.x),mParentPlot->toGuiY(pos.y)));
-                indexLast = p->data.startpoint->index();
-                continue;
-            }else{
-                break;/** 第一条和第二条并没有相连 **/
-            }
-        }
-        path.addPolygon(e->loop);
+    QList<QPolygonF> loops = getLoops();
+    for(auto& loop : loops){
+        QPolygonF gui;
+        for(auto& pos : loop)
+            gui.append(QPointF(mParentPlot->toGuiX(pos.x()),mParentPlot->toGuiY(pos.y())));
+        if(!gui.isEmpty())
+            gui.append(gui.first());
+        path.addPolygon(gui);
     }
 //    qDebug()<<path;
     QColor q;
@@ -200,9 +172,131 @@ void PF_Face::draw(QCPPainter *painter)
     painter->restore();
 }
 
-void PF_Face::calculateBorders()
+/*!
+ \brief 按照线的连接顺序生成各个lineloop的闭合多边形，模型坐标，
+ 首尾不重复。线段不相连的lineloop及其之后的都不生成。
+
+ \return QList<QPolygonF>
+*/
+QList<QPolygonF> PF_Face::getLoops() const
+{
+    QList<QPolygonF> loops;
+    PF_Line* line1,*line2;
+    PF_Vector pos;
+    int indexLast = -1;
+    for(auto e : data.faceData){
+        if(e->lines.size() < 2)
+            break;
+        /** 找到前两条线段的公共点，然后算出起始点 **/
+        line1 = e->lines.at(0);
+        line2 = e->lines.at(1);
+        if(line1->data.startpoint->index() == line2->data.startpoint->index() ||
+                line1->data.startpoint->index() == line2->data.endpoint->index()){
+            indexLast = line1->data.endpoint->index();
+        }else if(line1->data.endpoint->index() == line2->data.startpoint->index() ||
+                line1->data.endpoint->index() == line2->data.endpoint->index()){
+            indexLast = line1->data.startpoint->index();
+        }else{
+            break;/** 第一条和第二条并没有相连 **/
+        }
+
+        QPolygonF loop;
+        for(auto p : e->lines){
+            /** 要注意线的方向 **/
+            if(indexLast == p->data.startpoint->index()){
+                pos = p->data.startpoint->getCenter();
+                indexLast = p->data.endpoint->index();
+            }else if(indexLast == p->data.endpoint->index()){
+                pos = p->data.endpoint->getCenter();
+                indexLast = p->data.startpoint->index();
+            }else{
+                break;
+            }
+            loop.append(QPointF(pos.x,pos.y));
+        }
+        loops.append(loop);
+    }
+    return loops;
+}
+
+/*!
+ \brief 把边界中的line换成首尾相连的parts，parts从line的起点排到终点。
+
+ \param line
+ \param parts
+*/
+void PF_Face::replaceLine(PF_Line *line, const QList<PF_Line *> &parts)
+{
+    for(auto e : data.faceData){
+        int i = e->lines.indexOf(line);
+        if(i < 0)
+            continue;
+        /** 前一条线段与line的起点相连时，边界沿着line的方向 **/
+        PF_Line* prev = e->lines.at((i + e->lines.size() - 1) % e->lines.size());
+        bool forward = prev->data.startpoint == line->data.startpoint ||
+                prev->data.endpoint == line->data.startpoint;
+        e->lines.removeAt(i);
+        for(int k = 0; k < parts.size(); ++k)
+            e->lines.insert(i + k, forward ? parts.at(k) : parts.at(parts.size() - 1 - k));
+    }
+    setDirty(true);
+}
+
+/*!
+ \brief 保存面的网格，之前的网格被释放
+
+ \param m
+*/
+void PF_Face::setMesh(CMesh *m)
 {
+    if(mesh){
+        free(mesh->nodes);
+        free(mesh->eles);
+        delete mesh;
+    }
+    mesh = m;
+}
+
+/*!
+ \brief 面没有网格，或者面、面的线段和端点在上一次分网之后改变过
 
+ \return bool
+*/
+bool PF_Face::isMeshDirty() const
+{
+    if(!mesh || isDirty())
+        return true;
+    for(auto l : data.faceData){
+        for(auto line : l->lines){
+            if(line->isDirty() || line->data.startpoint->isDirty() ||
+                    line->data.endpoint->isDirty())
+                return true;
+        }
+    }
+    return false;
+}
+
+void PF_Face::clearMeshDirty()
+{
+    setDirty(false);
+    for(auto l : data.faceData){
+        for(auto line : l->lines){
+            line->setDirty(false);
+            line->data.startpoint->setDirty(false);
+            line->data.endpoint->setDirty(false);
+        }
+    }
+}
+
+void PF_Face::calculateBorders()
+{
+    resetBorders();
+    for(auto& loop : getLoops()){
+        for(auto& pos : loop){
+            minV = PF_Vector::minimum(minV, PF_Vector(pos.x(), pos.y()));
+            maxV = PF_Vector::maximum(maxV, PF_Vector(pos.x(), pos.y()));
+        }
+    }
 }
 
 /*!
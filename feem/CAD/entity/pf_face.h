@@ -6,6 +6,7 @@
 class QPainterPath;
 class QPolygonF;
 class PF_Line;
+typedef struct _CMesh CMesh;
 /*!
  \brief 保存闭合的曲线数据
 
@@ -49,7 +50,7 @@ public:
     PF_Face()=default;
     PF_Face(PF_EntityContainer* parent, PF_GraphicView* view, const PF_FaceData &d);
     PF_Face(PF_EntityContainer* parent, PF_GraphicView* view, const PF_FaceData &d,PF_Line* mouse);
-    ~PF_Face()=default;
+    ~PF_Face() override;
 
     /**	@return PF::EntityFace */
     PF::EntityType rtti() const override{
@@ -95,10 +96,25 @@ public:
     QString toGeoString() override;
     int index() const override;
 
+    const PF_FaceData& getData() const {return data;}
+    QList<QPolygonF> getLoops() const;
+    void replaceLine(PF_Line* line, const QList<PF_Line*>& parts);
+    /** 分网尺寸，<=0时由分网程序自动选取 **/
+    double getMeshSize() const {return meshSize;}
+    void setMeshSize(double size) {meshSize = size;setDirty(true);}
+
+    /** 面自己的网格，用于增量分网 **/
+    CMesh* getMesh() const {return mesh;}
+    void setMesh(CMesh* m);
+    bool isMeshDirty() const;
+    void clearMeshDirty();
+
     static int face_index;
 protected:
     PF_FaceData data;
     int m_index;
+    double meshSize = 0;
+    CMesh* mesh = nullptr;
 };
 
 #endif // PF_FACE_H
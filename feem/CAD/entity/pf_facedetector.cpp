@@ -0,0 +1,399 @@
+#include "pf_facedetector.h"
+#include "pf_line.h"
+
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+
+/** 面积小于这个值的曲线看作退化的曲线 **/
+static const double minArea = 1e-14;
+
+PF_FaceDetector::PF_FaceDetector(const QList<PF_Entity *> &entities)
+    :entities(entities)
+    ,walkCount(0)
+    ,loopCount(0)
+    ,valid(false)
+    ,resultValid(false)
+{
+
+}
+
+void PF_FaceDetector::clear()
+{
+    edges.clear();
+    freeEdges.clear();
+    vertices.clear();
+    vertexIndex.clear();
+    lineEdge.clear();
+    walks.clear();
+    loops.clear();
+    pending.clear();
+    changed.clear();
+    removed.clear();
+    result.clear();
+    valid = false;
+    resultValid = false;
+}
+
+void PF_FaceDetector::insert(PF_Entity *entity)
+{
+    if(valid && entity->rtti() == PF::EntityLine){
+        pending.append(static_cast<PF_Line*>(entity));
+        resultValid = false;
+    }
+}
+
+/*!
+ \brief 在实体删除之前调用，马上去掉对它的引用。
+
+ \param entity
+*/
+void PF_FaceDetector::remove(PF_Entity *entity)
+{
+    if(entity->rtti() == PF::EntityPoint){
+        /** 点删除之后不能再用它查找顶点 **/
+        clear();
+        return;
+    }
+    if(!valid || entity->rtti() != PF::EntityLine)
+        return;
+    PF_Line* line = static_cast<PF_Line*>(entity);
+    pending.removeAll(line);
+    changed.removeAll(line);
+    auto it = lineEdge.find(line);
+    if(it == lineEdge.end())
+        return;
+    int h = it.value();
+    lineEdge.erase(it);
+    edges[h].line = edges[h^1].line = nullptr;
+    removed.append(h);
+    resultValid = false;
+}
+
+void PF_FaceDetector::update(PF_Entity *entity)
+{
+    if(valid && entity->rtti() == PF::EntityLine){
+        changed.append(static_cast<PF_Line*>(entity));
+        resultValid = false;
+    }
+}
+
+void PF_FaceDetector::invalidate()
+{
+    valid = false;
+}
+
+const QList<PF_FaceDetector::Region> &PF_FaceDetector::regions() const
+{
+    ensureUpdated();
+    return result;
+}
+
+int PF_FaceDetector::regionAt(const PF_Vector &coord) const
+{
+    ensureUpdated();
+    QPointF p(coord.x, coord.y);
+    for(int i = 0; i < result.size(); ++i){
+        const Region& r = result.at(i);
+        if(coord.x < r.minx || coord.x > r.maxx || coord.y < r.miny || coord.y > r.maxy)
+            continue;
+        if(!r.polygons.first().containsPoint(p, Qt::OddEvenFill))
+            continue;
+        bool inHole = false;
+        for(int k = 1; k < r.polygons.size() && !inHole; ++k)
+            inHole = r.polygons.at(k).containsPoint(p, Qt::OddEvenFill);
+        if(!inHole)
+            return i;
+    }
+    return -1;
+}
+
+int PF_FaceDetector::addVertex(PF_Point *point) const
+{
+    auto it = vertexIndex.find(point);
+    if(it != vertexIndex.end())
+        return it.value();
+    Vertex v;
+    v.pos = point->getCenter();
+    vertices.append(v);
+    vertexIndex.insert(point, vertices.size()-1);
+    return vertices.size()-1;
+}
+
+/*!
+ \brief 加入直线的两条半边，sorted为true时按照角度插入出边中。
+
+ \param line
+ \param sorted
+ \return int 从起点出发的半边，退化的直线返回-1
+*/
+int PF_FaceDetector::addLine(PF_Line *line, bool sorted) const
+{
+    PF_Point* start = line->data.startpoint;
+    PF_Point* end = line->data.endpoint;
+    if(!start || !end || start == end || lineEdge.contains(line))
+        return -1;
+    PF_Vector d = end->getCenter() - start->getCenter();
+    if(d.magnitude() <= PF_TOLERANCE)
+        return -1;
+    int u = addVertex(start), v = addVertex(end);
+    int h;
+    if(!freeEdges.isEmpty()){
+        h = freeEdges.takeLast();
+    }else{
+        h = edges.size();
+        edges.resize(h+2);
+    }
+    edges[h] = {line, u, std::atan2(d.y, d.x), -1, -1};
+    edges[h^1] = {line, v, std::atan2(-d.y, -d.x), -1, -1};
+    lineEdge.insert(line, h);
+
+    for(int e : {h, h^1}){
+        QVector<int>& out = vertices[edges.at(e).origin].out;
+        if(sorted)
+            out.insert(std::lower_bound(out.begin(), out.end(), e, [this](int a, int b){
+                return before(a, b);
+            }) - out.begin(), e);
+        else
+            out.append(e);
+    }
+    return h;
+}
+
+/*!
+ \brief 同一点上出边的逆时针次序。重合的直线在两个端点上按照相反的
+ 次序排列，走出的环才不会交叉。
+
+ \param a
+ \param b
+ \return bool
+*/
+bool PF_FaceDetector::before(int a, int b) const
+{
+    if(edges.at(a).angle != edges.at(b).angle)
+        return edges.at(a).angle < edges.at(b).angle;
+    if(edges.at(a).origin < edges.at(a^1).origin)
+        return (a>>1) < (b>>1);
+    return (a>>1) > (b>>1);
+}
+
+/*!
+ \brief 沿着半边的左侧前进：在终点上取反向半边顺时针方向的下一条出边。
+
+ \param h
+ \return int
+*/
+int PF_FaceDetector::next(int h) const
+{
+    const QVector<int>& out = vertices.at(edges.at(h^1).origin).out;
+    int k = out.indexOf(h^1);
+    return out.at(k == 0 ? out.size()-1 : k-1);
+}
+
+/*!
+ \brief 去掉一个环及其闭合曲线，环上的半边放入seeds以便重新计算。
+
+ \param walk
+ \param seeds
+*/
+void PF_FaceDetector::kill(int walk, QVector<int> &seeds) const
+{
+    auto it = walks.find(walk);
+    if(it == walks.end())
+        return;
+    for(int h : it.value().edges){
+        edges[h].walk = -1;
+        edges[h].loop = -1;
+        seeds.append(h);
+    }
+    for(int id : it.value().loops)
+        loops.remove(id);
+    walks.erase(it);
+}
+
+/*!
+ \brief 从半边h出发走一圈。环上两条半边都出现的直线是桥，桥的两条半边
+ 像括号一样成对出现，去掉之后括号内外各自是闭合的曲线。
+
+ \param h
+*/
+void PF_FaceDetector::trace(int h) const
+{
+    int id = walkCount++;
+    Walk& walk = walks[id];
+    int e = h;
+    do{
+        edges[e].walk = id;
+        walk.edges.append(e);
+        e = next(e);
+    }while(e != h);
+
+    QVector<QVector<int> > stack(1);
+    QSet<int> open;
+    for(int k : walk.edges){
+        if(edges.at(k^1).walk != id){
+            stack.last().append(k);
+        }else if(open.contains(k^1)){
+            addLoop(walk, stack.takeLast());
+        }else{
+            open.insert(k);
+            stack.append(QVector<int>());
+        }
+    }
+    addLoop(walk, stack.first());
+}
+
+void PF_FaceDetector::addLoop(Walk &walk, const QVector<int> &list) const
+{
+    if(list.isEmpty())
+        return;
+    Loop loop;
+    loop.id = loopCount++;
+    loop.vertex = edges.at(list.first()).origin;
+    loop.area = 0;
+    loop.minx = loop.miny = PF_MAXDOUBLE;
+    loop.maxx = loop.maxy = -PF_MAXDOUBLE;
+    for(int e : list){
+        const PF_Vector& p = vertices.at(edges.at(e).origin).pos;
+        const PF_Vector& q = vertices.at(edges.at(e^1).origin).pos;
+        edges[e].loop = loop.id;
+        loop.lines.append(edges.at(e).line);
+        loop.polygon.append(QPointF(p.x, p.y));
+        loop.area += (p.x*q.y - q.x*p.y)/2;
+        loop.minx = std::min(loop.minx, p.x); loop.maxx = std::max(loop.maxx, p.x);
+        loop.miny = std::min(loop.miny, p.y); loop.maxy = std::max(loop.maxy, p.y);
+    }
+    loops.insert(loop.id, loop);
+    walk.loops.append(loop.id);
+}
+
+/*!
+ \brief 把顺时针的曲线作为孔放入包含它的最小区域。经过孔上的一个点的
+ 曲线属于同一块图形，不会包含这个孔，其余的用这个点判断包含关系。
+
+*/
+void PF_FaceDetector::collect() const
+{
+    QList<const Loop*> faces, holes;
+    for(auto it = loops.begin(); it != loops.end(); ++it){
+        if(it.value().area > minArea)
+            faces.append(&it.value());
+        else if(it.value().area < -minArea)
+            holes.append(&it.value());
+    }
+    std::sort(faces.begin(), faces.end(), [](const Loop* a, const Loop* b){
+        return a->area < b->area || (a->area == b->area && a->id < b->id);
+    });
+
+    result.clear();
+    for(auto f : faces){
+        Region r;
+        r.loops.append(f->lines);
+        r.polygons.append(f->polygon);
+        r.area = f->area;
+        r.minx = f->minx; r.miny = f->miny;
+        r.maxx = f->maxx; r.maxy = f->maxy;
+        result.append(r);
+    }
+    for(auto h : holes){
+        QSet<int> touching;
+        for(int e : vertices.at(h->vertex).out)
+            touching.insert(edges.at(e).loop);
+        const QPointF& p = h->polygon.first();
+        for(int i = 0; i < faces.size(); ++i){
+            const Loop* f = faces.at(i);
+            if(f->area < -h->area || touching.contains(f->id)
+                    || h->minx < f->minx || h->maxx > f->maxx
+                    || h->miny < f->miny || h->maxy > f->maxy)
+                continue;
+            if(!f->polygon.containsPoint(p, Qt::OddEvenFill))
+                continue;
+            Region& r = result[i];
+            r.loops.append(h->lines);
+            r.polygons.append(h->polygon);
+            r.area += h->area;
+            break;
+        }
+    }
+    resultValid = true;
+}
+
+void PF_FaceDetector::rebuild() const
+{
+    const_cast<PF_FaceDetector*>(this)->clear();
+    for(auto e : entities){
+        if(e->rtti() == PF::EntityLine)
+            addLine(static_cast<PF_Line*>(e), false);
+    }
+    for(auto& v : vertices){
+        std::sort(v.out.begin(), v.out.end(), [this](int a, int b){
+            return before(a, b);
+        });
+    }
+    for(int h = 0; h < edges.size(); ++h){
+        if(edges.at(h).walk < 0)
+            trace(h);
+    }
+    valid = true;
+}
+
+/*!
+ \brief 改变的直线较少时只重新计算经过其端点的环，否则全部重新计算。
+
+*/
+void PF_FaceDetector::ensureUpdated() const
+{
+    if(!valid || pending.size() + changed.size() + removed.size() > 16 + lineEdge.size()/8){
+        rebuild();
+        collect();
+        return;
+    }
+    if(pending.isEmpty() && changed.isEmpty() && removed.isEmpty()){
+        if(!resultValid)
+            collect();
+        return;
+    }
+
+    /** 形状改变的直线先删除再加入 **/
+    for(auto l : changed){
+        auto it = lineEdge.find(l);
+        if(it != lineEdge.end()){
+            removed.append(it.value());
+            lineEdge.erase(it);
+        }
+        if(!pending.contains(l))
+            pending.append(l);
+    }
+    changed.clear();
+
+    QVector<int> seeds;
+    for(int h : removed){
+        kill(edges.at(h).walk, seeds);
+        kill(edges.at(h^1).walk, seeds);
+        for(int e : {h, h^1}){
+            edges[e].line = nullptr;
+            vertices[edges.at(e).origin].out.removeOne(e);
+        }
+        freeEdges.append(h);
+    }
+    removed.clear();
+    for(auto l : pending){
+        int h = addLine(l, true);
+        if(h < 0)
+            continue;
+        seeds.append(h);
+        seeds.append(h^1);
+        for(int e : {h, h^1}){
+            for(int o : vertices.at(edges.at(e).origin).out){
+                kill(edges.at(o).walk, seeds);
+                kill(edges.at(o^1).walk, seeds);
+            }
+        }
+    }
+    pending.clear();
+    for(int h : seeds){
+        if(edges.at(h).line && edges.at(h).walk < 0)
+            trace(h);
+    }
+    collect();
+}
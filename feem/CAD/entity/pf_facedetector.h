@@ -0,0 +1,106 @@
+#ifndef PF_FACEDETECTOR_H
+#define PF_FACEDETECTOR_H
+
+#include "pf_vector.h"
+
+#include <QHash>
+#include <QList>
+#include <QPolygonF>
+#include <QVector>
+
+class PF_Entity;
+class PF_Line;
+class PF_Point;
+
+/*!
+ \brief 从直线围成的平面图中找出所有有界的区域。直线只在端点处相连，
+ 即先在交点处打断。每个点上的出边按照角度排序，沿着每条半边的左侧
+ 走一圈得到一个环，两侧在同一个环中的直线是桥，去掉桥之后环分成
+ 若干闭合曲线，逆时针的是有界区域的外边界，顺时针的是一块图形的
+ 外轮廓，作为包含它的最小区域的孔。全部重新计算的代价为O(n log n)。
+
+ 加入或删除直线时只重新走一遍经过其端点的环。圆不能放入PF_LineLoop，
+ 所以不参与区域的划分。
+
+*/
+class PF_FaceDetector
+{
+public:
+    struct Region{
+        QList<QList<PF_Line*> > loops;/** 第一个是外边界，其余的是孔 **/
+        QList<QPolygonF> polygons;/** 与loops对应的多边形，模型坐标 **/
+        double area;/** 去掉孔之后的面积 **/
+        double minx, miny, maxx, maxy;
+    };
+
+    PF_FaceDetector(const QList<PF_Entity*>& entities);
+
+    void clear();
+    void insert(PF_Entity* entity);
+    void remove(PF_Entity* entity);
+    void update(PF_Entity* entity);
+    /** 下次查询前全部重新计算 **/
+    void invalidate();
+
+    /** 按照外边界的面积从小到大排列 **/
+    const QList<Region>& regions() const;
+    /** 包含coord的最小区域的编号，不在任何区域中时返回-1 **/
+    int regionAt(const PF_Vector& coord) const;
+
+private:
+    /** 半边h的反向半边为h^1 **/
+    struct HalfEdge{
+        PF_Line* line;
+        int origin;/** 起点的编号 **/
+        double angle;
+        int walk;/** 所在的环 **/
+        int loop;/** 所在的闭合曲线，桥为-1 **/
+    };
+    struct Vertex{
+        PF_Vector pos;
+        QVector<int> out;/** 出边按照角度逆时针排列 **/
+    };
+    struct Walk{
+        QVector<int> edges;
+        QVector<int> loops;
+    };
+    struct Loop{
+        int id;
+        int vertex;/** 曲线上的一个点 **/
+        QList<PF_Line*> lines;
+        QPolygonF polygon;
+        double area;/** 有向面积，逆时针为正 **/
+        double minx, miny, maxx, maxy;
+    };
+
+    int addVertex(PF_Point* point) const;
+    int addLine(PF_Line* line, bool sorted) const;
+    bool before(int a, int b) const;
+    int next(int h) const;
+    void kill(int walk, QVector<int>& seeds) const;
+    void trace(int h) const;
+    void addLoop(Walk& walk, const QVector<int>& list) const;
+    void collect() const;
+    void rebuild() const;
+    void ensureUpdated() const;
+
+    const QList<PF_Entity*>& entities;
+    /** 查询时按需计算，所以这些成员是mutable的 **/
+    mutable QVector<HalfEdge> edges;
+    mutable QVector<int> freeEdges;
+    mutable QVector<Vertex> vertices;
+    mutable QHash<PF_Point*,int> vertexIndex;
+    mutable QHash<PF_Line*,int> lineEdge;
+    mutable QHash<int,Walk> walks;
+    mutable QHash<int,Loop> loops;
+    mutable QList<PF_Line*> pending;/** 新加入的直线 **/
+    mutable QList<PF_Line*> changed;/** 形状改变的直线 **/
+    mutable QVector<int> removed;/** 删除的直线的半边 **/
+    mutable QList<Region> result;
+    mutable int walkCount;
+    mutable int loopCount;
+    mutable bool valid;
+    mutable bool resultValid;
+};
+
+#endif // PF_FACEDETECTOR_H
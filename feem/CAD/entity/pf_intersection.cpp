@@ -0,0 +1,324 @@
+#include "pf_intersection.h"
+#include "pf_entity.h"
+#include "pf_spatialindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+PF_Intersection::PF_Intersection(const QList<PF_Entity *> &entities, const PF_SpatialIndex &index)
+    :entities(entities)
+    ,index(index)
+    ,valid(false)
+{
+
+}
+
+void PF_Intersection::clear()
+{
+    table.clear();
+    dirty.clear();
+    valid = false;
+}
+
+void PF_Intersection::insert(PF_Entity *entity)
+{
+    if(valid && isCurve(entity))
+        dirty.append(entity);
+}
+
+/*!
+ \brief 在实体删除之前调用，马上去掉其他实体中指向它的交点。
+
+ \param entity
+*/
+void PF_Intersection::remove(PF_Entity *entity)
+{
+    dirty.removeAll(entity);
+    if(!valid)
+        return;
+    unlink(entity);
+    table.remove(entity);
+}
+
+void PF_Intersection::update(PF_Entity *entity)
+{
+    if(valid && isCurve(entity) && !dirty.contains(entity))
+        dirty.append(entity);
+}
+
+void PF_Intersection::invalidate()
+{
+    valid = false;
+}
+
+const QList<PF_Intersection::Crossing> &PF_Intersection::crossings(PF_Entity *entity) const
+{
+    static const QList<Crossing> none;
+    ensureUpdated();
+    auto it = table.constFind(entity);
+    if(it == table.constEnd())
+        return none;
+    return it.value();
+}
+
+bool PF_Intersection::isCurve(const PF_Entity *entity)
+{
+    return entity->rtti() == PF::EntityLine || entity->rtti() == PF::EntityCircle;
+}
+
+/*!
+ \brief 计算两条直线或圆的交点，其他实体不求交点。
+
+ \param e1
+ \param e2
+ \return PF_VectorSolutions
+*/
+PF_VectorSolutions PF_Intersection::intersect(const PF_Entity *e1, const PF_Entity *e2)
+{
+    PF_VectorSolutions ret;
+    if(e1->rtti() == PF::EntityCircle && e2->rtti() == PF::EntityLine)
+        std::swap(e1, e2);
+    const double tol = 1e-9;
+    if(e1->rtti() == PF::EntityLine && e2->rtti() == PF::EntityLine){
+        PF_Vector p = e1->getStartpoint(), r = e1->getEndpoint() - p;
+        PF_Vector q = e2->getStartpoint(), s = e2->getEndpoint() - q;
+        double rs = r.x*s.y - r.y*s.x;
+        if(fabs(rs) <= PF_TOLERANCE*r.magnitude()*s.magnitude())
+            return ret;/** 平行或者重合 **/
+        PF_Vector qp = q - p;
+        double t = (qp.x*s.y - qp.y*s.x)/rs;
+        double u = (qp.x*r.y - qp.y*r.x)/rs;
+        if(t >= -tol && t <= 1+tol && u >= -tol && u <= 1+tol)
+            ret.push_back(p + r*t);
+    }else if(e1->rtti() == PF::EntityLine && e2->rtti() == PF::EntityCircle){
+        PF_Vector p = e1->getStartpoint(), d = e1->getEndpoint() - p;
+        PF_Vector f = p - e2->getCenter();
+        double R = e2->getRadius();
+        double a = d.dotP(d), b = 2*f.dotP(d), c = f.dotP(f) - R*R;
+        double disc = b*b - 4*a*c;
+        if(a <= 0 || disc < 0)
+            return ret;
+        double sq = sqrt(disc);
+        for(double t : {(-b - sq)/(2*a), (-b + sq)/(2*a)}){
+            if(t >= -tol && t <= 1+tol)
+                ret.push_back(p + d*t);
+            if(sq == 0)
+                break;
+        }
+    }else if(e1->rtti() == PF::EntityCircle && e2->rtti() == PF::EntityCircle){
+        PF_Vector c1 = e1->getCenter(), c12 = e2->getCenter() - c1;
+        double r1 = e1->getRadius(), r2 = e2->getRadius();
+        double d = c12.magnitude();
+        if(d <= 0 || d > r1 + r2 || d < fabs(r1 - r2))
+            return ret;
+        double a = (r1*r1 - r2*r2 + d*d)/(2*d);
+        double h = sqrt(std::max(0.0, r1*r1 - a*a));
+        PF_Vector m = c1 + c12*(a/d);
+        PF_Vector perp(-c12.y*h/d, c12.x*h/d);
+        ret.push_back(m + perp);
+        if(h > 0)
+            ret.push_back(m - perp);
+    }
+    return ret;
+}
+
+PF_Intersection::Box PF_Intersection::box(PF_Entity *entity)
+{
+    entity->calculateBorders();
+    PF_Vector vmin = entity->getMin();
+    PF_Vector vmax = entity->getMax();
+    return {vmin.x, vmin.y, vmax.x, vmax.y};
+}
+
+/*!
+ \brief 找出所有相交的包围盒。扫描线从左向右经过包围盒的左右边界，
+ 在同一x坐标上先加入再删除，边界接触的包围盒也算相交。扫描线上的
+ 包围盒按照y区间放入线段树的节点，与新区间[a,b]重叠的区间要么包含a，
+ 从根节点走到a所在的叶节点就能找到；要么下端点在(a,b]之间，在按照
+ 下端点排序的集合中找到。两种情况没有重复。
+
+ \param boxes
+ \param pairs 相交的包围盒的编号
+*/
+void PF_Intersection::sweep(const QVector<Box> &boxes, QVector<QPair<int,int> > &pairs)
+{
+    int n = boxes.size();
+    if(n < 2)
+        return;
+    /** y坐标离散化 **/
+    std::vector<double> ys;
+    ys.reserve(2*n);
+    for(auto& b : boxes){
+        ys.push_back(b.miny);
+        ys.push_back(b.maxy);
+    }
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+    int m = int(ys.size());
+    auto yIndex = [&](double y){
+        return int(std::lower_bound(ys.begin(), ys.end(), y) - ys.begin());
+    };
+    std::vector<int> lo(n), hi(n);
+    for(int i = 0; i < n; ++i){
+        lo[i] = yIndex(boxes.at(i).miny);
+        hi[i] = yIndex(boxes.at(i).maxy);
+    }
+
+    /** 事件：x坐标相同时先加入(0)再删除(1) **/
+    std::vector<std::pair<std::pair<double,int>,int> > events;
+    events.reserve(2*n);
+    for(int i = 0; i < n; ++i){
+        events.push_back({{boxes.at(i).minx, 0}, i});
+        events.push_back({{boxes.at(i).maxx, 1}, i});
+    }
+    std::sort(events.begin(), events.end());
+
+    int size = 1;
+    while(size < m)
+        size <<= 1;
+    std::vector<std::vector<int> > nodes(2*size);/** 节点中的区间，删除的区间延迟清除 **/
+    std::vector<char> active(n, 0);
+    std::set<std::pair<int,int> > starts;/** (下端点, 编号) **/
+
+    for(auto& ev : events){
+        int i = ev.second;
+        if(ev.first.second == 1){
+            active[i] = 0;
+            starts.erase({lo[i], i});
+            continue;
+        }
+        /** 包含a的区间 **/
+        int a = lo[i], b = hi[i];
+        for(int node = 1, l = 0, r = size-1;;){
+            std::vector<int>& list = nodes[node];
+            for(size_t k = 0; k < list.size();){
+                if(!active[list[k]]){
+                    list[k] = list.back();
+                    list.pop_back();
+                    continue;
+                }
+                pairs.append(qMakePair(list[k], i));
+                ++k;
+            }
+            if(l == r)
+                break;
+            int mid = (l + r)/2;
+            if(a <= mid){
+                node = 2*node; r = mid;
+            }else{
+                node = 2*node+1; l = mid+1;
+            }
+        }
+        /** 下端点在(a,b]之间的区间 **/
+        for(auto it = starts.upper_bound({a, n}); it != starts.end() && it->first <= b; ++it)
+            pairs.append(qMakePair(it->second, i));
+
+        /** 把[a,b]放入线段树 **/
+        std::vector<std::pair<int,std::pair<int,int> > > stack{{1,{0,size-1}}};
+        while(!stack.empty()){
+            int node = stack.back().first;
+            int l = stack.back().second.first, r = stack.back().second.second;
+            stack.pop_back();
+            if(r < a || l > b)
+                continue;
+            if(a <= l && r <= b){
+                nodes[node].push_back(i);
+                continue;
+            }
+            int mid = (l + r)/2;
+            stack.push_back({2*node,{l,mid}});
+            stack.push_back({2*node+1,{mid+1,r}});
+        }
+        active[i] = 1;
+        starts.insert({a, i});
+    }
+}
+
+void PF_Intersection::add(PF_Entity *e1, PF_Entity *e2) const
+{
+    for(auto& v : intersect(e1, e2)){
+        if(!v.valid)
+            continue;
+        table[e1].append({e2, v});
+        table[e2].append({e1, v});
+    }
+}
+
+/*!
+ \brief 去掉其他实体中与entity的交点。
+
+ \param entity
+*/
+void PF_Intersection::unlink(PF_Entity *entity) const
+{
+    auto it = table.find(entity);
+    if(it == table.end())
+        return;
+    for(auto& c : it.value()){
+        auto other = table.find(c.other);
+        if(other == table.end())
+            continue;
+        QList<Crossing>& list = other.value();
+        for(int k = list.size()-1; k >= 0; --k)
+            if(list.at(k).other == entity)
+                list.removeAt(k);
+    }
+    it.value().clear();
+}
+
+void PF_Intersection::rebuild() const
+{
+    table.clear();
+    dirty.clear();
+    QVector<PF_Entity*> curves;
+    QVector<Box> boxes;
+    for(auto e : entities){
+        if(!isCurve(e))
+            continue;
+        curves.append(e);
+        boxes.append(box(e));
+    }
+    QVector<QPair<int,int> > pairs;
+    sweep(boxes, pairs);
+    for(auto& p : pairs)
+        add(curves.at(p.first), curves.at(p.second));
+    valid = true;
+}
+
+/*!
+ \brief 改变的实体较少时通过空间索引找到包围盒与它们相交的直线和圆，
+ 逐个重新求交点，否则全部重新扫描。
+
+*/
+void PF_Intersection::ensureUpdated() const
+{
+    if(!valid || dirty.size() > 16 + entities.size()/8){
+        rebuild();
+        return;
+    }
+    /** 先去掉所有改变的实体的旧交点，相互之间的交点才不会重复 **/
+    for(auto e : dirty)
+        unlink(e);
+    QList<PF_Entity*> changed;
+    changed.swap(dirty);
+    QHash<PF_Entity*,int> order;
+    for(int i = 0; i < changed.size(); ++i)
+        order.insert(changed.at(i), i);
+    for(int i = 0; i < changed.size(); ++i){
+        PF_Entity* entity = changed.at(i);
+        Box b = box(entity);
+        index.queryBox(b.minx, b.miny, b.maxx, b.maxy, [&](PF_Entity* e, unsigned){
+            if(e == entity || !isCurve(e))
+                return;
+            /** 两个都改变了的实体只在前一个处理时求交 **/
+            int j = order.value(e, -1);
+            if(j >= 0 && j < i)
+                return;
+            PF_Vector vmin = e->getMin(), vmax = e->getMax();
+            if(vmin.x > b.maxx || vmax.x < b.minx || vmin.y > b.maxy || vmax.y < b.miny)
+                return;
+            add(entity, e);
+        });
+    }
+}
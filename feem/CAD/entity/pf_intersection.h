@@ -0,0 +1,64 @@
+#ifndef PF_INTERSECTION_H
+#define PF_INTERSECTION_H
+
+#include "pf_vector.h"
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QVector>
+
+class PF_Entity;
+class PF_SpatialIndex;
+
+/*!
+ \brief 直线和圆之间的交点。全部重新计算时用扫描线找出包围盒相交的
+ 实体对：扫描线沿x方向经过包围盒的左右边界，扫描线上的实体按照y区间
+ 保存在线段树中，新的实体只与y区间重叠的实体比较，代价为O((n+k)log n)，
+ k为包围盒相交的实体对数，只有这些实体对才精确求交。
+ 每个实体的交点缓存起来，实体改变时只通过空间索引重新计算它自己的交点。
+
+*/
+class PF_Intersection
+{
+public:
+    struct Crossing{
+        PF_Entity* other;/** 相交的另一个实体 **/
+        PF_Vector pos;
+    };
+
+    PF_Intersection(const QList<PF_Entity*>& entities, const PF_SpatialIndex& index);
+
+    void clear();
+    void insert(PF_Entity* entity);
+    void remove(PF_Entity* entity);
+    void update(PF_Entity* entity);
+    /** 下次查询前全部重新计算 **/
+    void invalidate();
+
+    /** entity与其他直线和圆的交点 **/
+    const QList<Crossing>& crossings(PF_Entity* entity) const;
+
+    static bool isCurve(const PF_Entity* entity);
+    static PF_VectorSolutions intersect(const PF_Entity* e1, const PF_Entity* e2);
+
+private:
+    struct Box{
+        double minx, miny, maxx, maxy;
+    };
+    static Box box(PF_Entity* entity);
+    static void sweep(const QVector<Box>& boxes, QVector<QPair<int,int> >& pairs);
+    void add(PF_Entity* e1, PF_Entity* e2) const;
+    void unlink(PF_Entity* entity) const;
+    void rebuild() const;
+    void ensureUpdated() const;
+
+    const QList<PF_Entity*>& entities;
+    const PF_SpatialIndex& index;
+    /** 查询时按需计算，所以这些成员是mutable的 **/
+    mutable QHash<PF_Entity*,QList<Crossing> > table;
+    mutable QList<PF_Entity*> dirty;
+    mutable bool valid;
+};
+
+#endif // PF_INTERSECTION_H
@@ -3,6 +3,7 @@
 #include <QPainter>
 
 int PF_Line::line_index = 1;
+
 PF_Line::PF_Line(PF_EntityContainer *parent, PF_GraphicView *view, const PF_LineData &d)
     :PF_AtomicEntity(parent,view)
     ,data(d)
@@ -11,7 +12,6 @@ PF_Line::PF_Line(PF_EntityContainer *parent, PF_GraphicView *view, const PF_Line
 //    line_index++;
 }
 
-
 PF_Line::PF_Line(PF_EntityContainer* parent, PF_GraphicView *view, PF_Point *pStart, PF_Point *pEnd)
     :PF_AtomicEntity(parent,view)
 {
@@ -171,6 +171,7 @@ bool PF_Line::offset(const PF_Vector &coord, const double &distance)
 
 void PF_Line::move(const PF_Vector &offset)
 {
+    setDirty(true);
     //    RS_DEBUG->print("RS_Line::move1: sp: %f/%f, ep: %f/%f",
     //                    data.startpoint.x, data.startpoint.y,
     //                    data.endpoint.x, data.endpoint.y);
@@ -187,6 +188,7 @@ void PF_Line::move(const PF_Vector &offset)
 
 void PF_Line::rotate(const PF_Vector &center, const double &angle)
 {
+    setDirty(true);
     //    RS_DEBUG->print("RS_Line::rotate");
     //    RS_DEBUG->print("RS_Line::rotate1: sp: %f/%f, ep: %f/%f",
     //                    data.startpoint.x, data.startpoint.y,
@@ -203,6 +205,7 @@ void PF_Line::rotate(const PF_Vector &center, const double &angle)
 
 void PF_Line::rotate(const PF_Vector &center, const PF_Vector &angleVector)
 {
+    setDirty(true);
     data.startpoint->getCenter().rotate(center, angleVector);
     data.endpoint->getCenter().rotate(center, angleVector);
     calculateBorders();
@@ -210,6 +213,7 @@ void PF_Line::rotate(const PF_Vector &center, const PF_Vector &angleVector)
 
 void PF_Line::scale(const PF_Vector &factor)
 {
+    setDirty(true);
     //    RS_DEBUG->print("RS_Line::scale1: sp: %f/%f, ep: %f/%f",
     //                    data.startpoint.x, data.startpoint.y,
     //                    data.endpoint.x, data.endpoint.y);
@@ -223,6 +227,7 @@ void PF_Line::scale(const PF_Vector &factor)
 
 void PF_Line::scale(const PF_Vector &center, const PF_Vector &factor)
 {
+    setDirty(true);
     //    RS_DEBUG->print("RS_Line::scale1: sp: %f/%f, ep: %f/%f",
     //                    data.startpoint.x, data.startpoint.y,
     //                    data.endpoint.x, data.endpoint.y);
@@ -236,6 +241,7 @@ void PF_Line::scale(const PF_Vector &center, const PF_Vector &factor)
 
 void PF_Line::mirror(const PF_Vector &axisPoint1, const PF_Vector &axisPoint2)
 {
+    setDirty(true);
     data.startpoint->getCenter().mirror(axisPoint1, axisPoint2);
     data.endpoint->getCenter().mirror(axisPoint1, axisPoint2);
     calculateBorders();
@@ -243,6 +249,7 @@ void PF_Line::mirror(const PF_Vector &axisPoint1, const PF_Vector &axisPoint2)
 
 void PF_Line::moveRef(const PF_Vector &ref, const PF_Vector &offset)
 {
+    setDirty(true);
 //    if(  fabs(data.startpoint.x -ref.x)<1.0e-4 &&
 //         fabs(data.startpoint.y -ref.y)<1.0e-4 ) {
 //        moveStartpoint(data.startpoint+offset);
@@ -279,26 +286,25 @@ void PF_Line::draw(QCPPainter *painter)
 
     /** 绘制控制点 **/
     if (isSelected() || isHighlighted()) {
-//		if (!e->isParentSelected()) {
-            PF_VectorSolutions const& s = this->getRefPoints();
-            double x,y;
-            int size = 4;
-            for (size_t i=0; i<s.getNumber(); ++i) {
-                x = mParentPlot->toGuiX(s.get(i).x);
-                y = mParentPlot->toGuiY(s.get(i).y);
-
-                painter->drawLine(QPointF(x-size,y-size),QPointF(x+size,y-size));
-                painter->drawLine(QPointF(x+size,y-size),QPointF(x+size,y+size));
-                painter->drawLine(QPointF(x+size,y+size),QPointF(x-size,y+size));
-                painter->drawLine(QPointF(x-size,y+size),QPointF(x-size,y-size));
-            }
-//		}
+        drawRefPoints(painter);
     }
 //    painter->setPen(oldpen);
 //    painter->setBrush(oldbursh);
     painter->restore();
 }
 
+bool PF_Line::batchLines(QVector<QLineF> &lines) const
+{
+    if(!mParentPlot || isSelected() || isHighlighted()){
+        return false;
+    }
+    QPointF start(mParentPlot->toGuiX(data.startpoint->getCenter().x),mParentPlot->toGuiY(data.startpoint->getCenter().y));
+    QPointF end(mParentPlot->toGuiX(data.endpoint->getCenter().x),mParentPlot->toGuiY(data.endpoint->getCenter().y));
+    /** 与QCPPainter::drawLine一样取整 **/
+    lines.append(QLineF(QLineF(start,end).toLine()));
+    return true;
+}
+
 void PF_Line::calculateBorders()
 {
     minV = PF_Vector::minimum(data.startpoint->getCenter(), data.endpoint->getCenter());
@@ -2,6 +2,7 @@
 #define PF_LINE_H
 
 #include "pf_atomicentity.h"
+#include "pf_entitypool.h"
 
 #include "pf_point.h"
 
@@ -13,7 +14,7 @@ struct PF_LineData{
     PF_Point* endpoint;
 };
 
-class PF_Line : public PF_AtomicEntity
+class PF_Line : public PF_AtomicEntity, public PF_PoolAllocated<PF_Line>
 {
 public:
     PF_Line()=default;
@@ -90,6 +91,7 @@ public:
     void moveRef(const PF_Vector& ref, const PF_Vector& offset) override;
 
     void draw(QCPPainter *painter) override;
+    bool batchLines(QVector<QLineF>& lines) const override;
 
     void calculateBorders() override;
 
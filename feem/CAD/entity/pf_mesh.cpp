@@ -0,0 +1,423 @@
+#include "pf_mesh.h"
+#include "pf_entitycontainer.h"
+#include "pf_graphicview.h"
+
+#include <QImage>
+#include <QLineF>
+#include <algorithm>
+#include <cmath>
+
+/** 边的平均长度不小于这么多像素时画出每条边 **/
+static const double minEdgePixels = 2;
+/** 边的平均长度不小于这么多像素时画出节点 **/
+static const double minNodePixels = 16;
+
+/** 坐标所在的网格，远在范围之外时也不会溢出 **/
+static int cellIndex(double v, double origin, double size, int n)
+{
+    return int(std::floor(qBound(-2.0, (v - origin)/size, n + 1.0)));
+}
+
+PF_Mesh::PF_Mesh(PF_EntityContainer *parent, PF_GraphicView *view, CMesh *mesh)
+    :PF_AtomicEntity(parent,view)
+    ,mesh(mesh)
+    ,avgLength(0)
+    ,ox(0)
+    ,oy(0)
+{
+    build();
+}
+
+PF_Mesh::~PF_Mesh()
+{
+    if(mesh){
+        free(mesh->nodes);
+        free(mesh->eles);
+        delete mesh;
+        mesh = nullptr;
+    }
+}
+
+/*!
+ \brief 提取三角形单元的边，去掉相邻单元的公共边，然后建立第0层
+ 网格和密度图。第0层网格的边长取边的平均长度，但网格总数不超过边数
+ 的4倍，疏密不均的网格也不会占用过多内存。
+
+*/
+void PF_Mesh::build()
+{
+    edges.clear();
+    cellStart.clear();
+    cellEdges.clear();
+    longEdges.clear();
+    levels.clear();
+    avgLength = 0;
+    calculateBorders();
+    if(!mesh || mesh->numNode <= 0)
+        return;
+
+    QVector<quint64> keys;
+    keys.reserve(3*mesh->numEle);
+    for(int i = 0;i < mesh->numEle;++i){
+        if(mesh->eles[i].ele_type != TRIANGLE_NODE3)
+            continue;
+        for(int k = 0;k < 3;++k){
+            quint32 a = quint32(mesh->eles[i].n[k]);
+            quint32 b = quint32(mesh->eles[i].n[(k+1)%3]);
+            if(a > b)
+                std::swap(a,b);
+            keys.append((quint64(a) << 32) | b);
+        }
+    }
+    std::sort(keys.begin(),keys.end());
+    keys.erase(std::unique(keys.begin(),keys.end()),keys.end());
+    if(keys.isEmpty())
+        return;
+    edges.reserve(2*keys.size());
+    QVector<double> lengths(keys.size());
+    for(int i = 0;i < keys.size();++i){
+        int a = int(keys.at(i) >> 32), b = int(keys.at(i) & 0xffffffff);
+        edges.append(a);
+        edges.append(b);
+        lengths[i] = std::hypot(mesh->nodes[b].x - mesh->nodes[a].x, mesh->nodes[b].y - mesh->nodes[a].y);
+        avgLength += lengths.at(i);
+    }
+    int n = keys.size();
+    avgLength /= n;
+
+    ox = minV.x;
+    oy = minV.y;
+    double w = maxV.x - minV.x, h = maxV.y - minV.y;
+    double size = std::max(avgLength, std::sqrt(w*h/(4.0*n)));
+    size = std::max(size, std::max(w,h)/4096);
+    if(size <= 0)
+        size = 1;
+    Level base;
+    base.nx = int(w/size) + 1;
+    base.ny = int(h/size) + 1;
+    base.size = size;
+    base.length.fill(0, base.nx*base.ny);
+
+    auto cellOf = [&](double x, double y){
+        int ix = qBound(0, int((x - ox)/size), base.nx-1);
+        int iy = qBound(0, int((y - oy)/size), base.ny-1);
+        return iy*base.nx + ix;
+    };
+    /** 按照中点计数排序放入网格，长边在每个网格中按照所占的长度累加 **/
+    cellStart.fill(0, base.nx*base.ny + 1);
+    QVector<int> cells(n);
+    for(int i = 0;i < n;++i){
+        const CNode& p = mesh->nodes[edges.at(2*i)];
+        const CNode& q = mesh->nodes[edges.at(2*i+1)];
+        int samples = std::max(1, int(std::ceil(lengths.at(i)/size)));
+        for(int k = 0;k < samples;++k){
+            double t = (k + 0.5)/samples;
+            base.length[cellOf(p.x + t*(q.x-p.x), p.y + t*(q.y-p.y))] += float(lengths.at(i)/samples);
+        }
+        if(lengths.at(i) > 2*size){
+            cells[i] = -1;
+            longEdges.append(i);
+            continue;
+        }
+        cells[i] = cellOf((p.x+q.x)/2, (p.y+q.y)/2);
+        ++cellStart[cells.at(i)+1];
+    }
+    for(int c = 0;c < base.nx*base.ny;++c)
+        cellStart[c+1] += cellStart.at(c);
+    cellEdges.resize(cellStart.last());
+    QVector<int> fill = cellStart;
+    for(int i = 0;i < n;++i){
+        if(cells.at(i) >= 0)
+            cellEdges[fill[cells.at(i)]++] = i;
+    }
+
+    levels.append(base);
+    while(levels.last().nx > 1 || levels.last().ny > 1){
+        const Level& fine = levels.last();
+        Level coarse;
+        coarse.nx = (fine.nx + 1)/2;
+        coarse.ny = (fine.ny + 1)/2;
+        coarse.size = fine.size*2;
+        coarse.length.fill(0, coarse.nx*coarse.ny);
+        for(int iy = 0;iy < fine.ny;++iy)
+            for(int ix = 0;ix < fine.nx;++ix)
+                coarse.length[(iy/2)*coarse.nx + ix/2] += fine.length.at(iy*fine.nx + ix);
+        levels.append(coarse);
+    }
+}
+
+PF_VectorSolutions PF_Mesh::getRefPoints() const
+{
+    return PF_VectorSolutions();
+}
+
+PF_Vector PF_Mesh::getMiddlePoint() const
+{
+    return PF_Vector(false);
+}
+
+PF_Vector PF_Mesh::getNearestEndpoint(const PF_Vector &coord, double *dist) const
+{
+    if(dist)
+        *dist = PF_MAXDOUBLE;
+    return PF_Vector(false);
+}
+
+PF_Vector PF_Mesh::getNearestPointOnEntity(const PF_Vector &coord, bool onEntity, double *dist, PF_Entity **entity) const
+{
+    if(dist)
+        *dist = PF_MAXDOUBLE;
+    return PF_Vector(false);
+}
+
+PF_Vector PF_Mesh::getNearestCenter(const PF_Vector &coord, double *dist) const
+{
+    if(dist)
+        *dist = PF_MAXDOUBLE;
+    return PF_Vector(false);
+}
+
+PF_Vector PF_Mesh::getNearestMiddle(const PF_Vector &coord, double *dist, int middlePoints) const
+{
+    if(dist)
+        *dist = PF_MAXDOUBLE;
+    return PF_Vector(false);
+}
+
+PF_Vector PF_Mesh::getNearestDist(double distance, const PF_Vector &coord, double *dist) const
+{
+    if(dist)
+        *dist = PF_MAXDOUBLE;
+    return PF_Vector(false);
+}
+
+void PF_Mesh::move(const PF_Vector &offset)
+{
+    setDirty(true);
+    for(int i = 0;mesh && i < mesh->numNode;++i){
+        mesh->nodes[i].x += offset.x;
+        mesh->nodes[i].y += offset.y;
+    }
+    build();
+}
+
+void PF_Mesh::rotate(const PF_Vector &center, const double &angle)
+{
+    rotate(center, PF_Vector(angle));
+}
+
+void PF_Mesh::rotate(const PF_Vector &center, const PF_Vector &angleVector)
+{
+    setDirty(true);
+    for(int i = 0;mesh && i < mesh->numNode;++i){
+        PF_Vector p(mesh->nodes[i].x, mesh->nodes[i].y);
+        p.rotate(center, angleVector);
+        mesh->nodes[i].x = p.x;
+        mesh->nodes[i].y = p.y;
+    }
+    build();
+}
+
+void PF_Mesh::scale(const PF_Vector &center, const PF_Vector &factor)
+{
+    setDirty(true);
+    for(int i = 0;mesh && i < mesh->numNode;++i){
+        PF_Vector p(mesh->nodes[i].x, mesh->nodes[i].y);
+        p.scale(center, factor);
+        mesh->nodes[i].x = p.x;
+        mesh->nodes[i].y = p.y;
+    }
+    build();
+}
+
+void PF_Mesh::mirror(const PF_Vector &axisPoint1, const PF_Vector &axisPoint2)
+{
+    setDirty(true);
+    for(int i = 0;mesh && i < mesh->numNode;++i){
+        PF_Vector p(mesh->nodes[i].x, mesh->nodes[i].y);
+        p.mirror(axisPoint1, axisPoint2);
+        mesh->nodes[i].x = p.x;
+        mesh->nodes[i].y = p.y;
+    }
+    build();
+}
+
+/*!
+ \brief 边在屏幕上足够长时画出可见的边，否则画密度图。
+
+ \param painter
+*/
+void PF_Mesh::draw(QCPPainter *painter)
+{
+    if(!(painter && mParentPlot) || edges.isEmpty()){
+        return;
+    }
+    QCPRange xr = mParentPlot->xAxis->range();
+    QCPRange yr = mParentPlot->yAxis->range();
+    /** 一个像素对应的模型长度 **/
+    double pixel = std::max(fabs(mParentPlot->toGraphDX(1)), fabs(mParentPlot->toGraphDY(1)));
+    if(!(pixel > 0))
+        return;
+    double x0 = xr.lower, x1 = xr.upper, y0 = yr.lower, y1 = yr.upper;
+    /** 分块绘制时只画所在的块 **/
+    if(painter->hasClipping()){
+        QRectF clip = painter->clipBoundingRect();
+        x0 = qMax(x0, mParentPlot->toGraphX(int(std::floor(clip.left()))));
+        x1 = qMin(x1, mParentPlot->toGraphX(int(std::ceil(clip.right()))));
+        y0 = qMax(y0, mParentPlot->toGraphY(int(std::ceil(clip.bottom()))));
+        y1 = qMin(y1, mParentPlot->toGraphY(int(std::floor(clip.top()))));
+        if(x0 > x1 || y0 > y1)
+            return;
+    }
+    painter->save();
+    if(avgLength >= minEdgePixels*pixel)
+        drawEdges(painter, pixel, x0, y0, x1, y1);
+    else
+        drawDensity(painter, pixel, x0, y0, x1, y1);
+    painter->restore();
+}
+
+/*!
+ \brief 短边的中点离可见区域不超过一个网格，只需要多查一圈网格。
+ 节点随每条可见的边画出，重复的节点画在同一个位置，这样绘制时不修改
+ 实体，可以在几个线程中同时进行。
+
+*/
+void PF_Mesh::drawEdges(QCPPainter *painter, double pixel, double x0, double y0, double x1, double y1)
+{
+    const Level& base = levels.first();
+    int ix0 = qMax(cellIndex(x0, ox, base.size, base.nx) - 1, 0);
+    int ix1 = qMin(cellIndex(x1, ox, base.size, base.nx) + 1, base.nx-1);
+    int iy0 = qMax(cellIndex(y0, oy, base.size, base.ny) - 1, 0);
+    int iy1 = qMin(cellIndex(y1, oy, base.size, base.ny) + 1, base.ny-1);
+
+    bool showNodes = avgLength >= minNodePixels*pixel;
+    QVector<QLineF> lines;
+    QVector<QRectF> nodes;
+    auto addNode = [&](int k){
+        double x = mParentPlot->toGuiX(mesh->nodes[k].x);
+        double y = mParentPlot->toGuiY(mesh->nodes[k].y);
+        nodes.append(QRectF(x-2, y-2, 4, 4));
+    };
+    auto addEdge = [&](int i){
+        int a = edges.at(2*i), b = edges.at(2*i+1);
+        const CNode& p = mesh->nodes[a];
+        const CNode& q = mesh->nodes[b];
+        if(std::max(p.x,q.x) < x0 || std::min(p.x,q.x) > x1 ||
+                std::max(p.y,q.y) < y0 || std::min(p.y,q.y) > y1)
+            return;
+        lines.append(QLineF(mParentPlot->toGuiX(p.x), mParentPlot->toGuiY(p.y),
+                            mParentPlot->toGuiX(q.x), mParentPlot->toGuiY(q.y)));
+        if(showNodes){
+            addNode(a);
+            addNode(b);
+        }
+    };
+    for(int iy = iy0;iy <= iy1;++iy)
+        for(int ix = ix0;ix <= ix1;++ix){
+            int c = iy*base.nx + ix;
+            for(int k = cellStart.at(c);k < cellStart.at(c+1);++k)
+                addEdge(cellEdges.at(k));
+        }
+    for(int i : longEdges)
+        addEdge(i);
+
+    painter->drawLines(lines);
+    if(!nodes.isEmpty()){
+        painter->setBrush(painter->pen().color());
+        painter->drawRects(nodes);
+    }
+}
+
+/*!
+ \brief 取网格不小于一个像素的最细的一层，可见的网格各对应图像中的
+ 一个像素。网格中边的总长度乘以线宽就是被覆盖的面积，除以网格面积
+ 得到覆盖率。
+
+*/
+void PF_Mesh::drawDensity(QCPPainter *painter, double pixel, double x0, double y0, double x1, double y1)
+{
+    int level = 0;
+    while(level+1 < levels.size() && levels.at(level).size < pixel)
+        ++level;
+    const Level& lv = levels.at(level);
+    int ix0 = qMax(cellIndex(x0, ox, lv.size, lv.nx), 0);
+    int ix1 = qMin(cellIndex(x1, ox, lv.size, lv.nx), lv.nx-1);
+    int iy0 = qMax(cellIndex(y0, oy, lv.size, lv.ny), 0);
+    int iy1 = qMin(cellIndex(y1, oy, lv.size, lv.ny), lv.ny-1);
+    if(ix0 > ix1 || iy0 > iy1)
+        return;
+
+    QColor color = painter->pen().color();
+    double width = qMax(painter->pen().widthF(), 1.0);
+    double ratio = width*pixel/(lv.size*lv.size);
+    QImage image(ix1-ix0+1, iy1-iy0+1, QImage::Format_ARGB32_Premultiplied);
+    /** 图像的第一行是y最大的一行网格 **/
+    for(int iy = iy0;iy <= iy1;++iy){
+        QRgb* row = reinterpret_cast<QRgb*>(image.scanLine(iy1-iy));
+        const float* length = lv.length.constData() + iy*lv.nx;
+        for(int ix = ix0;ix <= ix1;++ix){
+            int alpha = int(qMin(1.0, length[ix]*ratio)*color.alpha() + 0.5);
+            row[ix-ix0] = qPremultiply(qRgba(color.red(), color.green(), color.blue(), alpha));
+        }
+    }
+    QRectF target(QPointF(mParentPlot->toGuiX(ox + ix0*lv.size), mParentPlot->toGuiY(oy + (iy1+1)*lv.size)),
+                  QPointF(mParentPlot->toGuiX(ox + (ix1+1)*lv.size), mParentPlot->toGuiY(oy + iy0*lv.size)));
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    painter->drawImage(target, image);
+}
+
+void PF_Mesh::calculateBorders()
+{
+    minV = PF_Vector(PF_MAXDOUBLE, PF_MAXDOUBLE);
+    maxV = PF_Vector(-PF_MAXDOUBLE, -PF_MAXDOUBLE);
+    for(int i = 0;mesh && i < mesh->numNode;++i){
+        minV = PF_Vector::minimum(minV, PF_Vector(mesh->nodes[i].x, mesh->nodes[i].y));
+        maxV = PF_Vector::maximum(maxV, PF_Vector(mesh->nodes[i].x, mesh->nodes[i].y));
+    }
+    if(!mesh || mesh->numNode <= 0)
+        minV = maxV = PF_Vector(false);
+}
+
+QVector<QPolygonF> PF_Mesh::worstElements(int count, double maxQuality) const
+{
+    QVector<QPair<double,int> > bad;
+    for(int i = 0;mesh && i < mesh->numEle;++i){
+        if(mesh->eles[i].ele_type != TRIANGLE_NODE3)
+            continue;
+        const CNode& a = mesh->nodes[mesh->eles[i].n[0]];
+        const CNode& b = mesh->nodes[mesh->eles[i].n[1]];
+        const CNode& c = mesh->nodes[mesh->eles[i].n[2]];
+        double la = std::hypot(b.x-c.x,b.y-c.y);
+        double lb = std::hypot(c.x-a.x,c.y-a.y);
+        double lc = std::hypot(a.x-b.x,a.y-b.y);
+        double area = 0.5*((b.x-a.x)*(c.y-a.y) - (b.y-a.y)*(c.x-a.x));
+        double d = la*lb*lc*(la+lb+lc);
+        /** 2r/R = 16A^2/(P l1 l2 l3) **/
+        double q = (d > 0) ? 16*area*area/d : 0;
+        if(q < maxQuality)
+            bad.append(qMakePair(q,i));
+    }
+    count = qMin(count,bad.size());
+    std::partial_sort(bad.begin(),bad.begin()+count,bad.end());
+    QVector<QPolygonF> elements;
+    elements.reserve(count);
+    for(int k = 0;k < count;++k){
+        const CElement& e = mesh->eles[bad.at(k).second];
+        QPolygonF polygon;
+        for(int j = 0;j < 3;++j)
+            polygon.append(QPointF(mesh->nodes[e.n[j]].x,mesh->nodes[e.n[j]].y));
+        elements.append(polygon);
+    }
+    return elements;
+}
+
+QString PF_Mesh::toGeoString()
+{
+    return QString();
+}
+
+int PF_Mesh::index() const
+{
+    return 0;
+}
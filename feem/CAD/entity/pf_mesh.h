@@ -0,0 +1,92 @@
+#ifndef PF_MESH_H
+#define PF_MESH_H
+
+#include "pf_atomicentity.h"
+
+#include <QPolygonF>
+#include <QVector>
+
+typedef struct _CMesh CMesh;
+
+/*!
+ \brief 显示网格的实体，网格的所有边作为一个实体保存，不参与捕捉、
+ 求交和区域划分。边按照中点放入均匀网格，放大时只画可见网格中的边；
+ 边的平均长度小于几个像素时改为画边的密度图：每一层网格保存落在其中
+ 的边的总长度，上一层的网格边长加倍，绘制时选取网格不小于一个像素的
+ 那一层，每个网格的覆盖率作为一个像素的透明度。这样绘制的代价只与
+ 可见的像素数目有关，与网格的规模无关。
+
+*/
+class PF_Mesh : public PF_AtomicEntity
+{
+public:
+    /** 网格由实体接管，删除实体时释放 **/
+    PF_Mesh(PF_EntityContainer* parent, PF_GraphicView* view, CMesh* mesh);
+    ~PF_Mesh() override;
+
+    /**	@return PF::EntityMesh */
+    PF::EntityType rtti() const override{
+        return PF::EntityMesh;
+    }
+
+    /** 继承的虚函数 **/
+    PF_VectorSolutions getRefPoints() const override;
+
+    PF_Vector getMiddlePoint(void)const override;
+    PF_Vector getNearestEndpoint(const PF_Vector& coord,
+                                 double* dist = nullptr) const override;
+    PF_Vector getNearestPointOnEntity(const PF_Vector& coord,
+                                      bool onEntity = true, double* dist = nullptr, PF_Entity** entity=nullptr)const override;
+    PF_Vector getNearestCenter(const PF_Vector& coord,
+                               double* dist = nullptr)const override;
+    PF_Vector getNearestMiddle(const PF_Vector& coord,
+                               double* dist = nullptr,
+                               int middlePoints = 1 ) const override;
+    PF_Vector getNearestDist(double distance,
+                             const PF_Vector& coord,
+                             double* dist = nullptr)const override;
+
+    void move(const PF_Vector& offset) override;
+    void rotate(const PF_Vector& center, const double& angle) override;
+    void rotate(const PF_Vector& center, const PF_Vector& angleVector) override;
+    void scale(const PF_Vector& center, const PF_Vector& factor) override;
+    void mirror(const PF_Vector& axisPoint1, const PF_Vector& axisPoint2) override;
+
+    void draw(QCPPainter* painter) override;
+
+    void calculateBorders() override;
+
+    QString toGeoString() override;
+    int index() const override;
+
+    CMesh* getMesh() const {return mesh;}
+    int edgeCount() const {return edges.size()/2;}
+
+    /** 质量低于maxQuality的单元中最差的count个，最差的在前。质量是半径比
+     * 2r/R，正三角形为1，退化的三角形为0 **/
+    QVector<QPolygonF> worstElements(int count = 20, double maxQuality = 0.3) const;
+
+private:
+    /** 密度图的一层 **/
+    struct Level{
+        int nx, ny;
+        double size;/** 网格的边长 **/
+        QVector<float> length;/** 每个网格中边的总长度 **/
+    };
+
+    void build();
+    void drawEdges(QCPPainter* painter, double pixel, double x0, double y0, double x1, double y1);
+    void drawDensity(QCPPainter* painter, double pixel, double x0, double y0, double x1, double y1);
+
+    CMesh* mesh;
+    QVector<int> edges;/** 每条边两个节点的编号 **/
+    double avgLength;
+    /** 第0层网格，保存按照中点放入的边 **/
+    double ox, oy;
+    QVector<int> cellStart;
+    QVector<int> cellEdges;
+    QVector<int> longEdges;/** 超过两个网格长的边单独保存 **/
+    QVector<Level> levels;
+};
+
+#endif // PF_MESH_H
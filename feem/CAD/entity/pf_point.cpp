@@ -3,11 +3,26 @@
 #include <QPainter>
 
 int PF_Point::point_index = 1;
+
+/** 点的标记是以点为中心的实心方块，由几条水平线组成 **/
+static void appendMarker(QVector<QLineF>& lines, double x, double y)
+{
+    int width = 2;
+    for(int i = 0;i <= width*2;i++){
+        lines.append(QLineF(QLineF(x-width,y-width + i,x+width,y-width+i).toLine()));
+    }
+}
 PF_Point::PF_Point(PF_EntityContainer *parent, PF_GraphicView *view, const PF_PointData &d)
     :PF_AtomicEntity(parent,view)
-    ,data(d)
+    ,slot(PF_PointStore::instance().allocate(d.pos))
 {
     m_index = point_index;
+    calculateBorders();
+}
+
+PF_Point::~PF_Point()
+{
+    PF_PointStore::instance().release(slot);
 }
 
 PF::EntityType PF_Point::rtti() const
@@ -17,7 +32,7 @@ PF::EntityType PF_Point::rtti() const
 
 PF_Vector PF_Point::getCenter() const
 {
-    return data.pos;
+    return PF_PointStore::instance().get(slot);
 }
 
 double PF_Point::getRadius() const
@@ -27,50 +42,50 @@ double PF_Point::getRadius() const
 
 PF_VectorSolutions PF_Point::getRefPoints() const
 {
-    return PF_VectorSolutions{data.pos};
+    return PF_VectorSolutions{getCenter()};
 }
 
 PF_Vector PF_Point::getMiddlePoint() const
 {
-    return data.pos;
+    return getCenter();
 }
 
 PF_Vector PF_Point::getNearestEndpoint(const PF_Vector &coord, double *dist) const
 {
     if (dist) {
-        *dist = data.pos.distanceTo(coord);
+        *dist = getCenter().distanceTo(coord);
     }
 
-    return data.pos;
+    return getCenter();
 }
 
 PF_Vector PF_Point::getNearestPointOnEntity(const PF_Vector &coord, bool onEntity, double *dist, PF_Entity **entity) const
 {
     if (dist) {
-        *dist = data.pos.distanceTo(coord);
+        *dist = getCenter().distanceTo(coord);
     }
     if (entity) {
         *entity = const_cast<PF_Point*>(this);
     }
-    return data.pos;
+    return getCenter();
 }
 
 PF_Vector PF_Point::getNearestCenter(const PF_Vector &coord, double *dist) const
 {
     if (dist) {
-        *dist = data.pos.distanceTo(coord);
+        *dist = getCenter().distanceTo(coord);
     }
 
-    return data.pos;
+    return getCenter();
 }
 
 PF_Vector PF_Point::getNearestMiddle(const PF_Vector &coord, double *dist, int middlePoints) const
 {
     if (dist) {
-        *dist = data.pos.distanceTo(coord);
+        *dist = getCenter().distanceTo(coord);
     }
 
-    return data.pos;
+    return getCenter();
 }
 
 PF_Vector PF_Point::getNearestDist(double distance, const PF_Vector &coord, double *dist) const
@@ -93,31 +108,46 @@ PF_Vector PF_Point::getNearestDist(double distance, const PF_Vector &coord, doub
 
 void PF_Point::move(const PF_Vector &offset)
 {
-    data.pos.move(offset);
+    setDirty(true);
+    PF_Vector pos = getCenter();
+    pos.move(offset);
+    PF_PointStore::instance().set(slot, pos);
     calculateBorders();
 }
 
 void PF_Point::rotate(const PF_Vector &center, const double &angle)
 {
-    data.pos.rotate(center, angle);
+    setDirty(true);
+    PF_Vector pos = getCenter();
+    pos.rotate(center, angle);
+    PF_PointStore::instance().set(slot, pos);
     calculateBorders();
 }
 
 void PF_Point::rotate(const PF_Vector &center, const PF_Vector &angleVector)
 {
-    data.pos.rotate(center, angleVector);
+    setDirty(true);
+    PF_Vector pos = getCenter();
+    pos.rotate(center, angleVector);
+    PF_PointStore::instance().set(slot, pos);
     calculateBorders();
 }
 
 void PF_Point::scale(const PF_Vector &center, const PF_Vector &factor)
 {
-    data.pos.scale(center, factor);
+    setDirty(true);
+    PF_Vector pos = getCenter();
+    pos.scale(center, factor);
+    PF_PointStore::instance().set(slot, pos);
     calculateBorders();
 }
 
 void PF_Point::mirror(const PF_Vector &axisPoint1, const PF_Vector &axisPoint2)
 {
-    data.pos.mirror(axisPoint1, axisPoint2);
+    setDirty(true);
+    PF_Vector pos = getCenter();
+    pos.mirror(axisPoint1, axisPoint2);
+    PF_PointStore::instance().set(slot, pos);
     calculateBorders();
 }
 
@@ -131,9 +161,8 @@ void PF_Point::draw(QCPPainter *painter)
     if(!(painter && mParentPlot)){
         return;
     }
-    double x = mParentPlot->toGuiX(data.pos.x);
-    double y = mParentPlot->toGuiY(data.pos.y);
-    int width = 2;
+    double x = mParentPlot->toGuiX(getCenter().x);
+    double y = mParentPlot->toGuiY(getCenter().y);
     /** set Pen **/
 //    QPen oldpen = painter->pen();
 //    QBrush oldbursh = painter->brush();
@@ -142,47 +171,42 @@ void PF_Point::draw(QCPPainter *painter)
         pen.setColor(QColor(0,0,255));
         painter->setPen(pen);
     }
-    for(int i = 0;i <= width*2;i++){
-        painter->drawLine(QPointF(x-width,y-width + i),QPointF(x+width,y-width+i));
-//        qDebug()<<"line "<<i<<QPoint(x-width,y-width + i)<<QPoint(x+width,y-width+i);
-    }
+    QVector<QLineF> marker;
+    appendMarker(marker,x,y);
+    painter->drawLines(marker);
 //    painter->drawText(QPoint(x,y),toString());
     /** 绘制控制点 **/
     if (isSelected()) {
-//		if (!e->isParentSelected()) {
-            PF_VectorSolutions const& s = this->getRefPoints();
-            double x,y;
-            int size = 4;
-            for (size_t i=0; i<s.getNumber(); ++i) {
-                x = mParentPlot->toGuiX(s.get(i).x);
-                y = mParentPlot->toGuiY(s.get(i).y);
-
-                painter->drawLine(QPointF(x-size,y-size),QPointF(x+size,y-size));
-                painter->drawLine(QPointF(x+size,y-size),QPointF(x+size,y+size));
-                painter->drawLine(QPointF(x+size,y+size),QPointF(x-size,y+size));
-                painter->drawLine(QPointF(x-size,y+size),QPointF(x-size,y-size));
-            }
-//		}
+        drawRefPoints(painter);
     }
 //    painter->setPen(oldpen);
 //    painter->setBrush(oldbursh);
     painter->restore();
 }
 
+bool PF_Point::batchLines(QVector<QLineF> &lines) const
+{
+    if(!mParentPlot || isSelected()){
+        return false;
+    }
+    appendMarker(lines,mParentPlot->toGuiX(getCenter().x),mParentPlot->toGuiY(getCenter().y));
+    return true;
+}
+
 void PF_Point::calculateBorders()
 {
-    minV = maxV = data.pos;
+    minV = maxV = getCenter();
 }
 
 QString PF_Point::toString() const
 {
-    return data.pos.toString()+QString(" %1").arg(m_index);
+    return getCenter().toString()+QString(" %1").arg(m_index);
 }
 
 QString PF_Point::toGeoString()
 {
     //Point (11) = {0.032 *u, 0.031 *u, 0 *u, lc} ;
-    return QString("Point (%1) = {%2, %3, 0, 1e-1} ;").arg(m_index).arg(data.pos.x).arg(data.pos.y);
+    return QString("Point (%1) = {%2, %3, 0, 1e-1} ;").arg(m_index).arg(getCenter().x).arg(getCenter().y);
 }
 
 int PF_Point::index() const
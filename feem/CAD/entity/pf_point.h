@@ -2,6 +2,7 @@
 #define PF_POINT_H
 
 #include "pf_atomicentity.h"
+#include "pf_entitypool.h"
 
 //point data
 struct PF_PointData{
@@ -11,10 +12,11 @@ struct PF_PointData{
 };
 
 //point entity
-class PF_Point : public PF_AtomicEntity
+class PF_Point : public PF_AtomicEntity, public PF_PoolAllocated<PF_Point>
 {
 public:
     PF_Point(PF_EntityContainer* parent, PF_GraphicView* view, const PF_PointData & d);
+    ~PF_Point() override;
 
     /**	@return PF_ENTITY_POINT */
     PF::EntityType rtti() const override;
@@ -53,16 +55,19 @@ public:
 //    void moveRef(const PF_Vector& ref, const PF_Vector& offset) override;
 
     void draw(QCPPainter* painter) override;
+    bool batchLines(QVector<QLineF>& lines) const override;
 
     void calculateBorders() override;
 
     QString toString() const;
     QString toGeoString() override;
     int index() const override;
+    /** 坐标在PF_PointStore中的位置 **/
+    int getSlot() const {return slot;}
 public:
     static int point_index;
 protected:
-    PF_PointData data;
+    int slot;
     int m_index;
 };
 
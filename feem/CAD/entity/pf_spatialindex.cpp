@@ -0,0 +1,224 @@
+#include "pf_spatialindex.h"
+#include "pf_entity.h"
+
+/** 实体超过这么多个网格时不放入网格 **/
+static const int maxSpan = 16;
+
+PF_SpatialIndex::PF_SpatialIndex(const QList<PF_Entity *> &entities)
+    :entities(entities)
+    ,cellSize(1)
+    ,minIx(0),maxIx(-1),minIy(0),maxIy(-1)
+    ,builtCount(0)
+    ,builtLarge(0)
+    ,serialCount(0)
+    ,valid(false)
+    ,stampCount(0)
+{
+
+}
+
+void PF_SpatialIndex::clear()
+{
+    entries.clear();
+    cells.clear();
+    large.clear();
+    pending.clear();
+    minIx = minIy = 0;
+    maxIx = maxIy = -1;
+    builtCount = 0;
+    builtLarge = 0;
+    serialCount = 0;
+    valid = false;
+}
+
+/*!
+ \brief 在实体加入列表之后调用。
+
+ \param entity
+*/
+void PF_SpatialIndex::insert(PF_Entity *entity)
+{
+    if(!valid)
+        return;
+    Entry entry = bounds(entity);
+    entry.serial = serialCount++;
+    place(entity, entry);
+    entries.insert(entity, entry);
+}
+
+/*!
+ \brief 在实体移出列表之后调用。
+
+ \param entity
+*/
+void PF_SpatialIndex::remove(PF_Entity *entity)
+{
+    auto it = entries.find(entity);
+    if(it == entries.end())
+        return;
+    if(valid)
+        unplace(entity, it.value());
+    entries.erase(it);
+}
+
+/*!
+ \brief 实体的形状改变时调用。修改函数可能在改变形状之前通知，
+ 所以只做标记，在下次查询前按照新的包围盒重新放置。
+
+ \param entity
+*/
+void PF_SpatialIndex::update(PF_Entity *entity)
+{
+    if(!valid)
+        return;
+    auto it = entries.find(entity);
+    if(it == entries.end() || it.value().pending)
+        return;
+    it.value().pending = true;
+    pending.append(entity);
+}
+
+void PF_SpatialIndex::invalidate()
+{
+    valid = false;
+}
+
+PF_SpatialIndex::Entry PF_SpatialIndex::bounds(PF_Entity *entity) const
+{
+    entity->calculateBorders();
+    PF_Vector vmin = entity->getMin();
+    PF_Vector vmax = entity->getMax();
+    Entry entry;
+    entry.minx = vmin.x;
+    entry.miny = vmin.y;
+    entry.maxx = vmax.x;
+    entry.maxy = vmax.y;
+    entry.serial = 0;
+    entry.pending = false;
+    entry.stamp = 0;
+    /** 没有包围盒的实体每次都要访问 **/
+    entry.large = !vmin.valid || !vmax.valid
+            || !(entry.minx <= entry.maxx) || !(entry.miny <= entry.maxy)
+            || entry.minx < -PF_MAXDOUBLE || entry.maxx > PF_MAXDOUBLE
+            || entry.miny < -PF_MAXDOUBLE || entry.maxy > PF_MAXDOUBLE;
+    return entry;
+}
+
+void PF_SpatialIndex::place(PF_Entity *entity, Entry &entry)
+{
+    if(!entry.large){
+        int ix0 = cell(entry.minx), ix1 = cell(entry.maxx);
+        int iy0 = cell(entry.miny), iy1 = cell(entry.maxy);
+        if(ix1 - ix0 >= maxSpan || iy1 - iy0 >= maxSpan){
+            entry.large = true;
+        }else{
+            for(int ix = ix0; ix <= ix1; ++ix)
+                for(int iy = iy0; iy <= iy1; ++iy)
+                    cells[key(ix,iy)].append(entity);
+            if(minIx > maxIx){
+                minIx = ix0; maxIx = ix1;
+                minIy = iy0; maxIy = iy1;
+            }else{
+                minIx = qMin(minIx,ix0); maxIx = qMax(maxIx,ix1);
+                minIy = qMin(minIy,iy0); maxIy = qMax(maxIy,iy1);
+            }
+            return;
+        }
+    }
+    large.append(entity);
+}
+
+void PF_SpatialIndex::unplace(PF_Entity *entity, const Entry &entry)
+{
+    if(entry.large){
+        large.removeOne(entity);
+        return;
+    }
+    int ix0 = cell(entry.minx), ix1 = cell(entry.maxx);
+    int iy0 = cell(entry.miny), iy1 = cell(entry.maxy);
+    for(int ix = ix0; ix <= ix1; ++ix)
+        for(int iy = iy0; iy <= iy1; ++iy){
+            auto it = cells.find(key(ix,iy));
+            if(it == cells.end())
+                continue;
+            it.value().removeOne(entity);
+            if(it.value().isEmpty())
+                cells.erase(it);
+        }
+}
+
+/*!
+ \brief 按照实体的平均密度选取网格尺寸，每个网格平均一两个实体。
+
+*/
+void PF_SpatialIndex::rebuild() const
+{
+    PF_SpatialIndex* self = const_cast<PF_SpatialIndex*>(this);
+    entries.clear();
+    cells.clear();
+    large.clear();
+    pending.clear();
+    minIx = minIy = 0;
+    maxIx = maxIy = -1;
+
+    QVector<Entry> list;
+    list.reserve(entities.size());
+    double x0 = PF_MAXDOUBLE, y0 = PF_MAXDOUBLE;
+    double x1 = -PF_MAXDOUBLE, y1 = -PF_MAXDOUBLE;
+    int n = 0;
+    for(auto e : entities){
+        list.append(bounds(e));
+        const Entry& entry = list.last();
+        if(entry.large)
+            continue;
+        x0 = qMin(x0,entry.minx); x1 = qMax(x1,entry.maxx);
+        y0 = qMin(y0,entry.miny); y1 = qMax(y1,entry.maxy);
+        ++n;
+    }
+    cellSize = 1;
+    if(n > 0){
+        double w = x1 - x0, h = y1 - y0;
+        if(w > 0 && h > 0)
+            cellSize = 1.5*std::sqrt(w*h/n);
+        else if(qMax(w,h) > 0)
+            cellSize = qMax(w,h)/n;
+    }
+
+    for(int i = 0; i < entities.size(); ++i){
+        Entry& entry = list[i];
+        entry.serial = unsigned(i);
+        self->place(entities.at(i), entry);
+        entries.insert(entities.at(i), entry);
+    }
+    serialCount = unsigned(entities.size());
+    builtCount = entities.size();
+    builtLarge = large.size();
+    valid = true;
+}
+
+/*!
+ \brief 实体数目增减较多或者过多实体不在网格中时重新划分网格，
+ 否则只重新放置形状改变了的实体。
+
+*/
+void PF_SpatialIndex::ensureBuilt() const
+{
+    int n = entries.size();
+    if(!valid || n > 2*builtCount + 64 || 4*n < builtCount
+            || large.size() > 2*builtLarge + 64){
+        rebuild();
+        return;
+    }
+    PF_SpatialIndex* self = const_cast<PF_SpatialIndex*>(this);
+    for(auto e : pending){
+        auto it = entries.find(e);
+        if(it == entries.end() || !it.value().pending)
+            continue;
+        Entry entry = bounds(e);
+        entry.serial = it.value().serial;
+        self->unplace(e, it.value());
+        self->place(e, entry);
+        it.value() = entry;
+    }
+    pending.clear();
+}
@@ -0,0 +1,158 @@
+#ifndef PF_SPATIALINDEX_H
+#define PF_SPATIALINDEX_H
+
+#include "pf.h"
+#include "pf_vector.h"
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <cmath>
+
+class PF_Entity;
+
+/*!
+ \brief 实体的空间索引，采用散列的均匀网格。每个实体按照包围盒放入
+ 覆盖的网格中，包围盒过大的实体单独保存。最近实体的查询从所在网格
+ 一圈一圈向外搜索，剩下的网格都比已找到的距离远时停止，查询的代价
+ 只与附近的实体数目有关。实体的数目变化较大时按照新的密度重新划分
+ 网格。
+
+*/
+class PF_SpatialIndex
+{
+public:
+    PF_SpatialIndex(const QList<PF_Entity*>& entities);
+
+    void clear();
+    void insert(PF_Entity* entity);
+    void remove(PF_Entity* entity);
+    void update(PF_Entity* entity);
+    /** 下次查询前整体重建 **/
+    void invalidate();
+
+    /*!
+     \brief 由近及远访问coord附近的实体。visit(entity,serial)返回目前
+     找到的最小距离，剩下的实体的包围盒都比这个距离远时停止。实体返回
+     的距离不能小于coord到其包围盒的距离。serial随实体在列表中的位置
+     增大，距离相同时可以用来优先选择后加入的实体。
+
+    */
+    template<typename Visitor>
+    void query(const PF_Vector& coord, Visitor visit) const;
+    /** 访问包围盒可能与给定区域相交的实体，每个实体只访问一次，
+        visit(entity,serial)的serial与query相同 **/
+    template<typename Visitor>
+    void queryBox(double minx, double miny, double maxx, double maxy, Visitor visit) const;
+
+private:
+    struct Entry{
+        double minx, miny, maxx, maxy;
+        unsigned serial;
+        bool large;
+        bool pending;/** 形状已改变，尚未重新放置 **/
+        mutable unsigned stamp;
+    };
+
+    static qint64 key(int ix, int iy){
+        return qint64((quint64(quint32(ix)) << 32) | quint32(iy));
+    }
+    int cell(double v) const{
+        return int(qBound(-1e9, std::floor(v/cellSize), 1e9));
+    }
+    Entry bounds(PF_Entity* entity) const;
+    void place(PF_Entity* entity, Entry& entry);
+    void unplace(PF_Entity* entity, const Entry& entry);
+    void rebuild() const;
+    void ensureBuilt() const;
+
+    const QList<PF_Entity*>& entities;
+    /** 查询时按需重建，所以这些成员是mutable的 **/
+    mutable QHash<PF_Entity*,Entry> entries;
+    mutable QHash<qint64,QVector<PF_Entity*> > cells;
+    mutable QVector<PF_Entity*> large;
+    mutable QVector<PF_Entity*> pending;
+    mutable double cellSize;
+    mutable int minIx, maxIx, minIy, maxIy;
+    mutable int builtCount;
+    mutable int builtLarge;
+    mutable unsigned serialCount;
+    mutable bool valid;
+    mutable unsigned stampCount;
+};
+
+template<typename Visitor>
+void PF_SpatialIndex::query(const PF_Vector& coord, Visitor visit) const
+{
+    ensureBuilt();
+    ++stampCount;
+    double best = PF_MAXDOUBLE;
+    for(auto e : large)
+        best = visit(e, entries[e].serial);
+    if(cells.isEmpty())
+        return;
+
+    int cx = cell(coord.x), cy = cell(coord.y);
+    /** 从与已有网格范围相交的第一圈开始 **/
+    int r0 = qMax(qMax(minIx - cx, cx - maxIx), qMax(minIy - cy, cy - maxIy));
+    int r1 = qMax(qMax(cx - minIx, maxIx - cx), qMax(cy - minIy, maxIy - cy));
+    auto visitCell = [&](int ix, int iy){
+        auto it = cells.constFind(key(ix,iy));
+        if(it == cells.constEnd())
+            return;
+        const QVector<PF_Entity*>& list = it.value();
+        for(auto en : list){
+            const Entry& e = entries[en];
+            if(e.stamp == stampCount)
+                continue;
+            e.stamp = stampCount;
+            best = visit(en, e.serial);
+        }
+    };
+    for(int r = qMax(r0,0); r <= r1; ++r){
+        /** 第r圈的网格到coord的距离不小于(r-1)*cellSize，
+            距离相同的实体也要访问到 **/
+        if(r > 0 && best < (r-1)*cellSize)
+            break;
+        int x0 = qMax(cx-r,minIx), x1 = qMin(cx+r,maxIx);
+        int y0 = qMax(cy-r,minIy), y1 = qMin(cy+r,maxIy);
+        if(cy-r >= minIy)
+            for(int ix = x0; ix <= x1; ++ix)
+                visitCell(ix, cy-r);
+        if(r > 0 && cy+r <= maxIy)
+            for(int ix = x0; ix <= x1; ++ix)
+                visitCell(ix, cy+r);
+        if(cx-r >= minIx)
+            for(int iy = qMax(y0,cy-r+1); iy <= qMin(y1,cy+r-1); ++iy)
+                visitCell(cx-r, iy);
+        if(r > 0 && cx+r <= maxIx)
+            for(int iy = qMax(y0,cy-r+1); iy <= qMin(y1,cy+r-1); ++iy)
+                visitCell(cx+r, iy);
+    }
+}
+
+template<typename Visitor>
+void PF_SpatialIndex::queryBox(double minx, double miny, double maxx, double maxy, Visitor visit) const
+{
+    ensureBuilt();
+    ++stampCount;
+    for(auto e : large)
+        visit(e, entries[e].serial);
+    int ix0 = qMax(cell(minx),minIx), ix1 = qMin(cell(maxx),maxIx);
+    int iy0 = qMax(cell(miny),minIy), iy1 = qMin(cell(maxy),maxIy);
+    for(int ix = ix0; ix <= ix1; ++ix)
+        for(int iy = iy0; iy <= iy1; ++iy){
+            auto it = cells.constFind(key(ix,iy));
+            if(it == cells.constEnd())
+                continue;
+            for(auto en : it.value()){
+                const Entry& e = entries[en];
+                if(e.stamp == stampCount)
+                    continue;
+                e.stamp = stampCount;
+                visit(en, e.serial);
+            }
+        }
+}
+
+#endif // PF_SPATIALINDEX_H
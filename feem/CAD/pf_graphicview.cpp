@@ -6,6 +6,8 @@
 #include <QMouseEvent>
 #include <QDebug>
 #include <QGridLayout>
+#include <QImage>
+#include <QtConcurrent/QtConcurrentMap>
 
 #include "pf_actioninterface.h"
 #include "pf_eventhandler.h"
@@ -137,6 +139,7 @@ PF_GraphicView::PF_GraphicView(PF_Document *doc, QWidget *parent)
     mSelectionRectMode(QCP::srmNone),
     mSelectionRect(nullptr),
     mOpenGl(false),
+    mTiledRendering(true),
     mMouseHasMoved(false),
     mMouseEventLayerable(nullptr),
     mMouseSignalLayerable(nullptr),
@@ -185,6 +188,8 @@ PF_GraphicView::PF_GraphicView(PF_Document *doc, QWidget *parent)
     mLayers.append(new QCPLayer(this, QLatin1String("overlay")));
     updateLayerIndices();
     setCurrentLayer(QLatin1String("main"));
+    /** 实体画在单独的缓存中，只改变预览和捕捉点时不需要重画 **/
+    layer(QLatin1String("main"))->setMode(QCPLayer::lmBuffered);
     layer(QLatin1String("overlay"))->setMode(QCPLayer::lmBuffered);
 
     // create initial layout, axis rect and legend:
@@ -372,6 +377,42 @@ PF_EntityContainer *PF_GraphicView::getOverlayContainer(PF::OverlayGraphics posi
     return overlayEntities[position];
 }
 
+void PF_GraphicView::setHighlightedElements(const QVector<QPolygonF> &elements)
+{
+    highlightedElements = elements;
+    update();
+}
+
+void PF_GraphicView::clearHighlightedElements()
+{
+    if(highlightedElements.isEmpty()){
+        return;
+    }
+    highlightedElements.clear();
+    update();
+}
+
+/**高亮单元直接绘制在缓存之上，缩放和平移时不必重建缓存**/
+void PF_GraphicView::drawHighlightedElements(QCPPainter *painter)
+{
+    if(highlightedElements.isEmpty()){
+        return;
+    }
+    painter->save();
+    painter->setPen(QPen(QColor(255,0,0),2));
+    painter->setBrush(QColor(255,0,0,80));
+    QPolygonF polygon;
+    foreach (const QPolygonF &element, highlightedElements)
+    {
+        polygon.resize(element.size());
+        for(int i=0;i < element.size();++i){
+            polygon[i] = QPointF(toGuiX(element.at(i).x()),toGuiY(element.at(i).y()));
+        }
+        painter->drawPolygon(polygon);
+    }
+    painter->restore();
+}
+
 /**绘制坐标轴和网格**/
 //void PF_GraphicView::drawLayer1(QPainter * painter){
 //    int numgridw = 10;
@@ -503,6 +544,132 @@ void PF_GraphicView::drawEntity(QCPPainter *painter, PF_Entity *e)
     e->draw(painter);
 }
 
+/** 分块绘制时每块的边长（像素），实体少于minTiledEntities时直接绘制 **/
+static const int tileSize = 256;
+static const int minTiledEntities = 2000;
+
+/*!
+ \brief 按照次序绘制实体。打开分块绘制并且实体较多时，把坐标区域
+ 分成若干块，实体按照包围盒放入覆盖的块中，各块在线程池中画到单独的
+ 图像上，再由GUI线程依次拼起来。选中或高亮的实体绘制时会修改自己的
+ 画笔，最后在GUI线程中绘制。导出矢量图时不分块。
+
+ \param painter
+ \param entities
+*/
+void PF_GraphicView::drawEntities(QCPPainter *painter, const QVector<PF_Entity *> &entities)
+{
+    QCPAxisRect* rect = axisRect();
+    QRect area = rect ? rect->rect() : QRect();
+    int devType = painter->device() ? painter->device()->devType() : 0;
+    if(!mTiledRendering || entities.size() < minTiledEntities || area.isEmpty() ||
+            painter->modes().testFlag(QCPPainter::pmVectorized) ||
+            (devType != QInternal::Pixmap && devType != QInternal::Image)){
+        drawBatched(painter,entities);
+        return;
+    }
+
+    struct Tile{
+        QRect rect;
+        QVector<PF_Entity*> entities;
+        QImage image;
+    };
+    int nx = (area.width() + tileSize - 1)/tileSize;
+    int ny = (area.height() + tileSize - 1)/tileSize;
+    QVector<Tile> tiles(nx*ny);
+    for(int j = 0; j < ny; ++j)
+        for(int i = 0; i < nx; ++i)
+            tiles[j*nx+i].rect = QRect(area.left() + i*tileSize, area.top() + j*tileSize,
+                                       tileSize, tileSize).intersected(area);
+
+    /** 包围盒转换成块的编号，留出点的标记所占的几个像素 **/
+    auto tileIndex = [](double v, int origin, int n){
+        return int(qBound(0.0, std::floor((v - origin)/tileSize), n - 1.0));
+    };
+    QVector<PF_Entity*> front;
+    for(auto e : entities){
+        if(e->isSelected() || e->isHighlighted()){
+            front.append(e);
+            continue;
+        }
+        int i0 = 0, i1 = nx-1, j0 = 0, j1 = ny-1;
+        PF_Vector vmin = e->getMin(), vmax = e->getMax();
+        if(vmin.valid && vmax.valid){
+            double gx0 = toGuiX(vmin.x), gx1 = toGuiX(vmax.x);
+            double gy0 = toGuiY(vmin.y), gy1 = toGuiY(vmax.y);
+            i0 = tileIndex(qMin(gx0,gx1) - 4, area.left(), nx);
+            i1 = tileIndex(qMax(gx0,gx1) + 4, area.left(), nx);
+            j0 = tileIndex(qMin(gy0,gy1) - 4, area.top(), ny);
+            j1 = tileIndex(qMax(gy0,gy1) + 4, area.top(), ny);
+        }
+        for(int j = j0; j <= j1; ++j)
+            for(int i = i0; i <= i1; ++i)
+                tiles[j*nx+i].entities.append(e);
+    }
+
+    double ratio = mBufferDevicePixelRatio;
+    QPen pen = painter->pen();
+    QBrush brush = painter->brush();
+    QPainter::RenderHints hints = painter->renderHints();
+    bool antialiasing = painter->antialiasing();
+    QCPPainter::PainterModes modes = painter->modes();
+    QtConcurrent::blockingMap(tiles, [&](Tile& tile){
+        if(tile.entities.isEmpty())
+            return;
+        tile.image = QImage(tile.rect.size()*ratio, QImage::Format_ARGB32_Premultiplied);
+        tile.image.setDevicePixelRatio(ratio);
+        tile.image.fill(Qt::transparent);
+        QCPPainter p(&tile.image);
+        p.setModes(modes);
+        p.setRenderHints(hints);
+        /** QCPPainter打开反走样时平移半个像素，不能只复制RenderHints。
+            块本身就是裁剪区域，不再按逻辑坐标裁剪，否则平移后块左上
+            边缘的半个像素画不到 **/
+        p.setRenderHint(QPainter::Antialiasing, false);
+        p.setAntialiasing(antialiasing);
+        p.setPen(pen);
+        p.setBrush(brush);
+        p.translate(-tile.rect.topLeft());
+        drawBatched(&p,tile.entities);
+    });
+    /** 块中已经包含半个像素的平移，贴图时去掉painter的平移，与直接
+        绘制和front中的实体对齐 **/
+    painter->save();
+    if(painter->antialiasing())
+        painter->translate(-0.5,-0.5);
+    for(auto& tile : tiles){
+        if(!tile.image.isNull())
+            painter->drawImage(tile.rect.topLeft(), tile.image);
+    }
+    painter->restore();
+    drawBatched(painter,front);
+}
+
+/*!
+ \brief 依次绘制实体。能够表示成直线段的实体只把线段收集起来，遇到
+ 需要单独绘制的实体时先用drawLines一次画出已收集的线段，保持绘制的
+ 次序。一般的图形中除了面和选中的实体，整层只需要一次绘制调用。
+
+ \param painter
+ \param entities
+*/
+void PF_GraphicView::drawBatched(QCPPainter *painter, const QVector<PF_Entity *> &entities)
+{
+    QVector<QLineF> lines;
+    lines.reserve(entities.size()*2);
+    for(auto e : entities){
+        if(!e || e->batchLines(lines))
+            continue;
+        if(!lines.isEmpty()){
+            painter->drawLines(lines);
+            lines.resize(0);
+        }
+        drawEntity(painter,e);
+    }
+    if(!lines.isEmpty())
+        painter->drawLines(lines);
+}
+
 //void PF_GraphicView::drawEntityLayer(QPainter *painter)
 //{
 //    drawEntity(painter, container);
@@ -513,6 +680,21 @@ void PF_GraphicView::drawEntity(QCPPainter *painter, PF_Entity *e)
 //    drawOverlay(painter);
 //}
 
+/*!
+ \brief 只重画overlay层，预览和捕捉点改变时使用，实体所在的main层
+ 直接使用缓存。缓存失效时（如窗口大小改变）整体重画。
+
+*/
+void PF_GraphicView::replotOverlay()
+{
+    /** 缓存失效时QCPLayer::replot()什么也不做 **/
+    if(hasInvalidatedPaintBuffers()){
+        replot();
+        return;
+    }
+    layer(QLatin1String("overlay"))->replot();
+}
+
 void PF_GraphicView::drawOverlay(QCPPainter *painter)
 {
     foreach (auto ec, overlayEntities)
@@ -921,6 +1103,16 @@ void PF_GraphicView::setOpenGl(bool enabled, int multisampling)
 #endif
 }
 
+/*!
+ \brief 实体较多时是否分块在多个线程中绘制，见drawEntities。
+
+ \param enabled
+*/
+void PF_GraphicView::setTiledRendering(bool enabled)
+{
+    mTiledRendering = enabled;
+}
+
 /*!
   Sets the viewport of this PF_GraphicView. Usually users of PF_GraphicView don't need to change the
   viewport manually.
@@ -2623,6 +2815,7 @@ void PF_GraphicView::paintEvent(QPaintEvent *event)
         drawBackground(&painter);
         for (int bufferIndex = 0; bufferIndex < mPaintBuffers.size(); ++bufferIndex)
             mPaintBuffers.at(bufferIndex)->draw(&painter);
+        drawHighlightedElements(&painter);
     }
 }
 
@@ -2894,6 +3087,7 @@ void PF_GraphicView::draw(QCPPainter *painter)
     // draw all layered objects (grid, axes, plottables, items, legend,...):
     foreach (QCPLayer *layer, mLayers)
         layer->draw(painter);
+    drawHighlightedElements(painter);
 
     /* Debug code to draw all layout element rects
   foreach (QCPLayoutElement* el, findChildren<QCPLayoutElement*>())
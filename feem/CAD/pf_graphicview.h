@@ -3,6 +3,7 @@
 
 #include <QWidget>
 #include <QMap>
+#include <QPolygonF>
 
 #include "pf.h"
 #include "pf_entitycontainer.h"
@@ -53,6 +54,7 @@ class PF_GraphicView : public QWidget
     Q_PROPERTY(bool noAntialiasingOnDrag READ noAntialiasingOnDrag WRITE setNoAntialiasingOnDrag)
     Q_PROPERTY(Qt::KeyboardModifier multiSelectModifier READ multiSelectModifier WRITE setMultiSelectModifier)
     Q_PROPERTY(bool openGl READ openGl WRITE setOpenGl)
+    Q_PROPERTY(bool tiledRendering READ tiledRendering WRITE setTiledRendering)
     /// \endcond
 public:
     /*!
@@ -94,6 +96,8 @@ public:
     void redraw(PF::RedrawMethod method=PF::RedrawAll);
 
     void drawEntity(QCPPainter* painter, PF_Entity* e);
+    void drawEntities(QCPPainter* painter, const QVector<PF_Entity*>& entities);
+    void drawBatched(QCPPainter* painter, const QVector<PF_Entity*>& entities);
 
     //void drawEntityLayer(QPainter* painter);
 
@@ -103,6 +107,11 @@ public:
 
     virtual PF_EntityContainer *getOverlayContainer(PF::OverlayGraphics position);
 
+    /**高亮显示网格单元（如质量最差的单元），多边形为图形坐标**/
+    void setHighlightedElements(const QVector<QPolygonF> &elements);
+    void clearHighlightedElements();
+    const QVector<QPolygonF> &getHighlightedElements() const { return highlightedElements; }
+
     // getters:
     QRect viewport() const { return mViewport; }
     double bufferDevicePixelRatio() const { return mBufferDevicePixelRatio; }
@@ -121,6 +130,7 @@ public:
     QCP::SelectionRectMode selectionRectMode() const { return mSelectionRectMode; }
     QCPSelectionRect *selectionRect() const { return mSelectionRect; }
     bool openGl() const { return mOpenGl; }
+    bool tiledRendering() const { return mTiledRendering; }
 
     // setters:
     void setViewport(const QRect &rect);
@@ -145,6 +155,7 @@ public:
     void setSelectionRectMode(QCP::SelectionRectMode mode);
     void setSelectionRect(QCPSelectionRect *selectionRect);
     void setOpenGl(bool enabled, int multisampling=16);
+    void setTiledRendering(bool enabled);
 
     // non-property methods:
     // plottable interface:
@@ -240,6 +251,7 @@ public:
     QPixmap toPixmap(int width=0, int height=0, double scale=1.0);
     void toPainter(QCPPainter *painter, int width=0, int height=0);
     Q_SLOT void replot(PF_GraphicView::RefreshPriority refreshPriority=PF_GraphicView::rpRefreshHint);
+    void replotOverlay();
 
     QCPAxis *xAxis, *yAxis, *xAxis2, *yAxis2;
     QCPLegend *legend;
@@ -280,6 +292,10 @@ protected:
     PF::RedrawMethod redrawMethod;
 
     PF_SnapMode defaultSnapMode;
+
+    /**需要高亮显示的网格单元**/
+    QVector<QPolygonF> highlightedElements;
+    void drawHighlightedElements(QCPPainter *painter);
 private:
     /**保存绘图过程当中的实体**/
     QMap<int, PF_EntityContainer *> overlayEntities;
@@ -308,6 +324,7 @@ protected:
     QCP::SelectionRectMode mSelectionRectMode;
     QCPSelectionRect *mSelectionRect;
     bool mOpenGl;
+    bool mTiledRendering;
 
     // non-property members:
     QList<QSharedPointer<QCPAbstractPaintBuffer> > mPaintBuffers;
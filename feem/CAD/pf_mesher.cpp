@@ -0,0 +1,804 @@
+#include "pf_mesher.h"
+#include "pf_entitycontainer.h"
+
+#include <cmath>
+#include <algorithm>
+#include <set>
+#include <utility>
+
+/** 三点的方向，>0为逆时针 **/
+static double orient(double ax, double ay, double bx, double by, double cx, double cy)
+{
+    return (bx-ax)*(cy-ay) - (by-ay)*(cx-ax);
+}
+
+/** d在逆时针三角形abc的外接圆内时>0 **/
+static double incircle(double ax, double ay, double bx, double by,
+                       double cx, double cy, double dx, double dy)
+{
+    double adx = ax-dx, ady = ay-dy;
+    double bdx = bx-dx, bdy = by-dy;
+    double cdx = cx-dx, cdy = cy-dy;
+    double ad = adx*adx + ady*ady;
+    double bd = bdx*bdx + bdy*bdy;
+    double cd = cdx*cdx + cdy*cdy;
+    return adx*(bdy*cd - bd*cdy) - ady*(bdx*cd - bd*cdx) + ad*(bdx*cdy - bdy*cdx);
+}
+
+/** 奇偶规则判断点是否在多边形内 **/
+static bool insidePolygon(const QPolygonF& poly, double x, double y)
+{
+    bool inside = false;
+    int n = poly.size();
+    for(int i = 0, j = n-1; i < n; j = i++){
+        const QPointF& a = poly.at(i);
+        const QPointF& b = poly.at(j);
+        if((a.y() > y) != (b.y() > y) &&
+                x < (b.x()-a.x())*(y-a.y())/(b.y()-a.y()) + a.x())
+            inside = !inside;
+    }
+    return inside;
+}
+
+PF_Mesher::PF_Mesher()
+    :lastTriangle(-1)
+    ,minAngle(20.0)
+    ,maxPoints(200000)
+    ,defaultSize(0)
+    ,minLength(0)
+    ,fixedSplit(false)
+{
+
+}
+
+/*!
+ \brief 添加由若干闭合多边形组成的区域，多边形的坐标为模型坐标。
+
+ \param loops 闭合多边形，首尾不需要重复
+ \param size 单元尺寸
+ \param tag 物理编号
+ \return int 区域的编号
+*/
+int PF_Mesher::addRegion(const QList<QPolygonF> &loops, double size, int tag)
+{
+    Region r;
+    for(auto l : loops){
+        if(l.size() > 1 && l.first() == l.last())
+            l.removeLast();
+        if(l.size() > 2)
+            r.loops.push_back(l);
+    }
+    if(r.loops.empty())
+        return -1;
+    r.cx = r.cy = r.radius = 0;
+    r.size = size;
+    r.tag = tag;
+    regions.push_back(r);
+    return int(regions.size())-1;
+}
+
+int PF_Mesher::addCircle(const QPointF &center, double radius, double size, int tag)
+{
+    if(radius <= 0)
+        return -1;
+    Region r;
+    r.cx = center.x();
+    r.cy = center.y();
+    r.radius = radius;
+    r.size = size;
+    r.tag = tag;
+    regions.push_back(r);
+    return int(regions.size())-1;
+}
+
+/*!
+ \brief 设置最小角，Ruppert算法在不超过约20.7度时保证结束
+
+ \param degree
+*/
+void PF_Mesher::setMinAngle(double degree)
+{
+    minAngle = degree;
+}
+
+void PF_Mesher::setMaxPoints(int n)
+{
+    maxPoints = n;
+}
+
+void PF_Mesher::setDefaultSize(double size)
+{
+    defaultSize = size;
+}
+
+/*!
+ \brief 固定一条边界，区域边界中与之相同的边不再等分，也不会因为
+ 加密而分割，用于与已有的网格相接。只有在这条边不能出现在三角化中
+ 时才被分割，此时fixedEdgesSplit()返回true。
+
+*/
+void PF_Mesher::addFixedEdge(const QPointF &p1, const QPointF &p2)
+{
+    fixedEdges.push_back(std::make_pair(std::make_pair(p1.x(),p1.y()),
+                                        std::make_pair(p2.x(),p2.y())));
+}
+
+bool PF_Mesher::fixedEdgesSplit() const
+{
+    return fixedSplit;
+}
+
+int PF_Mesher::addVertex(double x, double y)
+{
+    px.push_back(x);
+    py.push_back(y);
+    vertexTriangle.push_back(-1);
+    return int(px.size())-1;
+}
+
+/*!
+ \brief 添加一段边界，按照尺寸h预先等分
+
+*/
+void PF_Mesher::addSegment(int a, int b, int curve, double h, bool fixed)
+{
+    double dx = px[b]-px[a], dy = py[b]-py[a];
+    int n = int(std::ceil(std::sqrt(dx*dx+dy*dy)/h - 1e-6));
+    if(n < 1 || fixed)
+        n = 1;
+    int last = a;
+    for(int i = 1; i <= n; ++i){
+        int next = b;
+        if(i < n)
+            next = addVertex(px[a]+dx*i/n, py[a]+dy*i/n);
+        Segment s = {last, next, curve, true, fixed};
+        segments.push_back(s);
+        last = next;
+    }
+}
+
+/*!
+ \brief 把所有区域的边界整理成不重复的点和线段。重合的点按照坐标合并，
+ 相邻区域共用的边只保留一份，并取两侧尺寸中较小的一个。
+
+*/
+void PF_Mesher::buildInput()
+{
+    double xmin = 1e300, xmax = -1e300, ymin = 1e300, ymax = -1e300;
+    for(auto& r : regions){
+        if(r.radius > 0){
+            xmin = std::min(xmin, r.cx-r.radius);
+            xmax = std::max(xmax, r.cx+r.radius);
+            ymin = std::min(ymin, r.cy-r.radius);
+            ymax = std::max(ymax, r.cy+r.radius);
+        }
+        for(auto& l : r.loops){
+            for(auto& p : l){
+                xmin = std::min(xmin, p.x());
+                xmax = std::max(xmax, p.x());
+                ymin = std::min(ymin, p.y());
+                ymax = std::max(ymax, p.y());
+            }
+        }
+    }
+    double diag = std::sqrt((xmax-xmin)*(xmax-xmin) + (ymax-ymin)*(ymax-ymin));
+    if(defaultSize <= 0)
+        defaultSize = diag/20;
+    minLength = diag*1e-6;
+
+    /** 超级三角形占据前三个点 **/
+    double cx = 0.5*(xmin+xmax), cy = 0.5*(ymin+ymax);
+    double big = 20*diag;
+    addVertex(cx-big, cy-big);
+    addVertex(cx+big, cy-big);
+    addVertex(cx, cy+big);
+
+    std::map<std::pair<double,double>,int> points;
+    std::map<std::pair<int,int>,std::pair<int,double> > edges;
+    auto vertex = [&](double x, double y){
+        auto it = points.find(std::make_pair(x,y));
+        if(it != points.end())
+            return it->second;
+        int v = addVertex(x,y);
+        points[std::make_pair(x,y)] = v;
+        return v;
+    };
+    for(int i = 0; i < int(regions.size()); ++i){
+        Region& r = regions[i];
+        double h = regionSize(i);
+        if(r.radius > 0){
+            /** 圆周按照尺寸等分，端点不与其他区域共用 **/
+            int n = std::max(8, int(std::ceil(2*M_PI*r.radius/h)));
+            int first = addVertex(r.cx+r.radius, r.cy);
+            int last = first;
+            for(int k = 1; k <= n; ++k){
+                int next = first;
+                if(k < n)
+                    next = addVertex(r.cx+r.radius*std::cos(2*M_PI*k/n),
+                                     r.cy+r.radius*std::sin(2*M_PI*k/n));
+                Segment s = {last, next, i, true, false};
+                segments.push_back(s);
+                last = next;
+            }
+            continue;
+        }
+        for(auto& l : r.loops){
+            for(int k = 0; k < l.size(); ++k){
+                int a = vertex(l.at(k).x(), l.at(k).y());
+                int b = vertex(l.at((k+1)%l.size()).x(), l.at((k+1)%l.size()).y());
+                if(a == b)
+                    continue;
+                std::pair<int,int> key = a < b ? std::make_pair(a,b) : std::make_pair(b,a);
+                auto it = edges.find(key);
+                if(it == edges.end())
+                    edges[key] = std::make_pair(a,h);
+                else
+                    it->second.second = std::min(it->second.second, h);
+            }
+        }
+    }
+    std::set<std::pair<int,int> > fixed;
+    for(auto& f : fixedEdges){
+        auto a = points.find(f.first), b = points.find(f.second);
+        if(a != points.end() && b != points.end())
+            fixed.insert(edgeKey(a->second, b->second));
+    }
+    for(auto& e : edges){
+        int a = e.second.first;
+        int b = a == e.first.first ? e.first.second : e.first.first;
+        addSegment(a, b, -1, e.second.second, fixed.count(e.first) > 0);
+    }
+}
+
+/*!
+ \brief 从上一次的单元出发，沿着点所在的方向走到包含该点的单元
+
+ \return int 单元编号，点在超级三角形外时返回-1
+*/
+int PF_Mesher::locate(double x, double y)
+{
+    int t = lastTriangle;
+    if(t < 0)
+        t = 0;
+    int steps = 0, r = 0;
+    while(t >= 0 && steps++ < int(triangles.size())){
+        const Triangle& tri = triangles[t];
+        bool found = true;
+        r = (r+1)%3;
+        for(int k = 0; k < 3; ++k){
+            int i = (k+r)%3;
+            int a = tri.v[(i+1)%3], b = tri.v[(i+2)%3];
+            if(orient(px[a],py[a],px[b],py[b],x,y) < 0){
+                t = tri.n[i];
+                found = false;
+                break;
+            }
+        }
+        if(found)
+            return t;
+    }
+    return -1;
+}
+
+/*!
+ \brief 设置单元t的顶点和相邻单元，t<0时分配新的单元
+
+*/
+int PF_Mesher::setTriangle(int t, int a, int b, int c, int na, int nb, int nc)
+{
+    Triangle tri = {{a,b,c},{na,nb,nc},-2};
+    if(t < 0){
+        t = int(triangles.size());
+        triangles.push_back(tri);
+    }else{
+        triangles[t] = tri;
+    }
+    vertexTriangle[a] = vertexTriangle[b] = vertexTriangle[c] = t;
+    triangleQueue.push_back(t);
+    return t;
+}
+
+/*!
+ \brief 把相邻单元t中指向from的邻居改为to
+
+*/
+void PF_Mesher::replaceNeighbor(int t, int from, int to)
+{
+    if(t < 0)
+        return;
+    for(int i = 0; i < 3; ++i){
+        if(triangles[t].n[i] == from){
+            triangles[t].n[i] = to;
+            return;
+        }
+    }
+}
+
+/*!
+ \brief 边ab是线段时加入待检查的队列
+
+*/
+void PF_Mesher::queueSegment(int a, int b)
+{
+    int s = segmentOf(a,b);
+    if(s >= 0)
+        segmentQueue.push_back(s);
+}
+
+/*!
+ \brief 插入一个点，与已有的点重合时返回已有的点
+
+ \return int 点的编号，点在超级三角形外时返回-1
+*/
+int PF_Mesher::insertPoint(double x, double y)
+{
+    int t = locate(x,y);
+    if(t < 0)
+        return -1;
+    for(int i = 0; i < 3; ++i){
+        int v = triangles[t].v[i];
+        if(std::fabs(px[v]-x) + std::fabs(py[v]-y) < minLength)
+            return v;
+    }
+    int p = addVertex(x,y);
+    insertVertex(p,t);
+    return p;
+}
+
+/*!
+ \brief 把已经保存的点p插入到包含它的单元t中。点在单元内时分成三个单元，
+ 在边上时把边两侧的单元分成四个，之后通过翻转对角线恢复Delaunay性质
+ （Lawson算法）。所有新单元的第三个顶点都是p，第三条边是待检查的边。
+
+*/
+void PF_Mesher::insertVertex(int p, int t)
+{
+    Triangle tri = triangles[t];
+    int edge = -1;
+    for(int i = 0; i < 3; ++i){
+        int a = tri.v[(i+1)%3], b = tri.v[(i+2)%3];
+        if(orient(px[a],py[a],px[b],py[b],px[p],py[p]) == 0 && tri.n[i] >= 0)
+            edge = i;
+    }
+
+    std::vector<int> stack;
+    if(edge < 0){
+        int a = tri.v[0], b = tri.v[1], c = tri.v[2];
+        int t2 = setTriangle(-1, c, a, p, -1, -1, tri.n[1]);
+        int t3 = setTriangle(-1, a, b, p, -1, -1, tri.n[2]);
+        setTriangle(t, b, c, p, t2, t3, tri.n[0]);
+        triangles[t2].n[0] = t3;
+        triangles[t2].n[1] = t;
+        triangles[t3].n[0] = t;
+        triangles[t3].n[1] = t2;
+        replaceNeighbor(tri.n[1], t, t2);
+        replaceNeighbor(tri.n[2], t, t3);
+        stack.push_back(t);
+        stack.push_back(t2);
+        stack.push_back(t3);
+    }else{
+        int c = tri.v[edge], a = tri.v[(edge+1)%3], b = tri.v[(edge+2)%3];
+        int u = tri.n[edge];
+        queueSegment(a, b);
+        Triangle other = triangles[u];
+        int j = 0;
+        while(other.n[j] != t)
+            ++j;
+        int d = other.v[j];
+        int ta = tri.n[(edge+1)%3], tb = tri.n[(edge+2)%3];
+        int ua = other.n[(j+2)%3], ub = other.n[(j+1)%3];
+        int t2 = setTriangle(-1, b, c, p, -1, -1, ta);
+        int t4 = setTriangle(-1, d, b, p, -1, -1, ua);
+        setTriangle(t, c, a, p, u, t2, tb);
+        setTriangle(u, a, d, p, t4, t, ub);
+        triangles[t2].n[0] = t;
+        triangles[t2].n[1] = t4;
+        triangles[t4].n[0] = t2;
+        triangles[t4].n[1] = u;
+        replaceNeighbor(ta, t, t2);
+        replaceNeighbor(ua, u, t4);
+        stack.push_back(t);
+        stack.push_back(t2);
+        stack.push_back(u);
+        stack.push_back(t4);
+    }
+
+    while(!stack.empty()){
+        int s = stack.back();
+        stack.pop_back();
+        Triangle cur = triangles[s];
+        int n = cur.n[2];
+        if(n < 0){
+            queueSegment(cur.v[0], cur.v[1]);
+            continue;
+        }
+        Triangle opp = triangles[n];
+        int j = 0;
+        while(opp.n[j] != s)
+            ++j;
+        int a = cur.v[0], b = cur.v[1], d = opp.v[j];
+        /** 舍入误差下四边形可能不是凸的，此时不翻转 **/
+        if(incircle(px[a],py[a],px[b],py[b],px[p],py[p],px[d],py[d]) <= 0 ||
+                orient(px[a],py[a],px[d],py[d],px[p],py[p]) <= 0 ||
+                orient(px[d],py[d],px[b],py[b],px[p],py[p]) <= 0){
+            /** 新点对面的边，对应的线段可能被新点侵占 **/
+            queueSegment(a, b);
+            continue;
+        }
+        queueSegment(a, b);
+        int ta = cur.n[0], tb = cur.n[1];
+        int nad = opp.n[(j+1)%3], ndb = opp.n[(j+2)%3];
+        setTriangle(s, a, d, p, n, tb, nad);
+        setTriangle(n, d, b, p, ta, s, ndb);
+        replaceNeighbor(ta, s, n);
+        replaceNeighbor(nad, n, s);
+        stack.push_back(s);
+        stack.push_back(n);
+    }
+    lastTriangle = t;
+}
+
+/*!
+ \brief 绕点a旋转，寻找包含边ab的单元
+
+*/
+int PF_Mesher::findEdge(int a, int b) const
+{
+    int t0 = vertexTriangle[a];
+    int t = t0;
+    do{
+        const Triangle& tri = triangles[t];
+        int k = tri.v[0] == a ? 0 : (tri.v[1] == a ? 1 : 2);
+        if(tri.v[(k+1)%3] == b || tri.v[(k+2)%3] == b)
+            return t;
+        t = tri.n[(k+1)%3];
+    }while(t >= 0 && t != t0);
+    return -1;
+}
+
+/*!
+ \brief 线段不在三角化中，或者两侧单元的顶点位于线段的直径圆内
+
+*/
+bool PF_Mesher::isEncroached(const Segment &s) const
+{
+    int t = findEdge(s.a, s.b);
+    if(t < 0)
+        return true;
+    for(int side = 0; side < 2 && t >= 0; ++side){
+        const Triangle& tri = triangles[t];
+        int k = 0;
+        while(tri.v[k] == s.a || tri.v[k] == s.b)
+            ++k;
+        int c = tri.v[k];
+        if(c >= 3 && (px[s.a]-px[c])*(px[s.b]-px[c]) + (py[s.a]-py[c])*(py[s.b]-py[c]) < 0)
+            return true;
+        t = tri.n[k];
+    }
+    return false;
+}
+
+bool PF_Mesher::encroachesSegment(int s, double x, double y) const
+{
+    const Segment& seg = segments[s];
+    return (px[seg.a]-x)*(px[seg.b]-x) + (py[seg.a]-y)*(py[seg.b]-y) < 0;
+}
+
+/*!
+ \brief 在线段中点处分割，圆上的线段取圆弧的中点
+
+*/
+bool PF_Mesher::splitSegment(int s)
+{
+    Segment seg = segments[s];
+    double x = 0.5*(px[seg.a]+px[seg.b]);
+    double y = 0.5*(py[seg.a]+py[seg.b]);
+    if(seg.curve >= 0){
+        const Region& r = regions[seg.curve];
+        double d = std::sqrt((x-r.cx)*(x-r.cx) + (y-r.cy)*(y-r.cy));
+        if(d > 0){
+            x = r.cx + (x-r.cx)*r.radius/d;
+            y = r.cy + (y-r.cy)*r.radius/d;
+        }
+    }
+    int m = insertPoint(x,y);
+    if(m < 0 || m == seg.a || m == seg.b)
+        return false;
+    segments[s].alive = false;
+    segmentEdges.erase(edgeKey(seg.a, seg.b));
+    Segment s1 = {seg.a, m, seg.curve, true, seg.fixed};
+    Segment s2 = {m, seg.b, seg.curve, true, seg.fixed};
+    segments.push_back(s1);
+    segmentEdges[edgeKey(seg.a, m)] = int(segments.size())-1;
+    segmentQueue.push_back(int(segments.size())-1);
+    segments.push_back(s2);
+    segmentEdges[edgeKey(m, seg.b)] = int(segments.size())-1;
+    segmentQueue.push_back(int(segments.size())-1);
+    return true;
+}
+
+std::pair<int,int> PF_Mesher::edgeKey(int a, int b)
+{
+    return a < b ? std::make_pair(a,b) : std::make_pair(b,a);
+}
+
+/*!
+ \brief 边ab对应的线段，不是线段时返回-1
+
+*/
+int PF_Mesher::segmentOf(int a, int b) const
+{
+    if(segmentEdges.empty())
+        return -1;
+    auto it = segmentEdges.find(edgeKey(a,b));
+    return it == segmentEdges.end() ? -1 : it->second;
+}
+
+/*!
+ \brief 插入点(x,y)时会被侵占的线段。所有线段都在三角化中且没有被侵占时，
+ 这样的线段只可能是外接圆包含该点的单元的边，从包含该点的单元t出发搜索即可。
+
+*/
+void PF_Mesher::encroachedSegments(double x, double y, int t, std::vector<int> &out) const
+{
+    std::vector<int> visited, stack;
+    stack.push_back(t);
+    visited.push_back(t);
+    while(!stack.empty()){
+        int c = stack.back();
+        stack.pop_back();
+        const Triangle& tri = triangles[c];
+        for(int i = 0; i < 3; ++i){
+            int s = segmentOf(tri.v[(i+1)%3], tri.v[(i+2)%3]);
+            if(s >= 0 && encroachesSegment(s, x, y) &&
+                    std::find(out.begin(), out.end(), s) == out.end())
+                out.push_back(s);
+            int nb = tri.n[i];
+            if(nb < 0 || std::find(visited.begin(), visited.end(), nb) != visited.end())
+                continue;
+            const Triangle& tn = triangles[nb];
+            if(incircle(px[tn.v[0]],py[tn.v[0]],px[tn.v[1]],py[tn.v[1]],
+                        px[tn.v[2]],py[tn.v[2]],x,y) > 0){
+                visited.push_back(nb);
+                stack.push_back(nb);
+            }
+        }
+    }
+}
+
+/*!
+ \brief 点所在的区域，圆形区域优先，之后添加的区域优先
+
+*/
+int PF_Mesher::regionAt(double x, double y) const
+{
+    for(int i = int(regions.size())-1; i >= 0; --i){
+        const Region& r = regions[i];
+        if(r.radius > 0 && (x-r.cx)*(x-r.cx) + (y-r.cy)*(y-r.cy) < r.radius*r.radius)
+            return i;
+    }
+    for(int i = int(regions.size())-1; i >= 0; --i){
+        const Region& r = regions[i];
+        if(r.radius > 0)
+            continue;
+        bool inside = false;
+        for(auto& l : r.loops)
+            if(insidePolygon(l, x, y))
+                inside = !inside;
+        if(inside)
+            return i;
+    }
+    return -1;
+}
+
+double PF_Mesher::regionSize(int region) const
+{
+    double h = regions[region].size;
+    return h > 0 ? h : defaultSize;
+}
+
+/*!
+ \brief 区域内的单元，外接圆半径与最短边之比过大或者尺寸超过要求
+
+*/
+bool PF_Mesher::isBad(int t)
+{
+    Triangle& tri = triangles[t];
+    int a = tri.v[0], b = tri.v[1], c = tri.v[2];
+    if(a < 3 || b < 3 || c < 3)
+        return false;
+    if(tri.region == -2)
+        tri.region = regionAt((px[a]+px[b]+px[c])/3, (py[a]+py[b]+py[c])/3);
+    if(tri.region < 0)
+        return false;
+    double l0 = std::hypot(px[b]-px[c], py[b]-py[c]);
+    double l1 = std::hypot(px[c]-px[a], py[c]-py[a]);
+    double l2 = std::hypot(px[a]-px[b], py[a]-py[b]);
+    double lmin = std::min(l0, std::min(l1, l2));
+    if(lmin < 2*minLength)
+        return false;
+    double area = 0.5*orient(px[a],py[a],px[b],py[b],px[c],py[c]);
+    if(area <= 0)
+        return false;
+    double R = l0*l1*l2/(4*area);
+    if(R/lmin > 1/(2*std::sin(minAngle*M_PI/180)))
+        return true;
+    return R*std::sqrt(3.0) > regionSize(tri.region);
+}
+
+/*!
+ \brief 生成网格
+
+ \return bool 所有区域为空或者插入失败时返回false
+*/
+bool PF_Mesher::generate()
+{
+    px.clear();py.clear();
+    segments.clear();
+    triangles.clear();
+    vertexTriangle.clear();
+    segmentEdges.clear();
+    segmentQueue.clear();
+    fixedSplit = false;
+    triangleQueue.clear();
+    lastTriangle = -1;
+    if(regions.empty())
+        return false;
+
+    buildInput();
+    setTriangle(-1, 0, 1, 2, -1, -1, -1);
+    for(int v = 3; v < int(px.size()); ++v){
+        int t = locate(px[v],py[v]);
+        if(t < 0)
+            return false;
+        /** 与已插入的点重合时合并 **/
+        int same = -1;
+        for(int i = 0; i < 3; ++i){
+            int u = triangles[t].v[i];
+            if(std::fabs(px[u]-px[v]) + std::fabs(py[u]-py[v]) < minLength)
+                same = u;
+        }
+        if(same < 0){
+            insertVertex(v,t);
+            continue;
+        }
+        for(auto& s : segments){
+            if(s.a == v) s.a = same;
+            if(s.b == v) s.b = same;
+        }
+    }
+    for(int s = 0; s < int(segments.size()); ++s){
+        segmentEdges[edgeKey(segments[s].a, segments[s].b)] = s;
+        segmentQueue.push_back(s);
+    }
+
+    while(int(px.size()) < maxPoints){
+        if(!segmentQueue.empty()){
+            int s = segmentQueue.back();
+            segmentQueue.pop_back();
+            if(segments[s].alive && isEncroached(segments[s])){
+                const Segment& seg = segments[s];
+                /** 固定的线段只在不在三角化中时分割 **/
+                if(seg.fixed && findEdge(seg.a, seg.b) >= 0)
+                    continue;
+                bool fixedSegment = seg.fixed;
+                if(std::hypot(px[seg.a]-px[seg.b], py[seg.a]-py[seg.b]) > 2*minLength &&
+                        splitSegment(s) && fixedSegment)
+                    fixedSplit = true;
+            }
+            continue;
+        }
+        if(triangleQueue.empty())
+            break;
+        int t = triangleQueue.back();
+        triangleQueue.pop_back();
+        if(!isBad(t))
+            continue;
+
+        /** 外接圆圆心 **/
+        const Triangle& tri = triangles[t];
+        double ax = px[tri.v[0]], ay = py[tri.v[0]];
+        double bx = px[tri.v[1]]-ax, by = py[tri.v[1]]-ay;
+        double cx = px[tri.v[2]]-ax, cy = py[tri.v[2]]-ay;
+        double d = 2*(bx*cy - by*cx);
+        double ux = ax + (cy*(bx*bx+by*by) - by*(cx*cx+cy*cy))/d;
+        double uy = ay + (bx*(cx*cx+cy*cy) - cx*(bx*bx+by*by))/d;
+
+        /** 圆心侵占线段时改为分割线段，单元留到之后再检查 **/
+        int tc = locate(ux, uy);
+        if(tc < 0)
+            continue;
+        std::vector<int> encroached;
+        encroachedSegments(ux, uy, tc, encroached);
+        if(!encroached.empty()){
+            /** 侵占固定的线段时放弃这个单元 **/
+            bool fixedSegment = false;
+            for(int s : encroached)
+                if(segments[s].fixed)
+                    fixedSegment = true;
+            if(fixedSegment)
+                continue;
+            bool split = false;
+            for(int s : encroached){
+                const Segment& seg = segments[s];
+                if(std::hypot(px[seg.a]-px[seg.b], py[seg.a]-py[seg.b]) > 2*minLength &&
+                        splitSegment(s))
+                    split = true;
+            }
+            if(split)
+                triangleQueue.push_back(t);
+            continue;
+        }
+        insertPoint(ux, uy);
+    }
+
+    for(auto& tri : triangles){
+        if(tri.region == -2){
+            int a = tri.v[0], b = tri.v[1], c = tri.v[2];
+            if(a < 3 || b < 3 || c < 3)
+                tri.region = -1;
+            else
+                tri.region = regionAt((px[a]+px[b]+px[c])/3, (py[a]+py[b]+py[c])/3);
+        }
+    }
+    return true;
+}
+
+/*!
+ \brief 生成与loadGmsh22相同结构的网格，只保留区域内的单元和用到的节点。
+ physic_tag为区域的编号，geometry_tag为区域的顺序号。
+
+ \param region 只生成该区域的网格，<0时生成所有区域的网格
+
+*/
+CMesh *PF_Mesher::createMesh(int region) const
+{
+    std::vector<int> perm(px.size(), -1);
+    int numNode = 0, numEle = 0;
+    for(auto& tri : triangles){
+        if(tri.region < 0 || (region >= 0 && tri.region != region))
+            continue;
+        ++numEle;
+        for(int i = 0; i < 3; ++i)
+            if(perm[tri.v[i]] < 0)
+                perm[tri.v[i]] = numNode++;
+    }
+    CMesh* mesh = new CMesh;
+    mesh->numNode = numNode;
+    mesh->numEle = numEle;
+    mesh->nodes = (CNode*)calloc(numNode, sizeof(CNode));
+    mesh->eles = (CElement*)calloc(numEle, sizeof(CElement));
+    for(int v = 0; v < int(px.size()); ++v){
+        if(perm[v] < 0)
+            continue;
+        mesh->nodes[perm[v]].x = px[v];
+        mesh->nodes[perm[v]].y = py[v];
+        mesh->nodes[perm[v]].z = 0;
+    }
+    int k = 0;
+    for(auto& tri : triangles){
+        if(tri.region < 0 || (region >= 0 && tri.region != region))
+            continue;
+        for(int i = 0; i < 3; ++i)
+            mesh->eles[k].n[i] = perm[tri.v[i]];
+        mesh->eles[k].ele_type = TRIANGLE_NODE3;
+        mesh->eles[k].physic_tag = regions[tri.region].tag;
+        mesh->eles[k].geometry_tag = tri.region+1;
+        ++k;
+    }
+    return mesh;
+}
+
+int PF_Mesher::numberOfNodes() const
+{
+    return int(px.size())-3;
+}
+
+int PF_Mesher::numberOfTriangles() const
+{
+    int n = 0;
+    for(auto& tri : triangles)
+        if(tri.region >= 0)
+            ++n;
+    return n;
+}
@@ -0,0 +1,100 @@
+#ifndef PF_MESHER_H
+#define PF_MESHER_H
+
+#include <QList>
+#include <QPolygonF>
+#include <map>
+#include <vector>
+
+typedef struct _CMesh CMesh;
+
+/*!
+ \brief 二维三角形分网。先对边界线段做Delaunay三角化，
+ 通过分割被侵占的线段恢复边界（保形Delaunay），再按照
+ Ruppert算法插入外接圆圆心，直到所有单元的最小角和尺寸
+ 满足要求。直接在内存中完成，不需要经过gmsh的文件。
+
+*/
+class PF_Mesher
+{
+public:
+    PF_Mesher();
+
+    /** 添加一个区域，多个闭合多边形按照奇偶规则组成区域，
+        与PF_Face的绘制一致。size为单元尺寸，<=0时自动选取 **/
+    int addRegion(const QList<QPolygonF>& loops, double size, int tag);
+    /** 添加一个圆形区域，加密时圆周上的新点投影到圆上，
+        圆形区域优先于之前添加的多边形区域 **/
+    int addCircle(const QPointF& center, double radius, double size, int tag);
+
+    void setMinAngle(double degree);
+    void setMaxPoints(int n);
+    /** 区域尺寸<=0时使用的单元尺寸，<=0时按照输入区域的范围选取 **/
+    void setDefaultSize(double size);
+    void addFixedEdge(const QPointF& p1, const QPointF& p2);
+
+    bool generate();
+    bool fixedEdgesSplit() const;
+    CMesh* createMesh(int region = -1) const;
+
+    int numberOfNodes() const;
+    int numberOfTriangles() const;
+
+private:
+    struct Region{
+        std::vector<QPolygonF> loops;
+        double cx, cy, radius;/** radius>0时为圆形区域 **/
+        double size;
+        int tag;
+    };
+    struct Segment{
+        int a, b;
+        int curve;/** 所在圆的编号，直线为-1 **/
+        bool alive;
+        bool fixed;
+    };
+    struct Triangle{
+        int v[3];/** 逆时针 **/
+        int n[3];/** n[i]为v[i]对边的相邻单元 **/
+        int region;/** -2表示尚未确定 **/
+    };
+
+    int addVertex(double x, double y);
+    void addSegment(int a, int b, int curve, double h, bool fixed);
+    void buildInput();
+    int locate(double x, double y);
+    int insertPoint(double x, double y);
+    void insertVertex(int p, int t);
+    int setTriangle(int t, int a, int b, int c, int na, int nb, int nc);
+    void replaceNeighbor(int t, int from, int to);
+    int findEdge(int a, int b) const;
+    bool isEncroached(const Segment& s) const;
+    bool encroachesSegment(int s, double x, double y) const;
+    bool splitSegment(int s);
+    static std::pair<int,int> edgeKey(int a, int b);
+    int segmentOf(int a, int b) const;
+    void queueSegment(int a, int b);
+    void encroachedSegments(double x, double y, int t, std::vector<int>& out) const;
+    int regionAt(double x, double y) const;
+    double regionSize(int region) const;
+    bool isBad(int t);
+
+    std::vector<Region> regions;
+    std::vector<std::pair<std::pair<double,double>,std::pair<double,double> > > fixedEdges;
+    std::vector<double> px, py;
+    std::vector<Segment> segments;
+    std::map<std::pair<int,int>,int> segmentEdges;/** 边到线段的索引 **/
+    std::vector<Triangle> triangles;
+    std::vector<int> vertexTriangle;
+    std::vector<int> segmentQueue;
+    std::vector<int> triangleQueue;
+    int lastTriangle;
+
+    double minAngle;
+    int maxPoints;
+    double defaultSize;
+    double minLength;
+    bool fixedSplit;
+};
+
+#endif // PF_MESHER_H
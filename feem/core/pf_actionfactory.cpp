@@ -110,6 +110,20 @@ void PF_ActionFactory::fillActionContainer(QMap<QString, QAction*>& a_map, PF_Ac
     action->setObjectName("DeSelectAll");
     a_map["DeSelectAll"] = action;
 
+    /**在交点处打断直线**/
+    action = new QAction(tr("SplitIntersections"), agm->file);
+    action->setIcon(QIcon(":/main/cut32x32.png"));
+    connect(action, SIGNAL(triggered()), action_handler, SLOT(slotSplitIntersections()));
+    action->setObjectName("SplitIntersections");
+    a_map["SplitIntersections"] = action;
+
+    /**生成直线围成的所有面**/
+    action = new QAction(tr("DetectFaces"), agm->file);
+    action->setIcon(QIcon(":/main/square.png"));
+    connect(action, SIGNAL(triggered()), action_handler, SLOT(slotDetectFaces()));
+    action->setObjectName("DetectFaces");
+    a_map["DetectFaces"] = action;
+
     /**导出geo文件**/
     action = new QAction(tr("Export Geometry"), agm->file);
     action->setIcon(QIcon(":/main/export.png"));
@@ -7,6 +7,8 @@
 #include "pf_actiondrawface.h"
 #include "pf_actionselectall.h"
 #include "pf_actionselectsingle.h"
+#include "pf_actionsplitintersections.h"
+#include "pf_actiondetectfaces.h"
 #include "pf_document.h"
 #include "pf_graphicview.h"
 
@@ -122,6 +124,12 @@ PF_ActionInterface *PF_ActionHandler::setCurrentAction(PF::ActionType typeId)
     case PF::ActionDeSelectAll:
         a = new PF_ActionSelectAll(document, view, false);
         break;
+    case PF::ActionSplitIntersections:
+        a = new PF_ActionSplitIntersections(document, view);
+        break;
+    case PF::ActionDetectFaces:
+        a = new PF_ActionDetectFaces(document, view);
+        break;
     case PF::ActionShowResult:
 
         break;
@@ -233,6 +241,16 @@ void PF_ActionHandler::slotDrawFace()
     setCurrentAction(PF::ActionDrawFace);
 }
 
+void PF_ActionHandler::slotSplitIntersections()
+{
+    setCurrentAction(PF::ActionSplitIntersections);
+}
+
+void PF_ActionHandler::slotDetectFaces()
+{
+    setCurrentAction(PF::ActionDetectFaces);
+}
+
 void PF_ActionHandler::slotSetSnaps(const PF_SnapMode &s)
 {
     if(view) {
@@ -45,6 +45,8 @@ public slots:
     void slotDrawCircle();
     void slotDrawRectangle();
     void slotDrawFace();
+    void slotSplitIntersections();
+    void slotDetectFaces();
 
     void slotSetSnaps(PF_SnapMode const& s);
     void slotSnapFree();
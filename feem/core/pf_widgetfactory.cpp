@@ -345,6 +345,8 @@ void PF_WidgetFactory::createGroupDrawOperation(RibbonPage *page)
         groupDrawOperation->addAction(a_map["SelectSingle"],Qt::ToolButtonTextBesideIcon);
         groupDrawOperation->addAction(a_map["SelectAll"],Qt::ToolButtonTextBesideIcon);
         groupDrawOperation->addAction(a_map["DeSelectAll"],Qt::ToolButtonTextBesideIcon);
+        groupDrawOperation->addAction(a_map["SplitIntersections"],Qt::ToolButtonTextBesideIcon);
+        groupDrawOperation->addAction(a_map["DetectFaces"],Qt::ToolButtonTextBesideIcon);
 //        groupDrawOperation->addAction(QIcon(":/main/solid.png"), tr("Unselect All"), Qt::ToolButtonTextBesideIcon);
         groupDrawOperation->addAction(QIcon(":/main/cut32x32.png"), tr("Cut"), Qt::ToolButtonTextUnderIcon);
         groupDrawOperation->addAction(QIcon(":/main/copy32x32.png"), tr("Copy"), Qt::ToolButtonTextUnderIcon);
@@ -9,6 +9,7 @@ QT       += core gui
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets printsupport
 
 QT +=  printsupport gui-private
+QT += concurrent
 
 TARGET = feem
 TEMPLATE = app
@@ -86,6 +87,7 @@ HEADERS += \
     util/constants.h \
     ./core/mainwindow.h \
     ./CAD/pf_graphicview.h \
+    ./CAD/pf_mesher.h \
     project/viewitem.h \
     project/navigationtreeview.h \
     project/treemodel.h \
@@ -116,6 +118,8 @@ HEADERS += \
     project/pf_nodetreebuilder.h \
     project/pf_sessionmanager.h \
     CAD/action/pf_actionselectsingle.h \
+    CAD/action/pf_actionsplitintersections.h \
+    CAD/action/pf_actiondetectfaces.h \
     project/inavigationwidgetfactory.h \
     core/coreapp.h \
     project/projectexplorerconstants.h \
@@ -126,6 +130,11 @@ HEADERS += \
     CAD/action/pf_actionselectall.h \
     CAD/action/pf_selection.h \
     CAD/entity/pf_face.h \
+    CAD/entity/pf_spatialindex.h \
+    CAD/entity/pf_intersection.h \
+    CAD/entity/pf_facedetector.h \
+    CAD/entity/pf_mesh.h \
+    CAD/entity/pf_entitypool.h \
     CAD/action/pf_actiondrawface.h \
 
 
@@ -167,6 +176,7 @@ SOURCES += \
     ./main.cpp \
     ./core/mainwindow.cpp \
     ./CAD/pf_graphicview.cpp \
+    ./CAD/pf_mesher.cpp \
     project/viewitem.cpp \
     project/navigationtreeview.cpp \
     project/treemodel.cpp \
@@ -193,6 +203,8 @@ SOURCES += \
     project/pf_nodetreebuilder.cpp \
     project/pf_sessionmanager.cpp \
     CAD/action/pf_actionselectsingle.cpp \
+    CAD/action/pf_actionsplitintersections.cpp \
+    CAD/action/pf_actiondetectfaces.cpp \
     project/inavigationwidgetfactory.cpp \
     core/coreapp.cpp \
     material/pf_materialtreemodel.cpp \
@@ -202,6 +214,11 @@ SOURCES += \
     CAD/action/pf_actionselectall.cpp \
     CAD/action/pf_selection.cpp \
     CAD/entity/pf_face.cpp \
+    CAD/entity/pf_spatialindex.cpp \
+    CAD/entity/pf_intersection.cpp \
+    CAD/entity/pf_facedetector.cpp \
+    CAD/entity/pf_mesh.cpp \
+    CAD/entity/pf_entitypool.cpp \
     CAD/action/pf_actiondrawface.cpp
 
 win32:CONFIG(release, debug|release): LIBS += -L$$_PRO_FILE_PWD_/../bin/ -lgmsh
@@ -0,0 +1,597 @@
+/*
+   ElmerGrid - A simple mesh generation and manipulation utility
+   Copyright (C) 1995- , CSC - IT Center for Science Ltd.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/* -------------------------------:  egadapt.c  :----------------------------
+   Adaptive h-refinement of linear triangle meshes. The triangles are kept so
+   that the refinement edge is the one between the local nodes 0 and 1, i.e.
+   node 2 is the newest vertex. The bisection of (v0,v1,v2) at the midpoint m
+   gives (v2,v0,m) and (v1,v2,m), which preserves the orientation and makes m
+   the newest vertex of both children.
+
+   The marks of one refinement live on the edges of the current mesh. A
+   triangle with any marked edge must have its refinement edge marked too,
+   and the closure of this rule keeps the mesh conforming. The children get
+   the other two original edges as their refinement edges, so a triangle is
+   split into at most four and every new node is the midpoint of a marked
+   edge. The elements are therefore refined independently of each other.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "egutils.h"
+#include "egdef.h"
+#include "egtypes.h"
+#include "egmesh.h"
+#include "egadapt.h"
+
+#define DORFLERITERATIONS 60 /* bisection steps of the marking threshold */
+
+
+static int CheckTriangles(struct FemType *data,const char *caller)
+{
+    int i;
+
+    for(i=1;i<=data->noelements;i++) {
+        if(data->elementtypes[i] != 303) {
+            printf("%s: implemented only for elementtype 303, not for %d\n",
+                   caller,data->elementtypes[i]);
+            return(FALSE);
+        }
+    }
+    return(TRUE);
+}
+
+
+static int RotatedSide(int side,int rot)
+/* The side of a triangle after its nodes are rotated by rot positions. The
+   sides 0-2 are edges and 3-5 are corners. */
+{
+    if(side < 3)
+        return((side+3-rot)%3);
+    else
+        return(3+(side+3-rot)%3);
+}
+
+
+int SetRefinementEdges(struct FemType *data,struct BoundaryType *bound,int info)
+/* Rotates the triangles so that the longest edge becomes the refinement
+   edge. The sides of the boundaries are rotated with their parents. */
+{
+    int i,j,k,r,*rot,*topo,ind[3];
+    Real len[3],dx,dy,dz;
+
+    if(!CheckTriangles(data,"SetRefinementEdges")) return(1);
+
+    DestroyEdgeTable(data,FALSE);
+    DestroySideTable(data,FALSE);
+
+    rot = Ivector(1,data->noelements);
+
+#pragma omp parallel for private(j,k,r,topo,ind,len,dx,dy,dz) schedule(static)
+    for(i=1;i<=data->noelements;i++) {
+        topo = data->topology[i];
+        for(j=0;j<3;j++) {
+            k = (j+1)%3;
+            dx = data->x[topo[k]] - data->x[topo[j]];
+            dy = data->y[topo[k]] - data->y[topo[j]];
+            dz = data->z[topo[k]] - data->z[topo[j]];
+            len[j] = dx*dx + dy*dy + dz*dz;
+        }
+        r = 0;
+        if(len[1] > len[r]) r = 1;
+        if(len[2] > len[r]) r = 2;
+        rot[i] = r;
+        if(!r) continue;
+
+        for(j=0;j<3;j++) ind[j] = topo[(j+r)%3];
+        for(j=0;j<3;j++) topo[j] = ind[j];
+    }
+
+    for(j=0;j<MAXBOUNDARIES;j++) {
+        if(!bound[j].created) continue;
+        for(i=1;i<=bound[j].nosides;i++) {
+            if((k = bound[j].parent[i]))
+                bound[j].side[i] = RotatedSide(bound[j].side[i],rot[k]);
+            if((k = bound[j].parent2[i]))
+                bound[j].side2[i] = RotatedSide(bound[j].side2[i],rot[k]);
+        }
+    }
+
+    free_Ivector(rot,1,data->noelements);
+
+    if(info) printf("The longest edges were set as the refinement edges\n");
+    return(0);
+}
+
+
+Real EstimateErrorZZ(struct FemType *data,int variable,Real *errors,int info)
+/* Computes the error indicator of each element as the L2 norm of the
+   difference between the element gradient and the recovered gradient of
+   the variable. The recovered gradient at a node is the area weighted mean
+   of the gradients of its elements, and the norm is integrated with the
+   corner rule. Returns the global estimate, or a negative value on error. */
+{
+    int i,j,c,e,k,edofs,noelements,noknots,*topo;
+    Real *u,*gx,*gy,*area,*rx,*ry;
+    Real x0,y0,x1,y1,x2,y2,u0,u1,u2,d,w,sx,sy,dx,dy,s,total;
+
+    edofs = data->edofs[variable];
+    if(edofs <= 0) {
+        printf("EstimateErrorZZ: there is no variable %d\n",variable);
+        return(-1.0);
+    }
+    if(!CheckTriangles(data,"EstimateErrorZZ")) return(-1.0);
+
+    noelements = data->noelements;
+    noknots = data->noknots;
+    u = data->dofs[variable];
+
+    if(!data->invtopoexists) CreateInverseTopology(data,info);
+
+    area = Rvector(1,noelements);
+    gx = Rvector(1,edofs*noelements);
+    gy = Rvector(1,edofs*noelements);
+    rx = Rvector(1,edofs*noknots);
+    ry = Rvector(1,edofs*noknots);
+
+    /* The constant gradients of the elements */
+#pragma omp parallel for private(c,topo,x0,y0,x1,y1,x2,y2,u0,u1,u2,d) schedule(static)
+    for(e=1;e<=noelements;e++) {
+        topo = data->topology[e];
+        x0 = data->x[topo[0]]; y0 = data->y[topo[0]];
+        x1 = data->x[topo[1]]; y1 = data->y[topo[1]];
+        x2 = data->x[topo[2]]; y2 = data->y[topo[2]];
+        d = (x1-x0)*(y2-y0) - (x2-x0)*(y1-y0);
+        area[e] = 0.5 * fabs(d);
+
+        for(c=1;c<=edofs;c++) {
+            u0 = u[edofs*(topo[0]-1)+c];
+            u1 = u[edofs*(topo[1]-1)+c];
+            u2 = u[edofs*(topo[2]-1)+c];
+            if(d != 0.0) {
+                gx[edofs*(e-1)+c] = (u0*(y1-y2) + u1*(y2-y0) + u2*(y0-y1)) / d;
+                gy[edofs*(e-1)+c] = (u0*(x2-x1) + u1*(x0-x2) + u2*(x1-x0)) / d;
+            }
+            else {
+                gx[edofs*(e-1)+c] = gy[edofs*(e-1)+c] = 0.0;
+            }
+        }
+    }
+
+    /* The recovered gradients gathered from the elements of each node */
+#pragma omp parallel for private(j,c,k,w,sx,sy) schedule(static)
+    for(i=1;i<=noknots;i++) {
+        for(c=1;c<=edofs;c++) {
+            w = sx = sy = 0.0;
+            for(j=data->invtopooffset[i];j<data->invtopooffset[i+1];j++) {
+                k = data->invtopo[j];
+                w += area[k];
+                sx += area[k] * gx[edofs*(k-1)+c];
+                sy += area[k] * gy[edofs*(k-1)+c];
+            }
+            rx[edofs*(i-1)+c] = (w > 0.0) ? sx / w : 0.0;
+            ry[edofs*(i-1)+c] = (w > 0.0) ? sy / w : 0.0;
+        }
+    }
+
+    total = 0.0;
+#pragma omp parallel for private(j,c,topo,dx,dy,s) reduction(+:total) schedule(static)
+    for(e=1;e<=noelements;e++) {
+        topo = data->topology[e];
+        s = 0.0;
+        for(j=0;j<3;j++) {
+            for(c=1;c<=edofs;c++) {
+                dx = rx[edofs*(topo[j]-1)+c] - gx[edofs*(e-1)+c];
+                dy = ry[edofs*(topo[j]-1)+c] - gy[edofs*(e-1)+c];
+                s += dx*dx + dy*dy;
+            }
+        }
+        s *= area[e] / 3.0;
+        errors[e] = sqrt(s);
+        total += s;
+    }
+
+    free_Rvector(area,1,noelements);
+    free_Rvector(gx,1,edofs*noelements);
+    free_Rvector(gy,1,edofs*noelements);
+    free_Rvector(rx,1,edofs*noknots);
+    free_Rvector(ry,1,edofs*noknots);
+
+    total = sqrt(total);
+    if(info) printf("Estimated error of variable %s is %.4lg\n",data->dofname[variable],total);
+    return(total);
+}
+
+
+int MarkElementsDorfler(struct FemType *data,Real *errors,Real theta,int *marked,int info)
+/* Marks the elements of the largest errors that together carry at least the
+   fraction theta of the squared error. The threshold is found by bisection
+   so that no sorting is needed. Returns the number of marked elements. */
+{
+    int e,iter,noelements,nomarked;
+    Real total,emax,lo,hi,t,s,err;
+
+    noelements = data->noelements;
+
+    total = emax = 0.0;
+#pragma omp parallel for private(err) reduction(+:total) reduction(max:emax) schedule(static)
+    for(e=1;e<=noelements;e++) {
+        err = errors[e] * errors[e];
+        total += err;
+        emax = MAX(emax,err);
+    }
+
+    lo = 0.0;
+    hi = emax;
+    if(total > 0.0) {
+        for(iter=0;iter<DORFLERITERATIONS;iter++) {
+            t = 0.5 * (lo + hi);
+            s = 0.0;
+#pragma omp parallel for private(err) reduction(+:s) schedule(static)
+            for(e=1;e<=noelements;e++) {
+                err = errors[e] * errors[e];
+                if(err >= t) s += err;
+            }
+            if(s >= theta * total)
+                lo = t;
+            else
+                hi = t;
+        }
+    }
+
+    nomarked = 0;
+#pragma omp parallel for reduction(+:nomarked) schedule(static)
+    for(e=1;e<=noelements;e++) {
+        marked[e] = (total > 0.0 && errors[e] * errors[e] >= lo);
+        nomarked += marked[e];
+    }
+
+    if(info) printf("Marked %d elements out of %d for refinement\n",nomarked,noelements);
+    return(nomarked);
+}
+
+
+static void SetTriangle(int *topo,int v0,int v1,int v2)
+{
+    topo[0] = v0;
+    topo[1] = v1;
+    topo[2] = v2;
+}
+
+
+static int FindChildSide(int **newtopo,int child1,int child2,int sideelemtype,
+                         int node1,int node2,int *side)
+/* Finds the child of the old parent that owns the given edge or corner. */
+{
+    int c,s;
+
+    for(c=child1;c<=child2;c++) {
+        for(s=0;s<3;s++) {
+            if(sideelemtype == 101) {
+                if(newtopo[c][s] != node1) continue;
+                *side = 3+s;
+                return(c);
+            }
+            if((newtopo[c][s] == node1 && newtopo[c][(s+1)%3] == node2) ||
+               (newtopo[c][s] == node2 && newtopo[c][(s+1)%3] == node1)) {
+                *side = s;
+                return(c);
+            }
+        }
+    }
+    return(0);
+}
+
+
+int RefineMarkedElements(struct FemType *data,struct BoundaryType *bound,int *marked,int info)
+/* Refines the marked triangles by newest vertex bisection with a conforming
+   closure. The boundary sides are split with their edges and the nodal
+   fields are interpolated linearly to the new nodes. */
+{
+    int i,j,k,l,e,c,edofs,changed,noelements,noknots,noedges,newelements,newknots;
+    int nosides,newsides,side,sideelemtype,sideind[MAXNODESD1],leaf[3];
+    int *edgemid,*triedges,*first,*split,**newtopo,*newmaterial,*newtypes,*topo;
+    int *bmaterial,*bside,*bside2,*bparent,*bparent2,*btypes,*bnormal;
+    int v0,v1,v2,m,m2,m3,n1,n2,mark,node1,node2;
+    Real *newx,*newy,*newz,*newdofs[MAXDOFS];
+
+    if(!CheckTriangles(data,"RefineMarkedElements")) return(1);
+    for(j=0;j<MAXBOUNDARIES;j++) {
+        if(bound[j].created && (bound[j].ediscont || bound[j].topology)) {
+            printf("RefineMarkedElements: not implemented for boundaries with own topology\n");
+            return(2);
+        }
+    }
+
+    noelements = data->noelements;
+    noknots = data->noknots;
+
+    CreateEdgeTable(data,FALSE);
+    noedges = data->noedges;
+
+    /* The edges (0,1), (1,2) and (2,0) of each triangle */
+    triedges = Ivector(0,3*noelements-1);
+#pragma omp parallel for private(topo) schedule(static)
+    for(e=1;e<=noelements;e++) {
+        topo = data->topology[e];
+        triedges[3*(e-1)] = GetEdgeIndex(data,topo[0],topo[1]);
+        triedges[3*(e-1)+1] = GetEdgeIndex(data,topo[1],topo[2]);
+        triedges[3*(e-1)+2] = GetEdgeIndex(data,topo[2],topo[0]);
+    }
+
+    edgemid = Ivector(1,noedges);
+    for(i=1;i<=noedges;i++)
+        edgemid[i] = 0;
+    for(e=1;e<=noelements;e++)
+        if(marked[e]) edgemid[triedges[3*(e-1)]] = 1;
+
+    /* Conforming closure: mark the refinement edge of every triangle that
+       has any other edge marked until nothing changes. */
+    do {
+        changed = 0;
+#pragma omp parallel for private(mark) reduction(+:changed) schedule(static)
+        for(e=1;e<=noelements;e++) {
+#pragma omp atomic read
+            mark = edgemid[triedges[3*(e-1)]];
+            if(mark) continue;
+#pragma omp atomic read
+            mark = edgemid[triedges[3*(e-1)+1]];
+            if(!mark) {
+#pragma omp atomic read
+                mark = edgemid[triedges[3*(e-1)+2]];
+            }
+            if(!mark) continue;
+#pragma omp atomic write
+            edgemid[triedges[3*(e-1)]] = 1;
+            changed++;
+        }
+    } while(changed);
+
+    /* The new nodes are the midpoints of the marked edges */
+    newknots = 0;
+    for(i=1;i<=noedges;i++)
+        if(edgemid[i]) edgemid[i] = noknots + (++newknots);
+
+    /* The children of element e are first[e]...first[e+1]-1 */
+    first = Ivector(1,noelements+1);
+    newelements = 0;
+    for(e=1;e<=noelements;e++) {
+        first[e] = newelements+1;
+        if(!edgemid[triedges[3*(e-1)]])
+            newelements += 1;
+        else
+            newelements += 2 + (edgemid[triedges[3*(e-1)+1]] != 0) + (edgemid[triedges[3*(e-1)+2]] != 0);
+    }
+    first[noelements+1] = newelements+1;
+
+    newtopo = Imatrix(1,newelements,0,2);
+    newmaterial = Ivector(1,newelements);
+    newtypes = Ivector(1,newelements);
+
+#pragma omp parallel for private(c,topo,v0,v1,v2,m,m2,m3) schedule(static)
+    for(e=1;e<=noelements;e++) {
+        topo = data->topology[e];
+        v0 = topo[0];
+        v1 = topo[1];
+        v2 = topo[2];
+        c = first[e];
+
+        m = edgemid[triedges[3*(e-1)]];
+        if(!m) {
+            SetTriangle(newtopo[c],v0,v1,v2);
+        }
+        else {
+            /* (v2,v0,m) and its bisection along (v2,v0) */
+            m2 = edgemid[triedges[3*(e-1)+2]];
+            if(m2) {
+                SetTriangle(newtopo[c++],m,v2,m2);
+                SetTriangle(newtopo[c++],v0,m,m2);
+            }
+            else
+                SetTriangle(newtopo[c++],v2,v0,m);
+
+            /* (v1,v2,m) and its bisection along (v1,v2) */
+            m3 = edgemid[triedges[3*(e-1)+1]];
+            if(m3) {
+                SetTriangle(newtopo[c++],m,v1,m3);
+                SetTriangle(newtopo[c++],v2,m,m3);
+            }
+            else
+                SetTriangle(newtopo[c++],v1,v2,m);
+        }
+
+        for(c=first[e];c<first[e+1];c++) {
+            newmaterial[c] = data->material[e];
+            newtypes[c] = 303;
+        }
+    }
+
+    /* Coordinates and fields at the midpoints */
+    newx = Rvector(1,noknots+newknots);
+    newy = Rvector(1,noknots+newknots);
+    newz = Rvector(1,noknots+newknots);
+    for(i=1;i<=noknots;i++) {
+        newx[i] = data->x[i];
+        newy[i] = data->y[i];
+        newz[i] = data->z[i];
+    }
+    for(k=1;k<MAXDOFS;k++) {
+        newdofs[k] = NULL;
+        if((edofs = data->edofs[k]) <= 0) continue;
+        newdofs[k] = Rvector(1,edofs*(noknots+newknots));
+        for(i=1;i<=edofs*noknots;i++)
+            newdofs[k][i] = data->dofs[k][i];
+    }
+
+#pragma omp parallel for private(k,l,m,n1,n2,edofs) schedule(static)
+    for(i=1;i<=noedges;i++) {
+        if(!(m = edgemid[i])) continue;
+        n1 = data->edgenodes[2*i-1];
+        n2 = data->edgenodes[2*i];
+        newx[m] = 0.5 * (data->x[n1] + data->x[n2]);
+        newy[m] = 0.5 * (data->y[n1] + data->y[n2]);
+        newz[m] = 0.5 * (data->z[n1] + data->z[n2]);
+        for(k=1;k<MAXDOFS;k++) {
+            if((edofs = data->edofs[k]) <= 0) continue;
+            for(l=1;l<=edofs;l++)
+                newdofs[k][edofs*(m-1)+l] = 0.5 *
+                    (data->dofs[k][edofs*(n1-1)+l] + data->dofs[k][edofs*(n2-1)+l]);
+        }
+    }
+
+    /* Split the boundary sides with their edges and find the children that
+       own the pieces. */
+    for(j=0;j<MAXBOUNDARIES;j++) {
+        if(!bound[j].created || !bound[j].nosides) continue;
+
+        nosides = bound[j].nosides;
+        split = Ivector(1,nosides);
+        newsides = 0;
+        for(i=1;i<=nosides;i++) {
+            split[i] = 0;
+            GetElementSide(bound[j].parent[i],bound[j].side[i],bound[j].normal[i],
+                           data,sideind,&sideelemtype);
+            if(sideelemtype == 202)
+                split[i] = edgemid[GetEdgeIndex(data,sideind[0],sideind[1])];
+            newsides += split[i] ? 2 : 1;
+        }
+
+        bmaterial = Ivector(1,newsides);
+        bside = Ivector(1,newsides);
+        bside2 = Ivector(1,newsides);
+        bparent = Ivector(1,newsides);
+        bparent2 = Ivector(1,newsides);
+        btypes = Ivector(1,newsides);
+        bnormal = Ivector(1,newsides);
+
+        l = 0;
+        for(i=1;i<=nosides;i++) {
+            GetElementSide(bound[j].parent[i],bound[j].side[i],bound[j].normal[i],
+                           data,sideind,&sideelemtype);
+            leaf[0] = sideind[0];
+            if(sideelemtype == 202) {
+                leaf[1] = split[i] ? split[i] : sideind[1];
+                leaf[2] = sideind[1];
+            }
+
+            for(c=0;c<(split[i] ? 2 : 1);c++) {
+                l++;
+                bmaterial[l] = bound[j].material[i];
+                btypes[l] = bound[j].types[i];
+                bnormal[l] = bound[j].normal[i];
+                node1 = leaf[c];
+                node2 = (sideelemtype == 202) ? leaf[c+1] : 0;
+
+                bparent[l] = bparent2[l] = 0;
+                bside[l] = bside2[l] = 0;
+                if((k = bound[j].parent[i])) {
+                    bparent[l] = FindChildSide(newtopo,first[k],first[k+1]-1,sideelemtype,
+                                               node1,node2,&side);
+                    bside[l] = side;
+                }
+                if((k = bound[j].parent2[i])) {
+                    bparent2[l] = FindChildSide(newtopo,first[k],first[k+1]-1,sideelemtype,
+                                                node1,node2,&side);
+                    bside2[l] = side;
+                }
+                if((bound[j].parent[i] && !bparent[l]) || (bound[j].parent2[i] && !bparent2[l]))
+                    printf("Failed to find parent for side %d of %d\n",i,j);
+            }
+        }
+        free_Ivector(split,1,nosides);
+
+        DestroyBoundary(&bound[j]);
+        bound[j].created = TRUE;
+        bound[j].nosides = newsides;
+        bound[j].material = bmaterial;
+        bound[j].side = bside;
+        bound[j].side2 = bside2;
+        bound[j].parent = bparent;
+        bound[j].parent2 = bparent2;
+        bound[j].types = btypes;
+        bound[j].normal = bnormal;
+    }
+
+    free_Ivector(triedges,0,3*noelements-1);
+    free_Ivector(edgemid,1,noedges);
+    free_Ivector(first,1,noelements+1);
+
+    DestroyEdgeTable(data,FALSE);
+    DestroySideTable(data,FALSE);
+    if(data->invtopoexists) DestroyInverseTopology(data,FALSE);
+    if(data->dualexists) DestroyDualGraph(data,FALSE);
+
+    free_Imatrix(data->topology,1,noelements,0,data->maxnodes-1);
+    free_Ivector(data->material,1,noelements);
+    free_Ivector(data->elementtypes,1,noelements);
+    free_Rvector(data->x,1,noknots);
+    free_Rvector(data->y,1,noknots);
+    free_Rvector(data->z,1,noknots);
+
+    data->topology = newtopo;
+    data->material = newmaterial;
+    data->elementtypes = newtypes;
+    data->noelements = newelements;
+    data->maxnodes = 3;
+    data->x = newx;
+    data->y = newy;
+    data->z = newz;
+    data->noknots = noknots + newknots;
+
+    for(k=1;k<MAXDOFS;k++) {
+        if(data->edofs[k] <= 0) continue;
+        free_Rvector(data->dofs[k],1,data->alldofs[k]);
+        data->dofs[k] = newdofs[k];
+        data->alldofs[k] = data->edofs[k] * data->noknots;
+    }
+
+    if(info) printf("There are %d elements and %d nodes after refinement (was %d and %d)\n",
+                    newelements,data->noknots,noelements,noknots);
+    return(0);
+}
+
+
+int AdaptMesh(struct FemType *data,struct BoundaryType *bound,int variable,Real theta,int info)
+/* One adaptive step for the current solution of the variable: estimate,
+   mark the fraction theta of the error and refine. Returns the number of
+   refined elements, or a negative value if the mesh could not be adapted. */
+{
+    int noelements,nomarked,*marked;
+    Real *errors,total;
+
+    noelements = data->noelements;
+    errors = Rvector(1,noelements);
+    marked = Ivector(1,noelements);
+
+    nomarked = -1;
+    total = EstimateErrorZZ(data,variable,errors,info);
+    if(total >= 0.0) {
+        nomarked = MarkElementsDorfler(data,errors,theta,marked,info);
+        if(nomarked > 0 && RefineMarkedElements(data,bound,marked,info))
+            nomarked = -1;
+    }
+
+    free_Rvector(errors,1,noelements);
+    free_Ivector(marked,1,noelements);
+    return(nomarked);
+}
@@ -0,0 +1,14 @@
+/* egadapt.h */
+/* Adaptive h-refinement of linear triangle meshes. The error is estimated
+   element by element with the Zienkiewicz-Zhu gradient recovery, the elements
+   carrying the given fraction of the error are marked, and they are refined
+   by newest vertex bisection with a conforming closure. The nodal fields are
+   interpolated to the new nodes so that they may start the next solution.
+   One adaptive step is solve - AdaptMesh, and SetRefinementEdges is called
+   once before the first step. */
+
+int SetRefinementEdges(struct FemType *data,struct BoundaryType *bound,int info);
+Real EstimateErrorZZ(struct FemType *data,int variable,Real *errors,int info);
+int MarkElementsDorfler(struct FemType *data,Real *errors,Real theta,int *marked,int info);
+int RefineMarkedElements(struct FemType *data,struct BoundaryType *bound,int *marked,int info);
+int AdaptMesh(struct FemType *data,struct BoundaryType *bound,int variable,Real theta,int info);
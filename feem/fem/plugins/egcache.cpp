@@ -0,0 +1,570 @@
+/*
+   ElmerGrid - A simple mesh generation and manipulation utility
+   Copyright (C) 1995- , CSC - IT Center for Science Ltd.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* -------------------------------:  egcache.c  :----------------------------
+   Saves the mesh structures into a binary cache file and maps them back.
+   The file consists of a fixed header followed by flat arrays, each starting
+   at an 8-byte boundary:
+
+     x, y, z                       (Real, noknots each)
+     elementtypes, material        (int, noelements each)
+     topology                      (int, noelements*maxnodes, row-wise)
+     for each created boundary:
+       index, nosides              (int, padded)
+       parent, parent2, side, side2, types, material, normal (int, nosides each)
+     bodyname, boundaryname        (only if the names exist)
+
+   When loaded the 1-based vectors of FemType and BoundaryType point directly
+   into the mapped file. The mapping is private (copy-on-write) so the mesh may
+   be modified in place, but operations that reallocate the vectors must be
+   preceded by DetachMeshCache.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "egutils.h"
+#include "egdef.h"
+#include "egtypes.h"
+#include "egmesh.h"
+#include "egcache.h"
+
+#define MESHCACHE_MAGIC "EGMCACHE"
+#define MESHCACHE_ALIGN 8
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+
+struct MeshCacheHeader {
+    char magic[8];
+    int version,
+        headersize,      /* sizeof(struct MeshCacheHeader) of the writer */
+        realsize,        /* sizeof(Real) of the writer */
+        intsize;         /* sizeof(int) of the writer */
+    MeshCacheKey key;    /* hash of the geometry and the mesh settings */
+    long long filesize;
+    int noknots,
+        noelements,
+        maxnodes,
+        dim,
+        coordsystem,
+        noboundaries,
+        nobounds,        /* number of created BoundaryType structures */
+        bodynamesexist,
+        boundarynamesexist,
+        boundtype[MAXBOUNDARIES];
+};
+
+/* The mapping that the FemType owns while its vectors point into the file. */
+struct MeshCacheType {
+    char *base;
+    long long size;
+#ifdef _WIN32
+    HANDLE file,map;
+#endif
+};
+
+
+MeshCacheKey MeshCacheHash(const void *buf,long size,MeshCacheKey seed)
+/* 64-bit FNV-1a hash of the buffer. The seed allows chaining several buffers. */
+{
+    const unsigned char *p = (const unsigned char*) buf;
+    MeshCacheKey h;
+    long i;
+
+    h = seed ? seed : FNV_OFFSET;
+    for(i=0;i<size;i++) {
+        h ^= (MeshCacheKey) p[i];
+        h *= FNV_PRIME;
+    }
+    return(h);
+}
+
+
+MeshCacheKey MeshCacheFileKey(const char *filename,const char *settings)
+/* Key of the cache: the contents of the geometry file and the mesh settings
+   given as a string. Returns zero if the file cannot be read. */
+{
+    MeshCacheKey h;
+    int version;
+
+    version = MESHCACHE_VERSION;
+    h = MeshCacheHash(&version,sizeof(version),0);
+    h = MeshCacheAddFile(h,filename);
+
+    if(h && settings)
+        h = MeshCacheHash(settings,(long)strlen(settings),h);
+
+    return(h);
+}
+
+
+MeshCacheKey MeshCacheAddFile(MeshCacheKey key,const char *filename)
+/* Chains the name and the contents of a further file, e.g. one referenced by
+   a command file, into the key. Returns zero if the key is zero or the file
+   cannot be read. */
+{
+    FILE *in;
+    char buf[65536];
+    size_t n;
+    MeshCacheKey h;
+
+    if(!key) return(0);
+    if((in = fopen(filename,"rb")) == NULL) return(0);
+
+    h = MeshCacheHash(filename,(long)strlen(filename)+1,key);
+    while((n = fread(buf,1,sizeof(buf),in)) > 0)
+        h = MeshCacheHash(buf,(long)n,h);
+    fclose(in);
+
+    return(h);
+}
+
+
+static long long AlignCache(long long offset)
+{
+    return((offset + MESHCACHE_ALIGN - 1) / MESHCACHE_ALIGN * MESHCACHE_ALIGN);
+}
+
+
+static int WriteCacheArray(FILE *out,const void *v,long long size,long long *offset)
+{
+    static const char zeros[MESHCACHE_ALIGN] = {0};
+    long long pad;
+
+    pad = AlignCache(*offset) - *offset;
+    if(pad && fwrite(zeros,1,(size_t)pad,out) != (size_t)pad) return(1);
+    *offset += pad;
+
+    if(size && fwrite(v,1,(size_t)size,out) != (size_t)size) return(1);
+    *offset += size;
+    return(0);
+}
+
+
+int SaveMeshCache(struct FemType *data,struct BoundaryType *bound,
+                  const char *filename,MeshCacheKey key,int info)
+{
+    struct MeshCacheHeader header;
+    FILE *out;
+    char *buf;
+    long long offset;
+    int i,j,ne,nn,nodes,error,sides[2];
+    int *flat;
+
+    if(!data->created) {
+        printf("SaveMeshCache: Data is not created!\n");
+        return(1);
+    }
+
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,MESHCACHE_MAGIC,8);
+    header.version = MESHCACHE_VERSION;
+    header.headersize = sizeof(struct MeshCacheHeader);
+    header.realsize = sizeof(Real);
+    header.intsize = sizeof(int);
+    header.key = key;
+    header.noknots = nn = data->noknots;
+    header.noelements = ne = data->noelements;
+    header.maxnodes = nodes = data->maxnodes;
+    header.dim = data->dim;
+    header.coordsystem = data->coordsystem;
+    header.noboundaries = data->noboundaries;
+    header.bodynamesexist = data->bodynamesexist;
+    header.boundarynamesexist = data->boundarynamesexist;
+    for(i=0;i<MAXBOUNDARIES;i++) {
+        header.boundtype[i] = data->boundtype[i];
+        if(bound[i].created && bound[i].nosides) header.nobounds++;
+    }
+
+    if((out = fopen(filename,"wb")) == NULL) {
+        if(info) printf("SaveMeshCache: opening of file %s failed!\n",filename);
+        return(2);
+    }
+    /* Large sequential writes, let stdio collect them into big blocks */
+    buf = (char*) malloc(1<<20);
+    if(buf) setvbuf(out,buf,_IOFBF,1<<20);
+
+    error = (fwrite(&header,sizeof(header),1,out) != 1);
+    offset = sizeof(header);
+
+    error |= WriteCacheArray(out,&data->x[1],(long long)nn*sizeof(Real),&offset);
+    error |= WriteCacheArray(out,&data->y[1],(long long)nn*sizeof(Real),&offset);
+    error |= WriteCacheArray(out,&data->z[1],(long long)nn*sizeof(Real),&offset);
+    error |= WriteCacheArray(out,&data->elementtypes[1],(long long)ne*sizeof(int),&offset);
+    error |= WriteCacheArray(out,&data->material[1],(long long)ne*sizeof(int),&offset);
+
+    /* Imatrix rows are contiguous but write them row by row to be safe */
+    flat = &data->topology[1][0];
+    if(ne > 1 && data->topology[ne] == flat + (long long)(ne-1)*nodes) {
+        error |= WriteCacheArray(out,flat,(long long)ne*nodes*sizeof(int),&offset);
+    }
+    else {
+        error |= WriteCacheArray(out,NULL,0,&offset);
+        for(i=1;i<=ne;i++) {
+            error |= (fwrite(data->topology[i],sizeof(int),nodes,out) != (size_t)nodes);
+            offset += (long long)nodes*sizeof(int);
+        }
+    }
+
+    for(j=0;j<MAXBOUNDARIES;j++) {
+        if(!bound[j].created || !bound[j].nosides) continue;
+        sides[0] = j;
+        sides[1] = bound[j].nosides;
+        error |= WriteCacheArray(out,sides,sizeof(sides),&offset);
+        error |= WriteCacheArray(out,&bound[j].parent[1],(long long)sides[1]*sizeof(int),&offset);
+        error |= WriteCacheArray(out,&bound[j].parent2[1],(long long)sides[1]*sizeof(int),&offset);
+        error |= WriteCacheArray(out,&bound[j].side[1],(long long)sides[1]*sizeof(int),&offset);
+        error |= WriteCacheArray(out,&bound[j].side2[1],(long long)sides[1]*sizeof(int),&offset);
+        error |= WriteCacheArray(out,&bound[j].types[1],(long long)sides[1]*sizeof(int),&offset);
+        error |= WriteCacheArray(out,&bound[j].material[1],(long long)sides[1]*sizeof(int),&offset);
+        error |= WriteCacheArray(out,&bound[j].normal[1],(long long)sides[1]*sizeof(int),&offset);
+    }
+
+    if(data->bodynamesexist)
+        error |= WriteCacheArray(out,data->bodyname,sizeof(data->bodyname),&offset);
+    if(data->boundarynamesexist)
+        error |= WriteCacheArray(out,data->boundaryname,sizeof(data->boundaryname),&offset);
+
+    /* The size is written last so that a truncated file is never accepted */
+    header.filesize = offset;
+    fseek(out,0,SEEK_SET);
+    error |= (fwrite(&header,sizeof(header),1,out) != 1);
+    fclose(out);
+    if(buf) free(buf);
+
+    if(error) {
+        printf("SaveMeshCache: writing of file %s failed!\n",filename);
+        remove(filename);
+        return(3);
+    }
+
+    if(info) printf("Saved mesh cache %s of %lld bytes\n",filename,offset);
+    return(0);
+}
+
+
+static struct MeshCacheType *MapCacheFile(const char *filename)
+{
+    struct MeshCacheType *cache;
+
+    cache = (struct MeshCacheType*) calloc(1,sizeof(struct MeshCacheType));
+    if(!cache) return(NULL);
+
+#ifdef _WIN32
+    {
+        LARGE_INTEGER size;
+
+        cache->file = CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,
+                                  OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+        if(cache->file == INVALID_HANDLE_VALUE) goto fail;
+        if(!GetFileSizeEx(cache->file,&size) || size.QuadPart == 0) {
+            CloseHandle(cache->file);
+            goto fail;
+        }
+        cache->size = size.QuadPart;
+        cache->map = CreateFileMappingA(cache->file,NULL,PAGE_WRITECOPY,0,0,NULL);
+        if(!cache->map) {
+            CloseHandle(cache->file);
+            goto fail;
+        }
+        cache->base = (char*) MapViewOfFile(cache->map,FILE_MAP_COPY,0,0,0);
+        if(!cache->base) {
+            CloseHandle(cache->map);
+            CloseHandle(cache->file);
+            goto fail;
+        }
+    }
+#else
+    {
+        struct stat st;
+        int fd;
+        void *p;
+
+        if((fd = open(filename,O_RDONLY)) < 0) goto fail;
+        if(fstat(fd,&st) || st.st_size == 0) {
+            close(fd);
+            goto fail;
+        }
+        cache->size = st.st_size;
+        p = mmap(NULL,(size_t)cache->size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+        close(fd);
+        if(p == MAP_FAILED) goto fail;
+        cache->base = (char*) p;
+    }
+#endif
+    return(cache);
+
+fail:
+    free(cache);
+    return(NULL);
+}
+
+
+static void UnmapCacheFile(struct MeshCacheType *cache)
+{
+    if(!cache) return;
+#ifdef _WIN32
+    UnmapViewOfFile(cache->base);
+    CloseHandle(cache->map);
+    CloseHandle(cache->file);
+#else
+    munmap(cache->base,(size_t)cache->size);
+#endif
+    free(cache);
+}
+
+
+static void *CacheArray(struct MeshCacheType *cache,long long size,long long *offset)
+/* Returns the address of the next array, or NULL if it does not fit in the file */
+{
+    char *p;
+
+    *offset = AlignCache(*offset);
+    if(*offset + size > cache->size) return(NULL);
+    p = cache->base + *offset;
+    *offset += size;
+    return(p);
+}
+
+
+int LoadMeshCache(struct FemType *data,struct BoundaryType *bound,
+                  const char *filename,MeshCacheKey key,int info)
+/* Maps the cache file and sets the mesh structures to point to it.
+   Returns nonzero if the file does not exist or is not valid for the key,
+   in which case the structures are left untouched. */
+{
+    struct MeshCacheType *cache;
+    struct MeshCacheHeader *header;
+    long long offset;
+    int i,j,ne,nn,nodes,nobounds;
+    int *sides[MAXBOUNDARIES],*ivec[MAXBOUNDARIES][7],*flat;
+    char *bodynames,*boundarynames;
+    Real *x,*y,*z;
+    int *elementtypes,*material;
+
+    cache = MapCacheFile(filename);
+    if(!cache) return(1);
+
+    header = (struct MeshCacheHeader*) cache->base;
+    if(cache->size < (long long)sizeof(struct MeshCacheHeader) ||
+       memcmp(header->magic,MESHCACHE_MAGIC,8) ||
+       header->version != MESHCACHE_VERSION ||
+       header->headersize != (int)sizeof(struct MeshCacheHeader) ||
+       header->realsize != (int)sizeof(Real) ||
+       header->intsize != (int)sizeof(int) ||
+       header->filesize != cache->size) {
+        if(info) printf("Mesh cache %s is not valid, ignoring it\n",filename);
+        UnmapCacheFile(cache);
+        return(2);
+    }
+    if(header->key != key) {
+        if(info) printf("Mesh cache %s is outdated, ignoring it\n",filename);
+        UnmapCacheFile(cache);
+        return(3);
+    }
+
+    nn = header->noknots;
+    ne = header->noelements;
+    nodes = header->maxnodes;
+    nobounds = header->nobounds;
+    offset = sizeof(struct MeshCacheHeader);
+
+    /* Locate all the arrays before touching the structures */
+    x = (Real*) CacheArray(cache,(long long)nn*sizeof(Real),&offset);
+    y = (Real*) CacheArray(cache,(long long)nn*sizeof(Real),&offset);
+    z = (Real*) CacheArray(cache,(long long)nn*sizeof(Real),&offset);
+    elementtypes = (int*) CacheArray(cache,(long long)ne*sizeof(int),&offset);
+    material = (int*) CacheArray(cache,(long long)ne*sizeof(int),&offset);
+    flat = (int*) CacheArray(cache,(long long)ne*nodes*sizeof(int),&offset);
+    if(!x || !y || !z || !elementtypes || !material || !flat) goto corrupt;
+    if(nobounds < 0 || nobounds > MAXBOUNDARIES) goto corrupt;
+
+    for(j=0;j<nobounds;j++) {
+        sides[j] = (int*) CacheArray(cache,2*sizeof(int),&offset);
+        if(!sides[j] || sides[j][0] < 0 || sides[j][0] >= MAXBOUNDARIES || sides[j][1] < 0)
+            goto corrupt;
+        for(i=0;i<7;i++) {
+            ivec[j][i] = (int*) CacheArray(cache,(long long)sides[j][1]*sizeof(int),&offset);
+            if(!ivec[j][i]) goto corrupt;
+        }
+    }
+
+    bodynames = boundarynames = NULL;
+    if(header->bodynamesexist) {
+        bodynames = (char*) CacheArray(cache,sizeof(data->bodyname),&offset);
+        if(!bodynames) goto corrupt;
+    }
+    if(header->boundarynamesexist) {
+        boundarynames = (char*) CacheArray(cache,sizeof(data->boundaryname),&offset);
+        if(!boundarynames) goto corrupt;
+    }
+
+    DestroyKnots(data);
+    for(j=0;j<MAXBOUNDARIES;j++)
+        DestroyBoundary(&bound[j]);
+
+    InitializeKnots(data);
+    data->noknots = nn;
+    data->noelements = ne;
+    data->maxnodes = nodes;
+    data->dim = header->dim;
+    data->coordsystem = header->coordsystem;
+    data->noboundaries = header->noboundaries;
+    for(i=0;i<MAXBOUNDARIES;i++)
+        data->boundtype[i] = header->boundtype[i];
+
+    /* Vectors are 1-based, so point them one element before the data */
+    data->x = x - 1;
+    data->y = y - 1;
+    data->z = z - 1;
+    data->elementtypes = elementtypes - 1;
+    data->material = material - 1;
+
+    /* Only the row pointers of the topology are allocated */
+    data->topology = (int**) malloc((size_t)(ne+1)*sizeof(int*));
+    if(!data->topology) nrerror("allocation failure in LoadMeshCache()");
+    for(i=1;i<=ne;i++)
+        data->topology[i] = flat + (long long)(i-1)*nodes;
+
+    data->mapped = TRUE;
+    data->meshcache = cache;
+    data->created = TRUE;
+
+    for(j=0;j<nobounds;j++) {
+        struct BoundaryType *b = &bound[sides[j][0]];
+        b->created = TRUE;
+        b->mapped = TRUE;
+        b->nosides = sides[j][1];
+        b->ediscont = FALSE;
+        b->parent = ivec[j][0] - 1;
+        b->parent2 = ivec[j][1] - 1;
+        b->side = ivec[j][2] - 1;
+        b->side2 = ivec[j][3] - 1;
+        b->types = ivec[j][4] - 1;
+        b->material = ivec[j][5] - 1;
+        b->normal = ivec[j][6] - 1;
+        b->elementtypes = NULL;
+        b->topology = NULL;
+    }
+
+    if(bodynames) {
+        memcpy(data->bodyname,bodynames,sizeof(data->bodyname));
+        data->bodynamesexist = TRUE;
+    }
+    if(boundarynames) {
+        memcpy(data->boundaryname,boundarynames,sizeof(data->boundaryname));
+        data->boundarynamesexist = TRUE;
+    }
+
+    if(info) printf("Mapped mesh cache %s with %d nodes and %d elements\n",
+                    filename,nn,ne);
+    return(0);
+
+corrupt:
+    printf("LoadMeshCache: file %s is corrupted!\n",filename);
+    UnmapCacheFile(cache);
+    return(4);
+}
+
+
+int DetachMeshCache(struct FemType *data,struct BoundaryType *bound,int info)
+/* Copies the mapped vectors into ordinary allocations so that the mesh may be
+   manipulated with all the routines, and releases the mapping. */
+{
+    int i,j,ne,nn,nodes,nosides;
+    int **topology;
+    int **ivec[7];
+
+    if(!data->mapped) return(0);
+
+    nn = data->noknots;
+    ne = data->noelements;
+    nodes = data->maxnodes;
+
+    {
+        Real *x,*y,*z;
+        int *elementtypes,*material;
+
+        x = Rvector(1,nn);
+        y = Rvector(1,nn);
+        z = Rvector(1,nn);
+        memcpy(&x[1],&data->x[1],(size_t)nn*sizeof(Real));
+        memcpy(&y[1],&data->y[1],(size_t)nn*sizeof(Real));
+        memcpy(&z[1],&data->z[1],(size_t)nn*sizeof(Real));
+        data->x = x;
+        data->y = y;
+        data->z = z;
+
+        elementtypes = Ivector(1,ne);
+        material = Ivector(1,ne);
+        memcpy(&elementtypes[1],&data->elementtypes[1],(size_t)ne*sizeof(int));
+        memcpy(&material[1],&data->material[1],(size_t)ne*sizeof(int));
+        data->elementtypes = elementtypes;
+        data->material = material;
+    }
+
+    topology = Imatrix(1,ne,0,nodes-1);
+    for(i=1;i<=ne;i++)
+        memcpy(topology[i],data->topology[i],(size_t)nodes*sizeof(int));
+    free(data->topology);
+    data->topology = topology;
+
+    for(j=0;j<MAXBOUNDARIES;j++) {
+        if(!bound[j].created || !bound[j].mapped) continue;
+        nosides = bound[j].nosides;
+        ivec[0] = &bound[j].parent;
+        ivec[1] = &bound[j].parent2;
+        ivec[2] = &bound[j].side;
+        ivec[3] = &bound[j].side2;
+        ivec[4] = &bound[j].types;
+        ivec[5] = &bound[j].material;
+        ivec[6] = &bound[j].normal;
+        for(i=0;i<7;i++) {
+            int *v = Ivector(1,nosides);
+            memcpy(&v[1],&(*ivec[i])[1],(size_t)nosides*sizeof(int));
+            *ivec[i] = v;
+        }
+        bound[j].mapped = FALSE;
+    }
+
+    CloseMeshCache(data);
+
+    if(info) printf("Detached the mesh from the cache file\n");
+    return(0);
+}
+
+
+void CloseMeshCache(struct FemType *data)
+/* Releases the mapping. Called by DestroyKnots and DetachMeshCache. */
+{
+    UnmapCacheFile((struct MeshCacheType*) data->meshcache);
+    data->meshcache = NULL;
+    data->mapped = FALSE;
+}
@@ -0,0 +1,23 @@
+/* egcache.h */
+/* A versioned binary cache of the native FemType and BoundaryType structures.
+   The arrays are stored flat and 8-byte aligned so that the file may be mapped
+   into memory and used without copying. The cache is keyed by a 64-bit hash of
+   the geometry, the files it refers to and the mesh settings so that an
+   unchanged model is not meshed again. The version changes with the format
+   and with the defaults of the meshing pipeline. */
+
+#define MESHCACHE_VERSION 2
+#define MESHCACHE_SUFFIX ".egc"
+
+typedef unsigned long long MeshCacheKey;
+
+MeshCacheKey MeshCacheHash(const void *buf,long size,MeshCacheKey seed);
+MeshCacheKey MeshCacheFileKey(const char *filename,const char *settings);
+MeshCacheKey MeshCacheAddFile(MeshCacheKey key,const char *filename);
+
+int SaveMeshCache(struct FemType *data,struct BoundaryType *bound,
+                  const char *filename,MeshCacheKey key,int info);
+int LoadMeshCache(struct FemType *data,struct BoundaryType *bound,
+                  const char *filename,MeshCacheKey key,int info);
+int DetachMeshCache(struct FemType *data,struct BoundaryType *bound,int info);
+void CloseMeshCache(struct FemType *data);
@@ -127,16 +127,31 @@ static int Comsolrow(char *line1,FILE *io)
 
 
 
+static int CompareIntegers(const void *a,const void *b)
+{
+    int i1,i2;
+
+    i1 = *(const int*)a;
+    i2 = *(const int*)b;
+    return((i1 > i2) - (i1 < i2));
+}
+
+
 static void FindPointParents(struct FemType *data,struct BoundaryType *bound,
                              int boundarynodes,int *nodeindx,int *boundindx,int info)
+/* Creates the side elements whose all nodes are boundary nodes of the same
+   type. Only the elements touching the nodes of the type are visited, and a
+   side shared by two elements is paired through the side table. */
 {
-    int i,j,k,sideelemtype,elemind,*indx;
-    int boundarytype,minboundary,maxboundary,minnode,maxnode,sideelem,elemtype;
-    int sideind[MAXNODESD1],elemsides,side,sidenodes,hit,nohits;
-    int *elemhits;
+    int i,j,k,sideelemtype,elemind,ind,noknots,stamp;
+    int boundarytype,minboundary,maxboundary,minnode,maxnode,sideelem;
+    int sideind[MAXNODESD1],elemsides,side,sidenodes,hit,sideindex,ownsinvtopo;
+    int *indx,*typeoffset,*typenodes,*elemmark,*elems,*firstside;
+    int notypes,noelems,boundfirst;
 
     info = TRUE;
 
+    noknots = data->noknots;
     sideelem = 0;
     maxboundary = minboundary = boundindx[1];
     minnode = maxnode = nodeindx[1];
@@ -152,125 +167,118 @@ static void FindPointParents(struct FemType *data,struct BoundaryType *bound,
         printf("Boundary types are in interval [%d, %d]\n",minboundary,maxboundary);
         printf("Boundary nodes are in interval [%d, %d]\n",minnode,maxnode);
     }
-    indx = Ivector(1,data->noknots);
 
-    elemhits = Ivector(1,data->noknots);
-    for(i=1;i<=data->noknots;i++) elemhits[i] = 0;
-
-    for(elemind=1;elemind<=data->noelements;elemind++) {
-        elemtype = data->elementtypes[elemind];
-        elemsides = elemtype % 100;
-
-        for(i=0;i<elemsides;i++) {
-            elemhits[data->topology[elemind][i]] += 1;
-        }
-    }
+    ownsinvtopo = !data->invtopoexists;
+    if(ownsinvtopo) CreateInverseTopology(data,FALSE);
+    CreateSideTable(data,FALSE);
+
+    /* Sort the boundary nodes by their type */
+    notypes = maxboundary - minboundary + 1;
+    typeoffset = Ivector(0,notypes);
+    for(i=0;i<=notypes;i++) typeoffset[i] = 0;
+    for(i=1;i<=boundarynodes;i++)
+        if(nodeindx[i] >= 1 && nodeindx[i] <= noknots)
+            typeoffset[boundindx[i]-minboundary+1] += 1;
+    for(i=0;i<notypes;i++)
+        typeoffset[i+1] += typeoffset[i];
+    typenodes = Ivector(0,MAX(typeoffset[notypes],1)-1);
+    for(i=1;i<=boundarynodes;i++)
+        if(nodeindx[i] >= 1 && nodeindx[i] <= noknots)
+            typenodes[typeoffset[boundindx[i]-minboundary]++] = nodeindx[i];
+    for(i=notypes;i>0;i--)
+        typeoffset[i] = typeoffset[i-1];
+    typeoffset[0] = 0;
 
+    indx = Ivector(1,noknots);
+    for(i=1;i<=noknots;i++) indx[i] = 0;
+    elemmark = Ivector(1,data->noelements);
+    for(i=1;i<=data->noelements;i++) elemmark[i] = 0;
+    elems = Ivector(0,MAX(data->noelements,1)-1);
+    firstside = Ivector(1,MAX(data->nouniquesides,1));
+    for(i=1;i<=data->nouniquesides;i++) firstside[i] = 0;
 
     for(boundarytype=minboundary;boundarytype <= maxboundary;boundarytype++) {
-        int boundfirst,bchits,bcsame,sideelemtype2;
-        int sideind2[MAXNODESD1];
-
-        boundfirst = 0;
-
-        for(i=1;i<=data->noknots;i++)
-            indx[i] = 0;
-
-        for(i=1;i<=boundarynodes;i++) {
-            if(boundindx[i] == boundarytype)
-                indx[nodeindx[i]] = TRUE;
+        k = boundarytype - minboundary;
+        if(typeoffset[k] == typeoffset[k+1]) continue;
+
+        stamp = k + 1;
+        boundfirst = sideelem + 1;
+
+        /* Mark the nodes of the type and gather the elements touching them */
+        noelems = 0;
+        for(j=typeoffset[k];j<typeoffset[k+1];j++) {
+            ind = typenodes[j];
+            indx[ind] = stamp;
+            for(i=data->invtopooffset[ind];i<data->invtopooffset[ind+1];i++) {
+                elemind = data->invtopo[i];
+                if(elemmark[elemind] == stamp) continue;
+                elemmark[elemind] = stamp;
+                elems[noelems++] = elemind;
+            }
         }
+        qsort(elems,(size_t) noelems,sizeof(int),CompareIntegers);
 
-
-        for(elemind=1;elemind<=data->noelements;elemind++) {
-            elemtype = data->elementtypes[elemind];
-            elemsides = elemtype / 100;
-            if(elemsides == 8) elemsides = 6;
-            else if(elemsides == 5) elemsides = 4;
-            else if(elemsides == 6) elemsides = 5;
-
-            if(0) printf("ind=%d  type=%d  sides=%d\n",elemind,elemtype,elemsides);
+        for(j=0;j<noelems;j++) {
+            elemind = elems[j];
+            elemsides = data->elemsideoffset[elemind+1] - data->elemsideoffset[elemind];
 
             /* Check whether the bc nodes occupy every node in the selected side */
             for(side=0;side<elemsides;side++) {
                 GetElementSide(elemind,side,1,data,&sideind[0],&sideelemtype);
                 sidenodes = sideelemtype%100;
 
-                if(0) printf("sidenodes=%d  side=%d\n",sidenodes,side);
-
                 hit = TRUE;
-                nohits = 0;
                 for(i=0;i<sidenodes;i++) {
-                    if(sideind[i] <= 0) {
-                        if(0) printf("sideind[%d] = %d\n",i,sideind[i]);
+                    if(sideind[i] <= 0 || sideind[i] > noknots)
                         hit = FALSE;
-                    }
-                    else if(sideind[i] > data->noknots) {
-                        if(0) printf("sideind[%d] = %d (noknots=%d)\n",i,sideind[i],data->noknots);
-                        hit = FALSE;
-                    }
-                    else if(!indx[sideind[i]]) {
+                    else if(indx[sideind[i]] != stamp)
                         hit = FALSE;
+                }
+                if(!hit) continue;
+
+                /* The same side in another element becomes the second parent */
+                sideindex = data->elemsides[data->elemsideoffset[elemind]+side];
+                ind = sideindex ? firstside[sideindex] : 0;
+
+                if(ind && !bound->parent2[ind]) {
+                    if(data->material[bound->parent[ind]] > data->material[elemind]) {
+                        bound->parent2[ind] = bound->parent[ind];
+                        bound->side2[ind] = bound->side[ind];
+                        bound->parent[ind] = elemind;
+                        bound->side[ind] = side;
                     }
                     else {
-                        nohits++;
-                    }
-                }
-
-
-                if(hit == TRUE) {
-
-                    /* If all the points belong to more than one element there may be
-             another parent for the side element */
-                    bcsame = FALSE;
-                    bchits = TRUE;
-                    for(i=0;i<sidenodes;i++)
-                        if(elemhits[sideind[i]] < 2) bchits = FALSE;
-
-                    if(bchits && boundfirst) {
-                        for(j=boundfirst;j<=sideelem;j++) {
-                            if(bound->parent2[j]) continue;
-                            GetElementSide(bound->parent[j],bound->side[j],1,data,&sideind2[0],&sideelemtype2);
-                            if(sideelemtype != sideelemtype2) continue;
-                            bcsame = 0;
-                            for(i=0;i<sidenodes;i++)
-                                for(k=0;k<sidenodes;k++)
-                                    if(sideind[i] == sideind2[k]) bcsame++;
-
-                            if(bcsame == sidenodes) {
-                                if(data->material[bound->parent[j]] > data->material[elemind]) {
-                                    bound->parent2[j] = bound->parent[j];
-                                    bound->side2[j] = bound->side[j];
-                                    bound->parent[j] = elemind;
-                                    bound->side[j] = side;
-                                }
-                                else {
-                                    bound->parent2[j] = elemind;
-                                    bound->side2[j] = side;
-                                }
-                                goto bcset;
-                            }
-                        }
+                        bound->parent2[ind] = elemind;
+                        bound->side2[ind] = side;
                     }
-
-                    sideelem += 1;
-                    bound->parent[sideelem] = elemind;
-                    bound->side[sideelem] = side;
-                    bound->parent2[sideelem] = 0;
-                    bound->side2[sideelem] = 0;
-                    bound->types[sideelem] = boundarytype;
-
-                    if(!boundfirst) boundfirst = sideelem;
-
-bcset:
                     continue;
                 }
+
+                sideelem += 1;
+                bound->parent[sideelem] = elemind;
+                bound->side[sideelem] = side;
+                bound->parent2[sideelem] = 0;
+                bound->side2[sideelem] = 0;
+                bound->types[sideelem] = boundarytype;
+                if(sideindex) firstside[sideindex] = sideelem;
             }
         }
-    }
 
+        /* Sides of different types are never paired */
+        for(i=boundfirst;i<=sideelem;i++) {
+            elemind = bound->parent[i];
+            sideindex = data->elemsides[data->elemsideoffset[elemind]+bound->side[i]];
+            if(sideindex) firstside[sideindex] = 0;
+        }
+    }
 
-    free_Ivector(indx,1,data->noknots);
+    free_Ivector(firstside,1,MAX(data->nouniquesides,1));
+    free_Ivector(elems,0,MAX(data->noelements,1)-1);
+    free_Ivector(elemmark,1,data->noelements);
+    free_Ivector(indx,1,noknots);
+    free_Ivector(typenodes,0,MAX(typeoffset[notypes],1)-1);
+    free_Ivector(typeoffset,0,notypes);
+    if(ownsinvtopo) DestroyInverseTopology(data,FALSE);
 
     if(info) printf("Found %d side elements formed by %d points.\n",
                     sideelem,boundarynodes);
@@ -515,6 +523,9 @@ end:
             for(j=1;j<=noelements;j++)
                 for(i=0;i < data->elementtypes[j]%100;i++)
                     data->topology[j][i] = ind[data->topology[j][i]];
+
+            /* The side table of FindPointParents is hashed with the old numbers */
+            DestroySideTable(data,FALSE);
         }
 
         free_ivector(ind,1,maxknot);
@@ -1927,14 +1938,13 @@ int LoadTriangleInput(struct FemType *data,struct BoundaryType *bound,
                 sscanf(line,"%d %d %d",&j,&ind1,&ind2);
 
             /* find an element which owns both the nodes */
-            for(j=1;j<=data->maxinvtopo;j++) {
+            hit = FALSE;
+            for(j=data->invtopooffset[ind1];j<data->invtopooffset[ind1+1];j++) {
                 hit = FALSE;
-                k = data->invtopo[j][ind1];
-                if(!k) break;
+                k = data->invtopo[j];
 
-                for(j2=1;j2<=data->maxinvtopo;j2++) {
-                    k2 = data->invtopo[j2][ind2];
-                    if(!k2) break;
+                for(j2=data->invtopooffset[ind2];j2<data->invtopooffset[ind2+1];j2++) {
+                    k2 = data->invtopo[j2];
                     if(k == k2) {
                         hit = TRUE;
                         elemind = k;
@@ -62,6 +62,9 @@
 #include "egmesh.h"
 #include "egnative.h"
 #include "egconvert.h"
+#include "egcache.h"
+#include "egparallel.h"
+#include "egadapt.h"
 
 
 #if EXE_MODE
@@ -226,6 +229,30 @@ int InlineParameters(struct ElmergridType *eg,int argc,char *argv[],const char *
             eg->order = 2;
         }
 
+        if(strcmp(argv[arg],"-noarena") == 0) {
+            eg->arena = 0;
+        }
+        if(strcmp(argv[arg],"-hugepages") == 0) {
+            eg->arena = 2;
+        }
+
+        if(strcmp(argv[arg],"-adapt") == 0) {
+            if(arg+1 >= argc) {
+                printf("Give the fraction of the error to be refined.\n");
+                return(15);
+            }
+            else {
+                eg->adapt = atof(argv[arg+1]);
+            }
+        }
+
+        if(strcmp(argv[arg],"-quality") == 0) {
+            eg->quality = 10;
+            if(arg+1 < argc) {
+                if(argv[arg+1][0] != '-') eg->quality = MAX(1,atoi(argv[arg+1]));
+            }
+        }
+
         if(strcmp(argv[arg],"-halo") == 0) {
             eg->partitionhalo = TRUE;
         }
@@ -440,9 +467,29 @@ int InlineParameters(struct ElmergridType *eg,int argc,char *argv[],const char *
             }
 #else
             printf("This version of ElmerGrid was compiled without Metis library!\n");
+            if(arg+1 < argc) {
+                eg->multilevel = atoi(argv[arg+1]);
+                printf("The mesh will be partitioned with the built-in multilevel method to %d partitions.\n",
+                       eg->multilevel);
+            }
 #endif     
         }
 
+        if(strcmp(argv[arg],"-multilevel") == 0) {
+            if(arg+1 >= argc) {
+                printf("The number of partitions is required as a parameter\n");
+                return(15);
+            }
+            else {
+                eg->multilevel = atoi(argv[arg+1]);
+                printf("The mesh will be partitioned with the built-in multilevel method to %d partitions.\n",
+                       eg->multilevel);
+                eg->partopt = 0;
+                if(arg+2 < argc)
+                    if(argv[arg+2][0] != '-') eg->partopt = atoi(argv[arg+2]);
+            }
+        }
+
         if(strcmp(argv[arg],"-periodic") == 0) {
             if(arg+dim >= argc) {
                 printf("Give the periodic coordinate directions (e.g. 1 1 0)\n");
@@ -455,6 +502,16 @@ int InlineParameters(struct ElmergridType *eg,int argc,char *argv[],const char *
             }
         }
 
+        if(strcmp(argv[arg],"-periodicangle") == 0) {
+            if(arg+1 >= argc) {
+                printf("Give the sector angle of rotational periodicity in degrees\n");
+                return(16);
+            }
+            else {
+                eg->periodicangle = atof(argv[arg+1]);
+            }
+        }
+
         if(strcmp(argv[arg],"-discont") == 0) {
             if(arg+1 >= argc) {
                 printf("Give the discontinuous boundary conditions.\n");
@@ -678,6 +735,7 @@ static void Instructions()
     printf("-relh real           : give relative mesh density parameter for ElmerGrid meshing\n");
     printf("-merge real          : merges nodes that are close to each other\n");
     printf("-order real[3]       : reorder elements and nodes using c1*x+c2*y+c3*z\n");
+    printf("-autoorder           : reorder nodes by Cuthill-McKee and elements by Hilbert curve\n");
     printf("-centralize          : set the center of the mesh to origin\n");
     printf("-scale real[3]       : scale the coordinates with vector real[3]\n");
     printf("-translate real[3]   : translate the nodes with vector real[3]\n");
@@ -707,6 +765,10 @@ static void Instructions()
     printf("-3d / -2d / -1d      : mesh is 3, 2 or 1-dimensional (applies to examples)\n");
     printf("-isoparam            : ensure that higher order elements are convex\n");
     printf("-nobound             : disable saving of boundary elements in ElmerPost format\n");
+    printf("-noarena             : allocate the meshes with malloc instead of mesh arenas\n");
+    printf("-hugepages           : back the mesh arenas with huge pages where available\n");
+    printf("-adapt real          : refine the triangles carrying the fraction real of the estimated error\n");
+    printf("-quality [int]       : analyse the element quality and list the int worst elements\n");
 
     printf("\nThe following keywords are related only to the parallel Elmer computations.\n");
     printf("-partition int[4]    : the mesh will be partitioned in main directions\n");
@@ -714,9 +776,11 @@ static void Instructions()
 #if HAVE_METIS
     printf("-metis int[2]        : the mesh will be partitioned with Metis\n");
 #endif
+    printf("-multilevel int[2]   : the mesh will be partitioned with the built-in multilevel method\n");
     printf("-halo                : create halo for the partitioning\n");
     printf("-indirect            : create indirect connections in the partitioning\n");
     printf("-periodic int[3]     : decleare the periodic coordinate directions for parallel meshes\n");
+    printf("-periodicangle real  : sector angle of rotational periodicity about the z-axis\n");
     printf("-saveinterval int[3] : the first, last and step for fusing parallel data\n");
 
     if(0) printf("-names               : conserve name information where applicable\n");
@@ -750,8 +814,14 @@ static int PartitionMesh(int nofile)
         noopt = eg.partopt / 5;
     }
 #endif
-    if(eg.partitions || eg.metis )
-        OptimizePartitioning(&data[nofile],boundaries[nofile],noopt,info);
+    if(eg.multilevel) {
+        PartitionMultilevelElements(&data[nofile],eg.multilevel,info);
+        noopt = eg.partopt;
+    }
+    if(eg.partitions || eg.metis || eg.multilevel)
+        OptimizePartitioning(&data[nofile],noopt,info);
+
+    return(0);
 }
 
 
@@ -1038,24 +1108,33 @@ static int DetermineFileType(const char *filename,int info)
 
 
 
-static int ImportMeshDefinition(int inmethod,int nofile,char *filename,int *nogrids)
+static void AllocateBoundaryCases(void)
 {
-    int i,k,errorstat = 0,dim;
+    int i,k;
     static int visited = FALSE;
 
-
-    *nogrids = 0;
-    if(!visited) {
-        for(k=0;k<MAXCASES;k++) {
-            boundaries[k] = (struct BoundaryType*)
-                    malloc((size_t) (MAXBOUNDARIES)*sizeof(struct BoundaryType));
-            for(i=0;i<MAXBOUNDARIES;i++) {
-                boundaries[k][i].created = FALSE;
-                boundaries[k][i].nosides = 0;
-            }
+    if(visited) return;
+    for(k=0;k<MAXCASES;k++) {
+        boundaries[k] = (struct BoundaryType*)
+                malloc((size_t) (MAXBOUNDARIES)*sizeof(struct BoundaryType));
+        for(i=0;i<MAXBOUNDARIES;i++) {
+            boundaries[k][i].created = FALSE;
+            boundaries[k][i].mapped = FALSE;
+            boundaries[k][i].nosides = 0;
         }
-        visited = TRUE;
     }
+    visited = TRUE;
+}
+
+
+
+static int ImportMeshDefinition(int inmethod,int nofile,char *filename,int *nogrids)
+{
+    int errorstat = 0,dim;
+
+
+    *nogrids = 0;
+    AllocateBoundaryCases();
 
     /* Native format of ElmerGrid gets specieal treatment */
     switch (inmethod) {
@@ -1160,6 +1239,7 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
     static int visited = FALSE;
     int i,j,k;
     Real mergeeps;
+    struct MeshQualityType quality;
 
     if(inmethod == 1 && outmethod != 1) {
         if(visited) {
@@ -1171,6 +1251,7 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
                 }
             }
         }
+        MemoryStep("mesh","CreateElmerGridMesh",info);
         for(k=0;k<nogrids;k++)
             CreateElmerGridMesh(&(grids[k]),&(data[k]),boundaries[k],relh,info);
         nomeshes = nogrids;
@@ -1178,9 +1259,14 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
 
     visited = TRUE;
 
+    /* The operations below reallocate the vectors, which must not point into a mesh cache */
+    for(k=0;k<nomeshes;k++)
+        if(data[k].mapped) DetachMeshCache(&data[k],boundaries[k],info);
+
     /* At first instance perform operations that should rather be done before extrusion
      or mesh union. */
     for(k=0;k<nomeshes;k++) {
+        UseArena(data[k].arena);
 
         /* Make the discontinous boundary needed, for example, in poor thermal conduction */
         if(!eg.discont) {
@@ -1191,11 +1277,13 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
                 }
         }
         if(eg.discont) {
+            MemoryStep("boundary","SetDiscontinuousBoundary",info);
             for(i=1;i<=eg.discont;i++)
                 SetDiscontinuousBoundary(&(data[k]),boundaries[k],eg.discontbounds[i-1],2,info);
         }
 
         /* Make a connected boundary (specific to Elmer format) needed in linear constraints */
+        if(eg.connect) MemoryStep("boundary","SetConnectedBoundary",info);
         for(i=1;i<=eg.connect;i++)
             SetConnectedBoundary(&(data[k]),boundaries[k],eg.connectbounds[i-1],i,info);
 
@@ -1203,24 +1291,30 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
         if(eg.triangles || grids[k].triangles == TRUE) {
             Real criticalangle;
             criticalangle = MAX(eg.triangleangle, grids[k].triangleangle);
+            MemoryStep("mesh","ElementsToTriangles",info);
             ElementsToTriangles(&data[k],boundaries[k],criticalangle,info);
         }
 
         /* Make a boundary layer with two different methods */
-        if(eg.layers > 0)
+        if(eg.layers > 0) {
+            MemoryStep("mesh","CreateBoundaryLayer",info);
             CreateBoundaryLayer(&data[k],boundaries[k],eg.layers,
                                 eg.layerbounds, eg.layernumber, eg.layerratios, eg.layerthickness,
                                 eg.layerparents, eg.layermove, eg.layereps, info);
-        else if(eg.layers < 0)
+        }
+        else if(eg.layers < 0) {
+            MemoryStep("mesh","CreateBoundaryLayerDivide",info);
             CreateBoundaryLayerDivide(&data[k],boundaries[k],abs(eg.layers),
                                       eg.layerbounds, eg.layernumber, eg.layerratios, eg.layerthickness,
                                       eg.layerparents, info);
+        }
     }
 
     if(outmethod != 1 && eg.dim != 2) {
         j = MAX(1,nogrids);
         for(k=0;k<j;k++) {
             if(grids[k].dimension == 3 || grids[k].rotate) {
+                MemoryStep("mesh","CreateKnotsExtruded",info);
                 CreateKnotsExtruded(&(data[k]),boundaries[k],&(grids[k]),
                                     &(data[j]),boundaries[j],info);
 #if LIB_MODE
@@ -1237,22 +1331,28 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
 
     /* Unite meshes if there are several of them */
     if(eg.unitemeshes) {
+        MemoryStep("mesh","UniteMeshes",info);
         for(k=1;k<nomeshes;k++)
             UniteMeshes(&data[0],&data[k],boundaries[0],boundaries[k],info);
         nomeshes = 1;
     }
 
     for(k=0;k<nomeshes;k++) {
+        UseArena(data[k].arena);
+
         /* If the original mesh was given in polar coordinates make the transformation into cartesian ones */
         if(eg.polar || data[k].coordsystem == COORD_POLAR) {
             if(!eg.polar) eg.polarradius = grids[k].polarradius;
+            MemoryStep("mesh","PolarCoordinates",info);
             PolarCoordinates(&data[k],eg.polarradius,info);
         }
         /* If the original mesh was given in cylindrical coordinates make the transformation into cartesian ones */
         if(eg.cylinder || data[k].coordsystem == COORD_CYL) {
+            MemoryStep("mesh","CylinderCoordinates",info);
             CylinderCoordinates(&data[k],info);
         }
         if(eg.clone[0] || eg.clone[1] || eg.clone[2]) {
+            MemoryStep("mesh","CloneMeshes",info);
             CloneMeshes(&data[k],boundaries[k],eg.clone,eg.clonesize,FALSE,info);
             mergeeps = fabs(eg.clonesize[0]+eg.clonesize[1]+eg.clonesize[2]) * 1.0e-8;
             MergeElements(&data[k],boundaries[k],eg.order,eg.corder,mergeeps,TRUE,TRUE);
@@ -1264,45 +1364,92 @@ static int ManipulateMeshDefinition(int inmethod,int outmethod,Real relh)
             eg.reducemat1 = grids[k].reduceordermatmin;
             eg.reducemat2 = grids[k].reduceordermatmax;
         }
-        if(eg.reduce)
+        if(eg.reduce) {
+            MemoryStep("mesh","ReduceElementOrder",info);
             ReduceElementOrder(&data[k],eg.reducemat1,eg.reducemat2);
+        }
 
         /* Increase element order */
-        if(eg.increase)
+        if(eg.increase) {
+            MemoryStep("mesh","IncreaseElementOrder",info);
             IncreaseElementOrder(&data[k],TRUE);
+        }
 
-        if(eg.merge)
+        if(eg.merge) {
+            MemoryStep("mesh","MergeElements",info);
             MergeElements(&data[k],boundaries[k],eg.order,eg.corder,eg.cmerge,FALSE,TRUE);
+        }
 #if HAVE_METIS
-        else if(eg.order == 3)
+        else if(eg.order == 3) {
+            MemoryStep("mesh","ReorderElementsMetis",info);
             ReorderElementsMetis(&data[k],TRUE);
+        }
 #endif
-        else if(eg.order)
+        else if(eg.order) {
+            MemoryStep("mesh","ReorderElements",info);
             ReorderElements(&data[k],boundaries[k],eg.order,eg.corder,TRUE);
+        }
 
-        if(eg.bulkbounds || eg.boundbounds)
+        if(eg.bulkbounds || eg.boundbounds) {
+            MemoryStep("boundary","SideAndBulkBoundaries",info);
             SideAndBulkBoundaries(&data[k],boundaries[k],&eg,info);
+        }
 
+        MemoryStep("mesh","RotateTranslateScale",info);
         RotateTranslateScale(&data[k],&eg,info);
 
-        if(eg.removelowdim)
+        if(eg.removelowdim) {
+            MemoryStep("boundary","RemoveLowerDimensionalBoundaries",info);
             RemoveLowerDimensionalBoundaries(&data[k],boundaries[k],info);
+        }
 
-        if(eg.removeunused)
+        if(eg.removeunused) {
+            MemoryStep("mesh","RemoveUnusedNodes",info);
             RemoveUnusedNodes(&data[k],info);
+        }
 
-        if(eg.sidemappings || eg.bulkmappings)
+        if(eg.sidemappings || eg.bulkmappings) {
+            MemoryStep("boundary","SideAndBulkMappings",info);
             SideAndBulkMappings(&data[k],boundaries[k],&eg,info);
+        }
 
-        if(eg.boundorder || eg.bcoffset)
+        if(eg.boundorder || eg.bcoffset) {
+            MemoryStep("boundary","RenumberBoundaryTypes",info);
             RenumberBoundaryTypes(&data[k],boundaries[k],eg.boundorder,eg.bcoffset,info);
+        }
 
-        if(eg.bulkorder)
+        if(eg.bulkorder) {
+            MemoryStep("mesh","RenumberMaterialTypes",info);
             RenumberMaterialTypes(&data[k],boundaries[k],info);
+        }
+
+        if(eg.periodicdim[0] || eg.periodicdim[1] || eg.periodicdim[2] || eg.periodicangle != 0.0) {
+            MemoryStep("mesh","FindPeriodicNodes",info);
+            FindPeriodicNodes(&data[k],eg.periodicdim,eg.periodicangle,info);
+        }
 
-        if(eg.periodicdim[0] || eg.periodicdim[1] || eg.periodicdim[2])
-            FindPeriodicNodes(&data[k],eg.periodicdim,info);
+        if(eg.adapt > 0.0) {
+            for(j=1;j<MAXDOFS;j++)
+                if(data[k].edofs[j] > 0) break;
+            if(j < MAXDOFS) {
+                MemoryStep("mesh","AdaptMesh",info);
+                SetRefinementEdges(&data[k],boundaries[k],info);
+                AdaptMesh(&data[k],boundaries[k],j,eg.adapt,info);
+            }
+            else
+                printf("There is no field for the adaptive refinement\n");
+        }
+
+        if(eg.quality) {
+            MemoryStep("mesh","MeshQuality",info);
+            MeshTypeStatistics(&data[k],info);
+            MeshQuality(&data[k],&quality,eg.quality,info);
+            DestroyMeshQuality(&quality);
+        }
     }
+
+    /* Report the last step */
+    MemoryStep(NULL,NULL,info);
     return 0;
 }
 
@@ -1339,7 +1486,10 @@ int eg_transfermesh(mesh_t *mesh,const char *str)
     static char arguments[10][10],**argv;
     int argc;
     static int visited = FALSE;
-    char filename[MAXFILESIZE];
+    char filename[MAXFILESIZE],cachename[MAXFILESIZE],cmdinput[MAXFILESIZE];
+    MeshCacheKey cachekey;
+    /* The default order changes the mesh and hence is a part of the cache key */
+    const int defaultorder = 2;
 
     activemesh = 0;
     nofile = 0;
@@ -1355,6 +1505,7 @@ int eg_transfermesh(mesh_t *mesh,const char *str)
 
     InitParameters(&eg);
     InitGrid(grids);
+    SetMeshArenas(eg.arena);
 
     strcpy(filename,Filename);
     if(info) printf("\nElmerGrid loading data from file: %s\n",filename);
@@ -1362,16 +1513,48 @@ int eg_transfermesh(mesh_t *mesh,const char *str)
     inmethod = Inmethod;
     if(inmethod < 0) return(1);
 
+    cmdinput[0] = '\0';
     if(inmethod == 0) {
+        eg.filesin[0][0] = '\0';
         errorstat = LoadCommands(filename,&eg,grids,1,IOmethods,info);
         inmethod = eg.inmethod;
         info = !eg.silent;
+        strcpy(cmdinput,eg.filesin[0]);
     }
     else {
         eg.inmethod = inmethod;
     }
     strcpy(eg.filesin[0],filename);
 
+    /* The mesh depends only on the geometry file and the in-line parameters.
+       If they have not changed the previous mesh is mapped from the cache. */
+    AllocateBoundaryCases();
+    cachekey = MeshCacheFileKey(filename,str);
+    if(cmdinput[0] && strcmp(cmdinput,filename))
+        cachekey = MeshCacheAddFile(cachekey,cmdinput);
+    if(cachekey)
+        cachekey = MeshCacheHash(&defaultorder,sizeof(defaultorder),cachekey);
+    sprintf(cachename,"%s%s",filename,MESHCACHE_SUFFIX);
+    if(cachekey && !LoadMeshCache(&data[activemesh],boundaries[activemesh],cachename,cachekey,info)) {
+        mesh->setNodes(0);
+        mesh->setPoints(0);
+        mesh->setEdges(0);
+        mesh->setSurfaces(0);
+        mesh->setElements(0);
+
+        nomeshes = 1;
+        errorstat = ConvertEgTypeToMeshType(&data[activemesh],boundaries[activemesh],mesh);
+        if(info) printf("Done converting cached mesh\n");
+        return(errorstat);
+    }
+
+    /* The importers allocate the structures anew */
+    if(data[nofile].mapped) {
+        DestroyKnots(&data[nofile]);
+        for(i=0;i<MAXBOUNDARIES;i++)
+            DestroyBoundary(&boundaries[nofile][i]);
+    }
+
     errorstat = ImportMeshDefinition(inmethod,nofile,filename,&nogrids);
 
     if(errorstat) return(errorstat);
@@ -1390,6 +1573,10 @@ int eg_transfermesh(mesh_t *mesh,const char *str)
         return(1);
     }
 
+    /* The mesh goes directly to assembly so by default it is given
+       a small bandwidth, which the in-line parameters may override */
+    eg.order = defaultorder;
+
     /* Checking in-line parameters */
     argc = StringToStrings(str,arguments,10,' ');
     for(i=0;i<argc;i++) argv[i] = &arguments[i][0];
@@ -1401,6 +1588,9 @@ int eg_transfermesh(mesh_t *mesh,const char *str)
 
     ManipulateMeshDefinition(inmethod,outmethod,eg.relh);
 
+    if(cachekey)
+        SaveMeshCache(&data[activemesh],boundaries[activemesh],cachename,cachekey,info);
+
     errorstat = ConvertEgTypeToMeshType(&data[activemesh],boundaries[activemesh],mesh);
 
     if(info) printf("Done converting mesh\n");
@@ -1465,6 +1655,7 @@ int main(int argc, char *argv[])
     info = !eg.silent;
     dim = eg.dim;
     relh = eg.relh;
+    SetMeshArenas(eg.arena);
     if(!outmethod || !inmethod) {
         printf("Please define the input and output formats\n");
         Goodbye();
@@ -1477,6 +1668,7 @@ int main(int argc, char *argv[])
     nomeshes = 0;
     nogrids = 0;
 
+    MemoryStep("input","ImportMeshDefinition",info);
     for(nofile=0;nofile<eg.nofilesin;nofile++) {
         errorstat = ImportMeshDefinition(inmethod,nofile,eg.filesin[nofile],&nogrids);
         if(errorstat) Goodbye();
@@ -1488,6 +1680,7 @@ int main(int argc, char *argv[])
     ManipulateMeshDefinition(inmethod,outmethod,relh);
 
     /* Partititioning related stuff */
+    MemoryStep("partition","PartitionMesh",info);
     for(k=0;k<nomeshes;k++)
         PartitionMesh(nofile);
 
@@ -1499,8 +1692,11 @@ int main(int argc, char *argv[])
             sprintf(filename,"%s",prefix);
         else
             sprintf(filename,"%s%d",prefix,nofile+1);
+        MemoryStep("output","ExportMeshDefinition",info);
         ExportMeshDefinition(inmethod,outmethod,nofile,filename);
     }
+    MemoryStep(NULL,NULL,info);
+    if(info) MemoryUsage();
     Goodbye();
 }
 #endif
@@ -40,6 +40,7 @@
 #include "egtypes.h"
 #include "egmesh.h"
 #include "egnative.h"
+#include "egcache.h"
 
 #define DEBUG 0
 
@@ -721,6 +722,9 @@ void InitializeKnots(struct FemType *data)
 
     data->boundarynamesexist = FALSE;
     data->bodynamesexist = FALSE;
+    data->mapped = FALSE;
+    data->meshcache = NULL;
+    data->arena = NULL;
 
     data->nopartitions = 1;
     data->partitionexist = FALSE;
@@ -729,6 +733,8 @@ void InitializeKnots(struct FemType *data)
 
     data->dualexists = FALSE;
     data->invtopoexists = FALSE;
+    data->edgesexist = FALSE;
+    data->sidesexist = FALSE;
     data->partitiontableexists = FALSE;
 
     for(i=0;i<MAXDOFS;i++) {
@@ -747,10 +753,26 @@ void InitializeKnots(struct FemType *data)
 }
 
 
+static int mesharenas = 0;
+
+void SetMeshArenas(int mode)
+/* With nonzero mode each mesh gets its own arena when it is allocated,
+   with mode 2 backed by huge pages. */
+{
+    mesharenas = mode;
+}
+
+
 void AllocateKnots(struct FemType *data)
 {
     int i;
 
+    /* The mesh and the following operations on it allocate from its arena */
+    if(mesharenas && !data->arena) {
+        data->arena = CreateArena(mesharenas == 2);
+        UseArena(data->arena);
+    }
+
     data->topology = Imatrix(1,data->noelements,0,data->maxnodes-1);
     data->material = Ivector(1,data->noelements);
     data->elementtypes = Ivector(1,data->noelements);
@@ -1320,6 +1342,14 @@ int CreateVariable(struct FemType *data,int variable,int unknowns,
 
 
 
+static void DestroyTopologyTables(struct FemType *data)
+/* The edge and side tables become stale when the topology is changed */
+{
+    DestroyEdgeTable(data,FALSE);
+    DestroySideTable(data,FALSE);
+}
+
+
 void DestroyKnots(struct FemType *data)
 {
     int i;
@@ -1334,13 +1364,28 @@ void DestroyKnots(struct FemType *data)
             data->edofs[i] = 0;
         }
 
-    free_Imatrix(data->topology,1,data->noelements,0,data->maxnodes-1);
-    free_Ivector(data->material,1,data->noelements);
-    free_Ivector(data->elementtypes,1,data->noelements);
+    DestroyTopologyTables(data);
 
-    free_Rvector(data->x,1,data->noknots);
-    free_Rvector(data->y,1,data->noknots);
-    free_Rvector(data->z,1,data->noknots);
+    if(data->mapped) {
+        /* Only the row pointers of the topology were allocated, the rest is in the cache file */
+        free(data->topology);
+        CloseMeshCache(data);
+    }
+    else {
+        free_Imatrix(data->topology,1,data->noelements,0,data->maxnodes-1);
+        free_Ivector(data->material,1,data->noelements);
+        free_Ivector(data->elementtypes,1,data->noelements);
+
+        free_Rvector(data->x,1,data->noknots);
+        free_Rvector(data->y,1,data->noknots);
+        free_Rvector(data->z,1,data->noknots);
+    }
+
+    /* The memory of the arena returns to the system with its last vector */
+    if(data->arena) {
+        CloseArena(data->arena);
+        data->arena = NULL;
+    }
 
     data->noknots = 0;
     data->noelements = 0;
@@ -1349,15 +1394,35 @@ void DestroyKnots(struct FemType *data)
 
 
 
+static int SameCyclicOrder(int sidenodes,int *ind1,int *ind2)
+{
+    int i,j,hit;
+
+    for(j=0;j<sidenodes;j++) {
+        hit = TRUE;
+        for(i=0;i<sidenodes;i++)
+            if(ind1[(i+j)%sidenodes] != ind2[i]) hit = FALSE;
+        if(hit) return(TRUE);
+    }
+    return(FALSE);
+}
+
+
 int FindParentSide(struct FemType *data,struct BoundaryType *bound,
                    int sideelem,int sideelemtype,int *sideind)
+/* Sets the sides of the parents of the side element. The side is usually
+   found with one lookup in the side table; otherwise all the sides of the
+   parents are compared. */
 {
-    int i,j,sideelemtype2,elemind,parent,normal;
+    int i,j,k,sideelemtype2,elemind,parent,normal,sideindex;
     int elemsides = 0,side,sidenodes,nohits,hit,noparent, bulknodes;
     int sideind2[MAXNODESD1];
 
     hit = FALSE;
 
+    CreateSideTable(data,FALSE);
+    sideindex = GetSideIndex(data,sideelemtype,sideind);
+
     for(parent=1;parent<=2;parent++) {
         if(parent == 1) {
             elemind = bound->parent[sideelem];
@@ -1366,6 +1431,30 @@ int FindParentSide(struct FemType *data,struct BoundaryType *bound,
         else
             elemind = bound->parent2[sideelem];
 
+        if(elemind > 0 && sideindex) {
+            for(k=data->elemsideoffset[elemind];k<data->elemsideoffset[elemind+1];k++)
+                if(data->elemsides[k] == sideindex) break;
+
+            if(k < data->elemsideoffset[elemind+1]) {
+                hit = TRUE;
+                side = k - data->elemsideoffset[elemind];
+                if(parent == 2) {
+                    bound->side2[sideelem] = side;
+                    goto skip;
+                }
+                bound->side[sideelem] = side;
+                for(normal=1;normal >= -1;normal -= 2) {
+                    GetElementSide(elemind,side,normal,data,&sideind2[0],&sideelemtype2);
+                    if(sideelemtype2 == sideelemtype &&
+                       SameCyclicOrder(sideelemtype%100,sideind,sideind2)) {
+                        bound->normal[sideelem] = normal;
+                        break;
+                    }
+                }
+                goto skip;
+            }
+        }
+
         if(elemind > 0) {
             elemsides = data->elementtypes[elemind] / 100;
             bulknodes = data->elementtypes[elemind] % 100;
@@ -1386,21 +1475,16 @@ int FindParentSide(struct FemType *data,struct BoundaryType *bound,
 
                     sidenodes = sideelemtype % 100;
 
-                    for(j=0;j<sidenodes;j++) {
-                        hit = TRUE;
-                        for(i=0;i<sidenodes;i++)
-                            if(sideind[(i+j)%sidenodes] != sideind2[i]) hit = FALSE;
-
-                        if(hit == TRUE) {
-                            if(parent == 1) {
-                                bound->side[sideelem] = side;
-                                bound->normal[sideelem] = normal;
-                            }
-                            else {
-                                bound->side2[sideelem] = side;
-                            }
-                            goto skip;
+                    hit = SameCyclicOrder(sidenodes,sideind,sideind2);
+                    if(hit) {
+                        if(parent == 1) {
+                            bound->side[sideelem] = side;
+                            bound->normal[sideelem] = normal;
+                        }
+                        else {
+                            bound->side2[sideelem] = side;
                         }
+                        goto skip;
                     }
                 }
             }
@@ -1784,6 +1868,7 @@ int AllocateBoundary(struct BoundaryType *bound,int size)
     }
     
     bound->created = TRUE;
+    bound->mapped = FALSE;
     bound->nosides = size;
     bound->ediscont = FALSE;
 
@@ -1794,6 +1879,8 @@ int AllocateBoundary(struct BoundaryType *bound,int size)
     bound->parent2 = Ivector(1,size);
     bound->types = Ivector(1,size);
     bound->normal = Ivector(1,size);
+    bound->elementtypes = NULL;
+    bound->topology = NULL;
 
     for(i=1;i<=size;i++) {
         bound->material[i] = 0;
@@ -1827,6 +1914,14 @@ int DestroyBoundary(struct BoundaryType *bound)
         return(2);
     }
 
+    if(bound->mapped) {
+        /* The vectors point into the mesh cache which is released with the FemType */
+        bound->mapped = FALSE;
+        bound->nosides = 0;
+        bound->created = FALSE;
+        return(0);
+    }
+
     free_Ivector(bound->material,1,nosides);
     free_Ivector(bound->side,1,nosides);
     free_Ivector(bound->side2,1,nosides);
@@ -2002,6 +2097,8 @@ static int CreateNewNodes(struct FemType *data,int *order,int material,int newkn
                 order[neworder[i]] = i;
         }
 
+    DestroyTopologyTables(data);
+
     /* Set the new element topology */
     for(i=1;i<=data->noelements;i++) {
         nonodes = data->elementtypes[i]%100;
@@ -2348,10 +2445,10 @@ int ElementsToTriangles(struct FemType *data,struct BoundaryType *bound,
                         Real critangle,int info)
 /* Make triangles out of rectangular elements */
 {
-    int i,j,k,l,side = 0,elem,i1,isum = 0,sideelemtype;
+    int i,j,k,l,l2,side = 0,elem,edge,isum = 0,sideelemtype;
     int noelements,elementtype,triangles,noknots,nonodes,newelements,newtype,newmaxnodes;
     int **newtopo = NULL,*newmaterial = NULL,*newelementtypes = NULL,newnodes,*needed,*divisions,*division1;
-    int sideind[MAXNODESD1], sideind2[MAXNODESD1];
+    int sideind[MAXNODESD1];
     int allocated,maxanglej,evenodd,newelem;
     Real dx1,dx2,dy1,dy2,ds1,ds2;
     Real angles[4],maxangle;
@@ -2360,6 +2457,7 @@ int ElementsToTriangles(struct FemType *data,struct BoundaryType *bound,
     noelements  = data->noelements;
     noknots = data->noknots;
     allocated = FALSE;
+    DestroyTopologyTables(data);
 
     needed = Ivector(1,noknots);
     for(i=1;i<=noknots;i++)
@@ -2572,8 +2670,11 @@ omstart:
 
 
     /* Then make the corresponding mapping for the BCs.
-     This is done in a brute-force way where all the
-     possible new elements are checked. */
+       The new parent is the part of the old parent that owns the edge
+       of the side in the edge table of the new elements. */
+
+    data2.noelements = newelements;
+    CreateEdgeTable(&data2,FALSE);
 
     for(j=0;j < MAXBOUNDARIES;j++) {
         if(!bound[j].created) continue;
@@ -2608,27 +2709,15 @@ omstart:
                     goto nextparent;
                 }
 
-                /* Test for all possible elements that could be parents */
-                for(elem=division1[k]+1;elem<=division1[k]+divisions[k];elem++) {
-                    isum = 0;
-                    for(i1=0;i1<3;i1++) {
-                        if(newtopo[elem][i1] == sideind[0]) isum++;
-                        if(newtopo[elem][i1] == sideind[1]) isum++;
-                    }
-
-                    if(isum != 2) continue;
-
-                    for(side=0;side<3;side++) {
-                        GetElementSide(elem,side,bound[j].normal[i],
-                                       &data2,sideind2,&sideelemtype);
-                        isum = 0;
-                        for(i1=0;i1<2;i1++) {
-                            if(sideind2[i1] == sideind[0]) isum++;
-                            if(sideind2[i1] == sideind[1]) isum++;
-                        }
-
-                        if(isum == 2) goto nextparent;
-                    }
+                isum = 0;
+                edge = GetEdgeIndex(&data2,sideind[0],sideind[1]);
+                if(!edge) goto nextparent;
+                for(l2=data2.edgeelemoffset[edge];l2<data2.edgeelemoffset[edge+1];l2++) {
+                    elem = data2.edgeelems[l2];
+                    if(elem <= division1[k] || elem > division1[k]+divisions[k]) continue;
+                    for(side=0;data2.elemedges[data2.elemedgeoffset[elem]+side] != edge;side++);
+                    isum = 2;
+                    break;
                 }
 
 nextparent:
@@ -2663,6 +2752,17 @@ nextparent:
     data->noelements = newelements;
     data->maxnodes = newmaxnodes;
 
+    /* The edge table of the new elements stays with the mesh */
+    data->edgesexist = data2.edgesexist;
+    data->noedges = data2.noedges;
+    data->edgenodes = data2.edgenodes;
+    data->elemedges = data2.elemedges;
+    data->elemedgeoffset = data2.elemedgeoffset;
+    data->edgeelems = data2.edgeelems;
+    data->edgeelemoffset = data2.edgeelemoffset;
+    data->edgehash = data2.edgehash;
+    data->edgehashsize = data2.edgehashsize;
+
     if(info) printf("There are %d elements after triangularization (was %d)\n",
                     newelements,noelements);
 
@@ -2728,6 +2828,10 @@ int UniteMeshes(struct FemType *data1,struct FemType *data2,
 
     if(0) printf("Uniting two meshes to %d nodes and %d elements.\n",noknots,noelements);
 
+    /* The element and node numbers of both meshes change */
+    DestroyTopologyTables(data1);
+    DestroyTopologyTables(data2);
+
     for(j=0;j < MAXBOUNDARIES;j++) {
         if(!bound2[j].created) continue;
 
@@ -2980,6 +3084,7 @@ int CloneMeshes(struct FemType *data,struct BoundaryType *bound,
             bound[bndr].discont = vdiscont;
     }
 
+    DestroyTopologyTables(data);
     free_Imatrix(data->topology,1,data->noelements,0,data->maxnodes-1);
     free_Ivector(data->material,1,data->noelements);
     free_Rvector(data->x,1,data->noknots);
@@ -3177,6 +3282,7 @@ int MirrorMeshes(struct FemType *data,struct BoundaryType *bound,
             bound[bndr].discont = vdiscont;
     }
 
+    DestroyTopologyTables(data);
     free_Imatrix(data->topology,1,data->noelements,0,data->maxnodes-1);
     free_Ivector(data->material,1,data->noelements);
     free_Rvector(data->x,1,data->noknots);
@@ -3199,200 +3305,231 @@ int MirrorMeshes(struct FemType *data,struct BoundaryType *bound,
 
 
 
-static void ReorderAutomatic(struct FemType *data,int iterations,
-                             int *origindx,Real corder[],int info)
+static int LevelStructure(struct FemType *data,int root,int *mark,int stamp,int *queue,
+                          int *lastlevel,int *size,int sortbydegree)
+/* Breadth-first search of the component of root in the dual graph. The nodes
+   are written to queue[] level by level, the start of the last level is
+   returned in lastlevel and the size of the component in size. If sortbydegree
+   is set the children of each node are ordered by increasing degree, as in
+   Cuthill-McKee. Returns the number of levels. */
 {
-    int i,j,k,l,nonodes,maxnodes,noelements,noknots,minwidth,indexwidth;
-    int **neighbours,*newrank,*newindx,*oldrank,*oldindx;
-    int nocands = 0,*cands,ind,ind2,cantdo;
-    int elemtype,indready,iter,*localorder,*localtmp,nolocal;
-    Real *localdist,dx,dy,dz;
-
-    iterations = 3;
-    iter = 0;
-    maxnodes = 8;
-
-    noelements = data->noelements;
-    noknots = data->noknots;
-
-    cantdo = FALSE;
-    for(j=1;j<=noelements;j++) {
-        elemtype = data->elementtypes[j];
-        if(elemtype != 404 && elemtype != 303 && elemtype != 808) cantdo = elemtype;
-    }
-    if(cantdo) {
-        printf("Automatic reordering not specified for elementtype %d\n",cantdo);
-        return;
-    }
+    int i,j,k,ind,ind2,head,tail,levelstart,levelend,depth;
+    int *offset;
+
+    offset = data->dualoffset;
+    queue[0] = root;
+    mark[root] = stamp;
+    tail = 1;
+    levelstart = 0;
+    depth = 1;
+
+    for(;;) {
+        levelend = tail;
+        for(head=levelstart;head<levelend;head++) {
+            ind = queue[head];
+            k = tail;
+            for(j=offset[ind];j<offset[ind+1];j++) {
+                ind2 = data->dualgraph[j];
+                if(mark[ind2] == stamp) continue;
+                mark[ind2] = stamp;
+                queue[tail++] = ind2;
+            }
+            if(sortbydegree) {
+                for(i=k+1;i<tail;i++) {
+                    ind2 = queue[i];
+                    for(j=i-1;j>=k && offset[queue[j]+1]-offset[queue[j]] >
+                            offset[ind2+1]-offset[ind2];j--)
+                        queue[j+1] = queue[j];
+                    queue[j+1] = ind2;
+                }
+            }
+        }
+        if(tail == levelend) break;
+        levelstart = levelend;
+        depth++;
+    }
+
+    *lastlevel = levelstart;
+    *size = tail;
+    return(depth);
+}
 
-    printf("Allocating...\n");
 
-    cands = Ivector(1,maxnodes);
-    localorder = Ivector(1,maxnodes);
-    localtmp = Ivector(1,maxnodes);
-    localdist = Rvector(1,maxnodes);
+static void ReorderNodesRCM(struct FemType *data,int *indx,int info)
+/* Reverse Cuthill-McKee ordering of the nodes, indx[i] being the old index of
+   the new node i. Each connected component is started from a pseudo-peripheral
+   node found with the algorithm of George and Liu. Works for any element types. */
+{
+    int i,j,n,noknots,root,depth,newdepth,lastlevel,size,stamp,ordered,components,ownsdual;
+    int *mark,*queue,*cmorder,*offset;
 
-    neighbours = Imatrix(1,noknots,1,maxnodes);
-    newrank = Ivector(1,noknots);
-    oldrank = Ivector(1,noknots);
-    newindx = Ivector(1,noknots);
-    oldindx = Ivector(1,noknots);
+    noknots = data->noknots;
 
-    for(i=1;i<=noknots;i++)
-        oldindx[i] = origindx[i];
+    ownsdual = !data->dualexists;
+    if(ownsdual) CreateDualGraph(data,TRUE,FALSE);
+    offset = data->dualoffset;
 
+    mark = Ivector(1,noknots);
+    queue = Ivector(0,noknots-1);
+    cmorder = Ivector(1,noknots);
     for(i=1;i<=noknots;i++)
-        oldrank[origindx[i]] = i;
-
-    minwidth = CalculateIndexwidth(data,TRUE,oldrank);
-    if(info) printf("Indexwidth of the initial node order is %d.\n",minwidth);
+        mark[i] = 0;
 
-    for(j=1;j<=noknots;j++)
-        for(i=1;i<=maxnodes;i++)
-            neighbours[j][i] = 0;
-
-
-    if(info) printf("Initializing neighbours\n");
-
-    for(j=1;j<=noelements;j++) {
-        elemtype = data->elementtypes[j];
-        nonodes = elemtype%100;
-
-        for(i=0;i<nonodes;i++) {
-            ind = data->topology[j][i];
-
-            if(elemtype == 404 || elemtype == 303) {
-                nocands = 2;
-                cands[1] = (i+1)%nonodes;
-                cands[2] = (i+nonodes-1)%nonodes;
-            }
-            else if(elemtype == 808) {
-                nocands = 3;
-                if(i<4) {
-                    cands[1] = (i+1)%4;
-                    cands[2] = (i+3)%4;
-                    cands[3] = i+4;
-                }
-                else {
-                    cands[1] = (i-4+1)%4+4;
-                    cands[2] = (i-4+3)%4+4;
-                    cands[3] = i-4;
-                }
-            }
+    stamp = 0;
+    ordered = 0;
+    components = 0;
+    for(i=1;i<=noknots;i++) {
+        if(mark[i]) continue;
+        components++;
 
-            for(k=1;k<=nocands;k++) {
-                ind2 = data->topology[j][cands[k]];
-                for(l=1;l<=maxnodes;l++) {
-                    if(neighbours[ind][l] == 0) break;
-                    if(neighbours[ind][l] == ind2) ind2 = 0;
-                }
-                if(ind2) neighbours[ind][l] = ind2;
-            }
+        /* Move to a node of minimum degree in the last level until the
+           depth of the level structure no longer grows */
+        root = i;
+        depth = LevelStructure(data,root,mark,++stamp,queue,&lastlevel,&size,FALSE);
+        for(;;) {
+            n = queue[lastlevel];
+            for(j=lastlevel+1;j<size;j++)
+                if(offset[queue[j]+1]-offset[queue[j]] < offset[n+1]-offset[n])
+                    n = queue[j];
+            newdepth = LevelStructure(data,n,mark,++stamp,queue,&lastlevel,&size,FALSE);
+            if(newdepth <= depth) break;
+            depth = newdepth;
+            root = n;
         }
-    }
 
-#if 0
-    for(j=1;j<=noknots;j++) {
-        printf("neigbourds[%d]= ",j);
-        for(l=1;l<=maxnodes;l++)
-            printf("%d ",neighbours[j][l]);
-        printf("\n");
+        LevelStructure(data,root,mark,++stamp,queue,&lastlevel,&size,TRUE);
+        for(j=0;j<size;j++)
+            cmorder[++ordered] = queue[j];
     }
-#endif
 
-    if(info) printf("Reordering neighbours table\n");
-
-    for(j=1;j<=noknots;j++) {
-
-        nolocal = 0;
-        dz = 0.0;
+    for(i=1;i<=noknots;i++)
+        indx[i] = cmorder[noknots+1-i];
 
-        for(l=1;l<=maxnodes;l++){
-            if(ind = neighbours[j][l]) {
-                nolocal++;
-                localtmp[l] = ind;
-                dx = data->x[l] - data->x[ind];
-                dy = data->y[l] - data->y[ind];
-                if(data->dim == 3) dz = data->z[l] - data->z[ind];
-                localdist[l] = corder[0]*fabs(dx) + corder[1]*fabs(dy) + corder[2]*fabs(dz);
-            }
-        }
+    if(info) printf("Reverse Cuthill-McKee ordering of %d components of the dual graph\n",components);
 
-        SortIndex(nolocal,localdist,localorder);
+    free_Ivector(mark,1,noknots);
+    free_Ivector(queue,0,noknots-1);
+    free_Ivector(cmorder,1,noknots);
+    if(ownsdual) DestroyDualGraph(data,FALSE);
+}
 
-        for(l=1;l<=nolocal;l++)
-            neighbours[j][l] = localtmp[localorder[l]];
 
-#if 0
-        for(l=1;l<=nolocal;l++)
-            printf("j=%d l=%d dist=%.3le order=%d  %d\n",
-                   j,l,localdist[l],localorder[l],neighbours[j][l]);
-#endif
-    }
+struct HilbertKeyType {
+    unsigned long long key;
+    int indx;
+};
 
 
+static int CompareHilbertKeys(const void *a,const void *b)
+{
+    const struct HilbertKeyType *ka = (const struct HilbertKeyType*) a;
+    const struct HilbertKeyType *kb = (const struct HilbertKeyType*) b;
 
-    for(iter=1;iter<=iterations;iter++) {
+    if(ka->key < kb->key) return(-1);
+    if(ka->key > kb->key) return(1);
+    return(ka->indx - kb->indx);
+}
 
-        if(info) printf("Optimal topology testing %d\n",iter);
 
-        for(i=1;i<=noknots;i++)
-            newrank[i] = 0;
+static unsigned long long HilbertKey(unsigned int *x,int dim,int bits)
+/* Position along the Hilbert curve of the integer coordinates x[0..dim-1],
+   each of the given number of bits (J. Skilling, AIP Conf. Proc. 707, 2004). */
+{
+    unsigned int m,p,q,t;
+    unsigned long long key;
+    int i,j;
 
-        ind = 0;
-        indready = 1;
+    m = 1U << (bits-1);
 
-        do {
-            if(indready > ind) {
-                for(l=noknots;l>=1;l--)
-                    if(j = oldindx[l]) break;
-                if(info) printf("Starting over from node %d when ind=%d indready=%d\n",j,ind,indready);
-            }
+    /* Inverse undo excess work */
+    for(q=m;q>1;q>>=1) {
+        p = q-1;
+        for(i=0;i<dim;i++) {
+            if(x[i] & q)
+                x[0] ^= p;
             else {
-                j = newindx[indready] ;
+                t = (x[0] ^ x[i]) & p;
+                x[0] ^= t;
+                x[i] ^= t;
             }
+        }
+    }
 
-            for(l=1;ind2 = neighbours[j][l];l++) {
-                if(ind2) {
-                    if(!newrank[ind2]) {
-                        ind++;
-                        newrank[ind2] = ind;
-                        newindx[ind]  = ind2;
-                        oldindx[oldrank[ind2]] = 0;
-                        oldrank[ind2] = 0;
-                    }
-                }
-            }
-            indready++;
+    /* Gray encode */
+    for(i=1;i<dim;i++)
+        x[i] ^= x[i-1];
+    t = 0;
+    for(q=m;q>1;q>>=1)
+        if(x[dim-1] & q) t ^= q-1;
+    for(i=0;i<dim;i++)
+        x[i] ^= t;
 
-        } while(ind < noknots);
+    /* Interleave the transposed bits */
+    key = 0;
+    for(j=bits-1;j>=0;j--)
+        for(i=0;i<dim;i++)
+            key = (key << 1) | ((x[i] >> j) & 1);
 
-        indexwidth = CalculateIndexwidth(data,TRUE,newrank);
-        if(info) printf("Indexwidth of the suggested node order is %d.\n",indexwidth);
+    return(key);
+}
 
-        for(i=1;i<=noknots;i++)
-            oldrank[i] = newrank[i];
 
-        for(i=1;i<=noknots;i++)
-            oldindx[i] = newindx[i];
+static void ReorderElementsHilbert(struct FemType *data,int *elemindx,int info)
+/* Orders the elements along a Hilbert curve through their centers, elemindx[i]
+   being the old index of the new element i. */
+{
+    int i,j,k,dim,bits,nonodes,noelements;
+    unsigned int ix[3];
+    Real xmin[3],xmax[3],c[3],scale;
+    struct HilbertKeyType *keys;
+
+    noelements = data->noelements;
+    dim = (data->dim == 3) ? 3 : 2;
+    bits = (dim == 3) ? 21 : 31;
 
-        if(indexwidth < minwidth) {
-            for(i=1;i<=noknots;i++)
-                origindx[i] = newindx[i];
-            minwidth = indexwidth;
+    xmin[0] = xmax[0] = data->x[1];
+    xmin[1] = xmax[1] = data->y[1];
+    xmin[2] = xmax[2] = data->z[1];
+    for(i=1;i<=data->noknots;i++) {
+        xmin[0] = MIN(xmin[0],data->x[i]);
+        xmax[0] = MAX(xmax[0],data->x[i]);
+        xmin[1] = MIN(xmin[1],data->y[i]);
+        xmax[1] = MAX(xmax[1],data->y[i]);
+        xmin[2] = MIN(xmin[2],data->z[i]);
+        xmax[2] = MAX(xmax[2],data->z[i]);
+    }
+    scale = 0.0;
+    for(k=0;k<dim;k++)
+        scale = MAX(scale,xmax[k]-xmin[k]);
+    if(scale > 0.0) scale = ((1U << bits) - 1) / scale;
+
+    keys = (struct HilbertKeyType*) malloc((size_t) noelements*sizeof(struct HilbertKeyType));
+    if(!keys) nrerror("allocation failure in ReorderElementsHilbert()");
+
+#pragma omp parallel for private(j,k,nonodes,c,ix) schedule(static)
+    for(i=1;i<=noelements;i++) {
+        nonodes = data->elementtypes[i] % 100;
+        c[0] = c[1] = c[2] = 0.0;
+        for(j=0;j<nonodes;j++) {
+            k = data->topology[i][j];
+            c[0] += data->x[k];
+            c[1] += data->y[k];
+            c[2] += data->z[k];
         }
+        for(k=0;k<dim;k++)
+            ix[k] = (unsigned int) (scale * (c[k]/nonodes - xmin[k]));
+        keys[i-1].key = HilbertKey(ix,dim,bits);
+        keys[i-1].indx = i;
     }
 
-    free_Ivector(cands,1,maxnodes);
-    free_Ivector(localorder,1,maxnodes);
-    free_Ivector(localtmp,1,maxnodes);
-    free_Rvector(localdist,1,maxnodes);
+    qsort(keys,(size_t) noelements,sizeof(struct HilbertKeyType),CompareHilbertKeys);
 
-    free_Imatrix(neighbours,1,noknots,1,maxnodes);
-    free_Ivector(newrank,1,noknots);
-    free_Ivector(oldrank,1,noknots);
-    free_Ivector(newindx,1,noknots);
-    free_Ivector(oldindx,1,noknots);
+    for(i=1;i<=noelements;i++)
+        elemindx[i] = keys[i-1].indx;
+
+    free(keys);
+
+    if(info) printf("Ordered the elements along a %d-dimensional Hilbert curve\n",dim);
 }
 
 
@@ -3466,30 +3603,35 @@ void ReorderElements(struct FemType *data,struct BoundaryType *bound,
         corder[2] = cz;
     }
 
-    if(info) printf("Ordering with (%.3lg*x + %.3lg*y + %.3lg*z)\n",cx,cy,cz);
-    for(i=1;i<=noknots;i++) {
-        arrange[i] = cx*data->x[i] + cy*data->y[i];
-        if(data->dim == 3) arrange[i] += cz*data->z[i];
+    /* The automatic ordering minimizes the bandwidth of the nodes and
+       keeps the elements local, otherwise a linear sweep is used */
+    if(manual == 2) {
+        ReorderNodesRCM(data,indx,info);
+        ReorderElementsHilbert(data,elemindx,info);
     }
-    SortIndex(noknots,arrange,indx);
+    else {
+        if(info) printf("Ordering with (%.3lg*x + %.3lg*y + %.3lg*z)\n",cx,cy,cz);
+        for(i=1;i<=noknots;i++) {
+            arrange[i] = cx*data->x[i] + cy*data->y[i];
+            if(data->dim == 3) arrange[i] += cz*data->z[i];
+        }
+        SortIndex(noknots,arrange,indx);
 
-    if(manual == 2) ReorderAutomatic(data,0,indx,corder,TRUE);
+        for(j=1;j<=noelements;j++) {
+            nonodes = data->elementtypes[j]%100;
+            arrange[j] = 0.0;
+            for(i=0;i<nonodes;i++) {
+                k = data->topology[j][i];
+                arrange[j] += cx*data->x[k] + cy*data->y[k];
+                if(data->dim == 3) arrange[j] +=  cz*data->z[k];
+            }
+        }
+        SortIndex(noelements,arrange,elemindx);
+    }
 
     for(i=1;i<=noknots;i++)
         revindx[indx[i]] = i;
 
-
-    for(j=1;j<=noelements;j++) {
-        nonodes = data->elementtypes[j]%100;
-        arrange[j] = 0.0;
-        for(i=0;i<nonodes;i++) {
-            k = data->topology[j][i];
-            arrange[j] += cx*data->x[k] + cy*data->y[k];
-            if(data->dim == 3) arrange[j] +=  cz*data->z[k];
-        }
-    }
-
-    SortIndex(noelements,arrange,elemindx);
     for(i=1;i<=noelements;i++)
         revelemindx[elemindx[i]] = i;
 
@@ -3535,6 +3677,11 @@ void ReorderElements(struct FemType *data,struct BoundaryType *bound,
         }
     }
 
+    DestroyTopologyTables(data);
+    free_Ivector(data->material,1,noelements);
+    free_Ivector(data->elementtypes,1,noelements);
+    free_Imatrix(data->topology,1,noelements,0,data->maxnodes-1);
+
     data->material = newmaterial;
     data->elementtypes = newelementtypes;
     data->topology = newtopology;
@@ -3598,6 +3745,7 @@ int RemoveUnusedNodes(struct FemType *data,int info)
     }
 
     if(info) printf("Removing %d unused nodes (out of %d) from the mesh\n",noknots-activeknots,noknots);
+    DestroyTopologyTables(data);
 
     for(j=1;j<=noelements;j++) {
         nonodes = data->elementtypes[j] % 100;
@@ -3824,132 +3972,56 @@ int RemoveLowerDimensionalBoundaries(struct FemType *data,struct BoundaryType *b
 
 static void FindEdges(struct FemType *data,struct BoundaryType *bound,
                       int material,int sidetype,int info)
+/* Creates a boundary of the edges that only one element of the given
+   material owns. */
 {
-    int i,j,side,identical,element;
-    int noknots,nomaterials,nosides,newbound;
-    int maxelementtype,maxedgenodes,elemedges,maxelemedges,edge,dosides;
-    int **edgetable,sideind[MAXNODESD1],sideelemtype,allocated;
-    int *indx;
-    Real *arrange;
-
-
-    nomaterials = 0;
-    maxelementtype = 0;
+    int i,j,k,edge,element,side,owners,nosides,newbound,maxelementtype;
 
     printf("FindEdges: Finding edges of bulk elements of type %d\n",material);
     maxelementtype = GetMaxElementType(data);
 
-    if(maxelementtype/100 > 4) {
+    if(maxelementtype/100 < 3 || maxelementtype/100 > 4) {
         printf("FindEdges: Implemented only for 2D elements!\n");
-        dosides = 0;
         return;
     }
 
-    if(maxelementtype/100 <= 2) maxedgenodes = 1;
-    else if(maxelementtype/100 <= 4) maxedgenodes = 2;
-    maxelemedges = maxelementtype/100;
-
-    edgetable = Imatrix(1,maxelemedges*nomaterials,0,maxedgenodes+1);
-    for(i=1;i<=maxelemedges*nomaterials;i++)
-        for(j=0;j<=maxedgenodes+1;j++)
-            edgetable[i][j] = 0;
+    CreateEdgeTable(data,info);
 
-    edge = 0;
-    for(element=1;element<=data->noelements;element++) {
-        if(data->material[element] != material) continue;
-
-        elemedges = data->elementtypes[element]/100;
-
-        for(side=0;side<elemedges;side++) {
-            edge++;
-
-            GetElementSide(element,side,1,data,sideind,&sideelemtype);
-            edgetable[edge][maxedgenodes] = element;
-            edgetable[edge][maxedgenodes+1] = side;
-
-            if(maxedgenodes == 1)
-                edgetable[edge][0] = sideind[0];
-            else if(maxedgenodes == 2) {
-                if(sideind[0] > sideind[1]) {
-                    edgetable[edge][0] = sideind[0];
-                    edgetable[edge][1] = sideind[1];
-                }
-                else {
-                    edgetable[edge][1] = sideind[0];
-                    edgetable[edge][0] = sideind[1];
-                }
-            }
-        }
+    nosides = 0;
+    for(edge=1;edge<=data->noedges;edge++) {
+        owners = 0;
+        for(j=data->edgeelemoffset[edge];j<data->edgeelemoffset[edge+1];j++)
+            if(data->material[data->edgeelems[j]] == material) owners++;
+        if(owners == 1) nosides++;
     }
 
-    noknots = edge;
-    arrange = Rvector(1,noknots);
-    for(i=1;i<=noknots;i++)
-        arrange[i] = 0.0;
-    for(i=1;i<=noknots;i++)
-        arrange[i] = edgetable[i][0];
-    indx = Ivector(1,noknots);
-
-    SortIndex(noknots,arrange,indx);
-
-#if 0
-    printf("noknots = %d\n",noknots);
-    for(i=1;i<=noknots;i++)
-        printf("indx[%d]=%d  edge=%d  arrange[%d] = %lg  arrange[indx[%d]] = %lg\n",
-               i,indx[i],edgetable[i][0],i,arrange[i],i,arrange[indx[i]]);
-#endif
-#if 0
-    revindx = Ivector(1,data->noknots);
-    for(i=1;i<=noknots;i++)
-        revindx[indx[i]] = i;
-#endif
-
-    allocated = FALSE;
+    for(j=0;j < MAXBOUNDARIES && bound[j].created;j++);
+    newbound = j;
+    AllocateBoundary(&bound[newbound],nosides);
+    if(info) printf("Created boundary %d of type %d and size %d for material %d\n",
+                    newbound,sidetype,nosides,material);
 
-omstart:
+    /* The sides follow the order of the elements */
     nosides = 0;
+    for(element=1;element<=data->noelements;element++) {
+        if(data->material[element] != material) continue;
 
-    for(i=1;i<=noknots;i++) {
-        identical = FALSE;
-        if(maxedgenodes == 1) {
-            for(j=i+1;j<=noknots && edgetable[indx[i]][0] == edgetable[indx[j]][0];j++)
-                identical = TRUE;
-            for(j=i-1;j>=1 && edgetable[indx[i]][0] == edgetable[indx[j]][0];j--)
-                identical = TRUE;
-        }
-        else if(maxedgenodes == 2) {
-            for(j=i+1;j<=noknots && edgetable[indx[i]][0] == edgetable[indx[j]][0];j++)
-                if(edgetable[indx[i]][1] == edgetable[indx[j]][1])
-                    identical = TRUE;
-            for(j=i-1;j>=1 && edgetable[indx[i]][0] == edgetable[indx[j]][0];j--)
-                if(edgetable[indx[i]][1] == edgetable[indx[j]][1])
-                    identical = TRUE;
-        }
-
-        if(identical) continue;
-        nosides++;
-        if(allocated) {
-            bound[newbound].parent[nosides] = edgetable[indx[i]][maxedgenodes];
+        for(i=data->elemedgeoffset[element];i<data->elemedgeoffset[element+1];i++) {
+            edge = data->elemedges[i];
+            owners = 0;
+            for(k=data->edgeelemoffset[edge];k<data->edgeelemoffset[edge+1];k++)
+                if(data->material[data->edgeelems[k]] == material) owners++;
+            if(owners != 1) continue;
+
+            side = i - data->elemedgeoffset[element];
+            nosides++;
+            bound[newbound].parent[nosides] = element;
             bound[newbound].parent2[nosides] = 0;
-            bound[newbound].side[nosides] = edgetable[indx[i]][maxedgenodes+1];
+            bound[newbound].side[nosides] = side;
             bound[newbound].side2[nosides] = 0;
             bound[newbound].types[nosides] = sidetype;
         }
     }
-
-    if(!allocated) {
-        for(j=0;j < MAXBOUNDARIES && bound[j].created;j++);
-        newbound = j;
-        AllocateBoundary(&bound[newbound],nosides);
-        allocated = TRUE;
-        if(info) printf("Created boundary %d of type %d and size %d for material %d\n",
-                        newbound,sidetype,nosides,material);
-        goto omstart;
-    }
-
-
-    free_Ivector(indx,1,noknots);
-    free_Imatrix(edgetable,1,maxelemedges*nomaterials,0,maxedgenodes+1);
 }
 
 
@@ -3969,6 +4041,19 @@ static int CompareIndexes(int elemtype,int *ind1,int *ind2)
 
 
 
+static int LowerDimIndex(struct FemType *data,int lowerdim,int sideelemtype,int *sideind)
+/* A number shared by the sides of the elements with the same nodes: the node,
+   the edge or the side of the topology tables. Zero if not found. */
+{
+    if(lowerdim == 0)
+        return(sideind[0]);
+    else if(lowerdim == 1)
+        return(GetEdgeIndex(data,sideind[0],sideind[1]));
+    else
+        return(GetSideIndex(data,sideelemtype,sideind));
+}
+
+
 int FindNewBoundaries(struct FemType *data,struct BoundaryType *bound,
                       int *boundnodes,int suggesttype,int dimred,int info)
 {
@@ -3976,6 +4061,7 @@ int FindNewBoundaries(struct FemType *data,struct BoundaryType *bound,
     int nonodes,nosides,newbound = 0;
     int sideind[MAXNODESD1],sideind0[MAXNODESD1],sideelemtype,sideelemtype0,allocated;
     int noboundnodes,sameside,newtype = 0,elemtype;
+    int *firstside,nofirst,index;
 
     allocated = FALSE;
     dim = data->dim;
@@ -4055,6 +4141,20 @@ omstart:
             nosides++;
 
             if(allocated) {
+                /* The side found earlier in another element gets the second parent */
+                index = LowerDimIndex(data,lowerdim,sideelemtype,sideind);
+                if(index > 0 && index <= nofirst) {
+                    i = firstside[index];
+                    if(i && !bound[newbound].parent2[i]) {
+                        bound[newbound].parent2[i] = element;
+                        bound[newbound].side2[i] = side;
+                        nosides--;
+                        goto foundsameside;
+                    }
+                    firstside[index] = nosides;
+                    goto newside;
+                }
+
                 for(i=1;i<nosides;i++) {
                     if(bound[newbound].parent2[i]) continue;
 
@@ -4070,6 +4170,7 @@ omstart:
                     }
                 }
 
+newside:
                 bound[newbound].types[nosides] = newtype;
                 bound[newbound].parent[nosides] = element;
                 bound[newbound].side[nosides] = side;
@@ -4096,9 +4197,25 @@ foundsameside:
             AllocateBoundary(&bound[newbound],nosides);
             allocated = TRUE;
             if(info) printf("Allocating for %d sides of boundary %d\n",nosides,newtype);
+
+            if(lowerdim == 0)
+                nofirst = data->noknots;
+            else if(lowerdim == 1) {
+                CreateEdgeTable(data,FALSE);
+                nofirst = data->noedges;
+            }
+            else {
+                CreateSideTable(data,FALSE);
+                nofirst = data->nouniquesides;
+            }
+            firstside = Ivector(1,MAX(nofirst,1));
+            for(i=1;i<=nofirst;i++)
+                firstside[i] = 0;
             goto omstart;
         }
 
+        free_Ivector(firstside,1,MAX(nofirst,1));
+
         bound[newbound].nosides = nosides;
         if(info) printf("Found %d sides of dim %d to define boundary %d\n",nosides,lowerdim,newtype);
 
@@ -4586,35 +4703,21 @@ int FindBoundaryBoundary(struct FemType *data,struct BoundaryType *bound,int mat
 
 
 int IncreaseElementOrder(struct FemType *data,int info)
+/* Adds a midnode to every edge of the edge table. The new node of edge i is
+   noknots+i, so both the coordinates and the topology are single passes. */
 {
-    int i,j,side,element,maxcon,con,newknots,ind,ind2;
-    int noelements,noknots,nonodes,maxnodes = 0,maxelemtype,hit,node,elemtype;
-    int **newnodetable,inds[2],**newtopo;
+    int i,j,element,newknots,node1,node2;
+    int noelements,noknots,nonodes,maxnodes = 0,maxelemtype,elemtype;
+    int **newtopo;
     Real *newx,*newy,*newz;
 
     if(info) printf("Trying to increase the element order of current elements\n");
 
-    CreateDualGraph(data,FALSE,info);
+    CreateEdgeTable(data,info);
 
     noknots = data->noknots;
     noelements = data->noelements;
-    maxcon = data->dualmaxconnections;
-
-    newnodetable = Imatrix(0,maxcon-1,1,noknots);
-    for(i=1;i<=noknots;i++)
-        for(j=0;j<maxcon;j++)
-            newnodetable[j][i] = 0;
-
-    newknots = 0;
-    for(i=1;i<=noknots;i++) {
-        for(j=0;j<maxcon;j++) {
-            con = data->dualgraph[j][i];
-            if(con > i) {
-                newknots++;
-                newnodetable[j][i] = noknots + newknots;
-            }
-        }
-    }
+    newknots = data->noedges;
 
     if(info) printf("There will be %d new nodes in the elements\n",newknots);
 
@@ -4628,16 +4731,13 @@ int IncreaseElementOrder(struct FemType *data,int info)
         newy[i] = data->y[i];
         newz[i] = data->z[i];
     }
-    for(i=1;i<=noknots;i++) {
-        for(j=0;j<maxcon;j++) {
-            con = data->dualgraph[j][i];
-            ind = newnodetable[j][i];
-            if(con && ind) {
-                newx[ind] = 0.5*(data->x[i] + data->x[con]);
-                newy[ind] = 0.5*(data->y[i] + data->y[con]);
-                newz[ind] = 0.5*(data->z[i] + data->z[con]);
-            }
-        }
+#pragma omp parallel for private(node1,node2) schedule(static)
+    for(i=1;i<=newknots;i++) {
+        node1 = data->edgenodes[2*i-1];
+        node2 = data->edgenodes[2*i];
+        newx[noknots+i] = 0.5*(data->x[node1] + data->x[node2]);
+        newy[noknots+i] = 0.5*(data->y[node1] + data->y[node2]);
+        newz[noknots+i] = 0.5*(data->z[node1] + data->z[node2]);
     }
     
 
@@ -4663,51 +4763,25 @@ int IncreaseElementOrder(struct FemType *data,int info)
     if(info) printf("New leading elementtype is %d\n",100*(maxelemtype/100)+maxnodes);
 
     newtopo = Imatrix(1,noelements,0,maxnodes-1);
-    
+
+#pragma omp parallel for private(i,j,elemtype,nonodes) schedule(static)
     for(element=1;element<=noelements;element++) {
         elemtype = data->elementtypes[element];
-        for(i=0;i<elemtype%100;i++)
+        nonodes = elemtype % 100;
+        for(i=0;i<nonodes;i++)
             newtopo[element][i] = data->topology[element][i];
-    }
-
-
-    for(element=1;element<=data->noelements;element++) {
-        elemtype = data->elementtypes[element];
-
-        nonodes = data->elementtypes[element] % 100;
-        for(side=0;;side++) {
-            hit = GetElementGraph(element,side,data,inds);
-
-            if(!hit) break;
-            if(inds[0] > inds[1]) {
-                ind = inds[1];
-                ind2 = inds[0];
-            }
-            else {
-                ind = inds[0];
-                ind2 = inds[1];
-            }
-            for(j=0;j<maxcon;j++) {
-                con = data->dualgraph[j][ind];
 
-                if(con == ind2) {
-                    node = newnodetable[j][ind];
-                    newtopo[element][nonodes+side] = node;
-                }
-            }
-        }
+        j = 0;
+        for(i=data->elemedgeoffset[element];i<data->elemedgeoffset[element+1];i++)
+            newtopo[element][nonodes+(j++)] = noknots + data->elemedges[i];
 
-        elemtype = 100*(elemtype/100)+nonodes+side;
-        data->elementtypes[element] = elemtype;
+        data->elementtypes[element] = 100*(elemtype/100)+nonodes+j;
     }
 
-    DestroyDualGraph(data,info);
-
     free_Rvector(data->x,1,data->noknots);
     free_Rvector(data->y,1,data->noknots);
     free_Rvector(data->z,1,data->noknots);
     free_Imatrix(data->topology,1,data->noelements,0,data->maxnodes);
-    free_Imatrix(newnodetable,0,maxcon-1,1,noknots);
 
     data->x = newx;
     data->y = newy;
@@ -4860,6 +4934,7 @@ static void CylindricalCoordinateTransformation(struct FemType *data,Real r1,Rea
         }
     }
     printf("Found %d double nodes in %d tests.\n",hits,tests);
+    DestroyTopologyTables(data);
 
     for(j=1;j<=data->noelements;j++) {
         nonodes1 = data->elementtypes[j]%100;
@@ -5978,6 +6053,7 @@ void ReduceElementOrder(struct FemType *data,int matmin,int matmax)
     data->z = newz;
     data->noknots = j;
 
+    DestroyTopologyTables(data);
     for(element=1;element<=data->noelements;element++) {
         maxnode = data->elementtypes[element]%100;
         for(i=0;i<maxnode;i++)
@@ -5988,29 +6064,170 @@ void ReduceElementOrder(struct FemType *data,int matmin,int matmax)
 
 
 
-void MergeElements(struct FemType *data,struct BoundaryType *bound,
-                   int manual,Real corder[],Real eps,int mergebounds,int info)
-{
-    int i,j,k,l;
-    int noelements,noknots,newnoknots,nonodes;
-    int *mergeindx,*doubles;
-    Real *newx,*newy,*newz;
-    Real cx,cy,cz,dx,dy,dz,cdist,dist;
+/* Points hashed by their cell in a uniform grid, for finding coincident
+   points in O(n) expected time. The points are given by 1-based coordinate
+   vectors and each bucket lists its points in ascending order. */
+struct PointHashType {
+    int nopoints,
+        nobuckets,
+        *start,
+        *points;
+    Real *x,*y,*z,
+        xmin[3],
+        h;
+};
 
-    ReorderElements(data,bound,manual,corder,TRUE);
 
-    /* The known ordering by vector corder[] is used to
-     reduce the cost of finding the merged nodes. */
+static int PointHashBucket(struct PointHashType *hash,Real x,Real y,Real z,
+                           int di,int dj,int dk)
+{
+    long long cx,cy,cz;
 
-    cx = corder[0];
-    cy = corder[1];
-    cz = corder[2];
+    cx = (long long) floor((x-hash->xmin[0])/hash->h) + di;
+    cy = (long long) floor((y-hash->xmin[1])/hash->h) + dj;
+    cz = (long long) floor((z-hash->xmin[2])/hash->h) + dk;
+    return((int) ((unsigned long long) (cx*73856093LL ^ cy*19349663LL ^ cz*83492791LL)
+                  % hash->nobuckets));
+}
+
+
+static void CreatePointHash(struct PointHashType *hash,int n,Real *x,Real *y,Real *z,Real h)
+{
+    int i,b,*bucket;
+
+    hash->nopoints = n;
+    hash->nobuckets = 2*n+1;
+    hash->x = x;
+    hash->y = y;
+    hash->z = z;
+    hash->h = h;
+
+    hash->xmin[0] = hash->xmin[1] = hash->xmin[2] = 0.0;
+    for(i=1;i<=n;i++) {
+        if(i == 1 || x[i] < hash->xmin[0]) hash->xmin[0] = x[i];
+        if(i == 1 || y[i] < hash->xmin[1]) hash->xmin[1] = y[i];
+        if(i == 1 || z[i] < hash->xmin[2]) hash->xmin[2] = z[i];
+    }
+
+    /* Counting sort of the points by bucket, in compressed row form */
+    hash->start = Ivector(0,hash->nobuckets);
+    hash->points = Ivector(0,MAX(n,1)-1);
+    bucket = Ivector(1,MAX(n,1));
+
+    for(b=0;b<=hash->nobuckets;b++)
+        hash->start[b] = 0;
+    for(i=1;i<=n;i++) {
+        bucket[i] = PointHashBucket(hash,x[i],y[i],z[i],0,0,0);
+        hash->start[bucket[i]+1] += 1;
+    }
+    for(b=0;b<hash->nobuckets;b++)
+        hash->start[b+1] += hash->start[b];
+    for(i=1;i<=n;i++)
+        hash->points[hash->start[bucket[i]]++] = i;
+    for(b=hash->nobuckets;b>0;b--)
+        hash->start[b] = hash->start[b-1];
+    hash->start[0] = 0;
+
+    free_Ivector(bucket,1,MAX(n,1));
+}
+
+
+static void DestroyPointHash(struct PointHashType *hash)
+{
+    free_Ivector(hash->start,0,hash->nobuckets);
+    free_Ivector(hash->points,0,MAX(hash->nopoints,1)-1);
+    hash->nopoints = hash->nobuckets = 0;
+}
+
+
+static int FindHashedPoint(struct PointHashType *hash,Real x,Real y,Real z,Real eps,
+                           int maxindx,int *exclude)
+/* Returns the smallest point index below maxindx within distance eps from (x,y,z),
+   or 0 if there is none. Points with nonzero exclude[] are skipped.
+   The cell size of the hash must not be smaller than eps. */
+{
+    int i,k,b,di,dj,dk,found;
+    Real dx,dy,dz;
+
+    found = 0;
+    for(di=-1;di<=1;di++)
+        for(dj=-1;dj<=1;dj++)
+            for(dk=-1;dk<=1;dk++) {
+                b = PointHashBucket(hash,x,y,z,di,dj,dk);
+
+                for(k=hash->start[b];k<hash->start[b+1];k++) {
+                    i = hash->points[k];
+                    if(i >= maxindx) break;
+                    if(found && i >= found) break;
+                    if(exclude && exclude[i]) continue;
+
+                    dx = hash->x[i] - x;
+                    dy = hash->y[i] - y;
+                    dz = hash->z[i] - z;
+                    if(dx*dx + dy*dy + dz*dz < eps*eps) {
+                        found = i;
+                        break;
+                    }
+                }
+            }
+    return(found);
+}
+
+
+static int FindCoincidentNodes(struct FemType *data,Real eps,int *mergeindx,int *doubles)
+/* Sets mergeindx[j] = -i when node j is closer than eps to the earlier unmerged node i.
+   Each node is joined with the first such node, as in a full pairwise search,
+   but only the neighbouring cells of a hash of size eps are searched.
+   Returns the number of nodes merged. */
+{
+    int i,j,noknots,merged;
+    int *first;
+    struct PointHashType hash;
+
+    noknots = data->noknots;
+    if(eps <= 0.0 || noknots < 2) return(0);
+
+    CreatePointHash(&hash,noknots,data->x,data->y,data->z,eps);
+
+    /* The nearest earlier node does not depend on the merging and may be
+       searched for each node independently. */
+    first = Ivector(1,noknots);
+#pragma omp parallel for schedule(static)
+    for(j=1;j<=noknots;j++)
+        first[j] = FindHashedPoint(&hash,data->x[j],data->y[j],data->z[j],eps,j,NULL);
+
+    /* Only if that node was itself merged must the search be repeated */
+    merged = 0;
+    for(j=2;j<=noknots;j++) {
+        i = first[j];
+        if(!i) continue;
+        if(mergeindx[i])
+            i = FindHashedPoint(&hash,data->x[j],data->y[j],data->z[j],eps,j,mergeindx);
+        if(!i) continue;
+
+        doubles[i] = doubles[j] = TRUE;
+        mergeindx[j] = -i;
+        merged++;
+    }
+
+    free_Ivector(first,1,noknots);
+    DestroyPointHash(&hash);
+
+    return(merged);
+}
+
+
+void MergeElements(struct FemType *data,struct BoundaryType *bound,
+                   int manual,Real corder[],Real eps,int mergebounds,int info)
+{
+    int i,j,k,l;
+    int noelements,noknots,newnoknots,nonodes;
+    int *mergeindx,*doubles;
+    Real *newx,*newy,*newz;
 
-    /* Normalizing for future use */
-    cdist = sqrt(cx*cx+cy*cy+cz*cz);
-    cx /= cdist;
-    cy /= cdist;
-    cz /= cdist;
+    /* The ordering is not needed for finding the merged nodes any more
+       but it defines the numbering of the resulting mesh. */
+    ReorderElements(data,bound,manual,corder,TRUE);
 
     noelements  = data->noelements;
     noknots = data->noknots;
@@ -6026,27 +6243,7 @@ void MergeElements(struct FemType *data,struct BoundaryType *bound,
 
     if(info) printf("Merging nodes close (%.3lg) to one another.\n",eps);
 
-    dz = 0.0;
-    for(i=1;i<noknots;i++) {
-        if(mergeindx[i]) continue;
-
-        for(j=i+1; j<=noknots;j++) {
-            if(mergeindx[j]) continue;
-
-            dx = data->x[i] - data->x[j];
-            dy = data->y[i] - data->y[j];
-            dz = data->z[i] - data->z[j];
-            if(fabs(cx*dx+cy*dy+cz*dz) > eps) break;
-
-            dist = dx*dx + dy*dy + dz*dz;
-
-            if(dist < eps*eps) {
-                doubles[i] = doubles[j] = TRUE;
-                mergeindx[j] = -i;
-                newnoknots--;
-            }
-        }
-    }
+    newnoknots -= FindCoincidentNodes(data,eps,mergeindx,doubles);
 
     if(mergebounds) MergeBoundaries(data,bound,doubles,info);
 
@@ -6091,6 +6288,7 @@ void MergeElements(struct FemType *data,struct BoundaryType *bound,
     if(info) printf("Merging the topologies.\n");
 #endif
 
+    DestroyTopologyTables(data);
     l = 0;
     for(j=1;j<=noelements;j++) {
         nonodes = data->elementtypes[j] % 100;
@@ -6102,6 +6300,7 @@ void MergeElements(struct FemType *data,struct BoundaryType *bound,
 
     data->noknots = newnoknots;
     free_Ivector(mergeindx,1,noknots);
+    free_Ivector(doubles,1,noknots);
 
     if(info) printf("Merging of nodes is complete.\n");
 }
@@ -6432,6 +6631,7 @@ foundtwo:
 
 
     /* Reorder remaining master elements */
+    DestroyTopologyTables(data);
     parentorder = Ivector(1,noelements);
     j = 0;
     for(i=1;i<=noelements;i++) {
@@ -6476,18 +6676,194 @@ foundtwo:
 
 
 
-int FindPeriodicNodes(struct FemType *data,int periodicdim[],int info)
+static void SetPeriodicPair(int *indxper,int j,int j2)
+/* Node j2 becomes the image of node j, or of the node that j itself is the image of */
+{
+    while(indxper[j] != j) j = indxper[j];
+    if(j != j2) indxper[j2] = j;
+}
+
+
+static int PairPeriodicNodes(struct FemType *data,int *indxper,int botn,int *revindbot,
+                             Real *bx,Real *by,Real *bz,int topn,int *revindtop,
+                             Real *tx,Real *ty,Real *tz,Real eps,int info)
+/* Pairs the bottom nodes, mapped to the top surface with coordinates b[xyz],
+   with the top nodes at t[xyz] through a spatial hash. Returns the number of
+   bottom and top nodes left without a counterpart. */
+{
+    int i,i2,j,j2,hits,unmatched;
+    int *found,*topfound;
+    struct PointHashType hash;
+
+    CreatePointHash(&hash,topn,tx,ty,tz,eps);
+
+    found = Ivector(1,MAX(botn,1));
+#pragma omp parallel for schedule(static)
+    for(i=1;i<=botn;i++)
+        found[i] = FindHashedPoint(&hash,bx[i],by[i],bz[i],eps,topn+1,NULL);
+
+    topfound = Ivector(1,MAX(topn,1));
+    for(i2=1;i2<=topn;i2++)
+        topfound[i2] = FALSE;
+
+    hits = unmatched = 0;
+    for(i=1;i<=botn;i++) {
+        j = revindbot[i];
+        i2 = found[i];
+        if(i2) {
+            j2 = revindtop[i2];
+            topfound[i2] = TRUE;
+            SetPeriodicPair(indxper,j,j2);
+            hits++;
+        }
+        else {
+            if(unmatched < 10)
+                printf("Couldn't find a periodic counterpart for node %d at [%.3lg %.3lg %.3lg]\n",
+                       j,data->x[j],data->y[j],data->z[j]);
+            unmatched++;
+        }
+    }
+    for(i2=1;i2<=topn;i2++) {
+        if(topfound[i2]) continue;
+        j2 = revindtop[i2];
+        if(unmatched < 10)
+            printf("Couldn't find a periodic counterpart for node %d at [%.3lg %.3lg %.3lg]\n",
+                   j2,data->x[j2],data->y[j2],data->z[j2]);
+        unmatched++;
+    }
+
+    if(info) printf("Paired %d periodic nodes\n",hits);
+    if(unmatched) printf("There are %d nodes without a periodic counterpart!\n",unmatched);
+
+    free_Ivector(found,1,MAX(botn,1));
+    free_Ivector(topfound,1,MAX(topn,1));
+    DestroyPointHash(&hash);
+
+    return(unmatched);
+}
+
+
+static int FindRotationalPeriodicNodes(struct FemType *data,int *indxper,Real angle,int info)
+/* Pairs the nodes on the two sides of a sector of the given angle (in degrees)
+   about the z-axis. The sector is located from the largest angular gap of the nodes. */
+{
+    int i,j,k,noknots,n,botn,topn,unmatched;
+    int *indx,*revindbot,*revindtop;
+    Real eps,rmax,r,phi,phi0,gap,span,alpha,c,s;
+    Real *phis,*bx,*by,*bz,*tx,*ty,*tz;
+
+    noknots = data->noknots;
+    alpha = angle * FM_PI / 180.0;
+
+    rmax = 0.0;
+    for(i=1;i<=noknots;i++) {
+        r = sqrt(data->x[i]*data->x[i] + data->y[i]*data->y[i]);
+        if(r > rmax) rmax = r;
+    }
+    if(rmax < 1.0e-10) return(0);
+    eps = 1.0e-5 * rmax;
+
+    /* Sorted polar angles of the nodes off the axis */
+    phis = Rvector(1,noknots);
+    indx = Ivector(1,noknots);
+    n = 0;
+    for(i=1;i<=noknots;i++) {
+        r = sqrt(data->x[i]*data->x[i] + data->y[i]*data->y[i]);
+        if(r < eps) continue;
+        phis[++n] = atan2(data->y[i],data->x[i]);
+    }
+    if(n < 2) {
+        free_Rvector(phis,1,noknots);
+        free_Ivector(indx,1,noknots);
+        return(0);
+    }
+    SortIndex(n,phis,indx);
+
+    gap = phis[indx[1]] + 2.0*FM_PI - phis[indx[n]];
+    phi0 = phis[indx[1]];
+    for(k=2;k<=n;k++) {
+        if(phis[indx[k]] - phis[indx[k-1]] > gap) {
+            gap = phis[indx[k]] - phis[indx[k-1]];
+            phi0 = phis[indx[k]];
+        }
+    }
+    span = 2.0*FM_PI - gap;
+    free_Rvector(phis,1,noknots);
+    free_Ivector(indx,1,noknots);
+
+    if(info) printf("Sector starts at %.3lg degrees and spans %.3lg degrees\n",
+                    phi0*180.0/FM_PI,span*180.0/FM_PI);
+    if(fabs(span - alpha) > 1.0e-3 * alpha)
+        printf("The sector spans %.3lg degrees instead of %.3lg!\n",span*180.0/FM_PI,angle);
+
+    /* Nodes closer than eps to the two bounding half-planes */
+    revindbot = Ivector(1,noknots);
+    revindtop = Ivector(1,noknots);
+    botn = topn = 0;
+    for(i=1;i<=noknots;i++) {
+        r = sqrt(data->x[i]*data->x[i] + data->y[i]*data->y[i]);
+        if(r < eps) continue;
+        phi = atan2(data->y[i],data->x[i]);
+        if(fabs(r*sin(phi-phi0)) < eps && cos(phi-phi0) > 0.0)
+            revindbot[++botn] = i;
+        else if(fabs(r*sin(phi-phi0-alpha)) < eps && cos(phi-phi0-alpha) > 0.0)
+            revindtop[++topn] = i;
+    }
+    if(info) printf("Looking for %d rotationally periodic nodes\n",botn);
+
+    bx = Rvector(1,MAX(botn,1));
+    by = Rvector(1,MAX(botn,1));
+    bz = Rvector(1,MAX(botn,1));
+    tx = Rvector(1,MAX(topn,1));
+    ty = Rvector(1,MAX(topn,1));
+    tz = Rvector(1,MAX(topn,1));
+
+    c = cos(alpha);
+    s = sin(alpha);
+    for(i=1;i<=botn;i++) {
+        j = revindbot[i];
+        bx[i] = c*data->x[j] - s*data->y[j];
+        by[i] = s*data->x[j] + c*data->y[j];
+        bz[i] = data->z[j];
+    }
+    for(i=1;i<=topn;i++) {
+        j = revindtop[i];
+        tx[i] = data->x[j];
+        ty[i] = data->y[j];
+        tz[i] = data->z[j];
+    }
+
+    unmatched = PairPeriodicNodes(data,indxper,botn,revindbot,bx,by,bz,
+                                  topn,revindtop,tx,ty,tz,eps,info);
+
+    free_Rvector(bx,1,MAX(botn,1));
+    free_Rvector(by,1,MAX(botn,1));
+    free_Rvector(bz,1,MAX(botn,1));
+    free_Rvector(tx,1,MAX(topn,1));
+    free_Rvector(ty,1,MAX(topn,1));
+    free_Rvector(tz,1,MAX(topn,1));
+    free_Ivector(revindbot,1,noknots);
+    free_Ivector(revindtop,1,noknots);
+
+    return(unmatched);
+}
+
+
+int FindPeriodicNodes(struct FemType *data,int periodicdim[],Real periodicangle,int info)
+/* Finds the periodic image of each node for translational periodicity in the
+   given coordinate directions, and for rotational periodicity of a sector of
+   angle periodicangle (in degrees) about the z-axis. The counterparts are
+   found through a spatial hash, and the nodes without one are reported. */
 {
-    int i,j,i2,j2,dim;
-    int noknots,hit,tothits,dimvisited;
-    int *topbot = NULL,*indxper;
-    int botn,topn,*revindtop,*revindbot;
-    Real eps,dist = 0,dx,dy,dz,coordmax,coordmin;
-    Real *coord = NULL,*toparr,*botarr,epsmin;
+    int i,j,dim;
+    int noknots,botn,topn,unmatched;
+    int *indxper,*revindtop,*revindbot;
+    Real eps,coordmax,coordmin;
+    Real *coord = NULL,*bx,*by,*bz,*tx,*ty,*tz;
 
 
     if(data->dim < 3) periodicdim[2] = 0;
-    if(!periodicdim[0] && !periodicdim[1] && !periodicdim[2]) return(1);
+    if(!periodicdim[0] && !periodicdim[1] && !periodicdim[2] && periodicangle == 0.0) return(1);
 
     if(data->periodicexist) {
         printf("FindPeriodicNodes: Subroutine is called for second time\n");
@@ -6495,8 +6871,7 @@ int FindPeriodicNodes(struct FemType *data,int periodicdim[],int info)
     }
 
     noknots = data->noknots;
-    tothits = 0;
-    dimvisited = FALSE;
+    unmatched = 0;
 
     data->periodicexist = TRUE;
     indxper = Ivector(1,noknots);
@@ -6526,148 +6901,69 @@ int FindPeriodicNodes(struct FemType *data,int periodicdim[],int info)
 
         if(coordmax-coordmin < 1.0e-10) continue;
 
-        if(!dimvisited) {
-            topbot = Ivector(1,noknots);
-        }
         eps = 1.0e-5 * (coordmax-coordmin);
 
+        revindtop = Ivector(1,noknots);
+        revindbot = Ivector(1,noknots);
         topn = botn = 0;
-        for(i=1;i<=data->noknots;i++) {
-            if(fabs(coord[i]-coordmax) < eps) {
-                topn++;
-                topbot[i] = topn;
-            }
-            else if(fabs(coord[i] - coordmin) < eps) {
-                botn++;
-                topbot[i] = -botn;
-            }
-            else {
-                topbot[i] = 0;
-            }
+        for(i=1;i<=noknots;i++) {
+            if(fabs(coord[i]-coordmax) < eps)
+                revindtop[++topn] = i;
+            else if(fabs(coord[i] - coordmin) < eps)
+                revindbot[++botn] = i;
         }
 
-        if(topn != botn) {
+        if(topn != botn)
             printf("There should be equal number of top and bottom nodes (%d vs. %d)!\n",topn,botn);
-            return(3);
-        }
-        else {
-            if(info) printf("Looking for %d periodic nodes\n",topn);
-        }
+        else if(info)
+            printf("Looking for %d periodic nodes\n",topn);
 
-        toparr = Rvector(1,topn);
-        botarr = Rvector(1,botn);
-        revindtop = Ivector(1,topn);
-        revindbot = Ivector(1,botn);
+        /* The nodes are compared with the periodic coordinate projected away */
+        bx = Rvector(1,MAX(botn,1));
+        by = Rvector(1,MAX(botn,1));
+        bz = Rvector(1,MAX(botn,1));
+        tx = Rvector(1,MAX(topn,1));
+        ty = Rvector(1,MAX(topn,1));
+        tz = Rvector(1,MAX(topn,1));
 
-        topn = botn = 0;
-        for(i=1;i<=noknots;i++) {
-            j = topbot[i];
-            if(j > 0) {
-                topn++;
-                revindtop[topn] = i;
-            }
-            else if(j < 0) {
-                j = abs(j);
-                botn++;
-                revindbot[botn] = i;
-            }
-        }
-
-
-        if(data->dim == 2) {
-            for(i=1;i<=botn;i++) {
-                j = revindbot[i];
-                hit = FALSE;
-                for(i2=1;i2<=topn;i2++) {
-                    j2 = revindtop[i2];
-                    if(dim == 1) dist = fabs(data->y[j] - data->y[j2]);
-                    else if(dim == 2) dist = fabs(data->x[j] - data->x[j2]);
-                    if(dist < eps) {
-                        hit = TRUE;
-                        goto hit2d;
-                    }
-                }
-hit2d:
-                if(hit) {
-                    tothits++;
-                    if(indxper[j] == j) indxper[j2] = j;
-                    else if(indxper[indxper[j]]==indxper[j]) {
-#if 0
-                        printf("case2: j=[%d %d]  i=[%d %d]\n",j,j2,i,i2);
-#endif
-                        indxper[j2] = indxper[j];
-                    }
-                    else {
-                        printf("unknown 2d case!\n");
-                    }
-                }
-                else {
-                    printf("Couldn't find a periodic counterpart for node %d at [%.3lg %.3lg]]\n",
-                           j,data->x[j],data->y[j]);
-                }
-            }
+        for(i=1;i<=botn;i++) {
+            j = revindbot[i];
+            bx[i] = (dim == 1) ? 0.0 : data->x[j];
+            by[i] = (dim == 2) ? 0.0 : data->y[j];
+            bz[i] = (dim == 3) ? 0.0 : data->z[j];
         }
-
-        dx = dy = dz = 0.0;
-        if(data->dim == 3) {
-            for(i=1;i<=botn;i++) {
-                j = revindbot[i];
-                hit = FALSE;
-                epsmin = coordmax - coordmin;
-
-                for(i2=1;i2<=topn;i2++) {
-                    j2 = revindtop[i2];
-                    if(dim == 1) {
-                        dy = data->y[j] - data->y[j2];
-                        dz = data->z[j] - data->z[j2];
-                    }
-                    else if(dim == 2) {
-                        dx = data->x[j] - data->x[j2];
-                        dz = data->z[j] - data->z[j2];
-                    }
-                    else if(dim == 3) {
-                        dx = data->x[j] - data->x[j2];
-                        dy = data->y[j] - data->y[j2];
-                    }
-                    if(dx*dx+dy*dy+dz*dz < eps*eps) {
-                        hit = TRUE;
-                        goto hit3d;
-                    }
-                }
-
-hit3d:
-                if(hit) {
-                    tothits++;
-
-                    if(indxper[j] == j) indxper[j2] = j;
-                    else if(indxper[indxper[j]]==indxper[j]) {
-                        indxper[j2] = indxper[j];
-                    }
-                    else if(indxper[indxper[indxper[j]]]==indxper[indxper[j]]) {
-                        indxper[j2] = indxper[indxper[j]];
-                    }
-                    else {
-                        printf("unknown 3d case!\n");
-                    }
-                }
-                else {
-                    printf("The periodic counterpart for node %d was not found!\n",j);
-                }
-            }
+        for(i=1;i<=topn;i++) {
+            j = revindtop[i];
+            tx[i] = (dim == 1) ? 0.0 : data->x[j];
+            ty[i] = (dim == 2) ? 0.0 : data->y[j];
+            tz[i] = (dim == 3) ? 0.0 : data->z[j];
         }
-        dimvisited = TRUE;
 
-    }
+        unmatched += PairPeriodicNodes(data,indxper,botn,revindbot,bx,by,bz,
+                                       topn,revindtop,tx,ty,tz,eps,info);
 
-    if(info) printf("Found all in all %d periodic nodes.\n",tothits);
+        free_Rvector(bx,1,MAX(botn,1));
+        free_Rvector(by,1,MAX(botn,1));
+        free_Rvector(bz,1,MAX(botn,1));
+        free_Rvector(tx,1,MAX(topn,1));
+        free_Rvector(ty,1,MAX(topn,1));
+        free_Rvector(tz,1,MAX(topn,1));
+        free_Ivector(revindtop,1,noknots);
+        free_Ivector(revindbot,1,noknots);
+    }
 
-#if 0
-    if(data->noknots < 200) {
-        for(i=1;i<=data->noknots;i++)
-            if(i!=indxper[i]) printf("i=%d per=%d\n",i,indxper[i]);
+    if(periodicangle != 0.0) {
+        if(info) printf("Finding rotationally periodic nodes for a sector of %.3lg degrees\n",
+                        periodicangle);
+        unmatched += FindRotationalPeriodicNodes(data,indxper,periodicangle,info);
     }
-#endif
 
+    j = 0;
+    for(i=1;i<=noknots;i++)
+        if(indxper[i] != i) j++;
+    if(info) printf("Found all in all %d periodic nodes.\n",j);
+
+    if(unmatched) return(3);
     return(0);
 }
 
@@ -7255,6 +7551,7 @@ foundbc:
 
 
     /* Put the pointers to the enlarged data set and destroy the old data */
+    DestroyTopologyTables(data);
     oldx = data->x;
     oldy = data->y;
     oldtopo = data->topology;
@@ -8180,6 +8477,7 @@ int CreateBoundaryLayerDivide(struct FemType *data,struct BoundaryType *bound,
 
     data->x = newx;
     data->y = newy;
+    DestroyTopologyTables(data);
     data->topology = newtopo;
     data->material = newmaterial;
     data->elementtypes = newelementtypes;
@@ -8291,207 +8589,579 @@ int RotateTranslateScale(struct FemType *data,struct ElmergridType *eg,int info)
 
 
 
-int CreateDualGraph(struct FemType *data,int full,int info)
+int CreateInverseTopology(struct FemType *data,int info)
+/* The elements of node i are invtopo[invtopooffset[i]...invtopooffset[i+1]-1]
+   in ascending order. Both the counting and the filling pass go over the
+   elements in parallel. */
 {
-    int i,j,k,l,m,totcon,noelements, noknots,elemtype,nonodes,hit,ind,ind2;
-    int maxcon,percon,edge;
+    int i,j,k,noelements,noknots,nonodes,ind,nocon,elem;
+    int *offset,*fill,*invtopo,minneeded,maxneeded,memtag;
 
-    printf("Creating a dual graph of the finite element mesh\n");
+    printf("Creating an inverse topology of the finite element mesh\n");
 
-    if(data->dualexists) {
-        printf("The dual graph already exists! You shoule remove the old graph!\n");
+    if(data->invtopoexists) {
+        printf("The inverse topology already exists!\n");
+        smallerror("The inverse topology not done");
     }
+    memtag = MemoryTag("topology","CreateInverseTopology");
 
-    maxcon = 0;
-    totcon = 0;
-    percon = 0;
     noelements = data->noelements;
     noknots = data->noknots;
 
-    for(i=1;i<=noelements;i++) {
-        elemtype = data->elementtypes[i];
+    offset = Ivector(1,noknots+1);
+    for(i=1;i<=noknots+1;i++)
+        offset[i] = 0;
 
-        if(!full) {
-            int inds[2];
-            for(edge=0;;edge++) {
-                if( !GetElementGraph(i,edge,data,&inds[0]) ) break;
-
-                ind = inds[0];
-                ind2 = inds[1];
-
-                hit = FALSE;
-                for(l=0;l<maxcon;l++) {
-                    if(data->dualgraph[l][ind] == ind2) hit = TRUE;
-                    if(data->dualgraph[l][ind] == 0) break;
-                }
-                if(!hit) {
-                    if(l >= maxcon) {
-                        data->dualgraph[maxcon] = Ivector(1,noknots);
-                        for(m=1;m<=noknots;m++)
-                            data->dualgraph[maxcon][m] = 0;
-                        maxcon++;
-                    }
-                    data->dualgraph[l][ind] = ind2;
-                    totcon++;
-                }
-
-                /* Make also so symmetric connection */
-                for(l=0;l<maxcon;l++) {
-                    if(data->dualgraph[l][ind2] == ind) hit = TRUE;
-                    if(data->dualgraph[l][ind2] == 0) break;
-                }
-                if(!hit) {
-                    if(l >= maxcon) {
-                        data->dualgraph[maxcon] = Ivector(1,noknots);
-                        for(m=1;m<=noknots;m++)
-                            data->dualgraph[maxcon][m] = 0;
-                        maxcon++;
-                    }
-                    data->dualgraph[l][ind2] = ind;
-                    totcon++;
-                }
-            }
+#pragma omp parallel for private(j,ind,nonodes) schedule(static)
+    for(i=1;i<=noelements;i++) {
+        nonodes = data->elementtypes[i] % 100;
+        for(j=0;j<nonodes;j++) {
+            ind = data->topology[i][j];
+#pragma omp atomic
+            offset[ind+1] += 1;
         }
+    }
 
-        else {
-            nonodes = data->elementtypes[i] % 100;
-            for(j=0;j<nonodes;j++) {
-                ind = data->topology[i][j];
-                for(k=0;k<nonodes;k++) {
-                    ind2 = data->topology[i][k];
-                    if(ind == ind2) continue;
+    minneeded = maxneeded = offset[2];
+    offset[1] = 0;
+    for(i=1;i<=noknots;i++) {
+        minneeded = MIN( minneeded, offset[i+1]);
+        maxneeded = MAX( maxneeded, offset[i+1]);
+        offset[i+1] += offset[i];
+    }
+    nocon = offset[noknots+1];
 
-                    hit = FALSE;
-                    for(l=0;l<maxcon;l++) {
-                        if(data->dualgraph[l][ind] == ind2) hit = TRUE;
-                        if(data->dualgraph[l][ind] == 0) break;
-                    }
-                    if(!hit) {
-                        if(l >= maxcon) {
-                            data->dualgraph[maxcon] = Ivector(1,noknots);
-                            for(m=1;m<=noknots;m++)
-                                data->dualgraph[maxcon][m] = 0;
-                            maxcon++;
-                        }
-                        data->dualgraph[l][ind] = ind2;
-                        totcon++;
-                    }
-                }
-            }
+    invtopo = Ivector(0,MAX(nocon,1)-1);
+    fill = Ivector(1,noknots);
+    for(i=1;i<=noknots;i++)
+        fill[i] = offset[i];
+
+#pragma omp parallel for private(j,k,ind,nonodes) schedule(static)
+    for(i=1;i<=noelements;i++) {
+        nonodes = data->elementtypes[i] % 100;
+        for(j=0;j<nonodes;j++) {
+            ind = data->topology[i][j];
+#pragma omp atomic capture
+            k = fill[ind]++;
+            invtopo[k] = i;
         }
+    }
+    free_Ivector(fill,1,noknots);
 
+    /* The parallel filling does not keep the order, the rows are short */
+#pragma omp parallel for private(j,k,elem) schedule(static)
+    for(i=1;i<=noknots;i++) {
+        for(j=offset[i]+1;j<offset[i+1];j++) {
+            elem = invtopo[j];
+            for(k=j-1;k>=offset[i] && invtopo[k] > elem;k--)
+                invtopo[k+1] = invtopo[k];
+            invtopo[k+1] = elem;
+        }
     }
 
-    if( data->periodicexist ) {
-        for(ind=1;ind<=noknots;ind++) {
-            ind2 = data->periodic[ind];
-            if(ind == ind2) continue;
+    if(info) printf("There are from %d to %d connections in the inverse topology.\n",minneeded,maxneeded);
+    data->invtopo = invtopo;
+    data->invtopooffset = offset;
+    data->invtopoexists = TRUE;
+    data->maxinvtopo = maxneeded;
 
-            hit = FALSE;
-            for(l=0;l<maxcon;l++) {
-                if(data->dualgraph[l][ind] == ind2) hit = TRUE;
-                if(data->dualgraph[l][ind] == 0) break;
-            }
-            if(!hit) {
-                if(l >= maxcon) {
-                    data->dualgraph[maxcon] = Ivector(1,noknots);
-                    for(m=1;m<=noknots;m++)
-                        data->dualgraph[maxcon][m] = 0;
-                    maxcon++;
-                }
-                data->dualgraph[l][ind] = ind2;
-                totcon++;
-                percon++;
-            }
-        }
+    RestoreMemoryTag(memtag);
+    return(0);
+}
+
+
+int DestroyInverseTopology(struct FemType *data,int info)
+{
+    if(!data->invtopoexists) {
+        printf("You tried to destroy a non-existing inverse topology\n");
+        return(1);
     }
 
-    data->dualmaxconnections = maxcon;
-    data->dualexists = TRUE;
+    free_Ivector(data->invtopo,0,MAX(data->invtopooffset[data->noknots+1],1)-1);
+    free_Ivector(data->invtopooffset,1,data->noknots+1);
 
-    if(info) printf("There are at maximum %d connections in dual graph.\n",maxcon);
-    if(info) printf("There are at all in all %d connections in dual graph.\n",totcon);
-    if(info && percon) printf("There are %d periodic connections in dual graph.\n",percon);
+    data->maxinvtopo = 0;
+    data->invtopoexists = FALSE;
 
+    if(info) printf("The inverse topology was destroyed\n");
     return(0);
 }
 
 
-int DestroyDualGraph(struct FemType *data,int info)
+static int GetElementEdge(int element,int edge,struct FemType *data,int *ind)
+/* Gives the corner nodes of an edge of the element. For higher order
+   elements the corners are picked from the two halves of GetElementGraph. */
 {
-    int i,maxcon, noknots;
+    int elemtype,inds[2];
 
-    if(!data->dualexists) {
-        printf("You tried to destroy a non-existing dual graph\n");
-        return(1);
+    elemtype = data->elementtypes[element];
+    if(elemtype%100 <= elemtype/100)
+        return(GetElementGraph(element,edge,data,ind));
+
+    if(!GetElementGraph(element,2*edge,data,inds)) return(FALSE);
+    ind[1] = inds[1];
+    GetElementGraph(element,2*edge+1,data,inds);
+    ind[0] = inds[0];
+    return(TRUE);
+}
+
+
+static int EdgeHashSlot(struct FemType *data,int node1,int node2)
+/* The slot of the edge node1 < node2 in the hash table, or the free slot
+   where it should be added. */
+{
+    unsigned int h,mask;
+    int edge;
+
+    mask = data->edgehashsize - 1;
+    h = ((unsigned int) node1 * 2654435761u + (unsigned int) node2 * 2246822519u) & mask;
+    for(;;) {
+        edge = data->edgehash[h];
+        if(!edge) return(h);
+        if(data->edgenodes[2*edge-1] == node1 && data->edgenodes[2*edge] == node2) return(h);
+        h = (h+1) & mask;
     }
+}
 
-    maxcon = data->dualmaxconnections;
-    noknots = data->noknots;
 
-    for(i=0;i<maxcon;i++)
-        free_Ivector(data->dualgraph[i],1,noknots);
+int GetEdgeIndex(struct FemType *data,int node1,int node2)
+/* Returns the edge between the two nodes, or 0 if there is none. */
+{
+    int tmp;
 
-    data->dualmaxconnections = 0;
-    data->dualexists = FALSE;
+    if(!data->edgesexist) return(0);
+    if(node1 > node2) {
+        tmp = node1;
+        node1 = node2;
+        node2 = tmp;
+    }
+    return(data->edgehash[EdgeHashSlot(data,node1,node2)]);
+}
 
-    if(info) printf("The dual graph was destroyed\n");
+
+int CreateEdgeTable(struct FemType *data,int info)
+/* Numbers the unique edges of the elements in the order of their first
+   appearance. The edges of element i are elemedges[elemedgeoffset[i]...]
+   in the order of GetElementGraph, and the elements of each edge are kept
+   in compressed rows as well. The edges are found through a hash table so
+   that the whole table is built in linear time. The table is kept in data
+   until the topology is changed. */
+{
+    int i,j,k,noelements,noedges,totedges,slot,edge,ind[2],*fill,*edgenodes,memtag;
+
+    if(data->edgesexist) return(0);
+    memtag = MemoryTag("topology","CreateEdgeTable");
+
+    noelements = data->noelements;
+
+    data->elemedgeoffset = Ivector(1,noelements+1);
+    totedges = 0;
+    for(i=1;i<=noelements;i++) {
+        data->elemedgeoffset[i] = totedges;
+        for(j=0;GetElementEdge(i,j,data,ind);j++)
+            totedges++;
+    }
+    data->elemedgeoffset[noelements+1] = totedges;
+    data->elemedges = Ivector(0,MAX(totedges,1)-1);
+
+    /* The hash table is kept at most half full */
+    for(k=1;k<2*totedges;k*=2);
+    data->edgehashsize = k;
+    data->edgehash = Ivector(0,k-1);
+    for(j=0;j<k;j++)
+        data->edgehash[j] = 0;
+    data->edgenodes = Ivector(1,2*MAX(totedges,1));
+
+    noedges = 0;
+    for(i=1;i<=noelements;i++) {
+        for(j=0;GetElementEdge(i,j,data,ind);j++) {
+            if(ind[0] > ind[1]) {
+                k = ind[0];
+                ind[0] = ind[1];
+                ind[1] = k;
+            }
+            slot = EdgeHashSlot(data,ind[0],ind[1]);
+            edge = data->edgehash[slot];
+            if(!edge) {
+                edge = ++noedges;
+                data->edgenodes[2*edge-1] = ind[0];
+                data->edgenodes[2*edge] = ind[1];
+                data->edgehash[slot] = edge;
+            }
+            data->elemedges[data->elemedgeoffset[i]+j] = edge;
+        }
+    }
+    data->noedges = noedges;
+
+    edgenodes = Ivector(1,2*MAX(noedges,1));
+    for(j=1;j<=2*noedges;j++)
+        edgenodes[j] = data->edgenodes[j];
+    free_Ivector(data->edgenodes,1,2*MAX(totedges,1));
+    data->edgenodes = edgenodes;
+
+    data->edgeelemoffset = Ivector(1,noedges+1);
+    for(edge=1;edge<=noedges+1;edge++)
+        data->edgeelemoffset[edge] = 0;
+    for(j=0;j<totedges;j++)
+        data->edgeelemoffset[data->elemedges[j]+1] += 1;
+    for(edge=1;edge<=noedges;edge++)
+        data->edgeelemoffset[edge+1] += data->edgeelemoffset[edge];
+
+    data->edgeelems = Ivector(0,MAX(totedges,1)-1);
+    fill = Ivector(1,MAX(noedges,1));
+    for(edge=1;edge<=noedges;edge++)
+        fill[edge] = data->edgeelemoffset[edge];
+    for(i=1;i<=noelements;i++)
+        for(j=data->elemedgeoffset[i];j<data->elemedgeoffset[i+1];j++)
+            data->edgeelems[fill[data->elemedges[j]]++] = i;
+    free_Ivector(fill,1,MAX(noedges,1));
+
+    data->edgesexist = TRUE;
+
+    if(info) printf("Created a table of %d edges\n",noedges);
+    RestoreMemoryTag(memtag);
     return(0);
 }
 
 
+int DestroyEdgeTable(struct FemType *data,int info)
+/* This is also used to drop a table that the changed topology made stale,
+   so a missing table is not an error. */
+{
+    int totedges;
 
-int CreateInverseTopology(struct FemType *data,int info)
+    if(!data->edgesexist) return(1);
+
+    totedges = data->elemedgeoffset[data->noelements+1];
+    free_Ivector(data->edgenodes,1,2*MAX(data->noedges,1));
+    free_Ivector(data->elemedges,0,MAX(totedges,1)-1);
+    free_Ivector(data->elemedgeoffset,1,data->noelements+1);
+    free_Ivector(data->edgeelems,0,MAX(totedges,1)-1);
+    free_Ivector(data->edgeelemoffset,1,data->noedges+1);
+    free_Ivector(data->edgehash,0,data->edgehashsize-1);
+
+    data->noedges = 0;
+    data->edgesexist = FALSE;
+
+    if(info) printf("The edge table was destroyed\n");
+    return(0);
+}
+
+
+static int ElementSideCount(int elemtype)
+/* The number of sides of one dimension lower, numbered from 0 as in GetElementSide */
+{
+    switch (elemtype/100) {
+    case 2:
+        return(2);
+    case 3:
+        return(3);
+    case 4:
+    case 5:
+        return(4);
+    case 6:
+    case 7:
+        return(5);
+    case 8:
+        return(6);
+    }
+    return(0);
+}
+
+
+static void GetSideCorners(int sideelemtype,int *sideind,int *corners)
+/* The corner nodes of the side in ascending order, padded with zeros */
 {
-    int i,j,l,m,noelements,noknots,elemtype,nonodes,ind,maxcon;
-    int *neededby,minneeded,maxneeded;
+    int i,j,n,tmp;
 
-    printf("Creating an inverse topology of the finite element mesh\n");
+    n = MIN(sideelemtype/100,4);
+    for(i=0;i<4;i++)
+        corners[i] = (i < n) ? sideind[i] : 0;
+    for(i=1;i<n;i++)
+        for(j=i;j>0 && corners[j-1] > corners[j];j--) {
+            tmp = corners[j];
+            corners[j] = corners[j-1];
+            corners[j-1] = tmp;
+        }
+}
 
-    if(data->invtopoexists) {
-        printf("The inverse topology already exists!\n");
-        smallerror("The inverse topology not done");
+
+static int SideHashSlot(struct FemType *data,int *corners)
+{
+    unsigned int h,mask;
+    int side,*c;
+
+    mask = data->sidehashsize - 1;
+    h = ((unsigned int) corners[0] * 2654435761u + (unsigned int) corners[1] * 2246822519u +
+         (unsigned int) corners[2] * 3266489917u + (unsigned int) corners[3] * 668265263u) & mask;
+    for(;;) {
+        side = data->sidehash[h];
+        if(!side) return(h);
+        c = &data->sidecorners[4*side-3];
+        if(c[0] == corners[0] && c[1] == corners[1] && c[2] == corners[2] && c[3] == corners[3])
+            return(h);
+        h = (h+1) & mask;
     }
+}
+
+
+int GetSideIndex(struct FemType *data,int sideelemtype,int *sideind)
+/* Returns the side of the elements with the same corners, or 0 if there is none. */
+{
+    int corners[4];
+
+    if(!data->sidesexist) return(0);
+    GetSideCorners(sideelemtype,sideind,corners);
+    return(data->sidehash[SideHashSlot(data,corners)]);
+}
+
+
+int CreateSideTable(struct FemType *data,int info)
+/* Numbers the unique sides of the elements, identified by their sorted
+   corner nodes. The sides of element i are elemsides[elemsideoffset[i]...]
+   in the order of GetElementSide, so that a boundary element finds its
+   parents and their sides with a single lookup. The table is kept in data
+   until the topology is changed. */
+{
+    int i,j,k,noelements,nosides,totsides,slot,side,sideelemtype,memtag;
+    int sideind[MAXNODESD1],corners[4],*fill,*sidecorners;
+
+    if(data->sidesexist) return(0);
+    memtag = MemoryTag("topology","CreateSideTable");
 
-    maxcon = 0;
     noelements = data->noelements;
-    noknots = data->noknots;
 
-    neededby = Ivector(1,noknots);
-    for(i=1;i<=noknots;i++)
-        neededby[i] = 0;
+    data->elemsideoffset = Ivector(1,noelements+1);
+    totsides = 0;
+    for(i=1;i<=noelements;i++) {
+        data->elemsideoffset[i] = totsides;
+        totsides += ElementSideCount(data->elementtypes[i]);
+    }
+    data->elemsideoffset[noelements+1] = totsides;
+    data->elemsides = Ivector(0,MAX(totsides,1)-1);
 
+    for(k=1;k<2*totsides;k*=2);
+    data->sidehashsize = k;
+    data->sidehash = Ivector(0,k-1);
+    for(j=0;j<k;j++)
+        data->sidehash[j] = 0;
+    data->sidecorners = Ivector(1,4*MAX(totsides,1));
+
+    nosides = 0;
     for(i=1;i<=noelements;i++) {
-        elemtype = data->elementtypes[i];
-        nonodes = data->elementtypes[i] % 100;
+        for(j=0;j<data->elemsideoffset[i+1]-data->elemsideoffset[i];j++) {
+            sideelemtype = 0;
+            GetElementSide(i,j,1,data,sideind,&sideelemtype);
+            side = 0;
+            if(sideelemtype) {
+                GetSideCorners(sideelemtype,sideind,corners);
+                slot = SideHashSlot(data,corners);
+                side = data->sidehash[slot];
+                if(!side) {
+                    side = ++nosides;
+                    for(k=0;k<4;k++)
+                        data->sidecorners[4*side-3+k] = corners[k];
+                    data->sidehash[slot] = side;
+                }
+            }
+            data->elemsides[data->elemsideoffset[i]+j] = side;
+        }
+    }
+    data->nouniquesides = nosides;
 
-        for(j=0;j<nonodes;j++) {
-            ind = data->topology[i][j];
+    sidecorners = Ivector(1,4*MAX(nosides,1));
+    for(j=1;j<=4*nosides;j++)
+        sidecorners[j] = data->sidecorners[j];
+    free_Ivector(data->sidecorners,1,4*MAX(totsides,1));
+    data->sidecorners = sidecorners;
+
+    data->sideelemoffset = Ivector(1,nosides+1);
+    for(side=1;side<=nosides+1;side++)
+        data->sideelemoffset[side] = 0;
+    for(j=0;j<totsides;j++)
+        if(data->elemsides[j]) data->sideelemoffset[data->elemsides[j]+1] += 1;
+    for(side=1;side<=nosides;side++)
+        data->sideelemoffset[side+1] += data->sideelemoffset[side];
+
+    data->sideelems = Ivector(0,MAX(data->sideelemoffset[nosides+1],1)-1);
+    fill = Ivector(1,MAX(nosides,1));
+    for(side=1;side<=nosides;side++)
+        fill[side] = data->sideelemoffset[side];
+    for(i=1;i<=noelements;i++)
+        for(j=data->elemsideoffset[i];j<data->elemsideoffset[i+1];j++)
+            if(data->elemsides[j]) data->sideelems[fill[data->elemsides[j]]++] = i;
+    free_Ivector(fill,1,MAX(nosides,1));
+
+    data->sidesexist = TRUE;
 
-            neededby[ind] += 1;
-            l = neededby[ind];
+    if(info) printf("Created a table of %d element sides\n",nosides);
+    RestoreMemoryTag(memtag);
+    return(0);
+}
+
+
+int DestroySideTable(struct FemType *data,int info)
+/* As DestroyEdgeTable a missing table is not an error. */
+{
+    int totsides;
+
+    if(!data->sidesexist) return(1);
+
+    totsides = data->elemsideoffset[data->noelements+1];
+    free_Ivector(data->sidecorners,1,4*MAX(data->nouniquesides,1));
+    free_Ivector(data->elemsides,0,MAX(totsides,1)-1);
+    free_Ivector(data->elemsideoffset,1,data->noelements+1);
+    free_Ivector(data->sideelems,0,MAX(data->sideelemoffset[data->nouniquesides+1],1)-1);
+    free_Ivector(data->sideelemoffset,1,data->nouniquesides+1);
+    free_Ivector(data->sidehash,0,data->sidehashsize-1);
+
+    data->nouniquesides = 0;
+    data->sidesexist = FALSE;
+
+    if(info) printf("The side table was destroyed\n");
+    return(0);
+}
+
+
+static int DualGraphNeighbours(struct FemType *data,int full,int ind,int *visited,int *neighbours)
+/* Collects the neighbours of node ind from the elements that own it. The
+   neighbours are written to neighbours[] if it is given, and their number is
+   returned. visited[] must not contain ind on entry. */
+{
+    int j,k,elem,nonodes,ind2,edge,inds[2],n;
 
-            if(l > maxcon) {
-                maxcon++;
-                data->invtopo[maxcon] = Ivector(1,noknots);
-                for(m=1;m<=noknots;m++)
-                    data->invtopo[maxcon][m] = 0;
+    n = 0;
+    for(j=data->invtopooffset[ind];j<data->invtopooffset[ind+1];j++) {
+        elem = data->invtopo[j];
+
+        if(!full) {
+            for(edge=0;;edge++) {
+                if( !GetElementGraph(elem,edge,data,&inds[0]) ) break;
+                if(inds[0] == ind) ind2 = inds[1];
+                else if(inds[1] == ind) ind2 = inds[0];
+                else continue;
+                if(ind2 == ind || visited[ind2] == ind) continue;
+                visited[ind2] = ind;
+                if(neighbours) neighbours[n] = ind2;
+                n++;
+            }
+        }
+        else {
+            nonodes = data->elementtypes[elem] % 100;
+            for(k=0;k<nonodes;k++) {
+                ind2 = data->topology[elem][k];
+                if(ind2 == ind || visited[ind2] == ind) continue;
+                visited[ind2] = ind;
+                if(neighbours) neighbours[n] = ind2;
+                n++;
             }
-            data->invtopo[l][ind] = i;
         }
     }
 
-    minneeded = maxneeded = neededby[1];
+    if( data->periodicexist ) {
+        ind2 = data->periodic[ind];
+        if(ind2 != ind && visited[ind2] != ind) {
+            visited[ind2] = ind;
+            if(neighbours) neighbours[n] = ind2;
+            n++;
+        }
+    }
+    return(n);
+}
+
+
+int CreateDualGraph(struct FemType *data,int full,int info)
+/* The neighbours of node i are dualgraph[dualoffset[i]...dualoffset[i+1]-1].
+   The graph is built from the inverse topology in two passes over the nodes,
+   the first counting and the second filling the connections. */
+{
+    int i,noknots,totcon,maxcon,percon,ownsinvtopo,memtag;
+    int *offset,*dualgraph,*visited;
+
+    printf("Creating a dual graph of the finite element mesh\n");
+
+    if(data->dualexists) {
+        printf("The dual graph already exists! You shoule remove the old graph!\n");
+    }
+
+    noknots = data->noknots;
+    memtag = MemoryTag("topology","CreateDualGraph");
+
+    ownsinvtopo = !data->invtopoexists;
+    if(ownsinvtopo) CreateInverseTopology(data,FALSE);
+
+    offset = Ivector(1,noknots+1);
+
+#pragma omp parallel private(visited)
+    {
+        int k;
+        visited = Ivector(1,noknots);
+        for(k=1;k<=noknots;k++)
+            visited[k] = 0;
+#pragma omp for schedule(dynamic,1024)
+        for(i=1;i<=noknots;i++)
+            offset[i+1] = DualGraphNeighbours(data,full,i,visited,NULL);
+        free_Ivector(visited,1,noknots);
+    }
+
+    maxcon = 0;
+    offset[1] = 0;
     for(i=1;i<=noknots;i++) {
-        minneeded = MIN( minneeded, neededby[i]);
-        maxneeded = MAX( maxneeded, neededby[i]);
+        maxcon = MAX( maxcon, offset[i+1]);
+        offset[i+1] += offset[i];
     }
-    free_Ivector(neededby,1,noknots);
+    totcon = offset[noknots+1];
+    dualgraph = Ivector(0,MAX(totcon,1)-1);
 
-    if(info) printf("There are from %d to %d connections in the inverse topology.\n",minneeded,maxneeded);
-    data->invtopoexists = TRUE;
-    data->maxinvtopo = maxcon;
+#pragma omp parallel private(visited)
+    {
+        int k;
+        visited = Ivector(1,noknots);
+        for(k=1;k<=noknots;k++)
+            visited[k] = 0;
+#pragma omp for schedule(dynamic,1024)
+        for(i=1;i<=noknots;i++)
+            DualGraphNeighbours(data,full,i,visited,&dualgraph[offset[i]]);
+        free_Ivector(visited,1,noknots);
+    }
+
+    percon = 0;
+    if( data->periodicexist ) {
+        for(i=1;i<=noknots;i++)
+            if(data->periodic[i] != i && offset[i+1] > offset[i] &&
+               dualgraph[offset[i+1]-1] == data->periodic[i]) percon++;
+    }
 
+    if(ownsinvtopo) DestroyInverseTopology(data,FALSE);
+
+    data->dualgraph = dualgraph;
+    data->dualoffset = offset;
+    data->dualmaxconnections = maxcon;
+    data->dualexists = TRUE;
+
+    if(info) printf("There are at maximum %d connections in dual graph.\n",maxcon);
+    if(info) printf("There are at all in all %d connections in dual graph.\n",totcon);
+    if(info && percon) printf("There are %d periodic connections in dual graph.\n",percon);
+
+    RestoreMemoryTag(memtag);
+    return(0);
+}
+
+
+int DestroyDualGraph(struct FemType *data,int info)
+{
+    if(!data->dualexists) {
+        printf("You tried to destroy a non-existing dual graph\n");
+        return(1);
+    }
+
+    free_Ivector(data->dualgraph,0,MAX(data->dualoffset[data->noknots+1],1)-1);
+    free_Ivector(data->dualoffset,1,data->noknots+1);
+
+    data->dualmaxconnections = 0;
+    data->dualexists = FALSE;
+
+    if(info) printf("The dual graph was destroyed\n");
     return(0);
 }
 
@@ -8530,6 +9200,305 @@ int MeshTypeStatistics(struct FemType *data,int info)
 
 
 
+#define QUALITYBLOCK 64
+
+static void QualityBlock(struct FemType *data,int *elems,int m,int nc,
+                         Real *quality,Real *minangle,Real *maxangle,Real *aspect,int *inverted)
+/* Computes the quality measures of m elements with nc corners. The corner
+   coordinates are gathered in blocks so that the measures are computed by
+   straight loops over the block. */
+{
+    int i,j,i0,i1,*ind;
+    Real px[4][QUALITYBLOCK],py[4][QUALITYBLOCK],pz[4][QUALITYBLOCK];
+    Real ex[4][QUALITYBLOCK],ey[4][QUALITYBLOCK],ez[4][QUALITYBLOCK],len[4][QUALITYBLOCK];
+    Real cx[4][QUALITYBLOCK],cy[4][QUALITYBLOCK],cz[4][QUALITYBLOCK];
+    Real nx[QUALITYBLOCK],ny[QUALITYBLOCK],nz[QUALITYBLOCK];
+    Real cosmin[QUALITYBLOCK],cosmax[QUALITYBLOCK],jacmin[QUALITYBLOCK];
+    Real lmin[QUALITYBLOCK],lmax[QUALITYBLOCK],rr[QUALITYBLOCK];
+    Real c,d,a2,dx,dy,dz,sq;
+
+    for(j=0;j<m;j++) {
+        ind = data->topology[elems[j]];
+        for(i=0;i<nc;i++) {
+            px[i][j] = data->x[ind[i]];
+            py[i][j] = data->y[ind[i]];
+            pz[i][j] = data->z[ind[i]];
+        }
+    }
+
+    /* Edge i goes from corner i to corner i+1 */
+    for(i=0;i<nc;i++) {
+        i1 = (i+1)%nc;
+#pragma omp simd
+        for(j=0;j<m;j++) {
+            ex[i][j] = px[i1][j] - px[i][j];
+            ey[i][j] = py[i1][j] - py[i][j];
+            ez[i][j] = pz[i1][j] - pz[i][j];
+            len[i][j] = sqrt(ex[i][j]*ex[i][j] + ey[i][j]*ey[i][j] + ez[i][j]*ez[i][j]);
+        }
+    }
+
+    /* Cross products and angle cosines at the corners */
+    for(j=0;j<m;j++) {
+        nx[j] = ny[j] = nz[j] = 0.0;
+        cosmin[j] = 1.0;
+        cosmax[j] = -1.0;
+        lmin[j] = lmax[j] = len[0][j];
+    }
+    for(i=0;i<nc;i++) {
+        i0 = (i+nc-1)%nc;
+#pragma omp simd private(c,d)
+        for(j=0;j<m;j++) {
+            cx[i][j] = ey[i0][j]*ez[i][j] - ez[i0][j]*ey[i][j];
+            cy[i][j] = ez[i0][j]*ex[i][j] - ex[i0][j]*ez[i][j];
+            cz[i][j] = ex[i0][j]*ey[i][j] - ey[i0][j]*ex[i][j];
+            nx[j] += cx[i][j];
+            ny[j] += cy[i][j];
+            nz[j] += cz[i][j];
+            d = len[i0][j] * len[i][j];
+            c = (d > 0.0) ? -(ex[i0][j]*ex[i][j] + ey[i0][j]*ey[i][j] + ez[i0][j]*ez[i][j]) / d : 1.0;
+            cosmin[j] = MIN(cosmin[j],c);
+            cosmax[j] = MAX(cosmax[j],c);
+            lmin[j] = MIN(lmin[j],len[i][j]);
+            lmax[j] = MAX(lmax[j],len[i][j]);
+        }
+    }
+
+    /* In plane meshes the orientation is given by the z-axis, otherwise by
+       the mean normal of the element. */
+    if(data->dim < 3) {
+        for(j=0;j<m;j++) {
+            nx[j] = ny[j] = 0.0;
+            nz[j] = 1.0;
+        }
+    }
+    for(j=0;j<m;j++) jacmin[j] = 1.0;
+    for(i=0;i<nc;i++) {
+#pragma omp simd private(c)
+        for(j=0;j<m;j++) {
+            c = cx[i][j]*nx[j] + cy[i][j]*ny[j] + cz[i][j]*nz[j];
+            jacmin[j] = MIN(jacmin[j],c);
+        }
+    }
+
+    if(nc == 3) {
+        /* radius ratio 2r/R = 16 A^2 / (P l1 l2 l3) and aspect ratio
+           lmax P / (4 sqrt(3) A), both unity for the equilateral triangle */
+#pragma omp simd private(a2,c,d)
+        for(j=0;j<m;j++) {
+            a2 = 0.25 * (cx[0][j]*cx[0][j] + cy[0][j]*cy[0][j] + cz[0][j]*cz[0][j]);
+            c = len[0][j] + len[1][j] + len[2][j];
+            d = c * len[0][j] * len[1][j] * len[2][j];
+            rr[j] = (d > 0.0) ? 16.0 * a2 / d : 0.0;
+            aspect[j] = (a2 > 0.0) ? lmax[j] * c / (4.0 * sqrt(3.0 * a2)) : 0.0;
+        }
+    }
+    else {
+        /* the smallest radius ratio of the four corner triangles scaled to
+           unity for the square, and the ratio of the extreme edges */
+        sq = 1.0 / (2.0 * (sqrt(2.0) - 1.0));
+        for(j=0;j<m;j++) rr[j] = 1.0;
+        for(i=0;i<nc;i++) {
+            i0 = (i+nc-1)%nc;
+            i1 = (i+1)%nc;
+#pragma omp simd private(a2,c,d,dx,dy,dz)
+            for(j=0;j<m;j++) {
+                dx = px[i1][j] - px[i0][j];
+                dy = py[i1][j] - py[i0][j];
+                dz = pz[i1][j] - pz[i0][j];
+                c = sqrt(dx*dx + dy*dy + dz*dz);
+                a2 = 0.25 * (cx[i][j]*cx[i][j] + cy[i][j]*cy[i][j] + cz[i][j]*cz[i][j]);
+                d = (len[i0][j] + len[i][j] + c) * len[i0][j] * len[i][j] * c;
+                c = (d > 0.0) ? sq * 16.0 * a2 / d : 0.0;
+                rr[j] = MIN(rr[j],c);
+            }
+        }
+#pragma omp simd
+        for(j=0;j<m;j++)
+            aspect[j] = (lmin[j] > 0.0) ? lmax[j] / lmin[j] : 0.0;
+    }
+
+    for(j=0;j<m;j++) {
+        inverted[j] = (jacmin[j] <= 0.0);
+        quality[j] = inverted[j] ? 0.0 : MIN(rr[j],1.0);
+        minangle[j] = RAD_TO_DEG(acos(MAX(-1.0,MIN(1.0,cosmax[j]))));
+        maxangle[j] = RAD_TO_DEG(acos(MAX(-1.0,MIN(1.0,cosmin[j]))));
+    }
+}
+
+
+static int WorseElement(Real *quality,int elem1,int elem2)
+{
+    if(quality[elem1] < quality[elem2]) return(TRUE);
+    if(quality[elem1] > quality[elem2]) return(FALSE);
+    return(elem1 < elem2);
+}
+
+
+static void SiftWorst(Real *quality,int *heap,int n,int i)
+/* Restores the heap where the root is the best of the kept worst elements. */
+{
+    int k,tmp;
+
+    for(;;) {
+        k = 2*i;
+        if(k > n) break;
+        if(k < n && WorseElement(quality,heap[k],heap[k+1])) k++;
+        if(!WorseElement(quality,heap[i],heap[k])) break;
+        tmp = heap[i]; heap[i] = heap[k]; heap[k] = tmp;
+        i = k;
+    }
+}
+
+
+int MeshQuality(struct FemType *data,struct MeshQualityType *quality,int noworst,int info)
+/* Computes the radius ratio, aspect ratio, extreme corner angles and the sign
+   of the Jacobian of all triangles and quadrilaterals. The radius ratio is
+   binned into a histogram and the noworst elements of the lowest quality are
+   listed worst first. Inverted and degenerate elements have quality zero. */
+{
+    int i,j,k,m,nc,b,kind,noelements,nokind[2],*kindelems[2],*worst,noinverted;
+    int blockinv[QUALITYBLOCK];
+    Real blockq[QUALITYBLOCK],blockmin[QUALITYBLOCK],blockmax[QUALITYBLOCK],blockasp[QUALITYBLOCK];
+    Real minangle,maxangle,maxaspect,minquality,*q;
+
+    quality->noelements = 0;
+    quality->notriangles = 0;
+    quality->noquadrilaterals = 0;
+    quality->noinverted = 0;
+    quality->noworst = 0;
+    quality->worst = NULL;
+    quality->quality = NULL;
+    for(i=0;i<QUALITYBINS;i++) quality->histogram[i] = 0;
+
+    if(!data->created) return(1);
+    noelements = data->noelements;
+
+    /* Collect the triangles and quadrilaterals separately so that each block
+       has the same number of corners. */
+    nokind[0] = nokind[1] = 0;
+    for(i=1;i<=noelements;i++) {
+        k = data->elementtypes[i] / 100;
+        if(k == 3 || k == 4) nokind[k-3] += 1;
+    }
+    if(nokind[0] + nokind[1] == 0) {
+        if(info) printf("There are no triangles or quadrilaterals for quality analysis\n");
+        return(2);
+    }
+    for(kind=0;kind<2;kind++)
+        kindelems[kind] = Ivector(0,MAX(nokind[kind],1)-1);
+    nokind[0] = nokind[1] = 0;
+    for(i=1;i<=noelements;i++) {
+        k = data->elementtypes[i] / 100;
+        if(k == 3 || k == 4) kindelems[k-3][nokind[k-3]++] = i;
+    }
+
+    q = Rvector(1,noelements);
+    for(i=1;i<=noelements;i++) q[i] = -1.0;
+
+    minangle = 180.0;
+    maxangle = 0.0;
+    maxaspect = 0.0;
+    minquality = 1.0;
+    noinverted = 0;
+
+    for(kind=0;kind<2;kind++) {
+        nc = kind + 3;
+#pragma omp parallel for private(j,m,blockq,blockmin,blockmax,blockasp,blockinv) reduction(min:minangle,minquality) reduction(max:maxangle,maxaspect) reduction(+:noinverted) schedule(static)
+        for(b=0;b<nokind[kind];b+=QUALITYBLOCK) {
+            m = MIN(QUALITYBLOCK,nokind[kind]-b);
+            QualityBlock(data,&kindelems[kind][b],m,nc,blockq,blockmin,blockmax,blockasp,blockinv);
+            for(j=0;j<m;j++) {
+                q[kindelems[kind][b+j]] = blockq[j];
+                minquality = MIN(minquality,blockq[j]);
+                if(blockinv[j]) {
+                    noinverted++;
+                    continue;
+                }
+                minangle = MIN(minangle,blockmin[j]);
+                maxangle = MAX(maxangle,blockmax[j]);
+                maxaspect = MAX(maxaspect,blockasp[j]);
+            }
+        }
+    }
+
+    /* Histogram and the worst elements kept in a heap of size noworst */
+    noworst = MIN(noworst,nokind[0]+nokind[1]);
+    worst = NULL;
+    if(noworst > 0) worst = Ivector(1,noworst);
+    m = 0;
+    for(i=1;i<=noelements;i++) {
+        if(q[i] < 0.0) continue;
+        b = (int) (q[i] * QUALITYBINS);
+        quality->histogram[MIN(b,QUALITYBINS-1)] += 1;
+
+        if(noworst == 0) continue;
+        if(m < noworst) {
+            worst[++m] = i;
+            if(m == noworst)
+                for(j=m/2;j>=1;j--) SiftWorst(q,worst,m,j);
+        }
+        else if(WorseElement(q,i,worst[1])) {
+            worst[1] = i;
+            SiftWorst(q,worst,m,1);
+        }
+    }
+    /* Heap sort so that the worst element comes first */
+    for(j=m;j>1;j--) {
+        k = worst[1]; worst[1] = worst[j]; worst[j] = k;
+        SiftWorst(q,worst,j-1,1);
+    }
+
+    for(kind=0;kind<2;kind++)
+        free_Ivector(kindelems[kind],0,MAX(nokind[kind],1)-1);
+
+    /* Elements other than triangles and quadrilaterals have zero quality */
+    for(i=1;i<=noelements;i++)
+        if(q[i] < 0.0) q[i] = 0.0;
+
+    quality->noelements = noelements;
+    quality->notriangles = nokind[0];
+    quality->noquadrilaterals = nokind[1];
+    quality->noinverted = noinverted;
+    quality->minangle = minangle;
+    quality->maxangle = maxangle;
+    quality->maxaspect = maxaspect;
+    quality->minquality = minquality;
+    quality->quality = q;
+    quality->noworst = noworst;
+    quality->worst = worst;
+
+    if(info) {
+        printf("Quality of %d triangles and %d quadrilaterals\n",nokind[0],nokind[1]);
+        printf("Corner angles between %.3lg and %.3lg degrees\n",minangle,maxangle);
+        printf("Maximum aspect ratio %.3lg and minimum radius ratio %.3lg\n",maxaspect,minquality);
+        if(noinverted) printf("There are %d inverted or degenerate elements\n",noinverted);
+        printf("Distribution of radius ratio\n");
+        for(i=0;i<QUALITYBINS;i++)
+            printf("\t%.2lf - %.2lf\t%d\n",(Real)i/QUALITYBINS,(Real)(i+1)/QUALITYBINS,
+                   quality->histogram[i]);
+        if(noworst) {
+            printf("Elements of the lowest quality\n");
+            for(j=1;j<=noworst;j++)
+                printf("\t%d\t%d\t%.4lg\n",worst[j],data->elementtypes[worst[j]],q[worst[j]]);
+        }
+    }
+
+    return(0);
+}
+
+
+void DestroyMeshQuality(struct MeshQualityType *quality)
+{
+    if(quality->worst) free_Ivector(quality->worst,1,quality->noworst);
+    if(quality->quality) free_Rvector(quality->quality,1,quality->noelements);
+    quality->worst = NULL;
+    quality->quality = NULL;
+    quality->noworst = 0;
+}
+
+
+
 
 int SideAndBulkMappings(struct FemType *data,struct BoundaryType *bound,struct ElmergridType *eg,int info)
 {
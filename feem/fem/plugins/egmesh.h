@@ -17,6 +17,7 @@ void NumberVariables(struct FemType *data,int variable);
 int CalculateIndexwidth(struct FemType *data,int indxis,int *indx);
 
 void InitializeKnots(struct FemType *data);
+void SetMeshArenas(int mode);
 void AllocateKnots(struct FemType *data);
 void CreateKnots(struct GridType *grid,struct CellType *cell,
 		 struct FemType *data,int noknots,int info);
@@ -75,7 +76,7 @@ void MergeBoundaries(struct FemType *data,struct BoundaryType *bound,int *double
 void SeparateCartesianBoundaries(struct FemType *data,struct BoundaryType *bound,int info);
 void ElementsToBoundaryConditions(struct FemType *data,
 				  struct BoundaryType *bound,int retainorphans,int info);
-int FindPeriodicNodes(struct FemType *data,int periodicdim[],int info);
+int FindPeriodicNodes(struct FemType *data,int periodicdim[],Real periodicangle,int info);
 int FindNewBoundaries(struct FemType *data,struct BoundaryType *bound,
 		      int *boundnodes,int suggesttype,int dimred,int info);
 int FindBulkBoundary(struct FemType *data,int mat1,int mat2,
@@ -95,6 +96,15 @@ int RemoveLowerDimensionalBoundaries(struct FemType *data,struct BoundaryType *b
 int CreateDualGraph(struct FemType *data,int full,int info);
 int DestroyDualGraph(struct FemType *data,int info);
 int CreateInverseTopology(struct FemType *data,int info);
+int DestroyInverseTopology(struct FemType *data,int info);
+int CreateEdgeTable(struct FemType *data,int info);
+int DestroyEdgeTable(struct FemType *data,int info);
+int GetEdgeIndex(struct FemType *data,int node1,int node2);
+int CreateSideTable(struct FemType *data,int info);
+int DestroySideTable(struct FemType *data,int info);
+int GetSideIndex(struct FemType *data,int sideelemtype,int *sideind);
 int MeshTypeStatistics(struct FemType *data,int info);
+int MeshQuality(struct FemType *data,struct MeshQualityType *quality,int noworst,int info);
+void DestroyMeshQuality(struct MeshQualityType *quality);
 int SideAndBulkMappings(struct FemType *data,struct BoundaryType *bound,struct ElmergridType *eg,int info);
 int SideAndBulkBoundaries(struct FemType *data,struct BoundaryType *bound,struct ElmergridType *eg,int info);
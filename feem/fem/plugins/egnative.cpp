@@ -2774,6 +2774,10 @@ void InitParameters(struct ElmergridType *eg)
     eg->elements3d = 0;
     eg->nodes3d = 0;
     eg->metis = 0;
+    eg->multilevel = 0;
+    eg->arena = 1;
+    eg->quality = 0;
+    eg->adapt = 0.0;
     eg->partitionhalo = FALSE;
     eg->partitionindirect = FALSE;
     eg->reduce = FALSE;
@@ -2800,6 +2804,7 @@ void InitParameters(struct ElmergridType *eg)
     eg->periodicdim[0] = 0;
     eg->periodicdim[1] = 0;
     eg->periodicdim[2] = 0;
+    eg->periodicangle = 0.0;
     eg->bulkorder = FALSE;
     eg->boundorder = FALSE;
     eg->sidemappings = 0;
@@ -3048,8 +3053,13 @@ int LoadCommands(char *prefix,struct ElmergridType *eg,
             sscanf(params,"%d",&eg->metis);
 #else
             printf("This version of ElmerGrid was compiled without Metis library!\n");
+            printf("Using the built-in multilevel partitioner instead.\n");
+            sscanf(params,"%d",&eg->multilevel);
 #endif
         }
+        else if(strstr(command,"MULTILEVEL PARTITION")) {
+            sscanf(params,"%d",&eg->multilevel);
+        }
         else if(strstr(command,"PARTITION ORDER")) {
             eg->partorder = 1;
             if(eg->dim == 2) sscanf(params,"%le%le",&eg->partcorder[0],&eg->partcorder[1]);
@@ -3065,6 +3075,9 @@ int LoadCommands(char *prefix,struct ElmergridType *eg,
                 eg->partitions *= eg->partdim[i];
             }
         }
+        else if(strstr(command,"PERIODIC ANGLE")) {
+            sscanf(params,"%le",&eg->periodicangle);
+        }
         else if(strstr(command,"PERIODIC")) {
             if(eg->dim == 2) sscanf(params,"%d%d",&eg->periodicdim[0],&eg->periodicdim[1]);
             if(eg->dim == 3) sscanf(params,"%d%d%d",&eg->periodicdim[0],
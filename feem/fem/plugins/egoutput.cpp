@@ -0,0 +1,1016 @@
+/*
+   ElmerGrid - A simple mesh generation and manipulation utility
+   Copyright (C) 1995- , CSC - IT Center for Science Ltd.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* -------------------------------:  egoutput.c  :----------------------------
+   Saves the mesh in the format of ElmerSolver. The directory prefix gets
+
+     mesh.header     nodes elements boundaryelements, number of element types,
+                     and a line "type count" for each type
+     mesh.nodes      index -1 x y z
+     mesh.elements   index material type nodes
+     mesh.boundary   index bctype parent parent2 type nodes
+     mesh.names      names of the bodies and boundaries, if they exist
+
+   The partitioned mesh goes to prefix/partitioning.N as part.K.header,
+   part.K.nodes, part.K.elements, part.K.boundary and part.K.shared with global
+   numbering. The header has an extra line with the number of shared nodes,
+   and each line of the shared file is "node count owner others". Halo elements
+   are written as "index/partition".
+
+   The partitions are independent and are written in parallel. The numbers are
+   formatted here instead of fprintf so that the locale and the varargs parsing
+   stay out of the inner loops, and each file is written in large blocks.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "egutils.h"
+#include "egdef.h"
+#include "egtypes.h"
+#include "egmesh.h"
+#include "egoutput.h"
+
+#define OUTBUFFERSIZE 1048576 /* size of the write buffer of each file */
+#define OUTBUFFERSLACK 256    /* room needed for one number or name */
+#define MAXELEMENTTYPE 1000   /* element types of Elmer are below this */
+
+
+/* A file with its own write buffer. */
+struct OutBufferType {
+    FILE *out;
+    char *buf;
+    int n;
+};
+
+
+static int OpenOutBuffer(struct OutBufferType *ob,char *filename)
+{
+    ob->n = 0;
+    ob->buf = NULL;
+    if((ob->out = fopen(filename,"w")) == NULL) {
+        printf("SaveElmerInput: The opening of file %s failed!\n",filename);
+        return(FALSE);
+    }
+    ob->buf = (char*) malloc(OUTBUFFERSIZE);
+    if(!ob->buf) nrerror("allocation failure in OpenOutBuffer()");
+    return(TRUE);
+}
+
+
+static void FlushOutBuffer(struct OutBufferType *ob)
+{
+    if(ob->n) fwrite(ob->buf,1,ob->n,ob->out);
+    ob->n = 0;
+}
+
+
+static void CloseOutBuffer(struct OutBufferType *ob)
+{
+    FlushOutBuffer(ob);
+    fclose(ob->out);
+    free(ob->buf);
+}
+
+
+static char *ReserveOutBuffer(struct OutBufferType *ob)
+{
+    if(ob->n > OUTBUFFERSIZE - OUTBUFFERSLACK) FlushOutBuffer(ob);
+    return(ob->buf + ob->n);
+}
+
+
+static void PutChar(struct OutBufferType *ob,char c)
+{
+    ReserveOutBuffer(ob);
+    ob->buf[ob->n++] = c;
+}
+
+
+static void PutString(struct OutBufferType *ob,const char *str)
+{
+    while(*str) PutChar(ob,*str++);
+}
+
+
+static void PutInt(struct OutBufferType *ob,int i)
+{
+    char digits[12],*s;
+    unsigned int u;
+    int nd;
+
+    s = ReserveOutBuffer(ob);
+    if(i < 0) {
+        *s++ = '-';
+        u = 0u - (unsigned int) i;
+    }
+    else
+        u = i;
+
+    nd = 0;
+    do {
+        digits[nd++] = '0' + u % 10;
+        u /= 10;
+    } while(u);
+    while(nd) *s++ = digits[--nd];
+
+    ob->n = s - ob->buf;
+}
+
+
+static const Real pow10tab[23] = {
+    1.0e0,1.0e1,1.0e2,1.0e3,1.0e4,1.0e5,1.0e6,1.0e7,1.0e8,1.0e9,1.0e10,1.0e11,
+    1.0e12,1.0e13,1.0e14,1.0e15,1.0e16,1.0e17,1.0e18,1.0e19,1.0e20,1.0e21,1.0e22};
+
+
+static int FormatReal(char *s,Real x,int decimals)
+/* Same as sprintf(s,"%.*lg",decimals,x) with a decimal point regardless of
+   the locale. The digits come from a scaling by an exact power of ten whose
+   rounding error is recovered with fma, so that the last digit is rounded
+   once from the exact value. Numbers outside the range of the table go to
+   sprintf. */
+{
+    int i,e,p,nd,len;
+    Real ax,m,mf,half,d;
+    unsigned long long mi;
+    char digits[16];
+
+    if(decimals < 1) decimals = 1;
+    if(x == 0.0) {
+        s[0] = '0';
+        return(1);
+    }
+    ax = fabs(x);
+    if(decimals > 15 || x != x || ax > 1.0e300)
+        return(sprintf(s,"%.*lg",decimals,x));
+
+    e = (int) floor(log10(ax));
+    for(i=0;i<2;i++) {
+        p = decimals - 1 - e;
+        if(p > 22 || p < -22) return(sprintf(s,"%.*lg",decimals,x));
+        m = (p >= 0) ? ax * pow10tab[p] : ax / pow10tab[-p];
+        /* log10 may be off by one next to the powers of ten */
+        if(m >= pow10tab[decimals]) e++;
+        else if(m < pow10tab[decimals-1]) e--;
+        else break;
+    }
+    if(i == 2) return(sprintf(s,"%.*lg",decimals,x));
+
+    /* The exact scaled value is m plus a residual r. The distance of m to the
+       rounding tie, half, is exact, so only the sign of r - half is needed:
+       it is exact for p >= 0 and given by one more fma for p < 0, where the
+       remainder of the division is exact. */
+    mf = floor(m);
+    half = 0.5 - (m - mf);
+    if(p >= 0)
+        d = fma(ax,pow10tab[p],-m) - half;
+    else
+        d = fma(-half,pow10tab[-p],fma(-m,pow10tab[-p],ax));
+    mi = (unsigned long long) mf;
+    if(d > 0.0 || (d == 0.0 && (mi & 1))) mi++;
+    if(mi >= (unsigned long long) pow10tab[decimals]) {
+        mi /= 10;
+        e++;
+    }
+    for(i=decimals-1;i>=0;i--) {
+        digits[i] = '0' + (int) (mi % 10);
+        mi /= 10;
+    }
+    nd = decimals;
+    while(nd > 1 && digits[nd-1] == '0') nd--;
+
+    len = 0;
+    if(x < 0.0) s[len++] = '-';
+
+    if(e < -4 || e >= decimals) {
+        s[len++] = digits[0];
+        if(nd > 1) {
+            s[len++] = '.';
+            for(i=1;i<nd;i++) s[len++] = digits[i];
+        }
+        s[len++] = 'e';
+        if(e < 0) {
+            s[len++] = '-';
+            e = -e;
+        }
+        else
+            s[len++] = '+';
+        if(e >= 100) {
+            s[len++] = '0' + e / 100;
+            e %= 100;
+        }
+        s[len++] = '0' + e / 10;
+        s[len++] = '0' + e % 10;
+    }
+    else if(e >= 0) {
+        for(i=0;i<=e;i++)
+            s[len++] = (i < nd) ? digits[i] : '0';
+        if(nd > e+1) {
+            s[len++] = '.';
+            for(i=e+1;i<nd;i++) s[len++] = digits[i];
+        }
+    }
+    else {
+        s[len++] = '0';
+        s[len++] = '.';
+        for(i=1;i<-e;i++) s[len++] = '0';
+        for(i=0;i<nd;i++) s[len++] = digits[i];
+    }
+    return(len);
+}
+
+
+static void PutReal(struct OutBufferType *ob,Real x,int decimals)
+{
+    char *s;
+
+    s = ReserveOutBuffer(ob);
+    ob->n += FormatReal(s,x,decimals);
+}
+
+
+static int CreateOutputDirectory(char *dirname,int info)
+{
+    int status;
+
+#ifdef _WIN32
+    status = _mkdir(dirname);
+#else
+    status = mkdir(dirname,0755);
+#endif
+    if(status != 0 && errno != EEXIST) {
+        printf("SaveElmerInput: Could not create directory %s\n",dirname);
+        return(FALSE);
+    }
+    if(info && status == 0) printf("Created directory %s\n",dirname);
+    return(TRUE);
+}
+
+
+static int GetBoundaryElement(struct FemType *data,struct BoundaryType *bound,
+                              int i,int *ind)
+/* Returns the type and the nodes of side i. Sides without parents carry
+   their own topology. */
+{
+    int j,sideelemtype;
+
+    sideelemtype = 0;
+    if(bound->parent[i])
+        GetElementSide(bound->parent[i],bound->side[i],bound->normal[i],data,ind,&sideelemtype);
+    else if(bound->parent2[i])
+        GetElementSide(bound->parent2[i],bound->side2[i],bound->normal[i],data,ind,&sideelemtype);
+    else if(bound->elementtypes) {
+        sideelemtype = bound->elementtypes[i];
+        for(j=0;j<sideelemtype%100;j++)
+            ind[j] = bound->topology[i][j];
+    }
+    return(sideelemtype);
+}
+
+
+static void PutNode(struct OutBufferType *ob,struct FemType *data,int i,int decimals)
+{
+    PutInt(ob,i);
+    PutString(ob," -1 ");
+    PutReal(ob,data->x[i],decimals);
+    PutChar(ob,' ');
+    PutReal(ob,data->y[i],decimals);
+    PutChar(ob,' ');
+    PutReal(ob,data->z[i],decimals);
+    PutChar(ob,'\n');
+}
+
+
+static void PutElement(struct OutBufferType *ob,struct FemType *data,int elem,int halopart)
+{
+    int j,nonodes;
+
+    nonodes = data->elementtypes[elem] % 100;
+    PutInt(ob,elem);
+    if(halopart) {
+        PutChar(ob,'/');
+        PutInt(ob,halopart);
+    }
+    PutChar(ob,' ');
+    PutInt(ob,data->material[elem]);
+    PutChar(ob,' ');
+    PutInt(ob,data->elementtypes[elem]);
+    for(j=0;j<nonodes;j++) {
+        PutChar(ob,' ');
+        PutInt(ob,data->topology[elem][j]);
+    }
+    PutChar(ob,'\n');
+}
+
+
+static void PutBoundaryElement(struct OutBufferType *ob,int index,int bctype,
+                               int parent,int parent2,int sideelemtype,int *ind)
+{
+    int j;
+
+    PutInt(ob,index);
+    PutChar(ob,' ');
+    PutInt(ob,bctype);
+    PutChar(ob,' ');
+    PutInt(ob,parent);
+    PutChar(ob,' ');
+    PutInt(ob,parent2);
+    PutChar(ob,' ');
+    PutInt(ob,sideelemtype);
+    for(j=0;j<sideelemtype%100;j++) {
+        PutChar(ob,' ');
+        PutInt(ob,ind[j]);
+    }
+    PutChar(ob,'\n');
+}
+
+
+static void PutHeaderTypes(FILE *out,int *typecount)
+{
+    int i,ntypes;
+
+    ntypes = 0;
+    for(i=0;i<MAXELEMENTTYPE;i++)
+        if(typecount[i]) ntypes++;
+    fprintf(out,"%d\n",ntypes);
+    for(i=0;i<MAXELEMENTTYPE;i++)
+        if(typecount[i]) fprintf(out,"%d %d\n",i,typecount[i]);
+}
+
+
+static void SaveElmerNames(struct FemType *data,struct BoundaryType *bound,char *dirname)
+{
+    int i,j,*used;
+    char filename[MAXFILESIZE];
+    FILE *out;
+
+    if(!data->bodynamesexist && !data->boundarynamesexist) return;
+
+    sprintf(filename,"%s/mesh.names",dirname);
+    if((out = fopen(filename,"w")) == NULL) {
+        printf("SaveElmerInput: The opening of file %s failed!\n",filename);
+        return;
+    }
+
+    used = Ivector(0,MAXBCS-1);
+
+    if(data->bodynamesexist) {
+        for(i=0;i<MAXBCS;i++) used[i] = FALSE;
+        for(i=1;i<=data->noelements;i++)
+            if(data->material[i] > 0 && data->material[i] < MAXBODIES)
+                used[data->material[i]] = TRUE;
+        fprintf(out,"! ----- names for bodies -----\n");
+        for(i=1;i<MAXBODIES;i++)
+            if(used[i]) fprintf(out,"$ %s = %d\n",data->bodyname[i],i);
+    }
+
+    if(data->boundarynamesexist) {
+        for(i=0;i<MAXBCS;i++) used[i] = FALSE;
+        for(j=0;j<MAXBOUNDARIES;j++) {
+            if(!bound[j].created) continue;
+            for(i=1;i<=bound[j].nosides;i++)
+                if(bound[j].types[i] > 0 && bound[j].types[i] < MAXBCS)
+                    used[bound[j].types[i]] = TRUE;
+        }
+        fprintf(out,"! ----- names for boundaries -----\n");
+        for(i=1;i<MAXBCS;i++)
+            if(used[i]) fprintf(out,"$ %s = %d\n",data->boundaryname[i],i);
+    }
+
+    free_Ivector(used,0,MAXBCS-1);
+    fclose(out);
+}
+
+
+int SaveElmerInput(struct FemType *data,struct BoundaryType *bound,
+                   char *prefix,int decimals,int info)
+/* Saves the mesh in ElmerSolver format into directory prefix. The nodes, the
+   elements and the boundary are written in parallel. */
+{
+    int i,j,noknots,noelements,nosides,sideelemtype,sideind[MAXNODESD2];
+    int *typecount,ok[3];
+    char filename[MAXFILESIZE];
+    FILE *out;
+    struct OutBufferType ob;
+
+    if(!data->created) {
+        printf("SaveElmerInput: You tried to save points that were never created.\n");
+        return(1);
+    }
+
+    noknots = data->noknots;
+    noelements = data->noelements;
+
+    if(info) printf("Saving mesh in ElmerSolver format to directory %s.\n",prefix);
+    if(!CreateOutputDirectory(prefix,info)) return(2);
+
+    typecount = Ivector(0,MAXELEMENTTYPE-1);
+    for(i=0;i<MAXELEMENTTYPE;i++)
+        typecount[i] = 0;
+    for(i=1;i<=noelements;i++)
+        typecount[data->elementtypes[i]] += 1;
+
+    nosides = 0;
+    for(j=0;j<MAXBOUNDARIES;j++) {
+        if(!bound[j].created) continue;
+        for(i=1;i<=bound[j].nosides;i++) {
+            sideelemtype = GetBoundaryElement(data,&bound[j],i,sideind);
+            if(!sideelemtype) continue;
+            typecount[sideelemtype] += 1;
+            nosides++;
+        }
+    }
+
+    sprintf(filename,"%s/mesh.header",prefix);
+    if((out = fopen(filename,"w")) == NULL) {
+        printf("SaveElmerInput: The opening of file %s failed!\n",filename);
+        free_Ivector(typecount,0,MAXELEMENTTYPE-1);
+        return(3);
+    }
+    fprintf(out,"%d %d %d\n",noknots,noelements,nosides);
+    PutHeaderTypes(out,typecount);
+    fclose(out);
+    free_Ivector(typecount,0,MAXELEMENTTYPE-1);
+
+    ok[0] = ok[1] = ok[2] = TRUE;
+
+#pragma omp parallel sections private(i,j,filename,ob,sideelemtype,sideind)
+    {
+#pragma omp section
+        {
+            sprintf(filename,"%s/mesh.nodes",prefix);
+            if((ok[0] = OpenOutBuffer(&ob,filename))) {
+                for(i=1;i<=noknots;i++)
+                    PutNode(&ob,data,i,decimals);
+                CloseOutBuffer(&ob);
+            }
+        }
+#pragma omp section
+        {
+            sprintf(filename,"%s/mesh.elements",prefix);
+            if((ok[1] = OpenOutBuffer(&ob,filename))) {
+                for(i=1;i<=noelements;i++)
+                    PutElement(&ob,data,i,0);
+                CloseOutBuffer(&ob);
+            }
+        }
+#pragma omp section
+        {
+            sprintf(filename,"%s/mesh.boundary",prefix);
+            if((ok[2] = OpenOutBuffer(&ob,filename))) {
+                int index = 0;
+                for(j=0;j<MAXBOUNDARIES;j++) {
+                    if(!bound[j].created) continue;
+                    for(i=1;i<=bound[j].nosides;i++) {
+                        sideelemtype = GetBoundaryElement(data,&bound[j],i,sideind);
+                        if(!sideelemtype) continue;
+                        index++;
+                        PutBoundaryElement(&ob,index,bound[j].types[i],bound[j].parent[i],
+                                           bound[j].parent2[i],sideelemtype,sideind);
+                    }
+                }
+                CloseOutBuffer(&ob);
+            }
+        }
+    }
+
+    SaveElmerNames(data,bound,prefix);
+
+    if(!ok[0] || !ok[1] || !ok[2]) return(3);
+
+    if(info) printf("Saved %d nodes, %d elements and %d boundary elements.\n",
+                    noknots,noelements,nosides);
+    return(0);
+}
+
+
+/* The partitions of the mesh entities in compressed rows, shared by the
+   threads that write the partitions. */
+struct PartitionListsType {
+    int nparts,
+        *nodepartoffset,  /* partitions of node i, owner first */
+        *nodeparts,
+        *elemoffset,      /* elements of partition p */
+        *elems,
+        *sideoffset,      /* boundary elements of partition p as numbers of the */
+        *sides,           /* boundary and the side, and their global index */
+        *sidebc,
+        *sideindex,
+        totsides;         /* number of all the boundary elements */
+};
+
+
+static void CreateNodePartitions(struct FemType *data,struct PartitionListsType *pl)
+/* The partitions of a node are the partitions of its elements; the owner
+   given by nodepart is listed first. */
+{
+    int i,j,k,p,q,noknots,found,*offset,*parts;
+
+    noknots = data->noknots;
+    offset = Ivector(1,noknots+1);
+
+#pragma omp parallel for private(j,k,p,q,found) schedule(static)
+    for(i=1;i<=noknots;i++) {
+        p = data->nodepart[i];
+        offset[i] = 1;
+        for(j=data->invtopooffset[i];j<data->invtopooffset[i+1];j++) {
+            q = data->elempart[data->invtopo[j]];
+            found = (q == p);
+            for(k=data->invtopooffset[i];k<j && !found;k++)
+                if(data->elempart[data->invtopo[k]] == q) found = TRUE;
+            if(!found) offset[i] += 1;
+        }
+    }
+
+    k = 0;
+    for(i=1;i<=noknots;i++) {
+        j = offset[i];
+        offset[i] = k;
+        k += j;
+    }
+    offset[noknots+1] = k;
+    parts = Ivector(0,k);
+
+#pragma omp parallel for private(j,k,p,q,found) schedule(static)
+    for(i=1;i<=noknots;i++) {
+        int n = offset[i];
+        p = data->nodepart[i];
+        parts[n++] = p;
+        for(j=data->invtopooffset[i];j<data->invtopooffset[i+1];j++) {
+            q = data->elempart[data->invtopo[j]];
+            found = FALSE;
+            for(k=offset[i];k<n && !found;k++)
+                if(parts[k] == q) found = TRUE;
+            if(!found) parts[n++] = q;
+        }
+    }
+
+    pl->nodepartoffset = offset;
+    pl->nodeparts = parts;
+}
+
+
+static void CreatePartitionLists(struct FemType *data,struct BoundaryType *bound,
+                                 struct PartitionListsType *pl)
+/* Sorts the elements and the boundary elements by partition. A boundary
+   element goes to the partitions of both of its parents. */
+{
+    int i,j,k,l,p,nparts,noelements,nosides,index,sideind[MAXNODESD2];
+    int *fill,sidepart[2];
+
+    nparts = pl->nparts;
+    noelements = data->noelements;
+    fill = Ivector(1,nparts+1);
+
+    pl->elemoffset = Ivector(1,nparts+1);
+    for(p=1;p<=nparts+1;p++)
+        pl->elemoffset[p] = 0;
+    for(i=1;i<=noelements;i++)
+        pl->elemoffset[data->elempart[i]+1] += 1;
+    for(p=1;p<=nparts;p++)
+        pl->elemoffset[p+1] += pl->elemoffset[p];
+    pl->elems = Ivector(0,noelements);
+    for(p=1;p<=nparts;p++)
+        fill[p] = pl->elemoffset[p];
+    for(i=1;i<=noelements;i++)
+        pl->elems[fill[data->elempart[i]]++] = i;
+
+    /* Two passes over the sides: first count, then fill */
+    pl->sideoffset = Ivector(1,nparts+1);
+    pl->sides = pl->sidebc = pl->sideindex = NULL;
+    nosides = 0;
+
+    for(l=0;l<2;l++) {
+        for(p=1;p<=nparts+1;p++)
+            fill[p] = 0;
+        if(l == 1)
+            for(p=1;p<=nparts;p++)
+                fill[p] = pl->sideoffset[p];
+
+        index = 0;
+        for(j=0;j<MAXBOUNDARIES;j++) {
+            if(!bound[j].created) continue;
+            for(i=1;i<=bound[j].nosides;i++) {
+                if(!GetBoundaryElement(data,&bound[j],i,sideind)) continue;
+                index++;
+
+                sidepart[0] = sidepart[1] = 0;
+                if(bound[j].parent[i]) sidepart[0] = data->elempart[bound[j].parent[i]];
+                if(bound[j].parent2[i]) sidepart[1] = data->elempart[bound[j].parent2[i]];
+                if(!sidepart[0] && !sidepart[1]) sidepart[0] = data->nodepart[sideind[0]];
+                if(sidepart[1] == sidepart[0]) sidepart[1] = 0;
+
+                for(k=0;k<2;k++) {
+                    p = sidepart[k];
+                    if(!p) continue;
+                    if(l == 0) {
+                        fill[p+1] += 1;
+                        continue;
+                    }
+                    pl->sides[fill[p]] = i;
+                    pl->sidebc[fill[p]] = j;
+                    pl->sideindex[fill[p]] = index;
+                    fill[p] += 1;
+                }
+            }
+        }
+
+        if(l == 0) {
+            pl->sideoffset[1] = 0;
+            for(p=1;p<=nparts;p++)
+                pl->sideoffset[p+1] = pl->sideoffset[p] + fill[p+1];
+            nosides = pl->sideoffset[nparts+1];
+            pl->totsides = index;
+            pl->sides = Ivector(0,nosides);
+            pl->sidebc = Ivector(0,nosides);
+            pl->sideindex = Ivector(0,nosides);
+        }
+    }
+
+    free_Ivector(fill,1,nparts+1);
+}
+
+
+static void DestroyPartitionLists(struct FemType *data,struct PartitionListsType *pl)
+{
+    int nosides;
+
+    nosides = pl->sideoffset[pl->nparts+1];
+    free_Ivector(pl->nodepartoffset,1,data->noknots+1);
+    free_Ivector(pl->nodeparts,0,0);
+    free_Ivector(pl->elemoffset,1,pl->nparts+1);
+    free_Ivector(pl->elems,0,data->noelements);
+    free_Ivector(pl->sideoffset,1,pl->nparts+1);
+    free_Ivector(pl->sides,0,nosides);
+    free_Ivector(pl->sidebc,0,nosides);
+    free_Ivector(pl->sideindex,0,nosides);
+}
+
+
+/* Work space of one writing thread. The marks are stamped with the
+   partition so that they need not be cleared between partitions. */
+struct PartitionWorkType {
+    int *nodemark,   /* partition that has listed the node */
+        *elemmark,   /* partition that has listed the element as halo */
+        *pairmark,   /* node that has been connected to this node */
+        *nodes,      /* nodes of the partition */
+        *halo,       /* halo elements of the partition */
+        *pairs,      /* indirect connections as pairs of nodes */
+        maxpairs;
+};
+
+
+static int FindIndirectPairs(struct FemType *data,struct PartitionListsType *pl,
+                             struct PartitionWorkType *w,int p,int nonodes,int *pairs)
+/* The shared nodes of partition p are coupled to the nodes of the elements of
+   the other partitions. Without the halo these nodes are not known to p, so
+   each such coupling is given as a 102 element. With pairs == NULL the
+   couplings are only counted. */
+{
+    int i,j,k,m,node,elem,npairs;
+
+    npairs = 0;
+    for(i=0;i<nonodes;i++) {
+        node = w->nodes[i];
+        if(pl->nodepartoffset[node+1] - pl->nodepartoffset[node] < 2) continue;
+
+        for(j=data->invtopooffset[node];j<data->invtopooffset[node+1];j++) {
+            elem = data->invtopo[j];
+            if(data->elempart[elem] == p) continue;
+            for(k=0;k<data->elementtypes[elem]%100;k++) {
+                m = data->topology[elem][k];
+                if(w->nodemark[m] == p) continue;
+                if(w->pairmark[m] == node) continue;
+                w->pairmark[m] = node;
+                if(pairs) {
+                    pairs[2*npairs] = node;
+                    pairs[2*npairs+1] = m;
+                }
+                npairs++;
+            }
+        }
+    }
+
+    /* The same node may be shared by the next partition */
+    for(i=0;i<nonodes;i++) {
+        node = w->nodes[i];
+        for(j=data->invtopooffset[node];j<data->invtopooffset[node+1];j++) {
+            elem = data->invtopo[j];
+            for(k=0;k<data->elementtypes[elem]%100;k++)
+                w->pairmark[data->topology[elem][k]] = 0;
+        }
+    }
+    return(npairs);
+}
+
+
+static int SavePartition(struct FemType *data,struct BoundaryType *bound,
+                         struct PartitionListsType *pl,struct PartitionWorkType *w,
+                         char *dirname,int p,int decimals,int halo,int indirect,
+                         int firstpair,int *stats)
+/* Writes the files of partition p. The number of nodes and halo elements
+   is returned in stats. */
+{
+    int i,j,k,q,e,elem,node,nonodes,nohalo,noown,nosides,npairs,noshared,found;
+    int sideelemtype,sideind[MAXNODESD2],typecount[MAXELEMENTTYPE];
+    char filename[MAXFILESIZE];
+    FILE *out;
+    struct OutBufferType ob;
+
+    noown = pl->elemoffset[p+1] - pl->elemoffset[p];
+
+    /* Elements of other partitions that share a node with this one */
+    nohalo = 0;
+    if(halo) {
+        for(e=pl->elemoffset[p];e<pl->elemoffset[p+1];e++) {
+            elem = pl->elems[e];
+            for(k=0;k<data->elementtypes[elem]%100;k++) {
+                node = data->topology[elem][k];
+                if(pl->nodepartoffset[node+1] - pl->nodepartoffset[node] < 2) continue;
+                for(j=data->invtopooffset[node];j<data->invtopooffset[node+1];j++) {
+                    i = data->invtopo[j];
+                    if(data->elempart[i] == p || w->elemmark[i] == p) continue;
+                    w->elemmark[i] = p;
+                    w->halo[nohalo++] = i;
+                }
+            }
+        }
+    }
+
+    /* Nodes of the own and the halo elements */
+    nonodes = 0;
+    for(e=0;e<noown+nohalo;e++) {
+        elem = (e < noown) ? pl->elems[pl->elemoffset[p]+e] : w->halo[e-noown];
+        for(k=0;k<data->elementtypes[elem]%100;k++) {
+            node = data->topology[elem][k];
+            if(w->nodemark[node] == p) continue;
+            w->nodemark[node] = p;
+            w->nodes[nonodes++] = node;
+        }
+    }
+
+    npairs = 0;
+    if(indirect && !halo) {
+        npairs = FindIndirectPairs(data,pl,w,p,nonodes,NULL);
+        if(npairs > w->maxpairs) {
+            if(w->maxpairs) free_Ivector(w->pairs,0,2*w->maxpairs);
+            w->maxpairs = npairs;
+            w->pairs = Ivector(0,2*npairs);
+        }
+        FindIndirectPairs(data,pl,w,p,nonodes,w->pairs);
+        for(i=0;i<npairs;i++) {
+            node = w->pairs[2*i+1];
+            if(w->nodemark[node] == p) continue;
+            w->nodemark[node] = p;
+            w->nodes[nonodes++] = node;
+        }
+    }
+
+    for(i=0;i<MAXELEMENTTYPE;i++)
+        typecount[i] = 0;
+    for(e=0;e<noown+nohalo;e++) {
+        elem = (e < noown) ? pl->elems[pl->elemoffset[p]+e] : w->halo[e-noown];
+        typecount[data->elementtypes[elem]] += 1;
+    }
+    nosides = pl->sideoffset[p+1] - pl->sideoffset[p];
+    for(e=pl->sideoffset[p];e<pl->sideoffset[p+1];e++) {
+        sideelemtype = GetBoundaryElement(data,&bound[pl->sidebc[e]],pl->sides[e],sideind);
+        typecount[sideelemtype] += 1;
+    }
+    if(npairs) typecount[102] += npairs;
+
+    noshared = 0;
+    for(i=0;i<nonodes;i++) {
+        node = w->nodes[i];
+        if(pl->nodepartoffset[node+1] - pl->nodepartoffset[node] > 1 ||
+           pl->nodeparts[pl->nodepartoffset[node]] != p) noshared++;
+    }
+
+    sprintf(filename,"%s/part.%d.header",dirname,p);
+    if((out = fopen(filename,"w")) == NULL) {
+        printf("SaveElmerInputPartitioned: The opening of file %s failed!\n",filename);
+        return(FALSE);
+    }
+    fprintf(out,"%d %d %d\n",nonodes,noown+nohalo,nosides+npairs);
+    PutHeaderTypes(out,typecount);
+    fprintf(out,"%d %d\n",noshared,0);
+    fclose(out);
+
+    sprintf(filename,"%s/part.%d.nodes",dirname,p);
+    if(!OpenOutBuffer(&ob,filename)) return(FALSE);
+    for(i=0;i<nonodes;i++)
+        PutNode(&ob,data,w->nodes[i],decimals);
+    CloseOutBuffer(&ob);
+
+    sprintf(filename,"%s/part.%d.elements",dirname,p);
+    if(!OpenOutBuffer(&ob,filename)) return(FALSE);
+    for(e=pl->elemoffset[p];e<pl->elemoffset[p+1];e++)
+        PutElement(&ob,data,pl->elems[e],0);
+    for(e=0;e<nohalo;e++)
+        PutElement(&ob,data,w->halo[e],data->elempart[w->halo[e]]);
+    CloseOutBuffer(&ob);
+
+    sprintf(filename,"%s/part.%d.boundary",dirname,p);
+    if(!OpenOutBuffer(&ob,filename)) return(FALSE);
+    for(e=pl->sideoffset[p];e<pl->sideoffset[p+1];e++) {
+        struct BoundaryType *bd = &bound[pl->sidebc[e]];
+        i = pl->sides[e];
+        sideelemtype = GetBoundaryElement(data,bd,i,sideind);
+        PutBoundaryElement(&ob,pl->sideindex[e],bd->types[i],bd->parent[i],bd->parent2[i],
+                           sideelemtype,sideind);
+    }
+    for(i=0;i<npairs;i++)
+        PutBoundaryElement(&ob,firstpair+i+1,0,0,0,102,&w->pairs[2*i]);
+    CloseOutBuffer(&ob);
+
+    sprintf(filename,"%s/part.%d.shared",dirname,p);
+    if(!OpenOutBuffer(&ob,filename)) return(FALSE);
+    for(i=0;i<nonodes;i++) {
+        node = w->nodes[i];
+        k = pl->nodepartoffset[node+1] - pl->nodepartoffset[node];
+        found = FALSE;
+        for(j=pl->nodepartoffset[node];j<pl->nodepartoffset[node+1];j++)
+            if(pl->nodeparts[j] == p) found = TRUE;
+        if(k < 2 && found) continue;
+
+        PutInt(&ob,node);
+        PutChar(&ob,' ');
+        PutInt(&ob,found ? k : k+1);
+        for(j=pl->nodepartoffset[node];j<pl->nodepartoffset[node+1];j++) {
+            q = pl->nodeparts[j];
+            PutChar(&ob,' ');
+            PutInt(&ob,q);
+        }
+        if(!found) {
+            PutChar(&ob,' ');
+            PutInt(&ob,p);
+        }
+        PutChar(&ob,'\n');
+    }
+    CloseOutBuffer(&ob);
+
+    stats[2*p-1] = nonodes;
+    stats[2*p] = nohalo;
+    return(TRUE);
+}
+
+
+int SaveElmerInputPartitioned(struct FemType *data,struct BoundaryType *bound,
+                              char *prefix,int decimals,int halo,int indirect,
+                              int info)
+/* Saves the partitioned mesh in ElmerSolver format. Each partition is written
+   by one thread. With halo the elements of the neighbouring partitions that
+   share a node with the partition are included. With indirect the couplings
+   of the shared nodes to the nodes of the other partitions are given as 102
+   elements in the boundary file. */
+{
+    int i,p,nparts,ownsinvtopo,ok,maxnodes,maxhalo;
+    int *stats,*pairoffset;
+    char dirname[MAXFILESIZE];
+    struct PartitionListsType pl;
+
+    if(!data->created) {
+        printf("SaveElmerInputPartitioned: You tried to save points that were never created.\n");
+        return(1);
+    }
+    if(!data->partitionexist) {
+        printf("SaveElmerInputPartitioned: The mesh has not been partitioned.\n");
+        return(1);
+    }
+
+    nparts = data->nopartitions;
+    if(info) printf("Saving mesh in parallel ElmerSolver format to directory %s.\n",prefix);
+    if(!CreateOutputDirectory(prefix,info)) return(2);
+    sprintf(dirname,"%s/partitioning.%d",prefix,nparts);
+    if(!CreateOutputDirectory(dirname,info)) return(2);
+
+    ownsinvtopo = !data->invtopoexists;
+    if(ownsinvtopo) CreateInverseTopology(data,FALSE);
+
+    pl.nparts = nparts;
+    CreateNodePartitions(data,&pl);
+    CreatePartitionLists(data,bound,&pl);
+
+    /* The indirect connections are numbered after the boundary elements,
+       which requires their counts before the files are written. */
+    pairoffset = Ivector(1,nparts+1);
+    for(p=1;p<=nparts+1;p++)
+        pairoffset[p] = pl.totsides;
+    if(indirect && !halo) {
+#pragma omp parallel private(p)
+        {
+            struct PartitionWorkType w;
+            int j,k,e,elem,node,nonodes;
+
+            w.nodemark = Ivector(1,data->noknots);
+            w.pairmark = Ivector(1,data->noknots);
+            w.nodes = Ivector(0,data->noknots);
+            for(j=1;j<=data->noknots;j++)
+                w.nodemark[j] = w.pairmark[j] = 0;
+#pragma omp for schedule(dynamic,1)
+            for(p=1;p<=nparts;p++) {
+                nonodes = 0;
+                for(e=pl.elemoffset[p];e<pl.elemoffset[p+1];e++) {
+                    elem = pl.elems[e];
+                    for(k=0;k<data->elementtypes[elem]%100;k++) {
+                        node = data->topology[elem][k];
+                        if(w.nodemark[node] == p) continue;
+                        w.nodemark[node] = p;
+                        w.nodes[nonodes++] = node;
+                    }
+                }
+                pairoffset[p+1] = FindIndirectPairs(data,&pl,&w,p,nonodes,NULL);
+            }
+            free_Ivector(w.nodemark,1,data->noknots);
+            free_Ivector(w.pairmark,1,data->noknots);
+            free_Ivector(w.nodes,0,data->noknots);
+        }
+        for(p=1;p<=nparts;p++)
+            pairoffset[p+1] += pairoffset[p];
+    }
+
+    stats = Ivector(1,2*nparts);
+    for(i=1;i<=2*nparts;i++)
+        stats[i] = 0;
+
+    ok = TRUE;
+#pragma omp parallel private(p)
+    {
+        struct PartitionWorkType w;
+        int j;
+
+        w.nodemark = Ivector(1,data->noknots);
+        w.elemmark = Ivector(1,data->noelements);
+        w.pairmark = Ivector(1,data->noknots);
+        w.nodes = Ivector(0,data->noknots);
+        w.halo = Ivector(0,data->noelements);
+        w.maxpairs = 0;
+        for(j=1;j<=data->noknots;j++)
+            w.nodemark[j] = w.pairmark[j] = 0;
+        for(j=1;j<=data->noelements;j++)
+            w.elemmark[j] = 0;
+
+#pragma omp for schedule(dynamic,1)
+        for(p=1;p<=nparts;p++) {
+            if(!SavePartition(data,bound,&pl,&w,dirname,p,decimals,halo,indirect,
+                              pairoffset[p],stats)) {
+#pragma omp atomic write
+                ok = FALSE;
+            }
+        }
+
+        free_Ivector(w.nodemark,1,data->noknots);
+        free_Ivector(w.elemmark,1,data->noelements);
+        free_Ivector(w.pairmark,1,data->noknots);
+        free_Ivector(w.nodes,0,data->noknots);
+        free_Ivector(w.halo,0,data->noelements);
+        if(w.maxpairs) free_Ivector(w.pairs,0,2*w.maxpairs);
+    }
+
+    SaveElmerNames(data,bound,prefix);
+
+    if(info) {
+        maxnodes = maxhalo = 0;
+        for(p=1;p<=nparts;p++) {
+            maxnodes = MAX(maxnodes,stats[2*p-1]);
+            maxhalo = MAX(maxhalo,stats[2*p]);
+        }
+        printf("Saved %d partitions with at most %d nodes each.\n",nparts,maxnodes);
+        if(halo) printf("The largest halo has %d elements.\n",maxhalo);
+        if(pairoffset[nparts+1] > pl.totsides)
+            printf("Added %d indirect connections.\n",pairoffset[nparts+1]-pl.totsides);
+    }
+
+    free_Ivector(stats,1,2*nparts);
+    free_Ivector(pairoffset,1,nparts+1);
+    DestroyPartitionLists(data,&pl);
+    if(ownsinvtopo) DestroyInverseTopology(data,FALSE);
+
+    return(ok ? 0 : 3);
+}
@@ -0,0 +1,10 @@
+/* egoutput.h */
+/* Saving of the mesh in the format of the Elmer solver. The serial mesh is
+   written into directory prefix, the partitioned mesh into the subdirectory
+   partitioning.N with the files of each partition written by its own thread. */
+
+int SaveElmerInput(struct FemType *data,struct BoundaryType *bound,
+		   char *prefix,int decimals,int info);
+int SaveElmerInputPartitioned(struct FemType *data,struct BoundaryType *bound,
+			      char *prefix,int decimals,int halo,int indirect,
+			      int info);
@@ -0,0 +1,1138 @@
+/*
+   ElmerGrid - A simple mesh generation and manipulation utility
+   Copyright (C) 1995- , CSC - IT Center for Science Ltd.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* -------------------------------:  egparallel.c  :----------------------------
+   Partitioning of the mesh. The geometric methods sort the elements or nodes
+   along the coordinate directions. The multilevel method works on the dual
+   graph of the elements: the graph is coarsened by heavy-edge matching, the
+   coarsest graph is bisected by greedy graph growing, and the bisection is
+   refined with the Fiduccia-Mattheyses heuristic while it is projected back.
+   Recursive bisection gives any number of partitions, and a final k-way pass
+   restores the balance and removes some of the cut.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "egutils.h"
+#include "egdef.h"
+#include "egtypes.h"
+#include "egmesh.h"
+#include "egparallel.h"
+
+#define COARSEST_SIZE 100   /* coarsening stops at this many vertices */
+#define MAXLEVELS 64        /* maximum number of coarsening levels */
+#define INITIAL_TRIALS 4    /* number of greedy growings of the coarsest graph */
+#define FM_PASSES 6         /* maximum number of refinement passes per level */
+#define PART_IMBALANCE 0.03 /* allowed relative excess of elements in a partition */
+
+
+/* Graph in compressed rows with vertex and edge weights, numbered from 0. */
+struct PartGraphType {
+    int nvtx,
+        totvwgt,
+        *xadj,
+        *adjncy,
+        *adjwgt,
+        *vwgt;
+};
+
+
+static void AllocatePartGraph(struct PartGraphType *g,int nvtx,int nedges)
+{
+    g->nvtx = nvtx;
+    g->totvwgt = 0;
+    g->xadj = Ivector(0,nvtx);
+    g->adjncy = Ivector(0,MAX(nedges,1)-1);
+    g->adjwgt = Ivector(0,MAX(nedges,1)-1);
+    g->vwgt = Ivector(0,MAX(nvtx,1)-1);
+}
+
+
+static void FreePartGraph(struct PartGraphType *g)
+{
+    free_Ivector(g->xadj,0,g->nvtx);
+    free_Ivector(g->adjncy,0,0);
+    free_Ivector(g->adjwgt,0,0);
+    free_Ivector(g->vwgt,0,0);
+    g->nvtx = 0;
+}
+
+
+static int ElementCorners(int elemtype)
+/* Number of corner nodes, the ones that decide whether elements share a side */
+{
+    switch(elemtype/100) {
+    case 1: return(1);
+    case 2: return(2);
+    case 3: return(3);
+    case 4: return(4);
+    case 5: return(4);
+    case 6: return(5);
+    case 7: return(6);
+    case 8: return(8);
+    }
+    return(elemtype%100);
+}
+
+
+static int ElementSideCorners(int elemtype)
+/* Number of corners that two elements must share to be neighbours */
+{
+    switch(elemtype/100) {
+    case 1:
+    case 2: return(1);
+    case 3:
+    case 4: return(2);
+    }
+    return(3);
+}
+
+
+static void CreateElementGraph(struct FemType *data,struct PartGraphType *g,int info)
+/* The dual graph of the elements: elements sharing a side are connected.
+   The graph is built from the inverse topology in a counting and a filling pass. */
+{
+    int i,j,k,l,e,f,pass,noelements,nocorners,need,ownsinvtopo,nedges;
+    int *mark,*common,*list,nolist;
+
+    noelements = data->noelements;
+
+    ownsinvtopo = !data->invtopoexists;
+    if(ownsinvtopo) CreateInverseTopology(data,FALSE);
+
+    mark = Ivector(1,noelements);
+    common = Ivector(1,noelements);
+    list = Ivector(0,noelements-1);
+    for(e=1;e<=noelements;e++)
+        mark[e] = 0;
+
+    g->xadj = NULL;
+    nedges = 0;
+    for(pass=1;pass<=2;pass++) {
+        if(pass == 2) {
+            AllocatePartGraph(g,noelements,nedges);
+            g->xadj[0] = 0;
+        }
+        nedges = 0;
+
+        for(e=1;e<=noelements;e++) {
+            nocorners = ElementCorners(data->elementtypes[e]);
+            nolist = 0;
+
+            for(i=0;i<nocorners;i++) {
+                k = data->topology[e][i];
+                for(j=data->invtopooffset[k];j<data->invtopooffset[k+1];j++) {
+                    f = data->invtopo[j];
+                    if(f == e) continue;
+                    if(mark[f] != e + (pass-1)*noelements) {
+                        mark[f] = e + (pass-1)*noelements;
+                        common[f] = 0;
+                        list[nolist++] = f;
+                    }
+                    /* Only the corners of the neighbour count */
+                    for(l=0;l<ElementCorners(data->elementtypes[f]);l++)
+                        if(data->topology[f][l] == k) {
+                            common[f] += 1;
+                            break;
+                        }
+                }
+            }
+
+            need = ElementSideCorners(data->elementtypes[e]);
+            for(l=0;l<nolist;l++) {
+                f = list[l];
+                if(common[f] < MIN(need,ElementSideCorners(data->elementtypes[f]))) continue;
+                if(pass == 2) {
+                    g->adjncy[nedges] = f-1;
+                    g->adjwgt[nedges] = 1;
+                }
+                nedges++;
+            }
+            if(pass == 2) {
+                g->xadj[e] = nedges;
+                g->vwgt[e-1] = 1;
+            }
+        }
+    }
+    g->totvwgt = noelements;
+
+    free_Ivector(mark,1,noelements);
+    free_Ivector(common,1,noelements);
+    free_Ivector(list,0,noelements-1);
+    if(ownsinvtopo) DestroyInverseTopology(data,FALSE);
+
+    if(info) printf("The dual graph of the elements has %d vertices and %d edges\n",
+                    noelements,nedges/2);
+}
+
+
+static unsigned int PartRandom(unsigned int *seed)
+/* Simple linear congruential generator so that the results are reproducible */
+{
+    *seed = *seed * 1103515245U + 12345U;
+    return((*seed >> 8) & 0xffffff);
+}
+
+
+static int *CoarsenGraph(struct PartGraphType *g,struct PartGraphType *cg,unsigned int *seed)
+/* Contracts a maximal heavy-edge matching of g into cg. Returns the
+   coarse vertex of each fine vertex. */
+{
+    int i,j,k,v,u,cv,cu,maxw,maxvwgt,nvtx,cnvtx,cnedges;
+    int *perm,*match,*cmap,*htable,*first;
+
+    nvtx = g->nvtx;
+    maxvwgt = MAX(1,(3*g->totvwgt)/(2*COARSEST_SIZE));
+
+    perm = Ivector(0,nvtx-1);
+    match = Ivector(0,nvtx-1);
+    cmap = Ivector(0,nvtx-1);
+    first = Ivector(0,nvtx-1);
+
+    for(i=0;i<nvtx;i++) {
+        perm[i] = i;
+        match[i] = -1;
+    }
+    for(i=nvtx-1;i>0;i--) {
+        j = PartRandom(seed) % (i+1);
+        k = perm[i];
+        perm[i] = perm[j];
+        perm[j] = k;
+    }
+
+    cnvtx = 0;
+    for(i=0;i<nvtx;i++) {
+        v = perm[i];
+        if(match[v] >= 0) continue;
+
+        u = v;
+        maxw = -1;
+        for(j=g->xadj[v];j<g->xadj[v+1];j++) {
+            k = g->adjncy[j];
+            if(match[k] >= 0) continue;
+            if(g->vwgt[v] + g->vwgt[k] > maxvwgt) continue;
+            if(g->adjwgt[j] > maxw) {
+                maxw = g->adjwgt[j];
+                u = k;
+            }
+        }
+        match[v] = u;
+        match[u] = v;
+        first[cnvtx] = v;
+        cmap[v] = cmap[u] = cnvtx++;
+    }
+
+    /* Contract the matched pairs, merging the parallel edges */
+    AllocatePartGraph(cg,cnvtx,g->xadj[nvtx]);
+    htable = Ivector(0,MAX(cnvtx,1)-1);
+    for(i=0;i<cnvtx;i++)
+        htable[i] = -1;
+
+    cnedges = 0;
+    cg->xadj[0] = 0;
+    for(cv=0;cv<cnvtx;cv++) {
+        v = first[cv];
+
+        cg->vwgt[cv] = g->vwgt[v];
+        if(match[v] != v) cg->vwgt[cv] += g->vwgt[match[v]];
+
+        for(k=0;k<2;k++) {
+            u = (k == 0) ? v : match[v];
+            if(k == 1 && u == v) break;
+            for(j=g->xadj[u];j<g->xadj[u+1];j++) {
+                cu = cmap[g->adjncy[j]];
+                if(cu == cv) continue;
+                if(htable[cu] < 0) {
+                    htable[cu] = cnedges;
+                    cg->adjncy[cnedges] = cu;
+                    cg->adjwgt[cnedges] = g->adjwgt[j];
+                    cnedges++;
+                }
+                else {
+                    cg->adjwgt[htable[cu]] += g->adjwgt[j];
+                }
+            }
+        }
+        for(j=cg->xadj[cv];j<cnedges;j++)
+            htable[cg->adjncy[j]] = -1;
+        cg->xadj[cv+1] = cnedges;
+    }
+    cg->totvwgt = g->totvwgt;
+
+    free_Ivector(htable,0,MAX(cnvtx,1)-1);
+    free_Ivector(perm,0,nvtx-1);
+    free_Ivector(match,0,nvtx-1);
+    free_Ivector(first,0,nvtx-1);
+
+    return(cmap);
+}
+
+
+static int EdgeCut(struct PartGraphType *g,int *where)
+{
+    int i,j,cut;
+
+    cut = 0;
+    for(i=0;i<g->nvtx;i++)
+        for(j=g->xadj[i];j<g->xadj[i+1];j++)
+            if(where[g->adjncy[j]] != where[i]) cut += g->adjwgt[j];
+    return(cut/2);
+}
+
+
+/* Max-heap of vertices keyed by gain. Stale entries are skipped when popped. */
+struct GainHeapType {
+    int n,size,
+        *gain,
+        *vtx;
+};
+
+
+static void GainHeapInit(struct GainHeapType *h,int size)
+{
+    h->n = 0;
+    h->size = MAX(size,16);
+    h->gain = (int*) malloc((size_t) h->size*sizeof(int));
+    h->vtx = (int*) malloc((size_t) h->size*sizeof(int));
+    if(!h->gain || !h->vtx) nrerror("allocation failure in GainHeapInit()");
+}
+
+
+static void GainHeapFree(struct GainHeapType *h)
+{
+    free(h->gain);
+    free(h->vtx);
+}
+
+
+static void GainHeapPush(struct GainHeapType *h,int v,int gain)
+{
+    int i,p;
+
+    if(h->n == h->size) {
+        h->size *= 2;
+        h->gain = (int*) realloc(h->gain,(size_t) h->size*sizeof(int));
+        h->vtx = (int*) realloc(h->vtx,(size_t) h->size*sizeof(int));
+        if(!h->gain || !h->vtx) nrerror("allocation failure in GainHeapPush()");
+    }
+    i = h->n++;
+    while(i > 0) {
+        p = (i-1)/2;
+        if(h->gain[p] >= gain) break;
+        h->gain[i] = h->gain[p];
+        h->vtx[i] = h->vtx[p];
+        i = p;
+    }
+    h->gain[i] = gain;
+    h->vtx[i] = v;
+}
+
+
+static int GainHeapTop(struct GainHeapType *h,int *gain,int *locked,int *curgain)
+/* Returns the vertex of the largest valid gain, or -1 if there is none */
+{
+    int i,c,g,v;
+
+    while(h->n > 0) {
+        v = h->vtx[0];
+        if(!locked[v] && h->gain[0] == curgain[v]) {
+            *gain = h->gain[0];
+            return(v);
+        }
+        /* Remove the stale top */
+        h->n--;
+        g = h->gain[h->n];
+        v = h->vtx[h->n];
+        i = 0;
+        for(;;) {
+            c = 2*i+1;
+            if(c >= h->n) break;
+            if(c+1 < h->n && h->gain[c+1] > h->gain[c]) c++;
+            if(h->gain[c] <= g) break;
+            h->gain[i] = h->gain[c];
+            h->vtx[i] = h->vtx[c];
+            i = c;
+        }
+        h->gain[i] = g;
+        h->vtx[i] = v;
+    }
+    return(-1);
+}
+
+
+static int BisectionScore(int *pwgts,int *maxpw)
+/* Excess weight over the balance limits, zero when balanced */
+{
+    return(MAX(0,pwgts[0]-maxpw[0]) + MAX(0,pwgts[1]-maxpw[1]));
+}
+
+
+static void FMRefine(struct PartGraphType *g,int *where,int *maxpw,int npasses)
+/* Fiduccia-Mattheyses refinement of a bisection. Each pass moves vertices of
+   the largest gain one at a time, allowing the cut to grow, and then rolls
+   back to the best balanced state seen. */
+{
+    int i,j,v,u,pass,nvtx,from,to,gain,g0,g1,v0,v1,cut,bestcut,bestexcess,excess;
+    int nmoves,bestmoves,limit,boundary,pwgts[2];
+    int *curgain,*locked,*moved;
+    struct GainHeapType heap[2];
+
+    nvtx = g->nvtx;
+    curgain = Ivector(0,nvtx-1);
+    locked = Ivector(0,nvtx-1);
+    moved = Ivector(0,nvtx-1);
+    limit = MAX(50,nvtx/50);
+
+    for(pass=0;pass<npasses;pass++) {
+        pwgts[0] = pwgts[1] = 0;
+        for(v=0;v<nvtx;v++)
+            pwgts[where[v]] += g->vwgt[v];
+
+        GainHeapInit(&heap[0],nvtx/8);
+        GainHeapInit(&heap[1],nvtx/8);
+        for(v=0;v<nvtx;v++) {
+            locked[v] = FALSE;
+            curgain[v] = 0;
+            boundary = FALSE;
+            for(j=g->xadj[v];j<g->xadj[v+1];j++) {
+                if(where[g->adjncy[j]] != where[v]) {
+                    curgain[v] += g->adjwgt[j];
+                    boundary = TRUE;
+                }
+                else
+                    curgain[v] -= g->adjwgt[j];
+            }
+            /* Only boundary vertices are candidates, the others enter the heap
+               when a neighbour moves */
+            if(boundary)
+                GainHeapPush(&heap[where[v]],v,curgain[v]);
+        }
+
+        cut = bestcut = EdgeCut(g,where);
+        excess = bestexcess = BisectionScore(pwgts,maxpw);
+        nmoves = bestmoves = 0;
+
+        while(nmoves - bestmoves < limit && nmoves < nvtx) {
+            v0 = GainHeapTop(&heap[0],&g0,locked,curgain);
+            v1 = GainHeapTop(&heap[1],&g1,locked,curgain);
+
+            /* Move from the heavier side if out of balance, otherwise the
+               best move that keeps the balance */
+            if(pwgts[0] > maxpw[0]) from = 0;
+            else if(pwgts[1] > maxpw[1]) from = 1;
+            else {
+                if(v0 >= 0 && pwgts[1] + g->vwgt[v0] > maxpw[1]) v0 = -1;
+                if(v1 >= 0 && pwgts[0] + g->vwgt[v1] > maxpw[0]) v1 = -1;
+                if(v0 < 0 && v1 < 0) break;
+                if(v0 < 0) from = 1;
+                else if(v1 < 0) from = 0;
+                else from = (g0 >= g1) ? 0 : 1;
+            }
+            v = (from == 0) ? v0 : v1;
+            if(v < 0) break;
+            gain = curgain[v];
+            to = 1 - from;
+
+            where[v] = to;
+            pwgts[from] -= g->vwgt[v];
+            pwgts[to] += g->vwgt[v];
+            locked[v] = TRUE;
+            moved[nmoves++] = v;
+            cut -= gain;
+
+            for(j=g->xadj[v];j<g->xadj[v+1];j++) {
+                u = g->adjncy[j];
+                if(where[u] == to)
+                    curgain[u] -= 2*g->adjwgt[j];
+                else
+                    curgain[u] += 2*g->adjwgt[j];
+                if(!locked[u]) GainHeapPush(&heap[where[u]],u,curgain[u]);
+            }
+
+            excess = BisectionScore(pwgts,maxpw);
+            if(excess < bestexcess || (excess == bestexcess && cut < bestcut)) {
+                bestcut = cut;
+                bestexcess = excess;
+                bestmoves = nmoves;
+            }
+        }
+
+        /* Roll back the moves after the best state */
+        for(i=nmoves-1;i>=bestmoves;i--) {
+            v = moved[i];
+            where[v] = 1 - where[v];
+        }
+
+        GainHeapFree(&heap[0]);
+        GainHeapFree(&heap[1]);
+
+        if(bestmoves == 0) break;
+    }
+
+    free_Ivector(curgain,0,nvtx-1);
+    free_Ivector(locked,0,nvtx-1);
+    free_Ivector(moved,0,nvtx-1);
+}
+
+
+static void GrowBisection(struct PartGraphType *g,int *where,int tw0,int *maxpw,unsigned int *seed)
+/* Greedy graph growing: side 0 is grown from a random vertex by always adding
+   the boundary vertex of the largest gain. The best of a few trials is kept. */
+{
+    int i,j,v,u,trial,nvtx,w0,best,bestgain,cut,bestcut;
+    int *trywhere,*gain,*inqueue;
+
+    nvtx = g->nvtx;
+    trywhere = Ivector(0,nvtx-1);
+    gain = Ivector(0,nvtx-1);
+    inqueue = Ivector(0,nvtx-1);
+    bestcut = -1;
+
+    for(trial=0;trial<INITIAL_TRIALS;trial++) {
+        for(v=0;v<nvtx;v++) {
+            trywhere[v] = 1;
+            gain[v] = 0;
+            inqueue[v] = FALSE;
+        }
+
+        v = PartRandom(seed) % nvtx;
+        w0 = 0;
+        for(;;) {
+            trywhere[v] = 0;
+            w0 += g->vwgt[v];
+            if(w0 >= tw0) break;
+
+            for(j=g->xadj[v];j<g->xadj[v+1];j++) {
+                u = g->adjncy[j];
+                if(trywhere[u] == 0) continue;
+                gain[u] += 2*g->adjwgt[j];
+                inqueue[u] = TRUE;
+            }
+
+            /* The coarsest graph is small so a linear search will do */
+            best = -1;
+            bestgain = 0;
+            for(u=0;u<nvtx;u++) {
+                if(!inqueue[u] || trywhere[u] == 0) continue;
+                if(w0 + g->vwgt[u] > maxpw[0]) continue;
+                i = gain[u] - (g->xadj[u+1]-g->xadj[u]);
+                if(best < 0 || i > bestgain) {
+                    best = u;
+                    bestgain = i;
+                }
+            }
+            /* Disconnected graph, start again from any vertex */
+            if(best < 0) {
+                for(u=0;u<nvtx;u++)
+                    if(trywhere[u] == 1 && w0 + g->vwgt[u] <= maxpw[0]) break;
+                if(u == nvtx) break;
+                best = u;
+            }
+            v = best;
+        }
+
+        FMRefine(g,trywhere,maxpw,FM_PASSES);
+        cut = EdgeCut(g,trywhere);
+        if(bestcut < 0 || cut < bestcut) {
+            bestcut = cut;
+            for(v=0;v<nvtx;v++)
+                where[v] = trywhere[v];
+        }
+    }
+
+    free_Ivector(trywhere,0,nvtx-1);
+    free_Ivector(gain,0,nvtx-1);
+    free_Ivector(inqueue,0,nvtx-1);
+}
+
+
+static void MultilevelBisection(struct PartGraphType *g,int *where,int tw0,Real ubfactor,
+                                unsigned int *seed)
+/* Bisects g so that side 0 gets the weight tw0 within the given tolerance */
+{
+    int i,v,nolevels,maxpw[2];
+    int *cmap[MAXLEVELS],*cwhere,*fwhere;
+    struct PartGraphType graphs[MAXLEVELS+1];
+
+    graphs[0] = *g;
+    nolevels = 0;
+    while(graphs[nolevels].nvtx > COARSEST_SIZE && nolevels < MAXLEVELS) {
+        cmap[nolevels] = CoarsenGraph(&graphs[nolevels],&graphs[nolevels+1],seed);
+        nolevels++;
+        /* Stop if the matching no longer reduces the graph */
+        if(graphs[nolevels].nvtx > 0.95 * graphs[nolevels-1].nvtx) break;
+    }
+
+    maxpw[0] = (int) (tw0 * (1.0+ubfactor)) + 1;
+    maxpw[1] = (int) ((g->totvwgt-tw0) * (1.0+ubfactor)) + 1;
+
+    cwhere = Ivector(0,graphs[nolevels].nvtx-1);
+    GrowBisection(&graphs[nolevels],cwhere,tw0,maxpw,seed);
+
+    for(i=nolevels-1;i>=0;i--) {
+        fwhere = (i == 0) ? where : Ivector(0,graphs[i].nvtx-1);
+        for(v=0;v<graphs[i].nvtx;v++)
+            fwhere[v] = cwhere[cmap[i][v]];
+        free_Ivector(cwhere,0,graphs[i+1].nvtx-1);
+        free_Ivector(cmap[i],0,graphs[i].nvtx-1);
+        FreePartGraph(&graphs[i+1]);
+
+        FMRefine(&graphs[i],fwhere,maxpw,FM_PASSES);
+        cwhere = fwhere;
+    }
+    if(nolevels == 0) {
+        for(v=0;v<g->nvtx;v++)
+            where[v] = cwhere[v];
+        free_Ivector(cwhere,0,g->nvtx-1);
+    }
+}
+
+
+static void ExtractSubgraph(struct PartGraphType *g,int *where,int side,
+                            struct PartGraphType *sg,int *label)
+/* The subgraph induced by the vertices on the given side. label[] maps
+   the subgraph vertices to those of g. */
+{
+    int i,j,v,n,nedges;
+    int *newindx;
+
+    newindx = Ivector(0,g->nvtx-1);
+    n = nedges = 0;
+    for(v=0;v<g->nvtx;v++) {
+        if(where[v] != side) continue;
+        label[n] = v;
+        newindx[v] = n++;
+        nedges += g->xadj[v+1]-g->xadj[v];
+    }
+
+    AllocatePartGraph(sg,n,nedges);
+    nedges = 0;
+    sg->xadj[0] = 0;
+    for(i=0;i<n;i++) {
+        v = label[i];
+        for(j=g->xadj[v];j<g->xadj[v+1];j++) {
+            if(where[g->adjncy[j]] != side) continue;
+            sg->adjncy[nedges] = newindx[g->adjncy[j]];
+            sg->adjwgt[nedges] = g->adjwgt[j];
+            nedges++;
+        }
+        sg->xadj[i+1] = nedges;
+        sg->vwgt[i] = g->vwgt[v];
+        sg->totvwgt += g->vwgt[v];
+    }
+
+    free_Ivector(newindx,0,g->nvtx-1);
+}
+
+
+static void RecursiveBisection(struct PartGraphType *g,int nparts,int firstpart,
+                               int *part,Real ubfactor,unsigned int *seed)
+{
+    int i,side,n0,tw0,nsub;
+    int *where,*label,*subpart;
+    struct PartGraphType sg;
+
+    if(nparts == 1 || g->nvtx == 0) {
+        for(i=0;i<g->nvtx;i++)
+            part[i] = firstpart;
+        return;
+    }
+
+    n0 = nparts / 2;
+    tw0 = (int) ((double) g->totvwgt * n0 / nparts);
+
+    where = Ivector(0,g->nvtx-1);
+    MultilevelBisection(g,where,tw0,ubfactor,seed);
+
+    label = Ivector(0,g->nvtx-1);
+    subpart = Ivector(0,g->nvtx-1);
+    for(side=0;side<2;side++) {
+        ExtractSubgraph(g,where,side,&sg,label);
+        nsub = sg.nvtx;
+        if(side == 0)
+            RecursiveBisection(&sg,n0,firstpart,subpart,ubfactor,seed);
+        else
+            RecursiveBisection(&sg,nparts-n0,firstpart+n0,subpart,ubfactor,seed);
+        for(i=0;i<nsub;i++)
+            part[label[i]] = subpart[i];
+        FreePartGraph(&sg);
+    }
+
+    free_Ivector(where,0,g->nvtx-1);
+    free_Ivector(label,0,g->nvtx-1);
+    free_Ivector(subpart,0,g->nvtx-1);
+}
+
+
+static void RefineKway(struct PartGraphType *g,int *part,int nparts,int maxpwgt,int npasses)
+/* Greedy k-way refinement: boundary vertices of overweight partitions are
+   moved to the neighbouring partition that increases the cut least, and other
+   boundary vertices are moved if that reduces the cut without breaking the balance. */
+{
+    int i,j,k,v,p,q,pass,bestq,bestgain,moves,nodomains;
+    int *pwgts,*conn,*domains;
+
+    pwgts = Ivector(0,nparts-1);
+    conn = Ivector(0,nparts-1);
+    domains = Ivector(0,nparts-1);
+
+    for(p=0;p<nparts;p++) {
+        pwgts[p] = 0;
+        conn[p] = 0;
+    }
+    for(v=0;v<g->nvtx;v++)
+        pwgts[part[v]] += g->vwgt[v];
+
+    for(pass=0;pass<npasses;pass++) {
+        moves = 0;
+        for(v=0;v<g->nvtx;v++) {
+            p = part[v];
+
+            nodomains = 0;
+            for(j=g->xadj[v];j<g->xadj[v+1];j++) {
+                q = part[g->adjncy[j]];
+                if(!conn[q] && q != p) domains[nodomains++] = q;
+                conn[q] += g->adjwgt[j];
+            }
+            if(nodomains == 0) {
+                conn[p] = 0;
+                continue;
+            }
+
+            bestq = -1;
+            bestgain = 0;
+            for(k=0;k<nodomains;k++) {
+                q = domains[k];
+                if(pwgts[q] + g->vwgt[v] > maxpwgt) continue;
+                i = conn[q] - conn[p];
+                if(pwgts[p] > maxpwgt) {
+                    /* Must move, take the least harmful */
+                    if(bestq < 0 || i > bestgain || (i == bestgain && pwgts[q] < pwgts[bestq])) {
+                        bestq = q;
+                        bestgain = i;
+                    }
+                }
+                else if(i > bestgain || (i == 0 && bestgain == 0 && pwgts[q] + g->vwgt[v] < pwgts[p])) {
+                    bestq = q;
+                    bestgain = i;
+                }
+            }
+
+            for(k=0;k<nodomains;k++)
+                conn[domains[k]] = 0;
+            conn[p] = 0;
+
+            if(bestq >= 0) {
+                part[v] = bestq;
+                pwgts[p] -= g->vwgt[v];
+                pwgts[bestq] += g->vwgt[v];
+                moves++;
+            }
+        }
+        if(!moves) break;
+    }
+
+    free_Ivector(pwgts,0,nparts-1);
+    free_Ivector(conn,0,nparts-1);
+    free_Ivector(domains,0,nparts-1);
+}
+
+
+static void AllocatePartitions(struct FemType *data,int nparts)
+{
+    if(data->partitionexist) {
+        free_Ivector(data->elempart,1,data->noelements);
+        free_Ivector(data->nodepart,1,data->noknots);
+    }
+    data->elempart = Ivector(1,data->noelements);
+    data->nodepart = Ivector(1,data->noknots);
+    data->nopartitions = nparts;
+    data->partitionexist = TRUE;
+}
+
+
+static void PartitionStatistics(struct FemType *data,int info)
+{
+    int i,j,k,nparts,minelems,maxelems,shared,*elems,*owner;
+
+    if(!info) return;
+    nparts = data->nopartitions;
+
+    elems = Ivector(1,nparts);
+    for(i=1;i<=nparts;i++)
+        elems[i] = 0;
+    for(i=1;i<=data->noelements;i++)
+        elems[data->elempart[i]] += 1;
+
+    minelems = maxelems = elems[1];
+    for(i=1;i<=nparts;i++) {
+        minelems = MIN(minelems,elems[i]);
+        maxelems = MAX(maxelems,elems[i]);
+    }
+
+    /* Nodes needed by elements of more than one partition */
+    owner = Ivector(1,data->noknots);
+    for(i=1;i<=data->noknots;i++)
+        owner[i] = 0;
+    shared = 0;
+    for(i=1;i<=data->noelements;i++) {
+        for(j=0;j<data->elementtypes[i]%100;j++) {
+            k = data->topology[i][j];
+            if(owner[k] == 0)
+                owner[k] = data->elempart[i];
+            else if(owner[k] > 0 && owner[k] != data->elempart[i]) {
+                owner[k] = -1;
+                shared++;
+            }
+        }
+    }
+
+    printf("Elements in partitions are between %d and %d, imbalance %.2lf %%\n",
+           minelems,maxelems,100.0*(maxelems*nparts-data->noelements)/data->noelements);
+    printf("There are %d nodes shared by several partitions\n",shared);
+
+    free_Ivector(elems,1,nparts);
+    free_Ivector(owner,1,data->noknots);
+}
+
+
+int PartitionNodesByElements(struct FemType *data,int info)
+/* Each node is given to the partition that owns most of its elements,
+   and periodic nodes follow their counterpart. */
+{
+    int i,j,k,p,best,noknots,nparts,ownsinvtopo;
+    int *count;
+
+    if(!data->partitionexist) return(1);
+
+    noknots = data->noknots;
+    nparts = data->nopartitions;
+
+    ownsinvtopo = !data->invtopoexists;
+    if(ownsinvtopo) CreateInverseTopology(data,FALSE);
+
+    count = Ivector(1,nparts);
+    for(p=1;p<=nparts;p++)
+        count[p] = 0;
+
+    for(i=1;i<=noknots;i++) {
+        best = 1;
+        for(j=data->invtopooffset[i];j<data->invtopooffset[i+1];j++) {
+            p = data->elempart[data->invtopo[j]];
+            count[p] += 1;
+            if(count[p] > count[best] || (count[p] == count[best] && p < best)) best = p;
+        }
+        data->nodepart[i] = best;
+        for(j=data->invtopooffset[i];j<data->invtopooffset[i+1];j++)
+            count[data->elempart[data->invtopo[j]]] = 0;
+    }
+
+    if(data->periodicexist) {
+        for(i=1;i<=noknots;i++) {
+            k = data->periodic[i];
+            while(data->periodic[k] != k) k = data->periodic[k];
+            data->nodepart[i] = data->nodepart[k];
+        }
+    }
+
+    free_Ivector(count,1,nparts);
+    if(ownsinvtopo) DestroyInverseTopology(data,FALSE);
+
+    if(info) printf("The nodes were given to the partitions of their elements\n");
+    return(0);
+}
+
+
+int PartitionMultilevelElements(struct FemType *data,int nparts,int info)
+/* Partitions the dual graph of the elements with multilevel recursive
+   bisection so that the numbers of elements differ by at most PART_IMBALANCE. */
+{
+    int i,e,levels,maxpwgt;
+    int *part;
+    unsigned int seed;
+    Real ubfactor;
+    struct PartGraphType g;
+
+    if(nparts < 2) return(1);
+    if(nparts > data->noelements) {
+        printf("PartitionMultilevelElements: too many partitions (%d) for %d elements!\n",
+               nparts,data->noelements);
+        return(2);
+    }
+
+    if(info) printf("Making a multilevel partitioning of %d elements to %d partitions\n",
+                    data->noelements,nparts);
+
+    CreateElementGraph(data,&g,info);
+
+    /* The tolerance is shared between the levels of the recursion */
+    levels = 0;
+    for(i=1;i<nparts;i*=2) levels++;
+    ubfactor = PART_IMBALANCE / (2*levels);
+
+    part = Ivector(0,data->noelements-1);
+    seed = 4321;
+    RecursiveBisection(&g,nparts,0,part,ubfactor,&seed);
+
+    maxpwgt = (int) floor((1.0+PART_IMBALANCE) * data->noelements / nparts);
+    maxpwgt = MAX(maxpwgt,(data->noelements+nparts-1)/nparts);
+    RefineKway(&g,part,nparts,maxpwgt,4);
+
+    if(info) printf("The edge cut of the partitioning is %d\n",EdgeCut(&g,part));
+
+    AllocatePartitions(data,nparts);
+    for(e=1;e<=data->noelements;e++)
+        data->elempart[e] = part[e-1] + 1;
+
+    free_Ivector(part,0,data->noelements-1);
+    FreePartGraph(&g);
+
+    PartitionNodesByElements(data,info);
+    PartitionStatistics(data,info);
+
+    return(0);
+}
+
+
+static void PartitionByCoordinates(int n,Real *x,Real *y,Real *z,int *dimpart,int *dimper,
+                                   int partorder,Real *corder,int *part)
+/* Divides the points first into dimpart[0] slabs of equal size in x,
+   then each slab into dimpart[1] in y and so on. In the periodic directions
+   dimper[] the slabs are shifted by half a slab, so that the half slabs at
+   both ends form one partition and the periodic boundary is not cut.
+   With partorder the points are just divided along the direction corder. */
+{
+    int i,j,k,l,nparts,dim,len,shift,nslab,*indx,*sub;
+    Real *arrange,*coord[3];
+
+    nparts = dimpart[0]*dimpart[1]*dimpart[2];
+    arrange = Rvector(1,n);
+    indx = Ivector(1,n);
+
+    if(partorder) {
+        for(i=1;i<=n;i++)
+            arrange[i] = corder[0]*x[i] + corder[1]*y[i] + corder[2]*z[i];
+        SortIndex(n,arrange,indx);
+        for(i=1;i<=n;i++)
+            part[indx[i]] = (int) (((long long)(i-1)*nparts)/n) + 1;
+    }
+    else {
+        coord[0] = x;
+        coord[1] = y;
+        coord[2] = z;
+        sub = Ivector(1,n);
+
+        for(i=1;i<=n;i++)
+            part[i] = 0;
+
+        /* part[] holds the index of the current block, refined one direction at a time */
+        nslab = 1;
+        for(dim=0;dim<3;dim++) {
+            if(dimpart[dim] <= 1) continue;
+            for(k=0;k<nslab;k++) {
+                len = 0;
+                for(i=1;i<=n;i++) {
+                    if(part[i] != k) continue;
+                    len++;
+                    sub[len] = i;
+                    arrange[len] = coord[dim][i];
+                }
+                if(!len) continue;
+                SortIndex(len,arrange,indx);
+                shift = dimper[dim] ? len / (2*dimpart[dim]) : 0;
+                for(l=1;l<=len;l++) {
+                    j = sub[indx[l]];
+                    part[j] = -(k*dimpart[dim] + (int)(((long long)((l-1+shift)%len)*dimpart[dim])/len)) - 1;
+                }
+            }
+            for(i=1;i<=n;i++)
+                part[i] = -part[i] - 1;
+            nslab *= dimpart[dim];
+        }
+        for(i=1;i<=n;i++)
+            part[i] += 1;
+
+        free_Ivector(sub,1,n);
+    }
+
+    free_Rvector(arrange,1,n);
+    free_Ivector(indx,1,n);
+}
+
+
+int PartitionSimpleElements(struct FemType *data,int dimpart[],int dimper[],
+			    int partorder,Real corder[],int info)
+/* Geometric division of the elements by their centers, see
+   PartitionByCoordinates for the periodic directions dimper[]. */
+{
+    int i,j,k,nonodes,noelements,nparts;
+    Real *cx,*cy,*cz;
+
+    noelements = data->noelements;
+    nparts = dimpart[0]*dimpart[1]*dimpart[2];
+    if(nparts < 2) return(1);
+
+    if(info) printf("Making a simple partitioning of %d elements to %d partitions\n",
+                    noelements,nparts);
+
+    cx = Rvector(1,noelements);
+    cy = Rvector(1,noelements);
+    cz = Rvector(1,noelements);
+    for(i=1;i<=noelements;i++) {
+        nonodes = data->elementtypes[i] % 100;
+        cx[i] = cy[i] = cz[i] = 0.0;
+        for(j=0;j<nonodes;j++) {
+            k = data->topology[i][j];
+            cx[i] += data->x[k];
+            cy[i] += data->y[k];
+            cz[i] += data->z[k];
+        }
+        cx[i] /= nonodes;
+        cy[i] /= nonodes;
+        cz[i] /= nonodes;
+    }
+
+    AllocatePartitions(data,nparts);
+    PartitionByCoordinates(noelements,cx,cy,cz,dimpart,dimper,partorder,corder,data->elempart);
+
+    free_Rvector(cx,1,noelements);
+    free_Rvector(cy,1,noelements);
+    free_Rvector(cz,1,noelements);
+
+    PartitionNodesByElements(data,info);
+    PartitionStatistics(data,info);
+    return(0);
+}
+
+
+int PartitionSimpleNodes(struct FemType *data,int dimpart[],int dimper[],
+			 int partorder,Real corder[],int info)
+/* Geometric division of the nodes. Each element is given to the partition
+   that owns most of its nodes. */
+{
+    int i,j,k,p,best,nonodes,nparts,*count;
+
+    nparts = dimpart[0]*dimpart[1]*dimpart[2];
+    if(nparts < 2) return(1);
+
+    if(info) printf("Making a simple partitioning of %d nodes to %d partitions\n",
+                    data->noknots,nparts);
+
+    AllocatePartitions(data,nparts);
+    PartitionByCoordinates(data->noknots,data->x,data->y,data->z,dimpart,dimper,
+                           partorder,corder,data->nodepart);
+
+    if(data->periodicexist) {
+        for(i=1;i<=data->noknots;i++) {
+            k = data->periodic[i];
+            while(data->periodic[k] != k) k = data->periodic[k];
+            data->nodepart[i] = data->nodepart[k];
+        }
+    }
+
+    count = Ivector(1,nparts);
+    for(p=1;p<=nparts;p++)
+        count[p] = 0;
+    for(i=1;i<=data->noelements;i++) {
+        nonodes = data->elementtypes[i] % 100;
+        best = data->nodepart[data->topology[i][0]];
+        for(j=0;j<nonodes;j++) {
+            p = data->nodepart[data->topology[i][j]];
+            count[p] += 1;
+            if(count[p] > count[best] || (count[p] == count[best] && p < best)) best = p;
+        }
+        data->elempart[i] = best;
+        for(j=0;j<nonodes;j++)
+            count[data->nodepart[data->topology[i][j]]] = 0;
+    }
+    free_Ivector(count,1,nparts);
+
+    PartitionStatistics(data,info);
+    return(0);
+}
+
+
+int OptimizePartitioning(struct FemType *data,int noopt,int info)
+/* Moves elements that own none of their nodes to the partition owning most
+   of them, so that no partition has elements dangling outside its nodes.
+   An element is not moved into a partition that would then exceed the
+   PART_IMBALANCE set by the partitioners. Boundary elements follow their
+   parents and need no treatment here. */
+{
+    int i,j,p,q,best,iter,nonodes,nparts,moved,blocked,own,maxpwgt;
+    int *count,*elems;
+
+    if(!data->partitionexist) return(1);
+    nparts = data->nopartitions;
+
+    count = Ivector(1,nparts);
+    elems = Ivector(1,nparts);
+    for(p=1;p<=nparts;p++)
+        count[p] = elems[p] = 0;
+    for(i=1;i<=data->noelements;i++)
+        elems[data->elempart[i]] += 1;
+
+    maxpwgt = (int) floor((1.0+PART_IMBALANCE) * data->noelements / nparts);
+    maxpwgt = MAX(maxpwgt,(data->noelements+nparts-1)/nparts);
+
+    for(iter=0;iter<=noopt;iter++) {
+        moved = blocked = 0;
+        for(i=1;i<=data->noelements;i++) {
+            p = data->elempart[i];
+            nonodes = data->elementtypes[i] % 100;
+
+            own = FALSE;
+            for(j=0;j<nonodes;j++)
+                if(data->nodepart[data->topology[i][j]] == p) own = TRUE;
+            if(own) continue;
+
+            for(j=0;j<nonodes;j++)
+                count[data->nodepart[data->topology[i][j]]] += 1;
+            best = 0;
+            for(j=0;j<nonodes;j++) {
+                q = data->nodepart[data->topology[i][j]];
+                if(elems[q] >= maxpwgt) continue;
+                if(!best || count[q] > count[best]) best = q;
+            }
+            for(j=0;j<nonodes;j++)
+                count[data->nodepart[data->topology[i][j]]] = 0;
+
+            if(!best) {
+                blocked++;
+                continue;
+            }
+            data->elempart[i] = best;
+            elems[p] -= 1;
+            elems[best] += 1;
+            moved++;
+        }
+        if(info) printf("Moved %d elements to the partitions of their nodes\n",moved);
+        if(info && blocked) printf("Kept %d elements to preserve the balance\n",blocked);
+        if(!moved) break;
+        PartitionNodesByElements(data,FALSE);
+    }
+
+    free_Ivector(count,1,nparts);
+    free_Ivector(elems,1,nparts);
+    PartitionStatistics(data,info);
+    return(0);
+}
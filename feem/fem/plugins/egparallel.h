@@ -0,0 +1,13 @@
+/* egparallel.h */
+/* Partitioning of the finite element mesh for parallel computation.
+   The partitions are given in the FemType vectors elempart and nodepart,
+   numbered from 1 to nopartitions. Besides the simple geometric division
+   there is a multilevel graph partitioner that needs no external library. */
+
+int PartitionSimpleElements(struct FemType *data,int dimpart[],int dimper[],
+			    int partorder,Real corder[],int info);
+int PartitionSimpleNodes(struct FemType *data,int dimpart[],int dimper[],
+			 int partorder,Real corder[],int info);
+int PartitionMultilevelElements(struct FemType *data,int nparts,int info);
+int PartitionNodesByElements(struct FemType *data,int info);
+int OptimizePartitioning(struct FemType *data,int noopt,int info);
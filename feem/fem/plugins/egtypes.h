@@ -16,7 +16,7 @@
 #define MAXNODESD2 27       /* maximum number of 2D nodes */ 
 #define MAXNODESD1 9        /* maximum number of 1D nodes */
 #define MAXMAPPINGS 10      /* maximum number of geometry mappings */
-#define MAXCONNECTIONS 100  /* maximum number of connections in dual graph */
+#define MAXCONNECTIONS 100  /* maximum number of connections in partition table */
 #define MAXBCS 1000         /* maximum number of BCs in naming */
 #define MAXBODIES 100       /* maximum number of bodies in naming */
 #define MAXPARTITIONS 512   /* maximum number of partitions */
@@ -164,7 +164,8 @@ struct FemType {
     maxnodes,      /* maximum number of nodes */
     dim,           /* dimension of space */
     variables,     /* number of variables */
-    *dualgraph[MAXCONNECTIONS],  
+    *dualgraph,    /* neighbours of node i are dualgraph[dualoffset[i]...dualoffset[i+1]-1] */
+    *dualoffset,
     dualmaxconnections,
     indexwidth,
     dualexists,
@@ -173,9 +174,28 @@ struct FemType {
     maxpartitiontable,
     partitiontableexists, 
 
-    *invtopo[MAXCONNECTIONS],
+    *invtopo,      /* elements of node i are invtopo[invtopooffset[i]...invtopooffset[i+1]-1] */
+    *invtopooffset,
     maxinvtopo,
     invtopoexists,
+    edgesexist,    /* does the edge table exist? */
+    noedges,       /* number of unique edges */
+    *edgenodes,    /* corner nodes of edge i are edgenodes[2*i-1] and edgenodes[2*i] */
+    *elemedges,    /* edges of element i are elemedges[elemedgeoffset[i]...elemedgeoffset[i+1]-1] */
+    *elemedgeoffset,
+    *edgeelems,    /* elements of edge i are edgeelems[edgeelemoffset[i]...edgeelemoffset[i+1]-1] */
+    *edgeelemoffset,
+    *edgehash,     /* open addressing table of the edges, see GetEdgeIndex */
+    edgehashsize,
+    sidesexist,    /* does the side table exist? */
+    nouniquesides, /* number of unique element sides */
+    *sidecorners,  /* sorted corner nodes of side i are sidecorners[4*i-3...4*i], padded with zeros */
+    *elemsides,    /* sides of element i are elemsides[elemsideoffset[i]...elemsideoffset[i+1]-1] */
+    *elemsideoffset,
+    *sideelems,    /* elements of side i are sideelems[sideelemoffset[i]...sideelemoffset[i+1]-1] */
+    *sideelemoffset,
+    *sidehash,     /* open addressing table of the sides, see GetSideIndex */
+    sidehashsize,
     timesteps,     /* number of timesteps */
     periodicexist, /* does the periodic vector exist? */
     *periodic,     /* peridic ordering vector, if needed */
@@ -189,7 +209,10 @@ struct FemType {
     *material,     /* material for each element */
     **topology,    /* element topology */
     bodynamesexist,
-    boundarynamesexist;
+    boundarynamesexist,
+    mapped;        /* are the arrays mapped from a mesh cache file? */
+  void *meshcache; /* handle of the mapped mesh cache, see egcache.h */
+  struct ArenaType *arena; /* arena of the vectors allocated for the mesh */
   int edofs[MAXDOFS],   /* number of dofs in each node */
     alldofs[MAXDOFS];   /* total number of variables */
   Real minsize,maxsize;
@@ -227,7 +250,8 @@ struct BoundaryType {
     open,            /* is the closure partially open? */
     echain,          /* does the chain exist? */
     ediscont,        /* does the discontinous boundary exist */
-    chainsize;       /* size of the chain */ 
+    chainsize,       /* size of the chain */
+    mapped;          /* are the arrays mapped from a mesh cache file? */
   int *parent,       /* primary parents of the sides */
     *parent2,        /* secondary parents of the sides */
     *material,       /* material of the sides */
@@ -251,6 +275,25 @@ struct BoundaryType {
 };
 
 
+/* Quality of the triangles and quadrilaterals of a mesh. The quality of an
+   element is its radius ratio scaled to unity for the ideal element, and
+   zero for inverted and degenerate elements. */
+#define QUALITYBINS 10
+struct MeshQualityType {
+  int noelements,        /* number of elements in the mesh */
+    notriangles,         /* number of triangles analysed */
+    noquadrilaterals,    /* number of quadrilaterals analysed */
+    noinverted,          /* elements with non-positive Jacobian at a corner */
+    histogram[QUALITYBINS], /* number of elements in each quality interval */
+    noworst,             /* number of the worst elements listed */
+    *worst;              /* the worst elements, the worst one first */
+  Real minangle,         /* smallest corner angle in degrees */
+    maxangle,            /* largest corner angle in degrees */
+    maxaspect,           /* largest aspect ratio */
+    minquality,          /* smallest quality */
+    *quality;            /* quality of each element */
+};
+
 #define MAXSIDEBULK 10
 struct ElmergridType {
 
@@ -271,6 +314,9 @@ struct ElmergridType {
     layernumber[MAXBOUNDARIES], 
     layermove,  /* map the created layer to the original geometry */
     metis,      /* number of Metis partitions */
+    multilevel, /* number of partitions of the built-in multilevel partitioner */
+    arena,      /* 0 malloc, 1 mesh arenas, 2 mesh arenas on huge pages */
+    quality,    /* number of the worst elements listed in quality analysis */
     partopt,    /* free parameter for optimization */
     partitions, /* number of simple geometric partitions */
     partdim[3],
@@ -335,6 +381,8 @@ struct ElmergridType {
     triangleangle, 
     partcorder[3],
     polarradius,
+    periodicangle, /* sector angle of rotational periodicity in degrees */
+    adapt,      /* fraction of the estimated error refined adaptively */
     relh;
 
   char filesin[MAXCASES][MAXFILESIZE],
@@ -32,24 +32,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 #include "egutils.h" 
 
 
 #define FREE_ARG char*
-#define SHOWMEM 0
 
-#if SHOWMEM
-static int nfloat=0, nint=0, cumnfloat=0, cumnint=0, locnint, locnfloat;
+#define ARENACHUNK   (2<<20)  /* the small blocks are carved from chunks of this size */
+#define ARENASMALL   (64<<10) /* larger blocks are mapped one by one */
+#define ARENACLASSES 12       /* small block sizes 32, 64, ... ARENASMALL bytes */
+#define ARENASPARE   (64<<20) /* freed large blocks kept for reuse */
+#define MAXMEMORYTAGS 64
 
-int MemoryUsage()
-{
-  if(locnint > 1000 || locnfloat > 1000) 
-    printf("Memory used real %d %d %d int %d %d %d\n",
-	   nfloat,cumnfloat,locnfloat,nint,cumnint,locnint);
-  locnfloat = locnint = 0;
-}
-#endif
 
 
 void nrerror(const char error_text[])
@@ -62,13 +59,484 @@ void nrerror(const char error_text[])
 }
 
 
+/* Arenas backing the allocations of a mesh. Every block starts with a
+   header telling which arena it came from, so that the deallocation routines
+   need not know. Small blocks are rounded to a power of two and recycled
+   through free lists, large ones are mapped separately and kept for reuse
+   up to a limit when freed. When the arena has been closed and its last
+   block is freed all its memory is released at once: up to a limit to a
+   pool from which the next arenas start, the rest to the system. */
+
+struct ArenaBlockType {
+  struct ArenaType *arena;     /* NULL for a block from malloc */
+  struct ArenaBlockType *next;
+  struct ArenaBlockType *prev;
+  size_t size;                 /* bytes including the header */
+  int tag;                     /* the account charged for the block */
+};
+
+struct ArenaType {
+  int hugepages,closed;
+  size_t live;                 /* blocks not yet freed */
+  size_t sparesize;            /* bytes in the spare blocks and, for a pool, chunks */
+  char *chunkpos,*chunkend;
+  struct ArenaBlockType *chunks,*large,*spare;
+  struct ArenaBlockType *freelist[ARENACLASSES];
+};
+
+static struct ArenaType *currentarena = NULL;
+#pragma omp threadprivate(currentarena)
+
+/* Memory of the released arenas with and without huge pages */
+static struct ArenaType arenapool[2];
+
+
+/* Accounting of the memory of the vectors and matrices. Each block is
+   charged to the account in use when it was allocated, and credited back to
+   the same account when freed. The account is shared by all threads so that
+   the worker threads of a parallel region charge the operation that started
+   it; it is only changed outside the parallel regions. */
+
+struct MemoryTagType {
+  const char *subsystem,*operation;
+  size_t current,peak,blocks;
+};
+
+static struct MemoryTagType memorytags[MAXMEMORYTAGS] = {{"other","other",0,0,0}};
+static int nomemorytags = 1;
+static size_t memorycurrent = 0,memorypeak = 0,steppeak = 0,arenamapped = 0;
+static int currenttag = 0;
+
+
+static void ChargeMemory(struct ArenaBlockType *b)
+{
+  struct MemoryTagType *t;
+
+  b->tag = currenttag;
+  t = &memorytags[b->tag];
+#pragma omp critical(memory)
+  {
+    t->current += b->size;
+    t->blocks += 1;
+    if(t->current > t->peak) t->peak = t->current;
+    memorycurrent += b->size;
+    if(memorycurrent > memorypeak) memorypeak = memorycurrent;
+    if(memorycurrent > steppeak) steppeak = memorycurrent;
+  }
+}
+
+
+static void CreditMemory(struct ArenaBlockType *b)
+{
+  struct MemoryTagType *t;
+
+  t = &memorytags[b->tag];
+#pragma omp critical(memory)
+  {
+    t->current -= b->size;
+    t->blocks -= 1;
+    memorycurrent -= b->size;
+  }
+}
+
+
+int MemoryTag(const char *subsystem,const char *operation)
+/* Charges the following allocations to the operation of the subsystem.
+   Returns the previous account to be given to RestoreMemoryTag. Not to be
+   called within a parallel region. */
+{
+  int i,previous;
+
+  previous = currenttag;
+#pragma omp critical(memory)
+  {
+    for(i=0;i<nomemorytags;i++)
+      if(!strcmp(memorytags[i].operation,operation) &&
+         !strcmp(memorytags[i].subsystem,subsystem)) break;
+    if(i == nomemorytags && i < MAXMEMORYTAGS) {
+      memorytags[i].subsystem = subsystem;
+      memorytags[i].operation = operation;
+      nomemorytags++;
+    }
+  }
+  currenttag = (i < MAXMEMORYTAGS) ? i : 0;
+  return(previous);
+}
+
+
+void RestoreMemoryTag(int tag)
+{
+  currenttag = tag;
+}
+
+
+size_t MemoryCurrent(const char *operation)
+/* The bytes now held by the operation, or by all if it is NULL */
+{
+  int i;
+  size_t bytes;
+
+  if(!operation) return(memorycurrent);
+  bytes = 0;
+  for(i=0;i<nomemorytags;i++)
+    if(!strcmp(memorytags[i].operation,operation)) bytes += memorytags[i].current;
+  return(bytes);
+}
+
+
+size_t MemoryPeak(const char *operation)
+/* The most bytes ever held by the operation, or by all if it is NULL */
+{
+  int i;
+  size_t bytes;
+
+  if(!operation) return(memorypeak);
+  bytes = 0;
+  for(i=0;i<nomemorytags;i++)
+    if(!strcmp(memorytags[i].operation,operation)) bytes += memorytags[i].peak;
+  return(bytes);
+}
+
+
+void MemoryStep(const char *subsystem,const char *operation,int info)
+/* Ends the previous step, telling its memory if info is set, and starts a
+   new one for the operation. With operation NULL no new step is started. */
+{
+  static int steptag = 0;
+  static size_t stepstart = 0;
+  struct MemoryTagType *t;
+
+  if(steptag && info) {
+    t = &memorytags[steptag];
+    printf("Memory after %s: %.2lf MB in use, %.2lf MB at peak, %+.2lf MB by the step\n",
+           t->operation,memorycurrent/1048576.0,steppeak/1048576.0,
+           ((double) memorycurrent - (double) stepstart)/1048576.0);
+  }
+
+  if(operation) {
+    MemoryTag(subsystem,operation);
+    steptag = currenttag;
+  }
+  else {
+    currenttag = 0;
+    steptag = 0;
+  }
+  stepstart = steppeak = memorycurrent;
+}
+
+
+int MemoryUsage()
+/* Prints the memory held by each operation and returns the total in kB */
+{
+  int i;
+  struct MemoryTagType *t;
+
+  printf("Memory of vectors and matrices in MB:    current       peak   blocks\n");
+  for(i=0;i<nomemorytags;i++) {
+    t = &memorytags[i];
+    if(!t->peak) continue;
+    printf("  %-10s %-24s %10.2lf %10.2lf %8lu\n",t->subsystem,t->operation,
+           t->current/1048576.0,t->peak/1048576.0,(unsigned long) t->blocks);
+  }
+  printf("  %-35s %10.2lf %10.2lf\n","total",memorycurrent/1048576.0,memorypeak/1048576.0);
+  if(arenamapped)
+    printf("  %-35s %10.2lf\n","mapped by the arenas",arenamapped/1048576.0);
+
+  return((int) (memorycurrent / 1024));
+}
+
+
+static void *SystemAlloc(size_t bytes,int hugepages)
+{
+#if defined(__linux__)
+  void *p;
+
+  if(hugepages) {
+    p = mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+    if(p != MAP_FAILED) {
+      arenamapped += bytes;
+      return(p);
+    }
+  }
+  p = mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(p == MAP_FAILED) return(NULL);
+#ifdef MADV_HUGEPAGE
+  /* Without reserved huge pages ask for transparent ones */
+  if(hugepages) madvise(p,bytes,MADV_HUGEPAGE);
+#endif
+#else
+  void *p;
+
+  p = malloc(bytes);
+  if(!p) return(NULL);
+#endif
+  arenamapped += bytes;
+  return(p);
+}
+
+
+static void SystemFree(void *p,size_t bytes)
+{
+  arenamapped -= bytes;
+#if defined(__linux__)
+  munmap(p,bytes);
+#else
+  free(p);
+#endif
+}
+
+
+static void LinkBlock(struct ArenaBlockType **list,struct ArenaBlockType *b)
+{
+  b->prev = NULL;
+  b->next = *list;
+  if(*list) (*list)->prev = b;
+  *list = b;
+}
+
+
+static void UnlinkBlock(struct ArenaBlockType **list,struct ArenaBlockType *b)
+{
+  if(b->prev) b->prev->next = b->next;
+  else *list = b->next;
+  if(b->next) b->next->prev = b->prev;
+}
+
+
+static struct ArenaBlockType *TakeSpare(struct ArenaType *arena,size_t size)
+/* A spare block is taken if it does not waste more than a quarter */
+{
+  struct ArenaBlockType *b;
+
+  for(b=arena->spare;b;b=b->next)
+    if(b->size >= size && b->size - size <= b->size / 4) break;
+  if(b) {
+    UnlinkBlock(&arena->spare,b);
+    arena->sparesize -= b->size;
+  }
+  return(b);
+}
+
+
+static void KeepSpare(struct ArenaType *arena,struct ArenaBlockType **list,
+                      struct ArenaBlockType *b)
+{
+  if(arena->sparesize + b->size <= ARENASPARE) {
+    LinkBlock(list,b);
+    arena->sparesize += b->size;
+  }
+  else
+    SystemFree(b,b->size);
+}
+
+
+static void ReleaseArenaSpares(struct ArenaType *arena)
+/* The spare blocks need not wait for the live blocks of a closed arena */
+{
+  struct ArenaType *pool;
+  struct ArenaBlockType *b,*next;
+
+  pool = &arenapool[arena->hugepages ? 1 : 0];
+  for(b=arena->spare;b;b=next) {
+    next = b->next;
+    KeepSpare(pool,&pool->spare,b);
+  }
+  arena->spare = NULL;
+  arena->sparesize = 0;
+}
+
+
+static void ReleaseArenaMemory(struct ArenaType *arena)
+{
+  int i;
+  struct ArenaType *pool;
+  struct ArenaBlockType *b,*next;
+
+  pool = &arenapool[arena->hugepages ? 1 : 0];
+
+  for(b=arena->chunks;b;b=next) {
+    next = b->next;
+    KeepSpare(pool,&pool->chunks,b);
+  }
+  for(b=arena->large;b;b=next) {
+    next = b->next;
+    KeepSpare(pool,&pool->spare,b);
+  }
+  ReleaseArenaSpares(arena);
+  arena->chunks = arena->large = NULL;
+  arena->chunkpos = arena->chunkend = NULL;
+  for(i=0;i<ARENACLASSES;i++)
+    arena->freelist[i] = NULL;
+}
+
+
+static struct ArenaBlockType *ArenaAlloc(struct ArenaType *arena,size_t bytes)
+{
+  int i;
+  size_t size,page;
+  struct ArenaType *pool;
+  struct ArenaBlockType *b;
+
+  pool = &arenapool[arena->hugepages ? 1 : 0];
+  bytes += sizeof(struct ArenaBlockType);
+
+  if(bytes > ARENASMALL) {
+    page = arena->hugepages ? ARENACHUNK : 4096;
+    size = (bytes + page - 1) / page * page;
+
+    if(!(b = TakeSpare(arena,size)) && !(b = TakeSpare(pool,size))) {
+      b = (struct ArenaBlockType*) SystemAlloc(size,arena->hugepages);
+      if(!b) return(NULL);
+      b->size = size;
+    }
+    LinkBlock(&arena->large,b);
+  }
+  else {
+    for(i=0,size=32;size < bytes;i++,size*=2);
+    if((b = arena->freelist[i])) {
+      arena->freelist[i] = b->next;
+    }
+    else {
+      if(arena->chunkpos + size > arena->chunkend) {
+        if((b = pool->chunks)) {
+          UnlinkBlock(&pool->chunks,b);
+          pool->sparesize -= b->size;
+        }
+        else {
+          b = (struct ArenaBlockType*) SystemAlloc(ARENACHUNK,arena->hugepages);
+          if(!b) return(NULL);
+          b->size = ARENACHUNK;
+        }
+        LinkBlock(&arena->chunks,b);
+        arena->chunkpos = (char*) b + sizeof(struct ArenaBlockType);
+        arena->chunkend = (char*) b + ARENACHUNK;
+      }
+      b = (struct ArenaBlockType*) arena->chunkpos;
+      b->size = size;
+      arena->chunkpos += size;
+    }
+  }
+
+  b->arena = arena;
+  arena->live++;
+  return(b);
+}
+
+
+static void ArenaFree(struct ArenaBlockType *b)
+{
+  int i;
+  size_t size;
+  struct ArenaType *arena,*spare;
+
+  arena = b->arena;
+  if(b->size > ARENASMALL) {
+    UnlinkBlock(&arena->large,b);
+    spare = arena->closed ? &arenapool[arena->hugepages ? 1 : 0] : arena;
+    KeepSpare(spare,&spare->spare,b);
+  }
+  else {
+    for(i=0,size=32;size < b->size;i++,size*=2);
+    b->next = arena->freelist[i];
+    arena->freelist[i] = b;
+  }
+
+  arena->live--;
+  if(arena->closed && !arena->live) {
+    ReleaseArenaMemory(arena);
+    free(arena);
+  }
+}
+
+
+static void *AllocBlock(size_t bytes)
+{
+  struct ArenaBlockType *b;
+  struct ArenaType *arena;
+
+  arena = currentarena;
+  if(!arena) {
+    b = (struct ArenaBlockType*) malloc(sizeof(struct ArenaBlockType) + bytes);
+    if(!b) return(NULL);
+    b->arena = NULL;
+    b->size = sizeof(struct ArenaBlockType) + bytes;
+  }
+  else {
+#pragma omp critical(arena)
+    b = ArenaAlloc(arena,bytes);
+    if(!b) return(NULL);
+  }
+  ChargeMemory(b);
+  return(b+1);
+}
+
+
+static void FreeBlock(void *p)
+{
+  struct ArenaBlockType *b;
+
+  b = (struct ArenaBlockType*) p - 1;
+  CreditMemory(b);
+  if(!b->arena)
+    free(b);
+  else {
+#pragma omp critical(arena)
+    ArenaFree(b);
+  }
+}
+
+
+struct ArenaType *CreateArena(int hugepages)
+/* The arena takes memory from the system only when it is used. */
+{
+  struct ArenaType *arena;
+
+  arena = (struct ArenaType*) calloc(1,sizeof(struct ArenaType));
+  if(!arena) nrerror("allocation failure in CreateArena()");
+  arena->hugepages = hugepages;
+  return(arena);
+}
+
+
+struct ArenaType *UseArena(struct ArenaType *arena)
+/* Makes the vectors and matrices allocated by this thread come from the
+   arena, or from malloc if it is NULL. Returns the previous arena. */
+{
+  struct ArenaType *previous;
+
+  previous = currentarena;
+  currentarena = (arena && !arena->closed) ? arena : NULL;
+  return(previous);
+}
+
+
+void CloseArena(struct ArenaType *arena)
+/* No more blocks are taken from the arena and its memory is released with
+   the last block, together with the descriptor. The arena may not be used
+   or closed again after this. */
+{
+  if(!arena) return;
+  if(currentarena == arena) currentarena = NULL;
+#pragma omp critical(arena)
+  {
+    arena->closed = TRUE;
+    if(!arena->live) {
+      ReleaseArenaMemory(arena);
+      free(arena);
+    }
+    else
+      ReleaseArenaSpares(arena);
+  }
+}
+
+
 /* Vector initialization */
 float *vector(int nl,int nh)
 /* allocate a float vector with subscript range v[nl..nh] */
 {
   float *v;
 
-  v = (float*)malloc((size_t) (nh-nl+1+1)*sizeof(float));
+  v = (float*)AllocBlock((size_t) (nh-nl+1+1)*sizeof(float));
   if (!v) nrerror("allocation failure in vector()");
   return(v-nl+1);
 }
@@ -80,15 +548,9 @@ int *ivector(int nl,int nh)
 {
   int *v;
 
-  v=(int*) malloc((size_t) (nh-nl+1+1)*sizeof(int));
+  v=(int*) AllocBlock((size_t) (nh-nl+1+1)*sizeof(int));
   if (!v) nrerror("allocation failure in ivector()");
 
- #if SHOWMEM
-  locnint = (nh-nl+1+1);
-  nint += locnint;
-  cumnint += locnint;
-  MemoryUsage();
-#endif
 
   return(v-nl+1);
 }
@@ -99,7 +561,7 @@ unsigned char *cvector(int nl,int nh)
 {
   unsigned char *v;
   
-  v=(unsigned char *)malloc((size_t) (nh-nl+1+1)*sizeof(unsigned char));
+  v=(unsigned char *)AllocBlock((size_t) (nh-nl+1+1)*sizeof(unsigned char));
   if (!v) nrerror("allocation failure in cvector()");
   return(v-nl+1);
 }
@@ -110,7 +572,7 @@ unsigned long *lvector(int nl,int nh)
 {
   unsigned long *v;
   
-  v=(unsigned long *)malloc((size_t) (nh-nl+1+1)*sizeof(unsigned long));
+  v=(unsigned long *)AllocBlock((size_t) (nh-nl+1+1)*sizeof(unsigned long));
   if (!v) nrerror("allocation failure in lvector()");
   return(v-nl+1);
 }
@@ -122,15 +584,9 @@ double *dvector(int nl,int nh)
 {
   double *v;
 
-  v=(double *)malloc((size_t) (nh-nl+1+1)*sizeof(double));
+  v=(double *)AllocBlock((size_t) (nh-nl+1+1)*sizeof(double));
   if (!v) nrerror("allocation failure in dvector()");
 
-#if SHOWMEM
-  locnfloat = nh-nl+1+1;
-  nfloat += locnfloat;
-  cumnfloat += locnfloat;
-  MemoryUsage();
-#endif
 
   return(v-nl+1);
 }
@@ -145,13 +601,13 @@ float **matrix(int nrl,int nrh,int ncl,int nch)
   float **m;
   
   /* allocate pointers to rows */
-  m=(float **) malloc((size_t) (nrow+1)*sizeof(float*));
+  m=(float **) AllocBlock((size_t) (nrow+1)*sizeof(float*));
   if (!m) nrerror("allocation failure 1 in matrix()");
   m += 1;
   m -= nrl;
   
   /* allocate rows and set pointers to them */
-  m[nrl]=(float *) malloc((size_t)((nrow*ncol+1)*sizeof(float)));
+  m[nrl]=(float *) AllocBlock((size_t)((nrow*ncol+1)*sizeof(float)));
   if (!m[nrl]) nrerror("allocation failure 2 in matrix()");
   m[nrl] += 1;
   m[nrl] -= ncl;
@@ -170,14 +626,14 @@ double **dmatrix(int nrl,int nrh,int ncl,int nch)
   double **m;
   
   /* allocate pointers to rows */
-  m=(double **) malloc((size_t) (nrow+1)*sizeof(double*));
+  m=(double **) AllocBlock((size_t) (nrow+1)*sizeof(double*));
   if (!m) nrerror("allocation failure 1 in dmatrix()");
   m += 1;
   m -= nrl;
 
   
   /* allocate rows and set pointers to them */
-  m[nrl]=(double *) malloc((size_t)((nrow*ncol+1)*sizeof(double)));
+  m[nrl]=(double *) AllocBlock((size_t)((nrow*ncol+1)*sizeof(double)));
   if (!m[nrl]) nrerror("allocation failure 2 in dmatrix()");
   m[nrl] += 1;
   m[nrl] -= ncl;
@@ -185,12 +641,6 @@ double **dmatrix(int nrl,int nrh,int ncl,int nch)
   for(i=nrl+1;i<=nrh;i++)
     m[i]=m[i-1]+ncol;
 
-#if SHOWMEM
-  locnfloat = (nrow+1 + (nrow*ncol+1));
-  nfloat += locnfloat;
-  cumnfloat += locnfloat;
-  MemoryUsage();
-#endif
   
   return(m);
 } 
@@ -203,13 +653,13 @@ int **imatrix(int nrl,int nrh,int ncl,int nch)
   int **m;
   
   /* allocate pointers to rows */
-  m=(int **) malloc((size_t) (nrow+1)*sizeof(int*));
+  m=(int **) AllocBlock((size_t) (nrow+1)*sizeof(int*));
   if (!m) nrerror("allocation failure 1 in imatrix()");
   m += 1;
   m -= nrl;
   
   /* allocate rows and set pointers to them */
-  m[nrl]=(int *) malloc((size_t)((nrow*ncol+1)*sizeof(int)));
+  m[nrl]=(int *) AllocBlock((size_t)((nrow*ncol+1)*sizeof(int)));
   if (!m[nrl]) nrerror("allocation failure 2 in imatrix()");
   m[nrl] += 1;
   m[nrl] -= ncl;
@@ -217,12 +667,6 @@ int **imatrix(int nrl,int nrh,int ncl,int nch)
   for(i=nrl+1;i<=nrh;i++)
     m[i]=m[i-1]+ncol;
 
-#if SHOWMEM
-  locnint = (nrow+1 + (nrow*ncol+1));
-  nint += locnint;
-  cumnint += locnint;
-  MemoryUsage();
-#endif
   
   return(m);
 } 
@@ -232,66 +676,50 @@ int **imatrix(int nrl,int nrh,int ncl,int nch)
 
 void free_vector(float *v,int nl,int nh)
 {
-  free((FREE_ARG) (v+nl-1));
+  FreeBlock((v+nl-1));
 }
 
 void free_ivector(int *v,int nl,int nh)
 {
-#if SHOWMEM
-  cumnint -= (nh-nl+1+1);
-#endif
 
-  free((FREE_ARG) (v+nl-1));
+  FreeBlock((v+nl-1));
 }
 
 void free_cvector(unsigned char *v,int nl,int nh)
 {
-  free((FREE_ARG) (v+nl-1));
+  FreeBlock((v+nl-1));
 }
 
 void free_lvector(unsigned long *v,int nl,int nh)
 {
-  free((FREE_ARG) (v+nl-1));
+  FreeBlock((v+nl-1));
 }
 
 
 void free_dvector(double *v,int nl,int nh)
 {
-#if SHOWMEM
-  cumnfloat -= (nh-nl+1+1);
-#endif
 
-  free((FREE_ARG) (v+nl-1));
+  FreeBlock((v+nl-1));
 }
 
 void free_matrix(float **m,int nrl,int nrh,int ncl,int nch)
 {
-  free((FREE_ARG) (m[nrl]+ncl-1));
-  free((FREE_ARG) (m+nrl-1));
+  FreeBlock((m[nrl]+ncl-1));
+  FreeBlock((m+nrl-1));
 }
 
 void free_dmatrix(double **m,int nrl,int nrh,int ncl,int nch)
 {
-#if SHOWMEM
-  int nrow=nrh-nrl+1;
-  int ncol=nch-ncl+1;
-  cumnfloat -= (nrow+1 + (nrow*ncol+1));
-#endif
 
-  free((FREE_ARG) (m[nrl]+ncl-1));
-  free((FREE_ARG) (m+nrl-1));
+  FreeBlock((m[nrl]+ncl-1));
+  FreeBlock((m+nrl-1));
 }
 
 void free_imatrix(int **m,int nrl,int nrh,int ncl,int nch)
 {
-#if SHOWMEM
-  int nrow=nrh-nrl+1;
-  int ncol=nch-ncl+1;
-  cumnint -= (nrow+1 + (nrow*ncol+1));
-#endif
 
-  free((FREE_ARG) (m[nrl]+ncl-1));
-  free((FREE_ARG) (m+nrl-1));
+  FreeBlock((m[nrl]+ncl-1));
+  FreeBlock((m+nrl-1));
 }
 
 
@@ -7,6 +7,8 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <stddef.h>
+
 typedef double Real;
 #define Rvector       dvector
 #define Ivector       ivector
@@ -22,7 +24,6 @@ typedef double Real;
 
 /* Numerical Recipes' uncopyrighted vector and matrix allocation 
    and deallocation routines. */
-int MemoryUsage();
 void nrerror(const char error_text[]);
 
 float *vector(int,int);
@@ -45,6 +46,22 @@ void free_matrix(float **,int,int,int,int);
 void free_dmatrix(double **,int,int,int,int);
 void free_imatrix(int **,int,int,int,int);
 
+/* Arenas from which the above routines take the memory of a mesh while
+   the arena is in use. */
+struct ArenaType;
+struct ArenaType *CreateArena(int hugepages);
+struct ArenaType *UseArena(struct ArenaType *arena);
+void CloseArena(struct ArenaType *arena);
+
+/* Accounting of the memory of the above routines by subsystem and
+   operation, e.g. MemoryTag("topology","CreateDualGraph"). */
+int MemoryTag(const char *subsystem,const char *operation);
+void RestoreMemoryTag(int tag);
+void MemoryStep(const char *subsystem,const char *operation,int info);
+size_t MemoryCurrent(const char *operation);
+size_t MemoryPeak(const char *operation);
+int MemoryUsage();
+
 void bigerror(const char error_text[]);
 void smallerror(const char error_text[]);
 int  FileExists(char *filename);
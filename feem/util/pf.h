@@ -48,7 +48,9 @@ public:
         /** Endpoint selected */
         FlagSelected2   = 1<<13,
         /** Entity is highlighted temporarily (as a user action feedback) */
-        FlagHighlighted = 1<<14
+        FlagHighlighted = 1<<14,
+        /** Geometry changed since the last mesh */
+        FlagDirty       = 1<<15
     };
     enum ActionType{
         ActionNone,
@@ -82,6 +84,8 @@ public:
         ActionDrawLine,
         ActionDrawFace,
         ActionDrawArc,
+        ActionSplitIntersections,
+        ActionDetectFaces,
 
         ActionViewZoomIn,
         ActionViewZoomOut,
@@ -134,6 +138,7 @@ public:
         EntityPoint,        /**< Point */
         EntityLine,         /**< Line */
         EntityFace,         /**< Face */
+        EntityMesh,         /**< Mesh */
         EntityPolyline,     /**< Polyline */
         EntityVertex,       /**< Vertex (part of a polyline) */
         EntityArc,          /**< Arc */